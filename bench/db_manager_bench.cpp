@@ -0,0 +1,191 @@
+// Бенчмарк горячих запросов DBManager::Manager.
+// Запуск из директории сборки: ./dec-rep-db_manager_bench [операций] [строка подключения]
+// Схема берётся из ../db_struct.sql, как в dec-rep-db_manager_test; таблицы
+// базы пересоздаются, поэтому нужна отдельная тестовая база.
+#include "../include/db_manager.hpp"
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <pqxx/pqxx>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+const std::string DEFAULT_CONNECTION = "dbname=mydb user=myuser password=mypassword hostaddr=127.0.0.1 port=5432";
+const fs::path BENCH_DIR = fs::temp_directory_path() / "dec-rep-db-bench";
+const std::string USERNAME = "bench_user";
+
+void reset_schema(pqxx::connection &C)
+{
+    std::ifstream sql_file("../db_struct.sql");
+    if (!sql_file.is_open()) {
+        throw std::runtime_error("Could not open ../db_struct.sql");
+    }
+    std::stringstream schema;
+    schema << sql_file.rdbuf();
+
+    pqxx::work w(C);
+    w.exec("DROP TABLE IF EXISTS FileOwners, Files, MyUsername, Users CASCADE;");
+    w.exec(schema.str());
+    w.exec_params("INSERT INTO Users(username, first_connection_time) VALUES($1, NOW())", USERNAME);
+    w.commit();
+}
+
+// Прежние реализации методов Manager: тот же SQL через exec_params,
+// который сервер разбирает и планирует при каждом вызове.
+int legacy_user_id(pqxx::work &w, const std::string &username)
+{
+    const pqxx::result user_id = w.exec_params("SELECT id FROM Users WHERE username = $1", username);
+    if (user_id.empty()) {
+        throw std::runtime_error("User does not exist");
+    }
+    return user_id[0]["id"].as<int>();
+}
+
+void legacy_add_file(
+    pqxx::connection &C,
+    const std::string &local_file_path,
+    const std::string &file_name,
+    const std::string &DecRep_path,
+    const std::string &username)
+{
+    pqxx::work w(C);
+    const auto file_size = fs::file_size(local_file_path);
+    const int author_id = legacy_user_id(w, username);
+    const pqxx::result res = w.exec_params(
+        "SELECT id FROM Files WHERE file_name = $1 AND DecRep_path = $2",
+        file_name, DecRep_path);
+    if (res.empty()) {
+        const pqxx::result file_added = w.exec_params(
+            "INSERT INTO Files (file_name, file_size, "
+            "addition_time, last_modified, DecRep_path, author_id) "
+            "VALUES ($1, $2, NOW(), NOW(), $3, $4) RETURNING id",
+            file_name, file_size, DecRep_path, author_id);
+        w.exec_params(
+            "INSERT INTO FileOwners (owner_id, file_id, local_path) "
+            "VALUES ($1, $2, $3)",
+            author_id, file_added[0]["id"].as<int>(), local_file_path);
+    }
+    w.commit();
+}
+
+void legacy_update_file(pqxx::connection &C, const std::string &local_path, const std::string &username)
+{
+    pqxx::work w(C);
+    const int owner_id = legacy_user_id(w, username);
+    const pqxx::result res = w.exec_params(
+        "SELECT file_id FROM FileOwners WHERE local_path = $1 AND owner_id = $2",
+        local_path, owner_id);
+    const int file_id = res[0]["file_id"].as<int>();
+    w.exec_params(
+        "UPDATE Files SET file_size = $1, last_modified = NOW() WHERE id = $2",
+        fs::file_size(local_path), file_id);
+    w.exec_params(
+        "DELETE FROM FileOwners WHERE file_id = $1 AND owner_id <> $2",
+        file_id, owner_id);
+    w.commit();
+}
+
+void legacy_delete_local_file(pqxx::connection &C, const std::string &local_path, const std::string &username)
+{
+    pqxx::work w(C);
+    const int owner_id = legacy_user_id(w, username);
+    const pqxx::result res = w.exec_params(
+        "SELECT file_id FROM FileOwners WHERE local_path = $1 AND "
+        "owner_id = $2",
+        local_path, owner_id);
+    if (res.empty()) {
+        return;
+    }
+    const int file_id = res[0]["file_id"].as<int>();
+    w.exec_params("DELETE FROM FileOwners WHERE file_id = $1 AND owner_id = $2", file_id, owner_id);
+    const pqxx::result remain = w.exec_params(
+        "SELECT COUNT(*) AS remain FROM FileOwners WHERE file_id = $1", file_id);
+    if (remain[0]["remain"].as<int>() == 0) {
+        w.exec_params("DELETE FROM Files WHERE id = $1 RETURNING DecRep_path, file_name", file_id);
+    }
+    w.commit();
+}
+
+struct Operations {
+    std::function<void(const std::string &, const std::string &)> add_file;
+    std::function<void(const std::string &)> update_file;
+    std::function<void(const std::string &)> delete_local_file;
+};
+
+// Прогоняет add_file, update_file и delete_local_file по files файлам
+// и печатает число операций в секунду для каждого метода.
+void run(std::ostream &report, const std::string &label, const Operations &ops, const std::vector<std::string> &files)
+{
+    const auto measure = [&](const std::function<void(const std::string &)> &op) {
+        const auto start = Clock::now();
+        for (const auto &file : files) {
+            op(file);
+        }
+        const std::chrono::duration<double> elapsed = Clock::now() - start;
+        return static_cast<double>(files.size()) / elapsed.count();
+    };
+
+    const double add = measure([&](const std::string &file) {
+        ops.add_file(file, fs::path(file).filename().string());
+    });
+    const double update = measure(ops.update_file);
+    const double remove = measure(ops.delete_local_file);
+    report << label << '\t' << add << '\t' << update << '\t' << remove << '\n';
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const std::size_t count = argc > 1 ? std::stoul(argv[1]) : 2000;
+    const std::string connection_data = argc > 2 ? argv[2] : DEFAULT_CONNECTION;
+
+    try {
+        fs::create_directories(BENCH_DIR);
+        std::vector<std::string> files;
+        for (std::size_t i = 0; i < count; ++i) {
+            const fs::path path = BENCH_DIR / ("file" + std::to_string(i) + ".txt");
+            std::ofstream(path) << "bench file " << i << '\n';
+            files.push_back(path.string());
+        }
+
+        std::ostream report(std::cout.rdbuf());
+        report << "queries\tadd_file/s\tupdate_file/s\tdelete_local_file/s\n";
+
+        // Два круга поочерёдно, чтобы прогретый кэш базы не доставался
+        // только второму варианту.
+        pqxx::connection C(connection_data);
+        for (int round = 0; round < 2; ++round) {
+            reset_schema(C);
+            run(report, "exec_params",
+                Operations {
+                    [&](const std::string &path, const std::string &name) { legacy_add_file(C, path, name, "/bench", USERNAME); },
+                    [&](const std::string &path) { legacy_update_file(C, path, USERNAME); },
+                    [&](const std::string &path) { legacy_delete_local_file(C, path, USERNAME); },
+                },
+                files);
+
+            reset_schema(C);
+            DBManager::Manager manager(connection_data);
+            // Manager сообщает о каждой операции в std::cout: на время замера
+            // вывод отключается, строка результата идёт через report.
+            std::cout.setstate(std::ios::badbit);
+            run(report, "exec_prepared",
+                Operations {
+                    [&](const std::string &path, const std::string &name) { manager.add_file(path, name, "/bench", USERNAME); },
+                    [&](const std::string &path) { manager.update_file(path, USERNAME); },
+                    [&](const std::string &path) { manager.delete_local_file(path, USERNAME); },
+                },
+                files);
+            std::cout.clear();
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    fs::remove_all(BENCH_DIR);
+    return EXIT_SUCCESS;
+}
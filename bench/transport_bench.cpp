@@ -0,0 +1,714 @@
+// Нагрузочные сценарии и бенчмарки transport_service.
+// Запуск: ./dec-rep-transport_bench <сценарий> [параметры]
+// Сертификаты сервера (server.crt, server.key, dhparams.pem) должны лежать
+// в текущей директории, как и для самого dec-rep.
+#include "../include/transport_service.hpp"
+#include <boost/uuid/detail/sha1.hpp>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <sys/resource.h>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace transport_service;
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+const fs::path BENCH_DIR = fs::temp_directory_path() / "dec-rep-bench";
+
+// Файл заданного размера; compressible - текст, иначе случайные байты.
+fs::path make_file(const std::string &name, std::size_t size, bool compressible)
+{
+    fs::create_directories(BENCH_DIR);
+    const fs::path path = BENCH_DIR / name;
+    std::ofstream out(path, std::ios::binary);
+    std::mt19937 gen(42);
+    std::size_t line = 0;
+    while (size > 0) {
+        std::string chunk;
+        if (compressible) {
+            chunk = "line " + std::to_string(line++) + " of the benchmark file\n";
+        } else {
+            chunk.resize(64);
+            for (auto &c : chunk) {
+                c = static_cast<char>(gen());
+            }
+        }
+        chunk.resize(std::min(chunk.size(), size));
+        out << chunk;
+        size -= chunk.size();
+    }
+    return path;
+}
+
+// Число потоков процесса из /proc/self/status.
+int thread_count()
+{
+    std::ifstream status("/proc/self/status");
+    std::string key;
+    while (status >> key) {
+        if (key == "Threads:") {
+            int count = 0;
+            status >> count;
+            return count;
+        }
+    }
+    return -1;
+}
+
+double seconds_since(const Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Один GET по новому TLS-соединению, тело читается и отбрасывается.
+std::size_t fetch_once(const std::string &target)
+{
+    net::io_context ioc;
+    ssl::context &ctx = Certificate_Singleton::get_instance().get_client_context();
+    tcp::resolver resolver(ioc);
+    Tls_Stream stream(ioc, ctx);
+    beast::get_lowest_layer(stream).connect(
+        resolver.resolve("127.0.0.1", std::to_string(SERVER_PORT))
+    );
+    stream.handshake(ssl::stream_base::client);
+
+    http::request<http::empty_body> req { http::verb::get, target, 11 };
+    req.set(http::field::host, "127.0.0.1");
+    req.keep_alive(false);
+    http::write(stream, req);
+
+    beast::flat_buffer buffer;
+    http::response_parser<http::buffer_body> parser;
+    parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+    std::vector<char> block(STREAM_BLOCK_SIZE);
+    std::size_t total = 0;
+    http::read_header(stream, buffer, parser);
+    while (!parser.is_done()) {
+        parser.get().body().data = block.data();
+        parser.get().body().size = block.size();
+        beast::error_code ec;
+        http::read(stream, buffer, parser, ec);
+        if (ec && ec != http::error::need_buffer) {
+            throw beast::system_error { ec };
+        }
+        total += block.size() - parser.get().body().size;
+    }
+    beast::error_code ec;
+    stream.shutdown(ec);
+    return total;
+}
+
+// Процессорное время процесса (user + system) в секундах.
+double cpu_seconds()
+{
+    rusage usage {};
+    ::getrusage(RUSAGE_SELF, &usage);
+    const auto to_seconds = [](const timeval &tv) {
+        return static_cast<double>(tv.tv_sec) + static_cast<double>(tv.tv_usec) / 1e6;
+    };
+    return to_seconds(usage.ru_utime) + to_seconds(usage.ru_stime);
+}
+
+// load [клиентов] [секунд] [размер файла в КиБ]
+// Для пула из 1, 2, 4 ... потоков сервера запускает поток клиентов,
+// каждый из которых открывает новое соединение на каждый запрос.
+// Показывает, что число потоков сервера не растёт с числом соединений,
+// а пропускная способность растёт вместе с размером пула.
+int load_scenario(const std::vector<std::string> &args)
+{
+    const int clients = args.size() > 0 ? std::stoi(args[0]) : 64;
+    const double duration = args.size() > 1 ? std::stod(args[1]) : 5.0;
+    const std::size_t file_kib = args.size() > 2 ? std::stoul(args[2]) : 256;
+    make_file("load.bin", file_kib * 1024, true);
+
+    const int max_threads = static_cast<int>(std::max(1U, std::thread::hardware_concurrency()));
+    std::cout << "server_threads\trequests/s\tMB/s\tidle_threads\tpeak_extra_threads\n";
+    for (int server_threads = 1; server_threads <= max_threads; server_threads *= 2) {
+        Server server(SERVER_PORT, server_threads, BENCH_DIR.string(), "bench.log");
+        server.set_compression_level(Z_BEST_SPEED);
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        const int idle_threads = thread_count();
+
+        std::atomic<bool> stop = false;
+        std::atomic<std::size_t> requests = 0;
+        std::atomic<std::size_t> bytes = 0;
+        std::vector<std::thread> workers;
+        const auto start = Clock::now();
+        for (int i = 0; i < clients; ++i) {
+            workers.emplace_back([&] {
+                while (!stop) {
+                    try {
+                        bytes += fetch_once("/load.bin");
+                        ++requests;
+                    } catch (const std::exception &e) {
+                        std::cerr << "request failed: " << e.what() << '\n';
+                    }
+                }
+            });
+        }
+
+        int peak_threads = 0;
+        while (seconds_since(start) < duration) {
+            peak_threads = std::max(peak_threads, thread_count());
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        stop = true;
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        const double elapsed = seconds_since(start);
+
+        // Потоки клиентов не относятся к серверу и вычитаются.
+        std::cout << server_threads << '\t' << requests / elapsed << '\t'
+                  << bytes / elapsed / (1024 * 1024) << '\t' << idle_threads << '\t'
+                  << peak_threads - idle_threads - clients << '\n';
+    }
+    return EXIT_SUCCESS;
+}
+
+// uncompressed [размер файла в МиБ] [повторов]
+// Отдаёт несжимаемый файл без сжатия: сначала через pread в буфер
+// приложения, затем из файла, отображённого в память.
+// CPU на ГиБ считается по всему процессу, то есть вместе с клиентом;
+// клиентская часть в обоих режимах одинакова, поэтому разница
+// между строками приходится на сервер.
+int uncompressed_scenario(const std::vector<std::string> &args)
+{
+    const std::size_t file_mib = args.size() > 0 ? std::stoul(args[0]) : 256;
+    const int repeats = args.size() > 1 ? std::stoi(args[1]) : 4;
+    make_file("uncompressed.bin", file_mib * 1024 * 1024, false);
+
+    Server server(SERVER_PORT, 1, BENCH_DIR.string(), "bench.log");
+    server.set_compression_level(Z_NO_COMPRESSION);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    std::cout << "path\tMB/s\tCPU s/GiB\n";
+    for (const bool memory_mapped : { false, true }) {
+        server.set_memory_mapped(memory_mapped);
+        fetch_once("/uncompressed.bin");
+
+        std::size_t bytes = 0;
+        const double cpu_start = cpu_seconds();
+        const auto start = Clock::now();
+        for (int i = 0; i < repeats; ++i) {
+            bytes += fetch_once("/uncompressed.bin");
+        }
+        const double elapsed = seconds_since(start);
+        const double cpu = cpu_seconds() - cpu_start;
+        const double gib = static_cast<double>(bytes) / (1024.0 * 1024 * 1024);
+
+        std::cout << (memory_mapped ? "mmap" : "pread") << '\t'
+                  << bytes / elapsed / (1024 * 1024) << '\t' << cpu / gib << '\n';
+    }
+    return EXIT_SUCCESS;
+}
+
+// Прогоняет файл через кодер и декодер, возвращает размер сжатых данных
+// и время сжатия и распаковки в секундах.
+struct Codec_Result {
+    std::size_t compressed_size = 0;
+    double compress_seconds = 0;
+    double decompress_seconds = 0;
+};
+
+Codec_Result run_codec(const std::string &encoding, int level, const std::string &data, unsigned threads = 1)
+{
+    Codec_Result result;
+    std::string compressed;
+    auto start = Clock::now();
+    auto encoder = make_encoder(encoding, level, threads);
+    const Sink append = [&](const char *chunk, std::size_t size) { compressed.append(chunk, size); };
+    for (std::size_t pos = 0; pos < data.size(); pos += STREAM_BLOCK_SIZE) {
+        encoder->write(data.data() + pos, std::min<std::size_t>(STREAM_BLOCK_SIZE, data.size() - pos), append);
+    }
+    encoder->finish(append);
+    result.compress_seconds = seconds_since(start);
+    result.compressed_size = compressed.size();
+
+    std::size_t restored = 0;
+    start = Clock::now();
+    auto decoder = make_decoder(encoding);
+    for (std::size_t pos = 0; pos < compressed.size(); pos += STREAM_BLOCK_SIZE) {
+        decoder->write(compressed.data() + pos, std::min<std::size_t>(STREAM_BLOCK_SIZE, compressed.size() - pos),
+            [&](const char *, std::size_t size) { restored += size; });
+    }
+    result.decompress_seconds = seconds_since(start);
+    if (restored != data.size()) {
+        throw std::runtime_error(encoding + ": round trip size mismatch");
+    }
+    return result;
+}
+
+// codecs [директория с корпусом]
+// Сжимает каждый файл корпуса всеми доступными кодеками на быстром и
+// максимальном уровнях. Без аргумента корпус генерируется: текст, лог,
+// CSV и случайные данные; для реальной картины стоит указать директорию
+// с типичными файлами DecRep.
+int codecs_scenario(const std::vector<std::string> &args)
+{
+    std::vector<fs::path> corpus;
+    if (!args.empty()) {
+        for (const auto &entry : fs::recursive_directory_iterator(args[0])) {
+            if (entry.is_regular_file()) {
+                corpus.push_back(entry.path());
+            }
+        }
+    } else {
+        corpus.push_back(make_file("corpus.txt", 8 * 1024 * 1024, true));
+        corpus.push_back(make_file("corpus.bin", 8 * 1024 * 1024, false));
+        const fs::path csv = BENCH_DIR / "corpus.csv";
+        std::ofstream out(csv);
+        std::mt19937 gen(7);
+        for (int row = 0; row < 200000; ++row) {
+            out << row << ',' << gen() % 100000 << ',' << gen() % 1000 / 10.0 << ",user" << gen() % 500 << '\n';
+        }
+        corpus.push_back(csv);
+    }
+
+    std::cout << "file\tcodec\tlevel\tratio\tcompress MB/s\tdecompress MB/s\n";
+    for (const auto &path : corpus) {
+        std::ifstream in(path, std::ios::binary);
+        const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (data.empty()) {
+            continue;
+        }
+        const double mib = static_cast<double>(data.size()) / (1024 * 1024);
+        for (const auto &encoding : supported_encodings()) {
+            for (const int level : { Z_BEST_SPEED, Z_BEST_COMPRESSION }) {
+                const Codec_Result result = run_codec(encoding, level, data);
+                std::cout << path.filename().string() << '\t' << encoding << '\t' << level << '\t'
+                          << static_cast<double>(result.compressed_size) / static_cast<double>(data.size()) << '\t'
+                          << mib / result.compress_seconds << '\t' << mib / result.decompress_seconds << '\n';
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+// parallel_deflate [размер файла в МиБ] [потоков]
+// Сжатие deflate в 1, 2, 4 ... потоков (по умолчанию до числа ядер)
+// на быстром и максимальном уровнях. Параллельный поток распаковывается
+// обычным Inflate_Stream, поэтому скорость распаковки от числа потоков
+// не зависит.
+int parallel_deflate_scenario(const std::vector<std::string> &args)
+{
+    const std::size_t file_mib = args.size() > 0 ? std::stoul(args[0]) : 64;
+    const fs::path path = make_file("parallel_deflate.txt", file_mib * 1024 * 1024, true);
+    std::ifstream in(path, std::ios::binary);
+    const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const unsigned cores = args.size() > 1 ? std::stoul(args[1]) : std::max(1U, std::thread::hardware_concurrency());
+
+    std::cout << "level	threads	ratio	compress MB/s	decompress MB/s\n";
+    for (const int level : { Z_BEST_SPEED, Z_BEST_COMPRESSION }) {
+        for (unsigned threads = 1;; threads = std::min(threads * 2, cores)) {
+            const Codec_Result result = run_codec("deflate", level, data, threads);
+            std::cout << level << '\t' << threads << '\t'
+                      << static_cast<double>(result.compressed_size) / static_cast<double>(data.size()) << '\t'
+                      << static_cast<double>(file_mib) / result.compress_seconds << '\t'
+                      << static_cast<double>(file_mib) / result.decompress_seconds << '\n';
+            if (threads == cores) {
+                break;
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+// Прежние deflate_compress и deflate_decompress: новый z_stream на каждый
+// вызов и копирование через буфер на стеке. Оставлены для сравнения.
+std::string legacy_deflate_compress(const std::string &data, int compression_level)
+{
+    z_stream zs {};
+    deflateInit(&zs, compression_level);
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    zs.avail_in = data.size();
+    int ret;
+    char out_buffer[BUFFER_SIZE];
+    std::string out_string;
+    do {
+        zs.next_out = reinterpret_cast<Bytef *>(out_buffer);
+        zs.avail_out = sizeof(out_buffer);
+        ret = deflate(&zs, Z_FINISH);
+        if (out_string.size() < zs.total_out) {
+            out_string.append(out_buffer, zs.total_out - out_string.size());
+        }
+    } while (ret == Z_OK);
+    deflateEnd(&zs);
+    return out_string;
+}
+
+std::string legacy_deflate_decompress(const std::string &data)
+{
+    z_stream zs {};
+    inflateInit(&zs);
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    zs.avail_in = data.size();
+    int ret;
+    char out_buffer[32768];
+    std::string out_string;
+    do {
+        zs.next_out = reinterpret_cast<Bytef *>(out_buffer);
+        zs.avail_out = sizeof(out_buffer);
+        ret = inflate(&zs, 0);
+        if (out_string.size() < zs.total_out) {
+            out_string.append(out_buffer, zs.total_out - out_string.size());
+        }
+    } while (ret == Z_OK);
+    inflateEnd(&zs);
+    return out_string;
+}
+
+// zlib [размер мелкого файла в КиБ] [вызовов] [размер крупного файла в МиБ]
+// Микробенчмарк deflate_compress и deflate_decompress против прежней
+// реализации: время одного вызова на мелких данных, где заметна цена
+// deflateInit, и пропускная способность на крупных.
+int zlib_scenario(const std::vector<std::string> &args)
+{
+    const std::size_t small_kib = args.size() > 0 ? std::stoul(args[0]) : 4;
+    const int calls = args.size() > 1 ? std::stoi(args[1]) : 20000;
+    const std::size_t large_mib = args.size() > 2 ? std::stoul(args[2]) : 64;
+    std::ifstream small_in(make_file("zlib_small.txt", small_kib * 1024, true), std::ios::binary);
+    const std::string small((std::istreambuf_iterator<char>(small_in)), std::istreambuf_iterator<char>());
+    std::ifstream large_in(make_file("zlib_large.txt", large_mib * 1024 * 1024, true), std::ios::binary);
+    const std::string large((std::istreambuf_iterator<char>(large_in)), std::istreambuf_iterator<char>());
+
+    using Compress = std::function<std::string(const std::string &, int)>;
+    using Decompress = std::function<std::string(const std::string &)>;
+    const std::vector<std::tuple<std::string, Compress, Decompress>> variants = {
+        { "legacy", legacy_deflate_compress, legacy_deflate_decompress },
+        { "pooled", [](const std::string &data, int level) { return deflate_compress(data, level); },
+            deflate_decompress },
+    };
+
+    std::cout << "variant\tlevel\tsmall compress us\tsmall decompress us\tlarge compress MB/s\tlarge decompress MB/s\n";
+    for (const int level : { Z_BEST_SPEED, Z_BEST_COMPRESSION }) {
+        for (const auto &[name, compress, decompress] : variants) {
+            const std::string small_compressed = compress(small, level);
+            auto start = Clock::now();
+            for (int i = 0; i < calls; ++i) {
+                compress(small, level);
+            }
+            const double small_compress = seconds_since(start) * 1e6 / calls;
+            start = Clock::now();
+            for (int i = 0; i < calls; ++i) {
+                decompress(small_compressed);
+            }
+            const double small_decompress = seconds_since(start) * 1e6 / calls;
+
+            start = Clock::now();
+            const std::string large_compressed = compress(large, level);
+            const double large_compress = seconds_since(start);
+            start = Clock::now();
+            if (decompress(large_compressed) != large) {
+                throw std::runtime_error(name + ": round trip mismatch");
+            }
+            const double large_decompress = seconds_since(start);
+            std::cout << name << '\t' << level << '\t' << small_compress << '\t' << small_decompress << '\t'
+                      << static_cast<double>(large_mib) / large_compress << '\t'
+                      << static_cast<double>(large_mib) / large_decompress << '\n';
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+// hash [размер файла в МиБ] [повторов]
+// Сравнивает прежний SHA-1 из boost::uuids с движком хеширования:
+// SHA-1 и SHA-256 через OpenSSL EVP и BLAKE3 в один и во все потоки.
+// Файл читается с диска (после первого прохода - из page cache).
+int hash_scenario(const std::vector<std::string> &args)
+{
+    const std::size_t file_mib = args.size() > 0 ? std::stoul(args[0]) : 512;
+    const int repeats = args.size() > 1 ? std::stoi(args[1]) : 3;
+    const fs::path path = make_file("hash.bin", file_mib * 1024 * 1024, false);
+    const double gib = static_cast<double>(file_mib) / 1024 * repeats;
+    const unsigned cores = args.size() > 1 ? std::stoul(args[1]) : std::max(1U, std::thread::hardware_concurrency());
+    hash_file(path.string(), Hash_Algorithm::sha1);
+
+    const auto measure = [&](const std::string &name, const std::function<void()> &hash) {
+        const auto start = Clock::now();
+        for (int i = 0; i < repeats; ++i) {
+            hash();
+        }
+        std::cout << name << '\t' << gib / seconds_since(start) << '\n';
+    };
+
+    std::cout << "hash\tGiB/s\n";
+    measure("boost sha1", [&] {
+        boost::uuids::detail::sha1 sha1;
+        std::ifstream file(path, std::ios::binary);
+        std::vector<char> buffer(STREAM_BLOCK_SIZE);
+        while (file) {
+            file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            sha1.process_bytes(buffer.data(), static_cast<std::size_t>(file.gcount()));
+        }
+        boost::uuids::detail::sha1::digest_type digest;
+        sha1.get_digest(digest);
+    });
+    measure("evp sha1", [&] { hash_file(path.string(), Hash_Algorithm::sha1); });
+    measure("evp sha256", [&] { hash_file(path.string(), Hash_Algorithm::sha256); });
+    measure("blake3 x1", [&] { hash_file(path.string(), Hash_Algorithm::blake3, 1); });
+    measure("blake3 x" + std::to_string(cores), [&] { hash_file(path.string(), Hash_Algorithm::blake3, cores); });
+    return EXIT_SUCCESS;
+}
+
+// small_files [файлов] [размер файла в КиБ]
+// Время на один небольшой файл: get_file по новому соединению с полным
+// рукопожатием TLS, по новому соединению с возобновлённой сессией, по
+// соединению из Connection_Pool и get_files конвейером по одному соединению.
+int small_files_scenario(const std::vector<std::string> &args)
+{
+    const int count = args.size() > 0 ? std::stoi(args[0]) : 200;
+    const std::size_t file_kib = args.size() > 1 ? std::stoul(args[1]) : 4;
+    std::vector<std::string> names;
+    for (int i = 0; i < count; ++i) {
+        names.push_back("small" + std::to_string(i) + ".txt");
+        make_file(names.back(), file_kib * 1024, true);
+    }
+    const fs::path out_dir = BENCH_DIR / "small-out";
+    fs::create_directories(out_dir);
+    const std::string out_prefix = out_dir.string() + "/";
+
+    Server server(SERVER_PORT, 1, BENCH_DIR.string(), "bench.log");
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    struct Mode {
+        std::string name;
+        bool drop_connections;
+        bool drop_sessions;
+    };
+    std::cout << "connection\tms/file\n";
+    for (const Mode &mode : { Mode { "cold", true, true }, Mode { "resumed", true, false },
+             Mode { "pooled", false, false } }) {
+        // get_file сообщает о каждом файле в std::cout.
+        std::ostringstream progress;
+        auto *const stdout_buffer = std::cout.rdbuf(progress.rdbuf());
+        get_file("127.0.0.1", names.front(), out_prefix, 0);
+        const auto start = Clock::now();
+        for (const auto &name : names) {
+            if (mode.drop_connections) {
+                Connection_Pool::get_instance().clear();
+            }
+            if (mode.drop_sessions) {
+                Certificate_Singleton::get_instance().forget_sessions();
+            }
+            get_file("127.0.0.1", name, out_prefix, 0);
+        }
+        const double elapsed = seconds_since(start);
+        std::cout.rdbuf(stdout_buffer);
+        std::cout << mode.name << '\t' << elapsed * 1000 / count << '\n';
+    }
+
+    std::ostringstream progress;
+    auto *const stdout_buffer = std::cout.rdbuf(progress.rdbuf());
+    const auto start = Clock::now();
+    get_files("127.0.0.1", names, out_prefix, 0);
+    const double elapsed = seconds_since(start);
+    std::cout.rdbuf(stdout_buffer);
+    std::cout << "pipelined\t" << elapsed * 1000 / count << '\n';
+    Connection_Pool::get_instance().clear();
+    return EXIT_SUCCESS;
+}
+
+// folder [файлов] [размер файла в КиБ]
+// Время на файл при скачивании каталога: get_files конвейером по одному
+// соединению и get_folder одним потоковым архивом.
+int folder_scenario(const std::vector<std::string> &args)
+{
+    const int count = args.size() > 0 ? std::stoi(args[0]) : 1000;
+    const std::size_t file_kib = args.size() > 1 ? std::stoul(args[1]) : 4;
+    // Содержимое у файлов разное, иначе кэш артефактов сервера сжимал бы
+    // их один раз на всех.
+    fs::remove_all(BENCH_DIR / "folder");
+    fs::create_directories(BENCH_DIR / "folder");
+    std::vector<std::string> names;
+    for (int i = 0; i < count; ++i) {
+        names.push_back("folder/file" + std::to_string(i) + ".txt");
+        std::ofstream out(BENCH_DIR / names.back(), std::ios::binary);
+        std::string content;
+        for (std::size_t line = 0; content.size() < file_kib * 1024; ++line) {
+            content += "file " + std::to_string(i) + " line " + std::to_string(line) + " of the benchmark folder\n";
+        }
+        content.resize(file_kib * 1024);
+        out << content;
+    }
+    const fs::path out_dir = BENCH_DIR / "folder-out";
+    fs::create_directories(out_dir / "folder");
+    const std::string out_prefix = out_dir.string() + "/";
+
+    Server server(SERVER_PORT, 1, BENCH_DIR.string(), "bench.log");
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    std::cout << "transfer\tms\tms/file\n";
+    const auto report = [&](const std::string &name, const std::function<void()> &run) {
+        std::ostringstream progress;
+        auto *const stdout_buffer = std::cout.rdbuf(progress.rdbuf());
+        const auto start = Clock::now();
+        run();
+        const double elapsed = seconds_since(start);
+        std::cout.rdbuf(stdout_buffer);
+        std::cout << name << '\t' << elapsed * 1000 << '\t' << elapsed * 1000 / count << '\n';
+    };
+    // Первый запрос открывает соединение, которым пользуются оба способа.
+    report("warmup", [&] { get_file("127.0.0.1", names.front(), out_prefix, 0); });
+    report("pipelined", [&] { get_files("127.0.0.1", names, out_prefix, 0); });
+    fs::remove_all(out_dir / "folder");
+    report("archive", [&] { get_folder("127.0.0.1", "folder", out_prefix, 0); });
+    Connection_Pool::get_instance().clear();
+    return EXIT_SUCCESS;
+}
+
+// shaping [лимит в МиБ/с] [размер bulk-файла в МиБ]
+// При ограничении исходящей полосы сервера скачивает крупный файл
+// и одновременно раз в 100 мс мелкий: скорость bulk-передачи должна
+// держаться у лимита, а задержка мелкого файла - остаться небольшой.
+int shaping_scenario(const std::vector<std::string> &args)
+{
+    const std::uint64_t limit_mib = args.size() > 0 ? std::stoull(args[0]) : 16;
+    const std::size_t bulk_mib = args.size() > 1 ? std::stoul(args[1]) : 64;
+    make_file("shaping_bulk.bin", bulk_mib * 1024 * 1024, false);
+    make_file("shaping_small.txt", 16 * 1024, true);
+    const fs::path out_dir = BENCH_DIR / "shaping-out";
+    fs::create_directories(out_dir);
+    const std::string out_prefix = out_dir.string() + "/";
+
+    Server server(SERVER_PORT, 2, BENCH_DIR.string(), "bench.log");
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    Bandwidth_Shaper::get_instance(Traffic_Direction::upload).set_limits(limit_mib * 1024 * 1024, 0);
+
+    // Задержка мелкого файла: сначала на пустом канале, затем пока
+    // в соседнем соединении идёт bulk-передача, занимающая весь лимит.
+    std::ostringstream progress;
+    auto *const stdout_buffer = std::cout.rdbuf(progress.rdbuf());
+    const auto small_latency = [&] {
+        const auto start = Clock::now();
+        get_file("127.0.0.1", "shaping_small.txt", out_prefix, 0, false);
+        return seconds_since(start) * 1000;
+    };
+    small_latency();
+    const double idle_ms = small_latency();
+
+    std::atomic<bool> bulk_done = false;
+    const auto bulk_start = Clock::now();
+    std::thread bulk([&] {
+        get_file("127.0.0.1", "shaping_bulk.bin", out_prefix, 0, false);
+        bulk_done = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    double max_ms = 0;
+    double total_ms = 0;
+    int samples = 0;
+    while (!bulk_done) {
+        const double ms = small_latency();
+        max_ms = std::max(max_ms, ms);
+        total_ms += ms;
+        ++samples;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    bulk.join();
+    const double bulk_seconds = seconds_since(bulk_start);
+    std::cout.rdbuf(stdout_buffer);
+
+    std::cout << "limit MiB/s\tbulk MiB/s\tsmall idle ms\tsmall avg ms\tsmall max ms\n"
+              << limit_mib << '\t' << static_cast<double>(bulk_mib) / bulk_seconds << '\t' << idle_ms << '\t'
+              << (samples > 0 ? total_ms / samples : 0) << '\t' << max_ms << '\n';
+    Bandwidth_Shaper::get_instance(Traffic_Direction::upload).set_limits(0, 0);
+    Connection_Pool::get_instance().clear();
+    return EXIT_SUCCESS;
+}
+
+// logger [потоков] [сообщений на поток]
+// Сравнивает прежнюю синхронную запись журнала (ofstream и std::endl под
+// мьютексом) с Server_Logger без прореживания и с записью каждого сотого
+// сообщения уровня request.
+int logger_scenario(const std::vector<std::string> &args)
+{
+    const int threads = args.size() > 0 ? std::stoi(args[0]) : 8;
+    const int per_thread = args.size() > 1 ? std::stoi(args[1]) : 100000;
+    const fs::path path = BENCH_DIR / "logger.log";
+    fs::create_directories(BENCH_DIR);
+
+    // Время, которое сессии проводят внутри log().
+    const auto run = [&](const std::function<void(const std::string &)> &log) {
+        std::vector<std::thread> writers;
+        const auto start = Clock::now();
+        for (int t = 0; t < threads; ++t) {
+            writers.emplace_back([&, t] {
+                for (int i = 0; i < per_thread; ++i) {
+                    log("Received request from 127.0.0.1:" + std::to_string(t) + ": GET /file" + std::to_string(i) + '\n');
+                }
+            });
+        }
+        for (auto &writer : writers) {
+            writer.join();
+        }
+        return seconds_since(start);
+    };
+
+    // ns/message - задержка вызова log(), drained ms - пока всё не окажется в файле.
+    std::cout << "logger\tthreads\tns/message\tdrained ms\tdropped\n";
+    const double total = static_cast<double>(threads) * per_thread;
+    {
+        // Прежний журнал: общий ofstream, std::endl на каждой записи.
+        std::ofstream file(path);
+        std::mutex mutex;
+        const double elapsed = run([&](const std::string &message) {
+            const std::lock_guard lock(mutex);
+            file << message << std::endl;
+        });
+        std::cout << "sync endl\t" << threads << '\t' << elapsed * 1e9 / total << '\t' << elapsed * 1000 << "\t0\n";
+    }
+    for (const unsigned rate : { 1u, 100u }) {
+        Server_Logger logger(path.string());
+        logger.set_sample_rate(rate);
+        const auto start = Clock::now();
+        const double elapsed = run([&](const std::string &message) { logger.log(Log_Level::request, message); });
+        logger.flush();
+        std::cout << "async 1/" << rate << '\t' << threads << '\t' << elapsed * 1e9 / total << '\t'
+                  << seconds_since(start) * 1000 << '\t' << logger.get_dropped() << '\n';
+    }
+    fs::remove(path);
+    return EXIT_SUCCESS;
+}
+
+const std::map<std::string, std::function<int(const std::vector<std::string> &)>> SCENARIOS = {
+    { "codecs", codecs_scenario },
+    { "folder", folder_scenario },
+    { "hash", hash_scenario },
+    { "load", load_scenario },
+    { "logger", logger_scenario },
+    { "parallel_deflate", parallel_deflate_scenario },
+    { "shaping", shaping_scenario },
+    { "small_files", small_files_scenario },
+    { "uncompressed", uncompressed_scenario },
+    { "zlib", zlib_scenario },
+};
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || !SCENARIOS.contains(argv[1])) {
+        std::cerr << "Usage: dec-rep-transport_bench <scenario> [args...]\nScenarios:";
+        for (const auto &[name, scenario] : SCENARIOS) {
+            std::cerr << ' ' << name;
+        }
+        std::cerr << '\n';
+        return EXIT_FAILURE;
+    }
+    try {
+        return SCENARIOS.at(argv[1])(std::vector<std::string>(argv + 2, argv + argc));
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
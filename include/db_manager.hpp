@@ -21,6 +21,9 @@ class Manager {
 private:
     pqxx::connection C;
 
+    // регистрирует на соединении C все запросы с постоянным текстом
+    void prepare_statements();
+
     // (Вспомогательные)
     static int get_user_id(
         pqxx::work &w,
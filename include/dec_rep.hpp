@@ -36,6 +36,12 @@ public:
 
     void construct_dec_rep_fs();
 
+    // Скачивает файл сразу у всех пиров, найденных search_service.
+    void download_file(const std::string &file_name, const std::string &file_path);
+
+    // Скачивает каталог одним архивом у первого пира, который его отдал.
+    void download_folder(const std::string &folder_name, const std::string &folder_path);
+
     void run();
 
     void stop();
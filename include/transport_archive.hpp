@@ -0,0 +1,95 @@
+#ifndef TRANSPORT_ARCHIVE_HPP
+#define TRANSPORT_ARCHIVE_HPP
+
+#include "transport_codec.hpp"
+#include "transport_commit.hpp"
+#include "transport_hash.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define ARCHIVE_MAX_PATH_SIZE 4096
+#define ARCHIVE_HASH_SIZE 40
+// Архив сжимается одним потоком, и на длинном повторяющемся вводе
+// уровни выше 6 замедляют deflate в разы почти без выигрыша в размере.
+#define ARCHIVE_MAX_COMPRESSION_LEVEL 6
+// Значение X-Transfer-Mode запроса и ответа с архивом каталога.
+#define ARCHIVE_TRANSFER_MODE "archive"
+
+namespace transport_service {
+// Поток архива: "DRA1", затем записи 'D' <длина пути u32> <путь> для
+// каталогов и 'F' <длина пути u32> <путь> <размер u64> <байты>
+// <ETag, 40 символов> для файлов, в конце 'E'. Пути относительные, через '/'.
+// Хеш идёт после данных, поэтому файл отправляется за один проход.
+class Archive_Writer {
+private:
+    const Sink sink;
+    std::optional<Sha1_Hasher> hasher;
+    std::uint64_t remaining = 0;
+    bool in_file = false;
+
+public:
+    explicit Archive_Writer(Sink m_sink);
+
+    void add_directory(const std::string &path);
+    // Данные файла подаются write() ровно в объявленном размере.
+    void begin_file(const std::string &path, std::uint64_t size);
+    void write(const char *data, std::size_t size);
+    void end_file();
+    void finish();
+};
+
+// Путь записи архива безопасен: относительный, без "." и "..".
+bool is_safe_archive_path(std::string_view path);
+
+// Распаковывает архив в каталог root по мере поступления байт. Файл
+// пишется в path + PART_FILE_SUFFIX и после сверки SHA-1 переименовывается
+// пачкой с соседними через Commit_Batch, несовпадение хеша или небезопасный
+// путь прерывают распаковку. В get_extracted() файл попадает, когда уже
+// лежит на своём месте.
+class Archive_Reader {
+public:
+    struct Extracted_File {
+        std::filesystem::path path;
+        std::string hash;
+    };
+
+private:
+    enum class State { magic, tag, path_size, path, file_size, data, hash, done };
+
+    const std::filesystem::path root;
+    State state = State::magic;
+    std::string field;
+    char tag = 0;
+    std::string entry_path;
+    std::uint64_t remaining = 0;
+    std::optional<Sha1_Hasher> hasher;
+    std::optional<Part_File> out;
+    std::uint64_t written = 0;
+    Commit_Batch batch;
+    std::vector<Extracted_File> extracted;
+
+    // Копит байты поля размером size; true, когда поле собрано.
+    bool take(const char *&data, std::size_t &size, std::size_t field_size);
+    void open_entry();
+    void close_entry();
+
+public:
+    explicit Archive_Reader(std::filesystem::path m_root);
+    ~Archive_Reader();
+
+    Archive_Reader(const Archive_Reader &) = delete;
+    Archive_Reader &operator=(const Archive_Reader &) = delete;
+
+    void write(const char *data, std::size_t size);
+    // true, если прочитан завершающий 'E'.
+    [[nodiscard]] bool is_done() const;
+    [[nodiscard]] const std::vector<Extracted_File> &get_extracted() const;
+};
+}  // namespace transport_service
+
+#endif  // TRANSPORT_ARCHIVE_HPP
@@ -0,0 +1,79 @@
+#ifndef TRANSPORT_CHUNK_HPP
+#define TRANSPORT_CHUNK_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#define CDC_MIN_CHUNK_SIZE (16 * 1024)
+#define CDC_AVG_CHUNK_SIZE (64 * 1024)
+#define CDC_MAX_CHUNK_SIZE (256 * 1024)
+// Файлы меньше этого размера передаются целиком, без манифеста.
+#define CHUNK_MIN_FILE_SIZE (1024 * 1024)
+#define CHUNK_STORE_FILE "chunk_store.journal"
+// Значение X-Transfer-Mode запроса и ответа с манифестом.
+#define CHUNKED_TRANSFER_MODE "chunks"
+
+namespace transport_service {
+struct Chunk {
+    std::uint64_t offset = 0;
+    std::uint32_t length = 0;
+    // SHA-1 содержимого чанка в hex.
+    std::string hash;
+};
+
+// Длина первого чанка data по FastCDC: gear-хеш с нормализованным
+// разбиением, граница зависит только от содержимого рядом с ней.
+std::size_t fastcdc_cut(const char *data, std::size_t size);
+
+// Разбивает файл на чанки; пустой список для пустого файла.
+std::vector<Chunk> chunk_file(const std::string &path);
+
+// Манифест - строки "hash length" в порядке следования чанков.
+std::string serialize_manifest(const std::vector<Chunk> &chunks);
+std::optional<std::vector<Chunk>> parse_manifest(std::string_view manifest);
+
+// Индекс чанков по хешу: где байты чанка уже лежат в локальных файлах.
+// Сами чанки не копируются, поэтому одинаковые данные занимают место
+// на диске только в файлах репозитория. Месторасположение проверяется
+// хешем при чтении, так что изменённые файлы просто выпадают из индекса.
+// Журнал хранит строки "hash offset length path" и "- hash".
+class Chunk_Store {
+private:
+    struct Location {
+        std::string path;
+        std::uint64_t offset = 0;
+        std::uint32_t length = 0;
+    };
+
+    const std::string store_path;
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, Location> locations;
+    std::ofstream journal;
+
+    void load();
+    void forget(const std::string &hash, const Location &stale);
+
+public:
+    explicit Chunk_Store(std::string m_store_path);
+
+    Chunk_Store(const Chunk_Store &) = delete;
+    Chunk_Store &operator=(const Chunk_Store &) = delete;
+
+    static Chunk_Store &get_instance();
+
+    // Запоминает, что чанки chunks лежат в файле path.
+    void add_file(const std::string &path, const std::vector<Chunk> &chunks);
+    // Байты чанка, если он есть в каком-нибудь локальном файле.
+    std::optional<std::string> read(const Chunk &chunk);
+    [[nodiscard]] bool contains(const std::string &hash) const;
+};
+}  // namespace transport_service
+
+#endif  // TRANSPORT_CHUNK_HPP
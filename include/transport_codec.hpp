@@ -0,0 +1,272 @@
+#ifndef TRANSPORT_CODEC_HPP
+#define TRANSPORT_CODEC_HPP
+
+#include <zlib.h>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef DECREP_HAS_ZSTD
+#include <zstd.h>
+#endif
+#ifdef DECREP_HAS_LZ4
+#include <lz4frame.h>
+#endif
+
+#define CODEC_BUFFER_SIZE 65536
+#define ZSTD_WORKER_COUNT 2
+// Размер блока параллельного deflate, как у pigz.
+#define PARALLEL_DEFLATE_BLOCK_SIZE (128 * 1024)
+// Окно deflate: столько хвоста предыдущего блока служит словарём.
+#define DEFLATE_WINDOW_SIZE 32768
+// Сколько свободных контекстов zlib каждого вида (deflate всех уровней
+// вместе и inflate) процесс держит про запас.
+#define ZLIB_POOL_SIZE 16
+// Content-Encoding для данных без сжатия.
+#define RAW_ENCODING "raw"
+
+namespace transport_service {
+// Приёмник очередного готового блока данных.
+using Sink = std::function<void(const char *, std::size_t)>;
+
+// Потоковый кодер: данные подаются блоками, результат отдаётся в sink.
+class Encoder {
+public:
+    virtual ~Encoder() = default;
+
+    virtual void write(const char *data, std::size_t size, const Sink &sink) = 0;
+    virtual void finish(const Sink &sink) = 0;
+};
+
+// Потоковый декодер, парный к Encoder.
+class Decoder {
+public:
+    virtual ~Decoder() = default;
+
+    virtual void write(const char *data, std::size_t size, const Sink &sink) = 0;
+    // true, если встречен конец сжатого потока.
+    [[nodiscard]] virtual bool is_done() const = 0;
+};
+
+// Контексты zlib из пула потока. deflateInit выделяет сотни килобайт
+// и заполняет таблицы, что для небольших данных дороже самого сжатия,
+// поэтому освобождённый контекст сбрасывается deflateReset/inflateReset
+// и ждёт следующего вызова на том же потоке.
+struct Deflate_Context {
+    z_stream zs{};
+    int compression_level = Z_DEFAULT_COMPRESSION;
+
+    ~Deflate_Context();
+};
+
+struct Inflate_Context {
+    z_stream zs{};
+
+    ~Inflate_Context();
+};
+
+struct Deflate_Releaser {
+    void operator()(Deflate_Context *context) const;
+};
+
+struct Inflate_Releaser {
+    void operator()(Inflate_Context *context) const;
+};
+
+using Pooled_Deflate = std::unique_ptr<Deflate_Context, Deflate_Releaser>;
+using Pooled_Inflate = std::unique_ptr<Inflate_Context, Inflate_Releaser>;
+
+// Контекст сжатия в формате zlib на уровне compression_level.
+Pooled_Deflate acquire_deflate(int compression_level);
+Pooled_Inflate acquire_inflate();
+
+// Потоковое сжатие deflate: сжатый результат отдаётся в sink порциями
+// не больше CODEC_BUFFER_SIZE.
+class Deflate_Stream : public Encoder {
+private:
+    Pooled_Deflate context;
+    std::vector<char> out_buffer;
+
+    void drain(int flush, const Sink &sink);
+
+public:
+    explicit Deflate_Stream(int compression_level);
+
+    Deflate_Stream(const Deflate_Stream &) = delete;
+    Deflate_Stream &operator=(const Deflate_Stream &) = delete;
+
+    void write(const char *data, std::size_t size, const Sink &sink) override;
+    void finish(const Sink &sink) override;
+};
+
+// Параллельное сжатие deflate по схеме pigz: вход режется на блоки
+// по PARALLEL_DEFLATE_BLOCK_SIZE, каждый блок сжимается в своём потоке
+// со словарём из хвоста предыдущего и завершается Z_SYNC_FLUSH, поэтому
+// блоки просто склеиваются. Заголовок zlib и общая adler32 (через
+// adler32_combine) дают обычный поток, который читает Inflate_Stream.
+// Блоки сжимает общий для всех потоков пул по числу ядер, так что
+// одновременные ответы не запускают лишних потоков. У одного потока
+// в работе не больше threads блоков; готовые блоки отдаются в sink
+// строго по порядку. write() и finish() ждут пул, поэтому сервер
+// вызывает их вне сетевых потоков.
+class Parallel_Deflate_Stream : public Encoder {
+private:
+    struct Block {
+        std::string data;
+        uLong adler = 0;
+        std::size_t size = 0;
+    };
+
+    const int compression_level;
+    const unsigned threads;
+    std::string input;
+    std::string dictionary;
+    std::deque<std::future<Block>> blocks;
+    uLong adler;
+    bool started = false;
+
+    // Сжимает один блок в «сырой» deflate без заголовка zlib.
+    static Block compress_block(
+        int compression_level,
+        const std::string &input,
+        const std::string &dictionary,
+        bool last
+    );
+    void submit(bool last);
+    // Отдаёт готовые блоки по порядку; ждёт, пока в работе не останется
+    // не больше max_pending блоков.
+    void drain(std::size_t max_pending, const Sink &sink);
+
+public:
+    Parallel_Deflate_Stream(int compression_level, unsigned threads);
+
+    Parallel_Deflate_Stream(const Parallel_Deflate_Stream &) = delete;
+    Parallel_Deflate_Stream &operator=(const Parallel_Deflate_Stream &) = delete;
+
+    void write(const char *data, std::size_t size, const Sink &sink) override;
+    void finish(const Sink &sink) override;
+};
+
+// Потоковая распаковка deflate, парная к Deflate_Stream.
+class Inflate_Stream : public Decoder {
+private:
+    Pooled_Inflate context;
+    std::vector<char> out_buffer;
+    bool done = false;
+
+public:
+    Inflate_Stream();
+
+    Inflate_Stream(const Inflate_Stream &) = delete;
+    Inflate_Stream &operator=(const Inflate_Stream &) = delete;
+
+    void write(const char *data, std::size_t size, const Sink &sink) override;
+    [[nodiscard]] bool is_done() const override;
+};
+
+#ifdef DECREP_HAS_ZSTD
+// Сжатие zstd, при поддержке библиотекой - в workers потоков.
+class Zstd_Encoder : public Encoder {
+private:
+    ZSTD_CCtx *cctx;
+    std::vector<char> out_buffer;
+
+public:
+    explicit Zstd_Encoder(int compression_level, unsigned workers = ZSTD_WORKER_COUNT);
+    ~Zstd_Encoder() override;
+
+    Zstd_Encoder(const Zstd_Encoder &) = delete;
+    Zstd_Encoder &operator=(const Zstd_Encoder &) = delete;
+
+    void write(const char *data, std::size_t size, const Sink &sink) override;
+    void finish(const Sink &sink) override;
+};
+
+class Zstd_Decoder : public Decoder {
+private:
+    ZSTD_DCtx *dctx;
+    std::vector<char> out_buffer;
+    bool done = false;
+
+public:
+    Zstd_Decoder();
+    ~Zstd_Decoder() override;
+
+    Zstd_Decoder(const Zstd_Decoder &) = delete;
+    Zstd_Decoder &operator=(const Zstd_Decoder &) = delete;
+
+    void write(const char *data, std::size_t size, const Sink &sink) override;
+    [[nodiscard]] bool is_done() const override;
+};
+#endif
+
+#ifdef DECREP_HAS_LZ4
+// Сжатие в формате LZ4 frame; высокие уровни используют LZ4HC.
+class Lz4_Encoder : public Encoder {
+private:
+    LZ4F_cctx *cctx = nullptr;
+    LZ4F_preferences_t preferences{};
+    std::vector<char> out_buffer;
+    bool started = false;
+
+    void begin(const Sink &sink);
+
+public:
+    explicit Lz4_Encoder(int compression_level);
+    ~Lz4_Encoder() override;
+
+    Lz4_Encoder(const Lz4_Encoder &) = delete;
+    Lz4_Encoder &operator=(const Lz4_Encoder &) = delete;
+
+    void write(const char *data, std::size_t size, const Sink &sink) override;
+    void finish(const Sink &sink) override;
+};
+
+class Lz4_Decoder : public Decoder {
+private:
+    LZ4F_dctx *dctx = nullptr;
+    std::vector<char> out_buffer;
+    bool done = false;
+
+public:
+    Lz4_Decoder();
+    ~Lz4_Decoder() override;
+
+    Lz4_Decoder(const Lz4_Decoder &) = delete;
+    Lz4_Decoder &operator=(const Lz4_Decoder &) = delete;
+
+    void write(const char *data, std::size_t size, const Sink &sink) override;
+    [[nodiscard]] bool is_done() const override;
+};
+#endif
+
+// Поддерживаемые кодеки в порядке предпочтения сервера,
+// например {"zstd", "lz4", "deflate"}.
+const std::vector<std::string> &supported_encodings();
+
+// Значение Accept-Encoding, которое отправляет клиент.
+std::string accept_encoding_header();
+
+// Лучший из поддерживаемых кодеков, принимаемых клиентом. Без заголовка
+// Accept-Encoding - deflate, как у клиентов до появления выбора кодека;
+// RAW_ENCODING, если общего кодека нет.
+std::string negotiate_encoding(std::string_view accept_encoding);
+
+// Кодер и декодер по имени из Content-Encoding. compression_level задаётся
+// в шкале zlib (1-9) и переводится в шкалу конкретного кодека. При
+// threads > 1 deflate и zstd сжимают в несколько потоков, формат потока
+// при этом не меняется. nullptr для RAW_ENCODING и неизвестных имён.
+std::unique_ptr<Encoder> make_encoder(
+    std::string_view encoding,
+    int compression_level,
+    unsigned threads = 1
+);
+std::unique_ptr<Decoder> make_decoder(std::string_view encoding);
+}  // namespace transport_service
+
+#endif  // TRANSPORT_CODEC_HPP
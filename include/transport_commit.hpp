@@ -0,0 +1,102 @@
+#ifndef TRANSPORT_COMMIT_HPP
+#define TRANSPORT_COMMIT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <vector>
+
+#define PART_FILE_SUFFIX ".part"
+// Commit_Batch сбрасывает накопленные файлы на диск, как только их
+// набирается столько или столько байт.
+#define COMMIT_BATCH_FILES 64
+#define COMMIT_BATCH_BYTES (64 * 1024 * 1024)
+
+namespace transport_service {
+// pwrite всех size байт с учётом частичной записи и EINTR.
+void write_all_at(int fd, const char *data, std::size_t size, std::uint64_t offset);
+
+// fsync каталога, чтобы переименование в нём пережило сбой питания.
+// Ошибка открытия или fsync бросает std::system_error.
+void sync_directory(const std::filesystem::path &directory);
+
+// Временный файл target + PART_FILE_SUFFIX, в который пишется скачиваемый
+// файл. На место target он попадает только через commit() или
+// Commit_Batch: сначала данные сбрасываются на диск, затем rename
+// атомарно заменяет target, затем на диск сбрасывается каталог. Поэтому
+// после сбоя на месте target либо старая версия, либо новая целиком,
+// а наблюдатель за файлами видит одно переименование вместо череды
+// изменений. Деструктор только закрывает файл: недокачанный остаётся
+// для докачки, ненужный удаляется через discard().
+class Part_File {
+private:
+    std::filesystem::path target;
+    std::filesystem::path part_path;
+    int fd = -1;
+
+    void close_file();
+
+public:
+    // is_resumed - дописывать в уже существующий временный файл,
+    // иначе он создаётся заново.
+    explicit Part_File(std::filesystem::path m_target, bool is_resumed = false);
+    // Только закрывает файл: докачка по журналу продолжает его. Без
+    // журнала при ошибке вызывающий сам делает discard().
+    ~Part_File();
+
+    Part_File(Part_File &&other) noexcept;
+    Part_File(const Part_File &) = delete;
+    Part_File &operator=(const Part_File &) = delete;
+    Part_File &operator=(Part_File &&) = delete;
+
+    [[nodiscard]] int get_fd() const;
+    [[nodiscard]] const std::filesystem::path &get_path() const;
+    [[nodiscard]] const std::filesystem::path &get_target() const;
+
+    // Резервирует место под size байт одним куском, не меняя размер
+    // файла. Там, где fallocate не поддерживается, ничего не делает.
+    void preallocate(std::uint64_t size);
+    void write_at(const char *data, std::size_t size, std::uint64_t offset);
+    // Запускает запись данных на диск, не дожидаясь её окончания.
+    void start_writeback() const;
+
+    // fdatasync, rename на место target и fsync каталога.
+    void commit();
+    // Закрывает и переименовывает без сброса на диск: его делает
+    // Commit_Batch сразу для всех файлов.
+    void publish();
+    // Закрывает и удаляет временный файл.
+    void discard();
+};
+
+// Копит проверенные временные файлы и публикует их пачкой. Вместо
+// fdatasync и fsync каталога на каждый мелкий файл вся пачка сбрасывается
+// одним syncfs до переименований и одним после, а запись данных на диск
+// начинается ещё при добавлении файла. Непубликованные файлы удаляются
+// в деструкторе.
+class Commit_Batch {
+private:
+    struct Entry {
+        Part_File file;
+        std::function<void()> on_commit;
+    };
+
+    std::vector<Entry> entries;
+    std::uint64_t pending_bytes = 0;
+
+public:
+    Commit_Batch() = default;
+    ~Commit_Batch();
+
+    Commit_Batch(const Commit_Batch &) = delete;
+    Commit_Batch &operator=(const Commit_Batch &) = delete;
+
+    // on_commit вызывается после того, как файл занял своё место.
+    void add(Part_File &&file, std::uint64_t size, std::function<void()> on_commit = {});
+    void flush();
+    [[nodiscard]] std::size_t get_pending() const;
+};
+}  // namespace transport_service
+
+#endif  // TRANSPORT_COMMIT_HPP
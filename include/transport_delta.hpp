@@ -0,0 +1,121 @@
+#ifndef TRANSPORT_DELTA_HPP
+#define TRANSPORT_DELTA_HPP
+
+#include "transport_codec.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#define DELTA_MIN_BLOCK_SIZE 2048
+#define DELTA_MAX_BLOCK_SIZE (128 * 1024)
+#define DELTA_MIN_FILE_SIZE (64 * 1024)
+#define DELTA_STRONG_HASH_SIZE 16
+#define DELTA_MAX_LITERAL (64 * 1024)
+#define DELTA_STEP_SIZE (1024 * 1024)
+// Значение X-Transfer-Mode запроса и ответа с дельтой.
+#define DELTA_TRANSFER_MODE "delta"
+
+namespace transport_service {
+// Размер блока сигнатуры: около sqrt(file_size), как в rsync.
+std::uint32_t delta_block_size(std::uint64_t file_size);
+
+// Слабая контрольная сумма rsync, пересчитываемая за O(1)
+// при сдвиге окна на один байт.
+class Rolling_Checksum {
+private:
+    std::uint32_t a = 0;
+    std::uint32_t b = 0;
+    std::uint32_t window = 0;
+
+public:
+    void reset(const char *data, std::size_t size);
+    void roll(unsigned char out, unsigned char in);
+    [[nodiscard]] std::uint32_t value() const;
+};
+
+using Strong_Hash = std::array<unsigned char, DELTA_STRONG_HASH_SIZE>;
+
+// Первые DELTA_STRONG_HASH_SIZE байт SHA-1 блока.
+Strong_Hash strong_hash(const char *data, std::size_t size);
+
+// Сигнатуры полных блоков устаревшей копии файла; неполный хвост
+// не описывается и всегда передаётся целиком.
+struct Delta_Signatures {
+    std::uint32_t block_size = 0;
+    std::vector<std::uint32_t> weak;
+    std::vector<Strong_Hash> strong;
+
+    static Delta_Signatures compute(const std::string &path);
+    [[nodiscard]] std::string serialize() const;
+    static std::optional<Delta_Signatures> parse(std::string_view data);
+};
+
+// Дельта нового файла относительно сигнатур - последовательность команд
+// 'C' <первый блок u64> <число блоков u32> (скопировать из старой копии)
+// и 'L' <длина u32> <байты> (вставить). Строится порциями, чтобы
+// результат можно было отправлять по ходу.
+class Delta_Encoder {
+private:
+    // Файл читается через pread окном от начала незавершённого литерала
+    // до конца очередной порции, а не отображается в память: файл,
+    // усечённый во время построения, даёт исключение, а не SIGBUS.
+    const int fd = -1;
+    std::vector<char> window;
+    // Байты файла начиная со смещения base; без fd - файл целиком.
+    const char *data;
+    std::size_t base = 0;
+    const std::size_t size;
+    const Delta_Signatures &signatures;
+    std::unordered_multimap<std::uint32_t, std::uint32_t> blocks_by_weak;
+    Rolling_Checksum checksum;
+    bool is_checksum_valid = false;
+    std::size_t pos = 0;
+    std::size_t literal_start = 0;
+    std::uint64_t copy_first = 0;
+    std::uint32_t copy_count = 0;
+    std::uint64_t copied_bytes = 0;
+
+    void index_blocks();
+    [[nodiscard]] const char *at(std::size_t offset) const;
+    // Сдвигает окно к literal_start и дочитывает файл до end.
+    void fill(std::size_t end);
+    std::optional<std::uint32_t> find_block() const;
+    void flush_copy(const Sink &sink);
+    void flush_literal(std::size_t end, const Sink &sink);
+
+public:
+    Delta_Encoder(const char *m_data, std::size_t m_size, const Delta_Signatures &m_signatures);
+    // Первые m_size байт файла m_fd; дескриптор должен жить дольше
+    // объекта. Если файл стал короче, step бросает исключение.
+    Delta_Encoder(int m_fd, std::size_t m_size, const Delta_Signatures &m_signatures);
+
+    // Обрабатывает около DELTA_STEP_SIZE байт; false, когда дельта готова.
+    bool step(const Sink &sink);
+    [[nodiscard]] std::uint64_t get_copied_bytes() const;
+};
+
+// Собирает новый файл из дельты и старой копии basis_fd.
+class Delta_Decoder {
+private:
+    const int basis_fd;
+    const std::uint32_t block_size;
+    std::string header;
+    std::uint32_t literal_remaining = 0;
+
+    void copy_blocks(std::uint64_t first, std::uint32_t count, const Sink &sink) const;
+
+public:
+    Delta_Decoder(int m_basis_fd, std::uint32_t m_block_size);
+
+    void write(const char *data, std::size_t size, const Sink &sink);
+    // true, если последняя команда прочитана целиком.
+    [[nodiscard]] bool is_idle() const;
+};
+}  // namespace transport_service
+
+#endif  // TRANSPORT_DELTA_HPP
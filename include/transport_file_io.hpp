@@ -0,0 +1,131 @@
+#ifndef TRANSPORT_FILE_IO_HPP
+#define TRANSPORT_FILE_IO_HPP
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/thread_pool.hpp>
+#ifdef DECREP_HAS_IO_URING
+#include <boost/asio/random_access_file.hpp>
+#endif
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Потоки для чтения и записи файлов там, где нет io_uring.
+#define FILE_IO_THREAD_COUNT 4
+// Сколько блоков Write_Behind держит в записи, прежде чем ждать диск.
+#define WRITE_BEHIND_DEPTH 4
+
+namespace transport_service {
+// true, если файлы читаются через io_uring (сборка с DECREP_IO_URING).
+bool has_io_uring();
+
+// Пул потоков для блокирующих pread/pwrite. Отделён от blocking_pool
+// сервера, чтобы чтение блока не стояло в очереди за построением
+// манифеста или дерева Меркла.
+class File_Io_Pool {
+private:
+    boost::asio::thread_pool pool{FILE_IO_THREAD_COUNT};
+
+    File_Io_Pool() = default;
+
+public:
+    File_Io_Pool(const File_Io_Pool &) = delete;
+    File_Io_Pool &operator=(const File_Io_Pool &) = delete;
+
+    static File_Io_Pool &get_instance();
+    boost::asio::thread_pool::executor_type get_executor();
+};
+
+// Файл, открытый для асинхронного чтения из корутины. С io_uring
+// запросы уходят в кольцо io_context, на котором работает executor,
+// иначе pread выполняется в File_Io_Pool, а корутина возвращается на
+// свой executor. В обоих случаях сетевой поток не блокируется диском.
+class Async_File {
+private:
+#ifdef DECREP_HAS_IO_URING
+    boost::asio::random_access_file file;
+#else
+    int fd = -1;
+#endif
+
+public:
+    Async_File(const boost::asio::any_io_executor &executor, const std::string &path);
+    ~Async_File();
+
+    Async_File(const Async_File &) = delete;
+    Async_File &operator=(const Async_File &) = delete;
+
+    // Читает ровно size байт с offset или бросает исключение.
+    boost::asio::awaitable<void> read_at(std::uint64_t offset, char *data, std::size_t size);
+};
+
+// Читает диапазон файла блоками с опережением на один блок: следующий
+// блок читается с диска, пока текущий уходит в сеть. Executor должен
+// выполнять обработчики последовательно (strand или один поток).
+class File_Prefetcher {
+private:
+    struct State;
+    // Незавершённое чтение держит состояние, поэтому объект можно
+    // уничтожить в любой момент.
+    std::shared_ptr<State> state;
+
+    void start_read();
+
+public:
+    File_Prefetcher(
+        const boost::asio::any_io_executor &executor,
+        const std::string &path,
+        std::uint64_t offset,
+        std::uint64_t length,
+        std::size_t block_size
+    );
+
+    // Очередной блок; пустой, когда диапазон прочитан. Блок действителен
+    // до следующего вызова.
+    boost::asio::awaitable<std::string_view> next();
+};
+
+// Отложенная запись принимаемого файла подряд с offset: данные копятся
+// в блоки, а блоки пишутся потоками File_Io_Pool, пока вызывающий поток
+// читает сеть и распаковывает следующий. Ошибка записи всплывает в
+// write() или drain(). Деструктор дожидается незаконченных записей,
+// поэтому дескриптор должен жить дольше объекта.
+class Write_Behind {
+private:
+    struct Block {
+        std::vector<char> data;
+        std::future<void> done;
+    };
+
+    const int fd;
+    std::uint64_t offset;
+    const std::size_t block_size;
+    std::vector<char> current;
+    std::deque<Block> in_flight;
+    std::vector<std::vector<char>> spare;
+
+    void submit();
+    void wait_oldest();
+
+public:
+    Write_Behind(int m_fd, std::uint64_t m_offset, std::size_t m_block_size);
+    ~Write_Behind();
+
+    Write_Behind(const Write_Behind &) = delete;
+    Write_Behind &operator=(const Write_Behind &) = delete;
+
+    void write(const char *data, std::size_t size);
+    // Дописывает накопленное и ждёт окончания всех записей.
+    void drain();
+};
+}  // namespace transport_service
+
+#endif  // TRANSPORT_FILE_IO_HPP
@@ -0,0 +1,110 @@
+#ifndef TRANSPORT_HASH_HPP
+#define TRANSPORT_HASH_HPP
+
+#include <openssl/evp.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#define HASH_READ_BLOCK_SIZE (1024 * 1024)
+#define HASH_READ_ALIGNMENT 4096
+// Поддерево BLAKE3 меньше этого размера хешируется одним потоком.
+#define BLAKE3_PARALLEL_MIN_SIZE (4 * 1024 * 1024)
+
+namespace transport_service {
+enum class Hash_Algorithm { sha1, sha256, blake3 };
+
+// Инкрементальный BLAKE3 (режим hash, 256 бит) по эталонной реализации.
+class Blake3_Hasher {
+public:
+    using Chaining_Value = std::array<std::uint32_t, 8>;
+
+    // Узел дерева до финального сжатия: из него получается либо
+    // chaining value для родителя, либо корневой хеш.
+    struct Output {
+        Chaining_Value input_cv;
+        std::array<std::uint32_t, 16> block_words;
+        std::uint64_t counter;
+        std::uint32_t block_len;
+        std::uint32_t flags;
+
+        [[nodiscard]] Chaining_Value chaining_value() const;
+        [[nodiscard]] std::array<std::uint8_t, 32> root_hash() const;
+    };
+
+    static Output parent_output(const Chaining_Value &left, const Chaining_Value &right);
+
+private:
+    struct Chunk_State {
+        Chaining_Value cv;
+        std::uint64_t chunk_counter;
+        std::array<std::uint8_t, 64> block{};
+        std::uint8_t block_len = 0;
+        std::uint8_t blocks_compressed = 0;
+
+        Chunk_State(const Chaining_Value &key, std::uint64_t counter);
+        [[nodiscard]] std::size_t len() const;
+        [[nodiscard]] std::uint32_t start_flag() const;
+        void update(const std::uint8_t *input, std::size_t size);
+        [[nodiscard]] Output output() const;
+    };
+
+    const std::uint64_t first_chunk;
+    Chunk_State chunk_state;
+    std::array<Chaining_Value, 54> cv_stack{};
+    std::uint8_t cv_stack_len = 0;
+
+    void push_cv(Chaining_Value cv, std::uint64_t total_chunks);
+
+public:
+    // first_chunk != 0 - хеширование поддерева, начинающегося с этого чанка.
+    explicit Blake3_Hasher(std::uint64_t first_chunk = 0);
+
+    void update(const char *data, std::size_t size);
+    // Узел всего поданного ввода: корень или поддерево.
+    [[nodiscard]] Output finalize_output() const;
+};
+
+// Потоковый хеш файла; SHA-1 и SHA-256 считаются через OpenSSL EVP,
+// который сам выбирает SHA-NI/AVX2, если процессор их поддерживает.
+class Hasher {
+private:
+    const Hash_Algorithm algorithm;
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> evp;
+    std::unique_ptr<Blake3_Hasher> blake3;
+
+public:
+    explicit Hasher(Hash_Algorithm m_algorithm);
+
+    void update(const char *data, std::size_t size);
+    [[nodiscard]] std::string hex_digest();
+};
+
+// ETag файла - SHA-1 в формате прежней реализации на
+// boost::uuids::detail::sha1: байты каждого 32-битного слова выписаны
+// в обратном порядке. Формат не меняется, пока ETag сравниваются с узлами
+// прежних версий и лежат в hash_index.journal и журналах докачки.
+// Переводит обычный hex SHA-1 (как у sha1sum) в этот формат.
+std::string sha1_to_etag(const std::string &sha1_hex);
+
+// Инкрементальный SHA-1 для проверки файлов по ETag.
+class Sha1_Hasher : public Hasher {
+public:
+    Sha1_Hasher() : Hasher(Hash_Algorithm::sha1) {
+    }
+
+    // Хеш в формате ETag, см. sha1_to_etag.
+    [[nodiscard]] std::string etag() {
+        return sha1_to_etag(hex_digest());
+    }
+};
+
+// Хеш файла в hex, пустая строка, если файл не открывается. Файл читается
+// выровненными блоками HASH_READ_BLOCK_SIZE; BLAKE3 считает поддеревья
+// в threads потоках (0 - по числу ядер).
+std::string hash_file(const std::string &path, Hash_Algorithm algorithm, unsigned threads = 0);
+}  // namespace transport_service
+
+#endif  // TRANSPORT_HASH_HPP
@@ -0,0 +1,105 @@
+#ifndef TRANSPORT_LOGGER_HPP
+#define TRANSPORT_LOGGER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#define DEFAULT_LOG_FILE "transport_service.log"
+// Ёмкость очереди записей, степень двойки. Переполненная очередь
+// не тормозит сессии: лишние записи отбрасываются и считаются.
+#define LOG_QUEUE_CAPACITY 8192
+// Как часто фоновый поток проверяет пустую очередь.
+#define LOG_FLUSH_INTERVAL std::chrono::milliseconds(10)
+
+namespace transport_service {
+// request - подробности отдельных запросов, их можно прореживать.
+enum class Log_Level { request, info, warning, error };
+
+struct Log_Record {
+    std::chrono::system_clock::time_point time;
+    Log_Level level = Log_Level::info;
+    std::string message;
+};
+
+// Ограниченная очередь без блокировок для многих писателей и одного
+// читателя (схема Вьюкова): каждая ячейка хранит номер хода, по которому
+// писатель и читатель понимают, чья она сейчас.
+class Log_Queue {
+private:
+    struct Slot {
+        std::atomic<std::size_t> sequence;
+        Log_Record record;
+    };
+
+    const std::size_t mask;
+    const std::unique_ptr<Slot[]> slots;
+    alignas(64) std::atomic<std::size_t> enqueue_pos = 0;
+    alignas(64) std::size_t dequeue_pos = 0;
+
+public:
+    explicit Log_Queue(std::size_t capacity);
+
+    Log_Queue(const Log_Queue &) = delete;
+    Log_Queue &operator=(const Log_Queue &) = delete;
+
+    // false, если очередь заполнена.
+    bool push(Log_Record &&record);
+    // Вызывается только из одного потока.
+    bool pop(Log_Record &record);
+};
+
+// Журнал сервера. log() только кладёт запись в очередь, а форматирует
+// и пишет в файл фоновый поток, сбрасывая буфер после каждой пачки,
+// поэтому сессии не ждут диска и не делят между собой ofstream.
+class Server_Logger {
+private:
+    const std::string log_file_name;
+    std::ofstream log_file;
+    mutable Log_Queue queue;
+    std::atomic<Log_Level> min_level = Log_Level::request;
+    std::atomic<unsigned> sample_rate = 1;
+    mutable std::atomic<std::uint64_t> request_count = 0;
+    mutable std::atomic<std::uint64_t> pushed = 0;
+    std::atomic<std::uint64_t> written = 0;
+    mutable std::atomic<std::uint64_t> dropped = 0;
+    std::atomic<bool> is_stopping = false;
+    std::thread flusher;
+    // Дата и время до секунд последней записи, их меняет только flusher.
+    std::time_t stamp_seconds = -1;
+    std::string stamp;
+
+    void write_record(const Log_Record &record);
+    void run();
+
+public:
+    explicit Server_Logger(
+        std::string m_log_file_name = DEFAULT_LOG_FILE,
+        std::size_t queue_capacity = LOG_QUEUE_CAPACITY
+    );
+    ~Server_Logger();
+
+    Server_Logger(const Server_Logger &) = delete;
+    Server_Logger &operator=(const Server_Logger &) = delete;
+
+    void log(const std::string &message) const;
+    void log(Log_Level level, std::string message) const;
+
+    // Записи ниже level отбрасываются сразу.
+    void set_level(Log_Level level);
+    // Из записей уровня request остаётся каждая every_n-я.
+    void set_sample_rate(unsigned every_n);
+
+    // Ждёт, пока всё, что уже поставлено в очередь, окажется в файле.
+    void flush() const;
+    [[nodiscard]] std::uint64_t get_dropped() const;
+};
+}  // namespace transport_service
+
+#endif  // TRANSPORT_LOGGER_HPP
@@ -0,0 +1,52 @@
+#ifndef TRANSPORT_MERKLE_HPP
+#define TRANSPORT_MERKLE_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define MERKLE_PIECE_SIZE (4 * 1024 * 1024)
+#define MERKLE_HASH_SIZE 32
+// Значение X-Transfer-Mode запроса и ответа с деревом кусков.
+#define MERKLE_TRANSFER_MODE "merkle"
+
+namespace transport_service {
+using Piece_Hash = std::array<unsigned char, MERKLE_HASH_SIZE>;
+
+// Дерево Меркла над кусками файла по piece_size. Листья - SHA-256
+// кусков, узлы - SHA-256 пары детей; префиксы 0 и 1, как в RFC 6962,
+// не дают выдать узел за лист. Непарный узел переходит на уровень выше
+// без изменений. Каждый кусок проверяется по своему листу сразу после
+// получения, а корни деревьев разных пиров можно сравнить между собой.
+class Merkle_Tree {
+private:
+    std::uint64_t piece_size = 0;
+    std::uint64_t file_size = 0;
+    std::vector<Piece_Hash> leaves;
+
+public:
+    static Piece_Hash hash_piece(const char *data, std::size_t size);
+    static Merkle_Tree
+    build(const std::string &path, std::uint64_t piece_size = MERKLE_PIECE_SIZE);
+
+    // Строка "piece_size file_size", затем листья в hex по одному на строку.
+    [[nodiscard]] std::string serialize() const;
+    static std::optional<Merkle_Tree> parse(std::string_view data);
+
+    // Корень в hex; у пустого файла - хеш пустого листа.
+    [[nodiscard]] std::string root() const;
+    [[nodiscard]] std::uint64_t get_piece_size() const;
+    [[nodiscard]] std::uint64_t get_file_size() const;
+    [[nodiscard]] std::size_t piece_count() const;
+    // Последний кусок может быть короче piece_size.
+    [[nodiscard]] std::uint64_t piece_length(std::size_t index) const;
+    [[nodiscard]] bool
+    verify_piece(std::size_t index, const char *data, std::size_t size) const;
+};
+}  // namespace transport_service
+
+#endif  // TRANSPORT_MERKLE_HPP
@@ -1,23 +1,98 @@
 #ifndef TRANSPORT_SERVICE_HPP
 #define TRANSPORT_SERVICE_HPP
 
+#include "transport_archive.hpp"
+#include "transport_chunk.hpp"
+#include "transport_codec.hpp"
+#include "transport_commit.hpp"
+#include "transport_delta.hpp"
+#include "transport_file_io.hpp"
+#include "transport_hash.hpp"
+#include "transport_logger.hpp"
+#include "transport_merkle.hpp"
+#include "transport_shaper.hpp"
 #include <zlib.h>
 #include <boost/asio.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/use_awaitable.hpp>
 #include <boost/asio/ssl/stream.hpp>
 #include <boost/beast.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/ssl/ssl_stream.hpp>
 #include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
 #define SERVER_PORT 6061
 #define CLIENT_PORT 6062
-#define THREAD_COUNT 1
+#define THREAD_COUNT 0  // 0 - по числу ядер
+#define MAX_SESSIONS 256
+#define BLOCKING_THREAD_COUNT 4
 #define DEC_REP_PATH "./"
 #define DEFAULT_COMPRESSION_LEVEL Z_BEST_COMPRESSION
 #define BUFFER_SIZE 8192
-#define DEFAULT_LOG_FILE "transport_service.log"
+#define STREAM_BLOCK_SIZE 65536
+#define LARGE_FILE_RANGE_SIZE (8 * 1024 * 1024)
+#define LARGE_FILE_CONNECTIONS 4
+// Куски роя совпадают с кусками дерева Меркла, чтобы каждый проверялся сразу.
+#define SWARM_PIECE_SIZE MERKLE_PIECE_SIZE
+#define SWARM_CONNECTIONS_PER_PEER 2
+#define SWARM_MAX_PEERS 8
+#define SWARM_PEER_RETRIES 2
+// Доля скорости лучшего пира, ниже которой пир считается медленным.
+#define SWARM_SLOW_PEER_RATIO 0.25
+// Вес нового замера в скользящем среднем скорости пира.
+#define SWARM_RATE_SMOOTHING 0.3
+#define COMPRESSION_SAMPLE_SIZE (128 * 1024)
+#define INCOMPRESSIBLE_RATIO 0.9
+#define WEAK_COMPRESSION_RATIO 0.5
+#define FAST_LINK_MBPS 1000
+// Файлы от этого размера сжимаются в несколько потоков.
+#define PARALLEL_COMPRESSION_MIN_SIZE (4 * 1024 * 1024)
+// Скорость сжатия deflate на одном ядре в Мбит/с, по ней число потоков
+// подбирается под канал клиента.
+#define COMPRESSION_CORE_MBPS 200
+#define COMPRESSION_THREAD_COUNT 0  // 0 - по числу ядер
+// Потоков сжатия, если клиент не сообщил скорость канала.
+#define UNKNOWN_LINK_COMPRESSION_THREADS 2
+#define LINK_SPEED_SAMPLE_SIZE (1024 * 1024)
+#define MAPPED_WINDOW_SIZE (64 * 1024 * 1024)
+#define RESUME_CHECKPOINT_SIZE (4 * 1024 * 1024)
+#define CONNECTION_POOL_MAX_IDLE 8  // на один пир
+// Запросов без ответа в одном соединении get_files. Все они должны
+// помещаться в буферы сокетов, иначе клиент, пишущий запросы, и сервер,
+// пишущий ответы, заблокируют друг друга.
+#define PIPELINE_DEPTH 64
+#define CONNECTION_POOL_IDLE_TIMEOUT std::chrono::seconds(30)
+// Тело запроса несёт сигнатуры для дельта-передачи.
+#define MAX_REQUEST_BODY_SIZE (64 * 1024 * 1024)
+#define ARTIFACT_CACHE_DIR "dec-rep-cache"
+#define ARTIFACT_CACHE_DISK_LIMIT (1024ULL * 1024 * 1024)
+#define ARTIFACT_CACHE_MEMORY_LIMIT (64 * 1024 * 1024)
+#define ARTIFACT_MEMORY_ENTRY_LIMIT (8 * 1024 * 1024)
+#define ARTIFACT_WAIT_INTERVAL std::chrono::milliseconds(20)
+#define HASH_INDEX_FILE "hash_index.journal"
+#define HASH_INDEX_RACY_WINDOW std::chrono::seconds(2)
+#define JOURNAL_FILE_SUFFIX ".journal"
 
 namespace beast = boost::beast;
 namespace http = beast::http;
@@ -26,30 +101,77 @@ namespace ssl = net::ssl;
 using tcp = net::ip::tcp;
 
 namespace transport_service {
-struct Server_Logger {
+using Tls_Stream = beast::ssl_stream<beast::tcp_stream>;
+// Непрерывный диапазон байт файла.
+struct Byte_Range {
+    std::uint64_t offset;
+    std::uint64_t length;
+};
+
+// Разбор заголовка Range вида "bytes=a-b", "bytes=a-" или "bytes=-n"
+// (поддерживается один диапазон). nullopt, если диапазон не выполним.
+std::optional<Byte_Range> parse_byte_range(
+    std::string_view value,
+    std::uint64_t file_size
+);
+
+// Уже сжатый формат (архивы, изображения, аудио и видео) по расширению
+// имени файла или по сигнатуре в первых байтах head.
+bool is_compressed_format(std::string_view file_name, std::string_view head);
+
+// Уровень сжатия для конкретного файла, не выше max_level.
+// 0 - уже сжатые форматы и данные, которые на пробе уровнем Z_BEST_SPEED
+// сжимаются хуже INCOMPRESSIBLE_RATIO; Z_BEST_SPEED - слабо сжимаемые
+// данные и быстрые каналы; иначе max_level. link_speed_mbps - скорость
+// канала клиента в Мбит/с, 0 если неизвестна.
+int choose_compression_level(
+    const std::string &file_path,
+    int max_level,
+    std::uint64_t link_speed_mbps
+);
+
+// Число потоков сжатия файла размером file_size, не больше max_threads:
+// 1 для файлов меньше PARALLEL_COMPRESSION_MIN_SIZE, иначе столько ядер,
+// сколько нужно, чтобы сжатие успевало за каналом. Если скорость канала
+// неизвестна, UNKNOWN_LINK_COMPRESSION_THREADS: один ответ не должен
+// занимать все ядра сервера.
+unsigned choose_compression_threads(
+    std::uint64_t file_size,
+    std::uint64_t link_speed_mbps,
+    unsigned max_threads
+);
+
+// Журнал докачки: лежит рядом с частично скачанным файлом и хранит
+// ETag и размер файла на сервере и диапазоны, уже сброшенные на диск.
+// Формат: первая строка "etag size", далее по строке "offset length".
+class Transfer_Journal {
 private:
-    const std::string log_file_name;
-    mutable std::ofstream log_file;
-    mutable bool is_open = true;
+    const std::string journal_path;
+    std::string etag;
+    std::uint64_t size = 0;
+    std::vector<Byte_Range> verified;  // отсортированы и не пересекаются
+    mutable std::mutex mutex;
+
+    void merge();
 
 public:
-    explicit Server_Logger(std::string m_log_file_name = DEFAULT_LOG_FILE)
-        : log_file_name(std::move(m_log_file_name)) {
-        log_file.open(log_file_name.c_str());
-        if (!log_file) {
-            is_open = false;
-            std::cerr << "Could not open log file" << std::endl;
-        }
-    }
+    explicit Transfer_Journal(std::string m_journal_path);
 
-    void log(const std::string &message) const {
-        if (log_file.is_open()) {
-            log_file << message << std::endl;
-        } else if (is_open) {
-            std::cerr << "Could not open log file" << std::endl;
-            is_open = false;
-        }
-    }
+    // false, если журнала нет или он повреждён.
+    bool load();
+    // Начинает журнал заново для новой версии файла.
+    void reset(const std::string &m_etag, std::uint64_t m_size);
+    void add(const Byte_Range &range);
+
+    // Недостающие диапазоны, нарезанные на куски не больше piece_size.
+    [[nodiscard]] std::vector<Byte_Range> missing(std::uint64_t piece_size
+    ) const;
+    [[nodiscard]] std::uint64_t verified_prefix() const;
+    [[nodiscard]] bool is_complete() const;
+    [[nodiscard]] const std::string &get_etag() const;
+    [[nodiscard]] std::uint64_t get_size() const;
+
+    void remove() const;
 };
 
 struct Certificate_Singleton {
@@ -67,8 +189,24 @@ private:
         server_context.use_certificate_chain_file("server.crt");
         server_context.use_private_key_file("server.key", ssl::context::pem);
         server_context.use_tmp_dh_file("dhparams.pem");
+        // Клиент сам хранит сессии по адресу сервера (save_session),
+        // а сервер выдаёт для них session tickets.
+        SSL_CTX_set_session_cache_mode(
+            client_context.native_handle(),
+            SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE
+        );
+        SSL_CTX_sess_set_new_cb(client_context.native_handle(), save_session);
     }
 
+    using Session_Ptr = std::unique_ptr<SSL_SESSION, decltype(&SSL_SESSION_free)>;
+
+    // Последняя сессия с каждым сервером: новое соединение с ним
+    // возобновляет её без полного рукопожатия.
+    std::mutex session_mutex;
+    std::unordered_map<std::string, Session_Ptr> client_sessions;
+
+    static int save_session(SSL *ssl, SSL_SESSION *session);
+
 public:
     Certificate_Singleton(const Certificate_Singleton &) = delete;
     Certificate_Singleton &operator=(const Certificate_Singleton &) = delete;
@@ -85,6 +223,236 @@ public:
     [[nodiscard]] ssl::context &get_client_context() {
         return client_context;
     }
+
+    // Сессия для возобновления соединения с address, nullptr - нет.
+    [[nodiscard]] Session_Ptr find_session(const std::string &address);
+    void forget_sessions();
+};
+
+// Пул keep-alive TLS-соединений клиента к пирам. Соединение берётся на
+// один запрос и возвращается в пул release(), если ответ прочитан
+// целиком; иначе Lease закрывает его. Соединения, простоявшие дольше
+// CONNECTION_POOL_IDLE_TIMEOUT или закрытые сервером, при выдаче
+// отбрасываются.
+class Connection_Pool {
+private:
+    struct Idle_Connection {
+        std::unique_ptr<Tls_Stream> stream;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    // Соединения используются только синхронно, поэтому io_context
+    // не запускается и должен пережить их.
+    net::io_context ioc;
+    std::mutex mutex;
+    std::unordered_map<std::string, std::vector<Idle_Connection>> idle;
+
+    void put(const std::string &address, std::unique_ptr<Tls_Stream> stream);
+
+public:
+    class Lease {
+    private:
+        Connection_Pool *pool;
+        std::string address;
+        std::unique_ptr<Tls_Stream> stream;
+        bool reused;
+
+    public:
+        Lease(
+            Connection_Pool &m_pool,
+            std::string m_address,
+            std::unique_ptr<Tls_Stream> m_stream,
+            bool m_reused
+        );
+        Lease(Lease &&) noexcept = default;
+        Lease &operator=(Lease &&) = delete;
+        ~Lease();
+
+        [[nodiscard]] Tls_Stream &get_stream() const;
+        // true, если соединение уже обслуживало запросы: сервер мог
+        // закрыть его, не дождавшись нового запроса.
+        [[nodiscard]] bool is_reused() const;
+        // Ответ прочитан целиком, соединение годится для следующего запроса.
+        void release();
+    };
+
+    Connection_Pool() = default;
+    Connection_Pool(const Connection_Pool &) = delete;
+    Connection_Pool &operator=(const Connection_Pool &) = delete;
+
+    static Connection_Pool &get_instance();
+
+    Lease acquire(const std::string &address);
+    // Закрывает все простаивающие соединения.
+    void clear();
+};
+
+// Отпечаток файла: пока он не изменился, не изменилось и содержимое.
+struct File_Fingerprint {
+    std::uint64_t size = 0;
+    std::int64_t mtime_ns = 0;
+    std::uint64_t inode = 0;
+
+    bool operator==(const File_Fingerprint &) const = default;
+};
+
+// nullopt, если файла нет.
+std::optional<File_Fingerprint> file_fingerprint(const std::string &path);
+
+// Индекс SHA-1 файлов по (путь, размер, mtime, inode): ETag берётся
+// из индекса, а хеш пересчитывается только после изменения файла.
+// Индекс хранится в журнале со строками "inode size mtime hash path"
+// и "- path" для удалённых записей; при загрузке журнал сжимается.
+class Hash_Index {
+private:
+    struct Entry {
+        File_Fingerprint fingerprint;
+        std::string hash;
+    };
+
+    const std::string index_path;
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    std::ofstream journal;
+
+    void load();
+    void store(const std::string &key, const Entry &entry);
+
+public:
+    explicit Hash_Index(std::string m_index_path);
+
+    Hash_Index(const Hash_Index &) = delete;
+    Hash_Index &operator=(const Hash_Index &) = delete;
+
+    static Hash_Index &get_instance();
+
+    // SHA-1 файла в hex, пустая строка, если файла нет.
+    std::string hash(const std::string &path);
+    // Запоминает уже известный хеш, например только что скачанного
+    // и проверенного файла.
+    void record(const std::string &path, const std::string &hash);
+    // Вызывается наблюдателем за файлами при изменении, удалении
+    // и переносе файла.
+    void invalidate(const std::string &path);
+};
+
+// Сжатый артефакт на диске; файл удаляется вместе с последней ссылкой,
+// поэтому вытеснение не мешает сессиям, которые его ещё отдают.
+struct Artifact_File {
+    std::string path;
+    std::uint64_t size = 0;
+
+    ~Artifact_File();
+};
+
+struct Cached_Artifact {
+    std::shared_ptr<const Artifact_File> file;
+    // Копия в памяти, nullptr если артефакт есть только на диске.
+    std::shared_ptr<const std::string> data;
+};
+
+// Кэш сжатых представлений файлов по ключу (SHA, кодек, уровень).
+// Все артефакты лежат на диске, небольшие дополнительно держатся в памяти;
+// оба бюджета соблюдаются вытеснением по LRU.
+class Artifact_Cache {
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<const Artifact_File> file;
+        std::shared_ptr<const std::string> data;
+    };
+
+    const std::filesystem::path cache_dir;
+    const std::uint64_t disk_limit;
+    const std::uint64_t memory_limit;
+    mutable std::mutex mutex;
+    // В начале списка - последние использованные.
+    std::list<Entry> lru;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    std::unordered_set<std::string> in_progress;
+    std::uint64_t disk_usage = 0;
+    std::uint64_t memory_usage = 0;
+
+    void evict();
+    void finish_build(
+        const std::string &key,
+        std::shared_ptr<const Artifact_File> file,
+        std::shared_ptr<const std::string> data
+    );
+
+public:
+    // Строит один артефакт: данные пишутся во временный файл и попадают
+    // в кэш только после commit(). Без commit() сборка отменяется.
+    class Builder {
+    private:
+        Artifact_Cache &cache;
+        const std::string key;
+        const std::string temp_path;
+        std::ofstream out;
+        std::string memory_copy;
+        std::uint64_t size = 0;
+        bool keep_in_memory = true;
+        bool committed = false;
+
+    public:
+        Builder(Artifact_Cache &m_cache, std::string m_key);
+        ~Builder();
+
+        Builder(const Builder &) = delete;
+        Builder &operator=(const Builder &) = delete;
+
+        void write(const char *data, std::size_t size);
+        void commit();
+    };
+
+    Artifact_Cache(
+        std::filesystem::path m_cache_dir,
+        std::uint64_t m_disk_limit,
+        std::uint64_t m_memory_limit
+    );
+    ~Artifact_Cache();
+
+    Artifact_Cache(const Artifact_Cache &) = delete;
+    Artifact_Cache &operator=(const Artifact_Cache &) = delete;
+
+    static std::string make_key(
+        const std::string &hash,
+        const std::string &encoding,
+        int compression_level
+    );
+
+    std::optional<Cached_Artifact> find(const std::string &key);
+    // Сборщик артефакта, если его ещё никто не строит и данные размером
+    // около expected_size помещаются в кэш; иначе nullptr.
+    std::unique_ptr<Builder> try_build(
+        const std::string &key,
+        std::uint64_t expected_size
+    );
+    [[nodiscard]] bool is_building(const std::string &key) const;
+    [[nodiscard]] std::uint64_t get_disk_usage() const;
+    [[nodiscard]] std::uint64_t get_memory_usage() const;
+};
+
+// Ограничивает число одновременных сессий: приём новых соединений
+// приостанавливается, пока одна из сессий не завершится.
+class Session_Limiter {
+private:
+    net::strand<net::io_context::executor_type> strand;
+    net::steady_timer released;
+    const std::size_t limit;
+    std::size_t active = 0;
+
+public:
+    Session_Limiter(net::io_context &ioc, std::size_t m_limit);
+
+    [[nodiscard]] net::strand<net::io_context::executor_type> get_executor(
+    ) const {
+        return strand;
+    }
+
+    // Вызывается только из корутины, запущенной на get_executor().
+    net::awaitable<void> acquire();
+    void release();
 };
 
 // Сервер предназначен для обработки HTTP-запросов на отправку файлов.
@@ -92,16 +460,27 @@ public:
 // для получения мета-информации по файлам в репозитории (время создания
 // определенного файла и структура репозитория) и GET-запросы для получения
 // содержимого файла.
+// Соединения принимаются и обслуживаются корутинами на пуле из
+// thread_count потоков, одновременно живёт не больше max_sessions сессий.
 struct Server {
 private:
     const int thread_count;
     const int port;
-    int compression_level = DEFAULT_COMPRESSION_LEVEL;
+    const std::size_t max_sessions;
+    std::atomic<int> compression_level = DEFAULT_COMPRESSION_LEVEL;
+    std::atomic<unsigned> compression_threads = COMPRESSION_THREAD_COUNT;
+    std::atomic<bool> memory_mapped = false;
     const std::string dec_rep_path;
-    const Server_Logger logger;
+    Server_Logger logger;
+    mutable Artifact_Cache artifact_cache;
+    mutable net::thread_pool blocking_pool{BLOCKING_THREAD_COUNT};
+    mutable net::io_context ioc;
     std::thread server_thread;
 
 public:
+    // Запросы, которые выполняются в пуле блокирующих задач: POST,
+    // дерево Меркла файла (X-Transfer-Mode: merkle) и запросы
+    // к отсутствующим файлам.
     [[nodiscard]] http::response<http::string_body> handle_response(
         const http::request<http::string_body> &req,
         const std::string &client_address
@@ -111,12 +490,27 @@ public:
         const int m_port = SERVER_PORT,
         const int m_thread_count = THREAD_COUNT,
         std::string m_dec_rep_path = DEC_REP_PATH,
-        const std::string &m_log_file = DEFAULT_LOG_FILE
+        const std::string &m_log_file = DEFAULT_LOG_FILE,
+        const std::size_t m_max_sessions = MAX_SESSIONS
     )
-        : thread_count(m_thread_count),
+        : thread_count(
+              m_thread_count > 0
+                  ? m_thread_count
+                  : static_cast<int>(
+                        std::max(1U, std::thread::hardware_concurrency())
+                    )
+          ),
           port(m_port),
+          max_sessions(m_max_sessions),
           dec_rep_path(std::move(m_dec_rep_path)),
-          logger(m_log_file) {
+          logger(m_log_file),
+          artifact_cache(
+              std::filesystem::temp_directory_path() /
+                  (ARTIFACT_CACHE_DIR "-" + std::to_string(port)),
+              ARTIFACT_CACHE_DISK_LIMIT,
+              ARTIFACT_CACHE_MEMORY_LIMIT
+          ),
+          ioc(thread_count) {
         // Сертификаты для сервера находятся в корневом репозитории.
         try {
             Certificate_Singleton::get_instance();
@@ -126,9 +520,15 @@ public:
             throw std::runtime_error("Fail to load certificate");
         }
         server_thread = std::thread(&Server::run, this);
-        server_thread.detach();
     }
 
+    Server(const Server &) = delete;
+    Server &operator=(const Server &) = delete;
+
+    ~Server();
+
+    // Верхняя граница уровня сжатия; уровень для каждого файла выбирает
+    // choose_compression_level.
     void set_compression_level(int level) {
         // 0 - без сжатия, 1 - максимальная скорость, 9 - максимальное сжатие
         if (Z_BEST_SPEED - 1 > level || level > Z_BEST_COMPRESSION) {
@@ -137,23 +537,137 @@ public:
         compression_level = level;
     }
 
+    // Верхняя граница числа потоков сжатия одного крупного файла,
+    // 0 - по числу ядер.
+    void set_compression_threads(unsigned threads) {
+        compression_threads = threads;
+    }
+
+    // Несжатые ответы и диапазоны отдаются из окон файла, отображённых
+    // в память, а не через pread. По умолчанию выключено: файл,
+    // усечённый посреди окна, роняет процесс по SIGBUS.
+    void set_memory_mapped(bool enabled) {
+        memory_mapped = enabled;
+    }
+
+    // Уровень журнала и прореживание подробностей запросов: из записей
+    // уровня request в журнал попадает каждая every_n-я.
+    void set_log_level(Log_Level level) {
+        logger.set_level(level);
+    }
+
+    void set_log_sample_rate(unsigned every_n) {
+        logger.set_sample_rate(every_n);
+    }
+
     [[nodiscard]] int get_port() const {
         return port;
     }
 
+    [[nodiscard]] int get_thread_count() const {
+        return thread_count;
+    }
+
 private:
     void run() const;
-    void do_session(tcp::socket &socket) const;
+    net::awaitable<void> do_listen(
+        tcp::acceptor &acceptor,
+        Session_Limiter &limiter
+    ) const;
+    net::awaitable<void> do_session(tcp::socket socket) const;
+    // Выполняет f в blocking_pool: сессия ждёт результат, не занимая
+    // сетевой поток сжатием, хешированием или чтением файла.
+    template <typename F>
+    net::awaitable<std::invoke_result_t<F &>> run_blocking(F f) const {
+        co_return co_await net::co_spawn(
+            blocking_pool,
+            [&f]() -> net::awaitable<std::invoke_result_t<F &>> {
+                co_return f();
+            },
+            net::use_awaitable
+        );
+    }
+    // Отправляет файл блоками: без сжатия - заголовок с Content-Length и
+    // байты через send_file_range (чтение с опережением или mmap), со
+    // сжатием - chunked-ответом. Ни в одном из случаев файл целиком не
+    // читается в память. Также обслуживает HEAD и запросы с заголовком Range.
+    net::awaitable<void> write_file_response(
+        Tls_Stream &stream,
+        const http::request<http::string_body> &req,
+        const std::string &file_path
+    ) const;
+    // Отправляет дельту файла относительно сигнатур из тела запроса
+    // (X-Transfer-Mode: delta): клиенту уходят только изменившиеся байты
+    // и ссылки на блоки его устаревшей копии.
+    net::awaitable<void> write_delta_response(
+        Tls_Stream &stream,
+        const http::request<http::string_body> &req,
+        const std::string &file_path,
+        const Delta_Signatures &signatures
+    ) const;
+    // Отправляет манифест чанков файла (X-Transfer-Mode: chunks): клиент
+    // докачивает Range-запросами только чанки, которых у него нет.
+    net::awaitable<void> write_manifest_response(
+        Tls_Stream &stream,
+        const http::request<http::string_body> &req,
+        const std::string &file_path
+    ) const;
+    // Отправляет каталог целиком одним архивом (X-Transfer-Mode: archive).
+    // Все файлы проходят через один кодер, поэтому сжатие использует
+    // повторы между файлами, а отдельные запрос и ответ на каждый файл
+    // не нужны.
+    net::awaitable<void> write_archive_response(
+        Tls_Stream &stream,
+        const http::request<http::string_body> &req,
+        const std::string &dir_path
+    ) const;
 };
 
 // Функция для получения файла с сервера по указанному адресу и имени файла.
+// Файл качается в file_name + PART_FILE_SUFFIX и переименовывается после
+// проверки хеша. Если передача оборвалась, следующий вызов докачивает
+// недостающее по журналу (Range + If-Range). Если у клиента уже есть
+// устаревшая копия, запрашивается только дельта относительно неё, иначе
+// файл собирается из чанков, уже лежащих в других локальных файлах
+// (Chunk_Store). allow_delta = false всегда качает файл целиком.
 void get_file(
     const std::string &server_address,
     const std::string &file_name,
     const std::string &file_path,
+    unsigned long local_clock,
+    bool allow_delta = true
+);
+
+// Скачивание множества файлов с одного сервера по одному соединению:
+// запросы отправляются конвейером (HTTP pipelining) на PIPELINE_DEPTH
+// вперёд, поэтому каждый файл стоит не ожидания ответа сервера, а только
+// передачи своих байт. Файлы, ответ на которые не прошёл проверку, и
+// оставшиеся после обрыва соединения качаются заново через get_file.
+void get_files(
+    const std::string &server_address,
+    const std::vector<std::string> &file_names,
+    const std::string &file_path,
+    unsigned long local_clock
+);
+
+// Скачивание каталога folder_name целиком одним архивом в
+// folder_path + folder_name. Архив распаковывается по мере получения,
+// каждый файл сверяется со своим SHA-1 и попадает на место только после
+// проверки. Возвращает false, если сервер не отдал архив или поток
+// оборвался; уже распакованные файлы при этом остаются.
+bool get_folder(
+    const std::string &server_address,
+    const std::string &folder_name,
+    const std::string &folder_path,
     unsigned long local_clock
 );
 
+// Скачивание большого файла: файл делится на куски дерева Меркла
+// (или по LARGE_FILE_RANGE_SIZE, если сервер не отдаёт дерево), которые
+// параллельно забираются Range-запросами по LARGE_FILE_CONNECTIONS
+// TLS-соединениям. Кусок пишется через pwrite только после проверки по
+// своему листу, испорченный качается заново. Готовые куски отмечаются
+// в журнале, поэтому повторный вызов после сбоя качает только недостающие.
 void get_large_file(
     const std::string &server_address,
     const std::string &file_name,
@@ -161,6 +675,80 @@ void get_large_file(
     unsigned long local_clock
 );
 
+// Распределяет куски файла между пирами роя. Свободный кусок достаётся
+// первому освободившемуся соединению, поэтому быстрые пиры сами берут
+// больше кусков. Пиру, который медленнее лучшего в 1 / SWARM_SLOW_PEER_RATIO
+// раз, не отдаются последние куски, пока кто-то ещё качает, а когда
+// свободных не осталось, быстрые соединения дублируют куски, застрявшие
+// у более медленных (endgame).
+class Swarm_Scheduler {
+private:
+    struct Piece {
+        Byte_Range range;
+        bool done = false;
+        unsigned in_flight = 0;
+        // Пир, который взял кусок последним.
+        std::size_t peer = 0;
+        std::chrono::steady_clock::time_point started;
+    };
+
+    struct Peer {
+        // Сглаженная скорость в байт/с, 0 - ещё не измерена.
+        double rate = 0;
+        unsigned failures = 0;
+        bool dropped = false;
+    };
+
+    mutable std::mutex mutex;
+    // Будит wait_acquire, когда кусок готов, освобождён или отклонён.
+    std::condition_variable changed;
+    std::vector<Piece> pieces;
+    std::deque<std::size_t> pending;
+    std::vector<Peer> peers;
+    std::size_t done_count = 0;
+    // Сколько кусков сейчас качается, с учётом дубликатов endgame.
+    std::size_t in_flight_count = 0;
+
+    [[nodiscard]] bool is_slow(std::size_t peer) const;
+    // acquire под уже захваченным mutex.
+    std::optional<std::size_t> take(std::size_t peer);
+
+public:
+    Swarm_Scheduler(const std::vector<Byte_Range> &ranges, std::size_t peer_count);
+
+    // Следующий кусок для пира, nullopt - сейчас пиру нечего качать.
+    std::optional<std::size_t> acquire(std::size_t peer);
+    // Как acquire, но пока куски качают другие соединения, ждёт: кусок
+    // может вернуться в очередь или дойти до endgame. nullopt - файл
+    // скачан, пир отключён или ждать больше нечего.
+    std::optional<std::size_t> wait_acquire(std::size_t peer);
+    // true, если кусок готов впервые и его нужно отметить в журнале.
+    bool complete(std::size_t piece, std::size_t peer);
+    // Кусок прерван: уже скачан другим пиром или пир отказал. После
+    // SWARM_PEER_RETRIES отказов пир больше не получает кусков.
+    void release(std::size_t piece, std::size_t peer, bool failed);
+    // Кусок не сошёлся с деревом Меркла: он снова ставится в очередь,
+    // а пир, приславший испорченные данные, больше не получает кусков.
+    void reject(std::size_t piece, std::size_t peer);
+    [[nodiscard]] Byte_Range get_range(std::size_t piece) const;
+    [[nodiscard]] bool is_done(std::size_t piece) const;
+    [[nodiscard]] bool is_finished() const;
+};
+
+// Скачивание файла сразу у нескольких пиров. Пиры опрашиваются HEAD-запросом,
+// источниками становятся все, у кого та же версия файла (ETag), что и
+// у большинства. Куски по SWARM_PIECE_SIZE качаются параллельно по
+// SWARM_CONNECTIONS_PER_PEER соединениям к каждому источнику: быстрые пиры
+// забирают больше кусков, а хвост, застрявший у медленных, дублируется
+// быстрыми. Как и get_large_file, проверяет куски по дереву Меркла
+// и после сбоя докачивает по журналу.
+void get_file_from_peers(
+    const std::vector<std::string> &peer_addresses,
+    const std::string &file_name,
+    const std::string &file_path,
+    unsigned long local_clock
+);
+
 // Функция для отправки файла на сервера по указанному адресу и имени файла.
 void send_file(
     const std::string &server_address,
@@ -169,11 +757,11 @@ void send_file(
     unsigned long local_clock
 );
 
+// Просит сервер забрать у нас большой файл через get_large_file.
 void send_large_file(
     const std::string &server_address,
     const std::string &file_name,
     const std::string &file_path,
-
     unsigned long local_clock
 );
 
@@ -181,11 +769,18 @@ inline unsigned long long get_local_time(const std::string &file_name) {
     return 0;  // TODO Надо походить в БД ручками.
 }
 
-// Вычисление хеша для валидации файлов.
+// ETag файла (SHA-1, см. sha1_to_etag) для ответов и проверки загрузок.
 std::string sha1_hash_file(const std::string &filename);
-// Функция для сжатия данных с использованием deflate в zlib.
-std::string deflate_compress(const std::string &data, int compression_level);
+// Функция для сжатия данных с использованием deflate в zlib. При
+// threads > 1 крупные данные сжимаются параллельно блоками, результат
+// читается той же deflate_decompress.
+std::string deflate_compress(
+    const std::string &data,
+    int compression_level,
+    unsigned threads = 1
+);
 // Функция для распаковки данных с использованием deflate в zlib.
+// Бросает std::runtime_error на повреждённом или обрезанном потоке.
 std::string deflate_decompress(const std::string &data);
 }  // namespace transport_service
 
@@ -0,0 +1,86 @@
+#ifndef TRANSPORT_SHAPER_HPP
+#define TRANSPORT_SHAPER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Файлы меньше этого размера идут классом small_file, остальные - bulk.
+#define SHAPER_SMALL_FILE_SIZE (1024 * 1024)
+// Ёмкость ведра - столько секунд трафика на полной скорости,
+// но не меньше SHAPER_MIN_BURST.
+#define SHAPER_BURST_INTERVAL std::chrono::milliseconds(100)
+#define SHAPER_MIN_BURST (256 * 1024)
+// Доля ведра, которую bulk не трогает: она остаётся мелким файлам.
+#define SHAPER_BULK_RESERVE 0.5
+
+namespace transport_service {
+// Классы трафика в порядке убывания приоритета.
+enum class Traffic_Class { metadata, small_file, bulk };
+
+enum class Traffic_Direction { upload, download };
+
+// Класс передачи файла по его размеру.
+Traffic_Class traffic_class_for_size(std::uint64_t size);
+
+// Ограничение полосы ведром токенов на узел и на каждого пира. Байты
+// списываются из обоих вёдер сразу, и долг (отрицательный остаток)
+// задерживает следующие порции. Приоритет задаётся уровнем, до которого
+// класс может опустошить ведро: metadata не ждёт никогда, small_file
+// ждёт, пока ведро не выйдет из долга, а bulk оставляет нетронутой долю
+// SHAPER_BULK_RESERVE. Поэтому мелкий файл во время крупной передачи
+// ждёт не дольше одной bulk-порции, а не всей очереди.
+class Bandwidth_Shaper {
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    struct Bucket {
+        double tokens = 0;
+        Clock::time_point updated;
+        bool is_started = false;
+
+        void refill(double rate, double burst, Clock::time_point now);
+    };
+
+    mutable std::mutex mutex;
+    // Пишутся только под mutex; атомарны, чтобы is_limited обходился
+    // без блокировки. Согласованную пару читает reserve под mutex.
+    std::atomic<std::uint64_t> node_rate = 0;
+    std::atomic<std::uint64_t> peer_rate = 0;
+    Bucket node;
+    std::unordered_map<std::string, Bucket> peers;
+
+public:
+    Bandwidth_Shaper() = default;
+
+    Bandwidth_Shaper(const Bandwidth_Shaper &) = delete;
+    Bandwidth_Shaper &operator=(const Bandwidth_Shaper &) = delete;
+
+    // Отдельные ограничители для исходящего и входящего трафика.
+    static Bandwidth_Shaper &get_instance(Traffic_Direction direction);
+
+    // Лимиты в байтах в секунду, 0 - без ограничения. Лимит пира
+    // действует на каждого пира по отдельности.
+    void set_limits(std::uint64_t node_bytes_per_second, std::uint64_t peer_bytes_per_second);
+    [[nodiscard]] bool is_limited() const;
+
+    // Списывает bytes, если класс может отправить их сейчас, и возвращает
+    // ноль; иначе ничего не списывает и возвращает время до следующей
+    // попытки.
+    Clock::duration reserve(
+        const std::string &peer,
+        Traffic_Class traffic_class,
+        std::size_t bytes,
+        Clock::time_point now = Clock::now()
+    );
+    // Блокирует поток, пока reserve не пропустит bytes.
+    void wait(const std::string &peer, Traffic_Class traffic_class, std::size_t bytes);
+};
+}  // namespace transport_service
+
+#endif  // TRANSPORT_SHAPER_HPP
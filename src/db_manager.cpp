@@ -2,6 +2,34 @@
 
 namespace fs = std::filesystem;
 
+namespace {
+// Имена подготовленных запросов, SQL у каждого в prepare_statements()
+constexpr const char *USER_ID = "user_id";
+constexpr const char *INSERT_USER = "insert_user";
+constexpr const char *INSERT_USER_NOW = "insert_user_now";
+constexpr const char *SET_MY_USERNAME = "set_my_username";
+constexpr const char *DELETE_USER = "delete_user";
+constexpr const char *DELETE_USER_OWNERSHIP = "delete_user_ownership";
+constexpr const char *FILE_ID = "file_id";
+constexpr const char *FOLDER_FILE_IDS = "folder_file_ids";
+constexpr const char *INSERT_FILE = "insert_file";
+constexpr const char *INSERT_FILE_ROW = "insert_file_row";
+constexpr const char *RENAME_FILE = "rename_file";
+constexpr const char *RENAME_FOLDER = "rename_folder";
+constexpr const char *CHANGE_PATH = "change_path";
+constexpr const char *TOUCH_FILE = "touch_file";
+constexpr const char *DELETE_FILE = "delete_file";
+constexpr const char *DELETE_FILE_RETURNING = "delete_file_returning";
+constexpr const char *DELETE_FOLDER_FILES = "delete_folder_files";
+constexpr const char *OWNED_FILE_ID = "owned_file_id";
+constexpr const char *COUNT_OWNERS = "count_owners";
+constexpr const char *INSERT_OWNER = "insert_owner";
+constexpr const char *DELETE_OWNER = "delete_owner";
+constexpr const char *DELETE_OTHER_OWNERS = "delete_other_owners";
+constexpr const char *DELETE_FILE_OWNERS = "delete_file_owners";
+constexpr const char *UPDATE_LOCAL_PATH = "update_local_path";
+} // namespace
+
 namespace DBManager {
 
 Manager::Manager(const std::string &connection_data)
@@ -9,7 +37,108 @@ Manager::Manager(const std::string &connection_data)
 {
     if (!C.is_open()) {
         std::cerr << "Error opening database connection" << std::endl;
+        return;
     }
+    prepare_statements();
+}
+
+// Запросы разбираются и планируются сервером один раз на соединение,
+// дальше методы передают только параметры
+void Manager::prepare_statements()
+{
+    C.prepare(USER_ID, "SELECT id FROM Users WHERE username = $1");
+    C.prepare(
+        INSERT_USER,
+        "INSERT INTO Users (username, first_connection_time) "
+        "VALUES ($1, $2)"
+    );
+    C.prepare(
+        INSERT_USER_NOW,
+        "INSERT INTO Users(username, first_connection_time) "
+        "VALUES($1, NOW()) "
+    );
+    C.prepare(
+        SET_MY_USERNAME,
+        "INSERT INTO MyUsername(username) VALUES($1) "
+        "ON CONFLICT(username) DO UPDATE "
+        "  SET username = EXCLUDED.username"
+    );
+    C.prepare(DELETE_USER, "DELETE FROM Users WHERE id = $1");
+    C.prepare(
+        DELETE_USER_OWNERSHIP,
+        "DELETE FROM FileOwners USING Files WHERE FileOwners.owner_id = $1 AND FileOwners.file_id = Files.id RETURNING FileOwners.file_id, Files.DecRep_path"
+    );
+
+    C.prepare(
+        FILE_ID,
+        "SELECT id FROM Files WHERE file_name = $1 AND DecRep_path = $2"
+    );
+    C.prepare(FOLDER_FILE_IDS, "SELECT id FROM Files WHERE DecRep_path = $1");
+    C.prepare(
+        INSERT_FILE,
+        "INSERT INTO Files (file_name, file_size, "
+        "addition_time, last_modified, DecRep_path, author_id) "
+        "VALUES ($1, $2, NOW(), NOW(), $3, $4) RETURNING id"
+    );
+    C.prepare(
+        INSERT_FILE_ROW,
+        "INSERT INTO Files (file_name, file_size, addition_time, last_modified, DecRep_path, author_id) "
+        "VALUES ($1, $2, $3, $4, $5, $6)"
+    );
+    C.prepare(
+        RENAME_FILE,
+        "UPDATE Files SET file_name = $1 "
+        "WHERE DecRep_path = $2 AND file_name = $3"
+    );
+    C.prepare(
+        RENAME_FOLDER,
+        "UPDATE Files SET DecRep_path = $1 "
+        "WHERE DecRep_path = $2"
+    );
+    C.prepare(
+        CHANGE_PATH,
+        "UPDATE Files SET DecRep_path = $1 "
+        "WHERE file_name = $2 AND DecRep_path = $3"
+    );
+    C.prepare(
+        TOUCH_FILE,
+        "UPDATE Files SET file_size = $1, last_modified = NOW() WHERE id = $2"
+    );
+    C.prepare(DELETE_FILE, "DELETE FROM Files WHERE id = $1");
+    C.prepare(
+        DELETE_FILE_RETURNING,
+        "DELETE FROM Files "
+        "WHERE id = $1 "
+        "RETURNING DecRep_path, file_name"
+    );
+    C.prepare(DELETE_FOLDER_FILES, "DELETE FROM Files WHERE DecRep_path = $1");
+
+    C.prepare(
+        OWNED_FILE_ID,
+        "SELECT file_id FROM FileOwners WHERE local_path = $1 AND owner_id = $2"
+    );
+    C.prepare(
+        COUNT_OWNERS,
+        "SELECT COUNT(*) AS remain FROM FileOwners WHERE file_id = $1"
+    );
+    C.prepare(
+        INSERT_OWNER,
+        "INSERT INTO FileOwners (owner_id, file_id, local_path) "
+        "VALUES ($1, $2, $3)"
+    );
+    C.prepare(
+        DELETE_OWNER,
+        "DELETE FROM FileOwners WHERE file_id = $1 AND owner_id = $2"
+    );
+    C.prepare(
+        DELETE_OTHER_OWNERS,
+        "DELETE FROM FileOwners WHERE file_id = $1 AND owner_id <> $2"
+    );
+    C.prepare(DELETE_FILE_OWNERS, "DELETE FROM FileOwners WHERE file_id = $1");
+    C.prepare(
+        UPDATE_LOCAL_PATH,
+        "UPDATE FileOwners SET local_path = $1 WHERE local_path = $2 AND owner_id = $3"
+    );
 }
 
 Manager::~Manager()
@@ -24,10 +153,7 @@ int Manager::get_user_id(
     const std::string &username
 )
 {
-    const pqxx::result user_id = w.exec_params(
-        "SELECT id FROM Users WHERE username = $1",
-        username
-    );
+    const pqxx::result user_id = w.exec_prepared(USER_ID, username);
     if (!user_id.empty()) {
         return user_id[0]["id"].as<int>();
     } else {
@@ -42,29 +168,17 @@ void Manager::add_user(
 {
     pqxx::work w(C);
 
-    const pqxx::result res = w.exec_params(
-        "SELECT 1 FROM Users WHERE username = $1",
-        username
-    );
+    const pqxx::result res = w.exec_prepared(USER_ID, username);
 
     if (!res.empty()) {
         std::cout << "Username already exists, please choose another\n";
         return;
     }
 
-    w.exec_params(
-        "INSERT INTO Users(username, first_connection_time) "
-        "VALUES($1, NOW()) ",
-        username
-    );
+    w.exec_prepared(INSERT_USER_NOW, username);
 
     if (isLocal) {
-        w.exec_params(
-            "INSERT INTO MyUsername(username) VALUES($1) "
-            "ON CONFLICT(username) DO UPDATE "
-            "  SET username = EXCLUDED.username",
-            username
-        );
+        w.exec_prepared(SET_MY_USERNAME, username);
         std::cout << "Your username is " << username << "\n";
     }
 
@@ -87,26 +201,16 @@ void Manager::add_file_template(
 
         int author_id = get_user_id(w, username);
 
-        const pqxx::result res = w.exec_params(
-            "SELECT id FROM Files WHERE file_name = $1 AND DecRep_path = $2",
-            file_name, DecRep_path
-        );
+        const pqxx::result res = w.exec_prepared(FILE_ID, file_name, DecRep_path);
 
         if (res.empty()) {
-            const pqxx::result file_added = w.exec_params(
-                "INSERT INTO Files (file_name, file_size, "
-                "addition_time, last_modified, DecRep_path, author_id) "
-                "VALUES ($1, $2, NOW(), NOW(), $3, $4) RETURNING id",
-                file_name, file_size, DecRep_path, author_id
+            const pqxx::result file_added = w.exec_prepared(
+                INSERT_FILE, file_name, file_size, DecRep_path, author_id
             );
 
             int file_id = file_added[0]["id"].as<int>();
 
-            w.exec_params(
-                "INSERT INTO FileOwners (owner_id, file_id, local_path) "
-                "VALUES ($1, $2, $3)",
-                author_id, file_id, local_file_path
-            );
+            w.exec_prepared(INSERT_OWNER, author_id, file_id, local_file_path);
 
             std::cout << "File added\n";
         } else {
@@ -163,11 +267,7 @@ void Manager::rename_DecRep_file(
 )
 {
     pqxx::work w(C);
-    w.exec_params(
-        "UPDATE Files SET file_name = $1 "
-        "WHERE DecRep_path = $2 AND file_name = $3",
-        new_file_name, DecRep_path, old_file_name
-    );
+    w.exec_prepared(RENAME_FILE, new_file_name, DecRep_path, old_file_name);
     w.commit();
     std::cout << "File renamed successfully \n";
 }
@@ -178,11 +278,7 @@ void Manager::rename_DecRep_folder(
 )
 {
     pqxx::work w(C);
-    w.exec_params(
-        "UPDATE Files SET DecRep_path = $1 "
-        "WHERE DecRep_path = $2",
-        new_DecRep_path_name, old_DecRep_path_name
-    );
+    w.exec_prepared(RENAME_FOLDER, new_DecRep_path_name, old_DecRep_path_name);
     w.commit();
     std::cout << "DecRep_path renamed from '" << old_DecRep_path_name
               << "' to '" << new_DecRep_path_name << "\n";
@@ -195,11 +291,7 @@ void Manager::change_DecRep_path(
 )
 {
     pqxx::work w(C);
-    w.exec_params(
-        "UPDATE Files SET DecRep_path = $1 "
-        "WHERE file_name = $2 AND DecRep_path = $3",
-        new_DecRep_path, file_name, old_DecRep_path
-    );
+    w.exec_prepared(CHANGE_PATH, new_DecRep_path, file_name, old_DecRep_path);
     w.commit();
     std::cout << "Path changed for file '" << file_name << "'\n";
 }
@@ -214,11 +306,7 @@ std::string Manager::delete_local_file(
 
     int owner_id = get_user_id(w, username);
 
-    const pqxx::result res = w.exec_params(
-        "SELECT file_id FROM FileOwners WHERE local_path = $1 AND "
-        "owner_id = $2",
-        local_path, owner_id
-    );
+    const pqxx::result res = w.exec_prepared(OWNED_FILE_ID, local_path, owner_id);
 
     if (res.empty()) {
         std::cout << "File doesn't exist\n";
@@ -227,31 +315,18 @@ std::string Manager::delete_local_file(
 
     int file_id = res[0]["file_id"].as<int>();
 
-    w.exec_params(
-        "DELETE FROM FileOwners WHERE file_id = $1 AND owner_id = $2",
-        file_id, owner_id
-    );
+    w.exec_prepared(DELETE_OWNER, file_id, owner_id);
 
-    const pqxx::result res2 = w.exec_params(
-        "SELECT COUNT(*) AS remain FROM FileOwners WHERE file_id = $1",
-        file_id
-    );
+    const pqxx::result res2 = w.exec_prepared(COUNT_OWNERS, file_id);
 
     int owners_left = res2[0]["remain"].as<int>();
 
     if (owners_left == 0) {
-        const pqxx::result untrack_file = w.exec_params(
-            "DELETE FROM Files "
-            "WHERE id = $1 "
-            "RETURNING DecRep_path, file_name",
-            file_id
-        );
+        const pqxx::result untrack_file = w.exec_prepared(DELETE_FILE_RETURNING, file_id);
         auto file_path = untrack_file[0]["DecRep_path"].as<std::string>();
         auto file_name = untrack_file[0]["file_name"].as<std::string>();
         fs::path full_path = fs::path(file_path) / file_name;
         delete_full_path = full_path.string();
-
-        w.exec_params("DELETE FROM Files WHERE id = $1", file_id);
     }
     w.commit();
     std::cout << "File " << delete_full_path << " deleted from DecRep\n";
@@ -266,10 +341,7 @@ void Manager::untrack_file(const std::string &full_DecRep_path)
     std::string file_name = p.filename().string();
     std::string file_path = p.parent_path().string();
 
-    const pqxx::result res = w.exec_params(
-        "SELECT id FROM Files WHERE file_name = $1 AND DecRep_path = $2",
-        file_name, file_path
-    );
+    const pqxx::result res = w.exec_prepared(FILE_ID, file_name, file_path);
 
     if (res.empty()) {
         std::cout << "File doesn't exist\n";
@@ -278,8 +350,8 @@ void Manager::untrack_file(const std::string &full_DecRep_path)
 
     int file_id = res[0]["id"].as<int>();
 
-    w.exec_params("DELETE FROM FileOwners WHERE file_id = $1", file_id);
-    w.exec_params("DELETE FROM Files WHERE id = $1", file_id);
+    w.exec_prepared(DELETE_FILE_OWNERS, file_id);
+    w.exec_prepared(DELETE_FILE, file_id);
 
     w.commit();
     std::cout << "File deleted\n";
@@ -289,9 +361,7 @@ void Manager::untrack_folder(const std::string &DecRep_path)
 {
     pqxx::work w(C);
 
-    const pqxx::result res = w.exec_params(
-        "SELECT id FROM Files WHERE DecRep_path = $1", DecRep_path
-    );
+    const pqxx::result res = w.exec_prepared(FOLDER_FILE_IDS, DecRep_path);
 
     if (res.empty()) {
         return;
@@ -299,10 +369,10 @@ void Manager::untrack_folder(const std::string &DecRep_path)
 
     for (const auto &file : res) {
         int file_id = file["id"].as<int>();
-        w.exec_params("DELETE FROM FileOwners WHERE file_id = $1", file_id);
+        w.exec_prepared(DELETE_FILE_OWNERS, file_id);
     }
 
-    w.exec_params("DELETE FROM Files WHERE DecRep_path = $1", DecRep_path);
+    w.exec_prepared(DELETE_FOLDER_FILES, DecRep_path);
 
     w.commit();
     std::cout << "Folder deleted\n";
@@ -316,17 +386,11 @@ void Manager::download_file(const std::string &username, const std::string &full
     std::string file_name = p.filename().string();
     std::string file_path = p.parent_path().string();
 
-    const pqxx::result res = w.exec_params(
-        "SELECT id FROM Files WHERE file_name = $1 AND DecRep_path = $2",
-        file_name, file_path
-    );
+    const pqxx::result res = w.exec_prepared(FILE_ID, file_name, file_path);
     int file_id = res[0]["id"].as<int>();
     int user_id = get_user_id(w, username);
 
-    w.exec_params(
-        "INSERT INTO FileOwners (owner_id, file_id, local_path) VALUES ($1, $2, $3)",
-        user_id, file_id, local_path
-    );
+    w.exec_prepared(INSERT_OWNER, user_id, file_id, local_path);
     w.commit();
 }
 
@@ -340,10 +404,7 @@ void Manager::update_local_file_path(
 
     int owner_id = get_user_id(w, username);
 
-    w.exec_params(
-        "UPDATE FileOwners SET local_path = $1 WHERE local_path = $2 AND owner_id = $3",
-        new_local_path, old_local_path, owner_id
-    );
+    w.exec_prepared(UPDATE_LOCAL_PATH, new_local_path, old_local_path, owner_id);
     w.commit();
 
     std::cout << "Local path updated\n";
@@ -360,10 +421,7 @@ void Manager::update_local_folder_path(
     int owner_id = get_user_id(w, username);
 
     for (size_t i = 0; i < old_local_paths.size(); i++) {
-        w.exec_params(
-            "UPDATE FileOwners SET local_path = $1 WHERE local_path = $2 AND owner_id = $3",
-            new_local_paths[i], old_local_paths[i], owner_id
-        );
+        w.exec_prepared(UPDATE_LOCAL_PATH, new_local_paths[i], old_local_paths[i], owner_id);
     }
     w.commit();
 }
@@ -377,10 +435,7 @@ void Manager::update_file(
 
     int owner_id = get_user_id(w, username);
 
-    const pqxx::result res = w.exec_params(
-        "SELECT file_id FROM FileOwners WHERE local_path = $1 AND owner_id = $2",
-        local_path, owner_id
-    );
+    const pqxx::result res = w.exec_prepared(OWNED_FILE_ID, local_path, owner_id);
     if (res.empty()) {
         std::cout << "File doesn't exist\n";
     }
@@ -388,15 +443,9 @@ void Manager::update_file(
 
     auto new_size = fs::file_size(local_path); // в байтах
 
-    w.exec_params(
-        "UPDATE Files SET file_size = $1, last_modified = NOW() WHERE id = $2",
-        new_size, file_id
-    );
+    w.exec_prepared(TOUCH_FILE, new_size, file_id);
 
-    w.exec_params(
-        "DELETE FROM FileOwners WHERE file_id = $1 AND owner_id <> $2",
-        file_id, owner_id
-    );
+    w.exec_prepared(DELETE_OTHER_OWNERS, file_id, owner_id);
 
     w.commit();
 
@@ -412,28 +461,22 @@ std::vector<std::string> Manager::delete_user(
 
     int user_id = get_user_id(w, username);
 
-    const pqxx::result deleted_files = w.exec_params(
-        "DELETE FROM FileOwners USING Files WHERE FileOwners.owner_id = $1 AND FileOwners.file_id = Files.id RETURNING FileOwners.file_id, Files.DecRep_path",
-        user_id
-    );
+    const pqxx::result deleted_files = w.exec_prepared(DELETE_USER_OWNERSHIP, user_id);
 
     for (const auto &row : deleted_files) {
         int file_id = row["file_id"].as<int>();
 
-        const pqxx::result file_owners = w.exec_params(
-            "SELECT COUNT(*) AS remain FROM FileOwners WHERE file_id = $1",
-            file_id
-        );
+        const pqxx::result file_owners = w.exec_prepared(COUNT_OWNERS, file_id);
 
         int owners_left = file_owners[0]["remain"].as<int>();
 
         if (owners_left == 0) {
             deleted.push_back(row["DecRep_path"].as<std::string>());
-            w.exec_params("DELETE FROM Files WHERE id = $1", file_id);
+            w.exec_prepared(DELETE_FILE, file_id);
         }
     }
 
-    w.exec_params("DELETE FROM Users WHERE id = $1", user_id);
+    w.exec_prepared(DELETE_USER, user_id);
     w.commit();
 
     std::cout << "User and " << deleted.size() << " files deleted\n";
@@ -507,11 +550,7 @@ void Manager::insert_into_Users(
 )
 {
     pqxx::work w(C);
-    w.exec_params(
-        "INSERT INTO Users (username, first_connection_time) "
-        "VALUES ($1, $2)",
-        username, first_conn_time
-    );
+    w.exec_prepared(INSERT_USER, username, first_conn_time);
     w.commit();
 }
 
@@ -525,11 +564,7 @@ void Manager::insert_into_Files(
 )
 {
     pqxx::work w(C);
-    w.exec_params(
-        "INSERT INTO Files (file_name, file_size, addition_time, last_modified, DecRep_path, author_id) "
-        "VALUES ($1, $2, $3, $4, $5, $6)",
-        file_name, file_size, addition_time, last_modified, DecRep_path, author_id
-    );
+    w.exec_prepared(INSERT_FILE_ROW, file_name, file_size, addition_time, last_modified, DecRep_path, author_id);
     w.commit();
 }
 
@@ -540,11 +575,7 @@ void Manager::insert_into_FileOwners(
 )
 {
     pqxx::work w(C);
-    w.exec_params(
-        "INSERT INTO FileOwners (owner_id, file_id, local_path) "
-        "VALUES ($1, $2, $3)",
-        owner_id, file_id, local_path
-    );
+    w.exec_prepared(INSERT_OWNER, owner_id, file_id, local_path);
     w.commit();
 }
 
@@ -28,6 +28,32 @@ void DecRep::construct_dec_rep_fs() {
     }
 }
 
+void DecRep::download_file(const std::string &file_name, const std::string &file_path)
+{
+    // Какие пользователи владеют файлом, знает FileOwners, но адресов
+    // пользователей в БД нет, поэтому опрашиваются все найденные пиры:
+    // источниками станут те, у кого есть нужная версия файла.
+    std::vector<std::string> peers;
+    for (const auto &endpoint : m_search_service.get_app_endpoints()) {
+        peers.push_back(endpoint.to_string());
+    }
+    transport_service::get_file_from_peers(
+        peers, file_name, file_path, transport_service::get_local_time(file_name)
+    );
+}
+
+void DecRep::download_folder(const std::string &folder_name, const std::string &folder_path)
+{
+    for (const auto &endpoint : m_search_service.get_app_endpoints()) {
+        if (transport_service::get_folder(
+                endpoint.to_string(), folder_name, folder_path,
+                transport_service::get_local_time(folder_name)
+            )) {
+            return;
+        }
+    }
+}
+
 DecRep::DecRep(const std::string &address, int port, const std::string &connection_data)
     : m_ioc()
     , m_work_guard(net::make_work_guard(m_ioc))
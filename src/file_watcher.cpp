@@ -1,4 +1,5 @@
 #include "file_watcher.hpp"
+#include "transport_service.hpp"
 #include <boost/asio/post.hpp>
 
 FileWatcher::FileWatcher(ChangePropagator::ChangePropagator &prop, boost::asio::io_context &io, EventCallback cb)
@@ -82,8 +83,29 @@ void FileWatcher::handleFileAction(
     const std::string oldFull = fs::absolute(fs::path(dir) / oldFilename).string();
     const std::string newFull = fs::absolute(fs::path(dir) / filename).string();
 
+    // Загрузка пишется во временный файл рядом с целевым, и он не
+    // синхронизируется. Его переименование на место - это уже проверенная
+    // версия с другого узла: хеш записан загрузкой, событие не нужно.
+    auto isPartFile = [](const std::string &path) {
+        return path.ends_with(PART_FILE_SUFFIX) || path.ends_with(PART_FILE_SUFFIX JOURNAL_FILE_SUFFIX);
+    };
+    if (isPartFile(newFull)) {
+        return;
+    }
+    if (action == efsw::Actions::Moved && isPartFile(oldFull)) {
+        watched_files.insert(newFull);
+        return;
+    }
+
     FW_Event event { to_Event(action), {}, {} };
 
+    // ETag изменившегося файла пересчитается при следующем запросе
+    auto &hash_index = transport_service::Hash_Index::get_instance();
+    hash_index.invalidate(newFull);
+    if (action == efsw::Actions::Moved) {
+        hash_index.invalidate(oldFull);
+    }
+
     if (action == efsw::Actions::Moved) {
         if (watched_files.contains(oldFull)) {
             event.old_paths.push_back("\"" + oldFull + "\"");
@@ -122,6 +144,7 @@ void FileWatcher::handleFileAction(
                 std::string newF = newPref + oldF.substr(oldPref.size());
                 watched_files.erase(oldF);
                 watched_files.insert(newF);
+                hash_index.invalidate(oldF);
                 event.old_paths.push_back("\"" + oldF + "\"");
                 event.new_paths.push_back("\"" + newF + "\"");
             }
@@ -16,6 +16,8 @@ const std::string HELP_MESSAGE = R"(
     untrack_folder [путь_в_DecRep] - Прекращает отслеживание папки.
     delete_local_file [локальный_путь_к_файлу] [имя_пользователя] - Удаляет локальный файл.
     delete_user [имя_пользователя] - Удаляет пользователя.
+    download_file [имя_файла] [локальная_папка] - Скачивает файл у всех найденных пиров.
+    download_folder [имя_папки] [локальная_папка] - Скачивает папку одним архивом.
     )";
 
 int main(int argc, char *argv[])
@@ -74,9 +76,22 @@ int main(int argc, char *argv[])
 
         std::cout << "App is running...\n";
         std::string line {};
-        for(;;) {
-            std::cin >> line;
-            transport_service::get_file("192.168.99.12", "test.txt", ".", 0);
+        while (std::getline(std::cin, line)) {
+            const std::vector<std::string_view> parts = Events::split_str(line, ' ');
+            if (parts.size() != 3) {
+                continue;
+            }
+            const std::string name(parts[1]);
+            // Имя файла дописывается к папке без разделителя.
+            std::string path(parts[2]);
+            if (!path.ends_with('/')) {
+                path += '/';
+            }
+            if (parts[0] == "download_file") {
+                app.download_file(name, path);
+            } else if (parts[0] == "download_folder") {
+                app.download_folder(name, path);
+            }
         }
         // for (;;) {
         //     std::cout << "Enter your comands (or type 'help')\n";
@@ -0,0 +1,252 @@
+#include "transport_archive.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+namespace {
+constexpr char ARCHIVE_MAGIC[] = "DRA1";
+constexpr std::size_t ARCHIVE_MAGIC_SIZE = sizeof(ARCHIVE_MAGIC) - 1;
+constexpr char DIRECTORY_ENTRY = 'D';
+constexpr char FILE_ENTRY = 'F';
+constexpr char END_ENTRY = 'E';
+
+template <typename T>
+void put_le(std::string &out, T value) {
+    for (std::size_t i = 0; i < sizeof(T); ++i) {
+        out.push_back(static_cast<char>(value & 0xFF));
+        value >>= 8;
+    }
+}
+
+template <typename T>
+T get_le(const char *data) {
+    T value = 0;
+    for (std::size_t i = sizeof(T); i > 0; --i) {
+        value = (value << 8) | static_cast<unsigned char>(data[i - 1]);
+    }
+    return value;
+}
+
+std::string entry_header(const char tag, const std::string &path) {
+    if (!transport_service::is_safe_archive_path(path)) {
+        throw std::invalid_argument("Unsafe archive path: " + path);
+    }
+    std::string header(1, tag);
+    put_le(header, static_cast<std::uint32_t>(path.size()));
+    header += path;
+    return header;
+}
+}  // namespace
+
+bool transport_service::is_safe_archive_path(const std::string_view path) {
+    if (path.empty() || path.size() > ARCHIVE_MAX_PATH_SIZE || path.front() == '/' ||
+        path.find('\0') != std::string_view::npos) {
+        return false;
+    }
+    std::size_t begin = 0;
+    while (begin <= path.size()) {
+        const std::size_t end = std::min(path.find('/', begin), path.size());
+        const std::string_view component = path.substr(begin, end - begin);
+        if (component.empty() || component == "." || component == "..") {
+            return false;
+        }
+        begin = end + 1;
+    }
+    return true;
+}
+
+transport_service::Archive_Writer::Archive_Writer(Sink m_sink) : sink(std::move(m_sink)) {
+    sink(ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE);
+}
+
+void transport_service::Archive_Writer::add_directory(const std::string &path) {
+    if (in_file) {
+        throw std::logic_error("Archive entry is not finished");
+    }
+    const std::string header = entry_header(DIRECTORY_ENTRY, path);
+    sink(header.data(), header.size());
+}
+
+void transport_service::Archive_Writer::begin_file(
+    const std::string &path,
+    const std::uint64_t size
+) {
+    if (in_file) {
+        throw std::logic_error("Archive entry is not finished");
+    }
+    std::string header = entry_header(FILE_ENTRY, path);
+    put_le(header, size);
+    sink(header.data(), header.size());
+    hasher.emplace();
+    remaining = size;
+    in_file = true;
+}
+
+void transport_service::Archive_Writer::write(const char *data, const std::size_t size) {
+    if (!in_file || size > remaining) {
+        throw std::logic_error("Archive entry size mismatch");
+    }
+    hasher->update(data, size);
+    sink(data, size);
+    remaining -= size;
+}
+
+void transport_service::Archive_Writer::end_file() {
+    if (!in_file || remaining != 0) {
+        throw std::logic_error("Archive entry size mismatch");
+    }
+    const std::string hash = hasher->etag();
+    sink(hash.data(), hash.size());
+    in_file = false;
+}
+
+void transport_service::Archive_Writer::finish() {
+    if (in_file) {
+        throw std::logic_error("Archive entry is not finished");
+    }
+    sink(&END_ENTRY, 1);
+}
+
+transport_service::Archive_Reader::Archive_Reader(std::filesystem::path m_root)
+    : root(std::move(m_root)) {
+}
+
+transport_service::Archive_Reader::~Archive_Reader() {
+    if (out) {
+        out->discard();
+    }
+    // Уже проверенные файлы публикуются и при оборванной распаковке.
+    try {
+        batch.flush();
+    } catch (const std::exception &) {
+    }
+}
+
+bool transport_service::Archive_Reader::take(
+    const char *&data,
+    std::size_t &size,
+    const std::size_t field_size
+) {
+    const std::size_t n = std::min(field_size - field.size(), size);
+    field.append(data, n);
+    data += n;
+    size -= n;
+    return field.size() == field_size;
+}
+
+void transport_service::Archive_Reader::open_entry() {
+    const std::filesystem::path target = root / entry_path;
+    std::filesystem::create_directories(target.parent_path());
+    out.emplace(target);
+    out->preallocate(remaining);
+    written = 0;
+    hasher.emplace();
+}
+
+void transport_service::Archive_Reader::close_entry() {
+    const std::filesystem::path target = root / entry_path;
+    const std::string hash = hasher->etag();
+    if (hash != field) {
+        out->discard();
+        out.reset();
+        throw std::runtime_error("Hash mismatch for archive entry: " + entry_path);
+    }
+    batch.add(std::move(*out), written, [this, target, hash] {
+        extracted.push_back({target, hash});
+    });
+    out.reset();
+}
+
+void transport_service::Archive_Reader::write(const char *data, std::size_t size) {
+    while (size > 0) {
+        switch (state) {
+            case State::magic:
+                if (take(data, size, ARCHIVE_MAGIC_SIZE)) {
+                    if (field != ARCHIVE_MAGIC) {
+                        throw std::runtime_error("Corrupt archive stream");
+                    }
+                    field.clear();
+                    state = State::tag;
+                }
+                break;
+            case State::tag:
+                tag = *data;
+                ++data;
+                --size;
+                if (tag == END_ENTRY) {
+                    batch.flush();
+                    state = State::done;
+                } else if (tag == DIRECTORY_ENTRY || tag == FILE_ENTRY) {
+                    state = State::path_size;
+                } else {
+                    throw std::runtime_error("Corrupt archive stream");
+                }
+                break;
+            case State::path_size:
+                if (take(data, size, sizeof(std::uint32_t))) {
+                    remaining = get_le<std::uint32_t>(field.data());
+                    field.clear();
+                    if (remaining == 0 || remaining > ARCHIVE_MAX_PATH_SIZE) {
+                        throw std::runtime_error("Corrupt archive stream");
+                    }
+                    state = State::path;
+                }
+                break;
+            case State::path:
+                if (take(data, size, static_cast<std::size_t>(remaining))) {
+                    entry_path = std::move(field);
+                    field.clear();
+                    if (!is_safe_archive_path(entry_path)) {
+                        throw std::runtime_error("Unsafe archive path: " + entry_path);
+                    }
+                    if (tag == DIRECTORY_ENTRY) {
+                        std::filesystem::create_directories(root / entry_path);
+                        state = State::tag;
+                    } else {
+                        state = State::file_size;
+                    }
+                }
+                break;
+            case State::file_size:
+                if (take(data, size, sizeof(std::uint64_t))) {
+                    remaining = get_le<std::uint64_t>(field.data());
+                    field.clear();
+                    open_entry();
+                    state = remaining == 0 ? State::hash : State::data;
+                }
+                break;
+            case State::data: {
+                const auto n =
+                    static_cast<std::size_t>(std::min<std::uint64_t>(remaining, size));
+                out->write_at(data, n, written);
+                written += n;
+                hasher->update(data, n);
+                data += n;
+                size -= n;
+                remaining -= n;
+                if (remaining == 0) {
+                    state = State::hash;
+                }
+                break;
+            }
+            case State::hash:
+                if (take(data, size, ARCHIVE_HASH_SIZE)) {
+                    close_entry();
+                    field.clear();
+                    state = State::tag;
+                }
+                break;
+            case State::done:
+                throw std::runtime_error("Trailing data after archive end");
+        }
+    }
+}
+
+bool transport_service::Archive_Reader::is_done() const {
+    return state == State::done;
+}
+
+const std::vector<transport_service::Archive_Reader::Extracted_File> &
+transport_service::Archive_Reader::get_extracted() const {
+    return extracted;
+}
@@ -0,0 +1,246 @@
+#include "transport_chunk.hpp"
+#include "transport_hash.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+// Таблица gear-хеша: 256 псевдослучайных слов splitmix64.
+constexpr auto GEAR = [] {
+    std::array<std::uint64_t, 256> table{};
+    std::uint64_t state = 0x2545F4914F6CDD1D;
+    for (auto &value : table) {
+        state += 0x9E3779B97F4A7C15;
+        std::uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+        value = z ^ (z >> 31);
+    }
+    return table;
+}();
+
+// Старшие биты gear-хеша зависят от последних 64 байт, младшие - от
+// нескольких, поэтому маски берутся сверху. До среднего размера маска
+// строже (на 2 бита больше log2 среднего размера), после - мягче:
+// размеры чанков прижимаются к среднему.
+constexpr unsigned AVG_BITS =
+    std::countr_zero(static_cast<unsigned>(CDC_AVG_CHUNK_SIZE));
+constexpr std::uint64_t MASK_STRICT = ~0ULL << (64 - (AVG_BITS + 2));
+constexpr std::uint64_t MASK_LOOSE = ~0ULL << (64 - (AVG_BITS - 2));
+
+std::string chunk_hash(const char *data, const std::size_t size) {
+    transport_service::Sha1_Hasher hasher;
+    hasher.update(data, size);
+    return hasher.hex_digest();
+}
+
+std::string store_key(const std::string &path) {
+    return std::filesystem::absolute(path).lexically_normal().string();
+}
+}  // namespace
+
+std::size_t transport_service::fastcdc_cut(const char *data, std::size_t size) {
+    if (size <= CDC_MIN_CHUNK_SIZE) {
+        return size;
+    }
+    size = std::min<std::size_t>(size, CDC_MAX_CHUNK_SIZE);
+    const std::size_t normal = std::min<std::size_t>(size, CDC_AVG_CHUNK_SIZE);
+    const auto *bytes = reinterpret_cast<const unsigned char *>(data);
+    std::uint64_t hash = 0;
+    std::size_t i = CDC_MIN_CHUNK_SIZE;
+    for (; i < normal; ++i) {
+        hash = (hash << 1) + GEAR[bytes[i]];
+        if ((hash & MASK_STRICT) == 0) {
+            return i + 1;
+        }
+    }
+    for (; i < size; ++i) {
+        hash = (hash << 1) + GEAR[bytes[i]];
+        if ((hash & MASK_LOOSE) == 0) {
+            return i + 1;
+        }
+    }
+    return size;
+}
+
+std::vector<transport_service::Chunk>
+transport_service::chunk_file(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+    std::vector<Chunk> chunks;
+    std::vector<char> buffer(4 * CDC_MAX_CHUNK_SIZE);
+    std::size_t start = 0;
+    std::size_t end = 0;
+    std::uint64_t offset = 0;
+    for (;;) {
+        // В буфере всегда не меньше CDC_MAX_CHUNK_SIZE байт, пока файл
+        // не кончился, иначе граница зависела бы от размера чтения.
+        if (end - start < CDC_MAX_CHUNK_SIZE && file) {
+            std::memmove(buffer.data(), buffer.data() + start, end - start);
+            end -= start;
+            start = 0;
+            file.read(
+                buffer.data() + end,
+                static_cast<std::streamsize>(buffer.size() - end)
+            );
+            end += static_cast<std::size_t>(file.gcount());
+        }
+        if (start == end) {
+            break;
+        }
+        const std::size_t length = fastcdc_cut(buffer.data() + start, end - start);
+        chunks.push_back(Chunk{
+            offset, static_cast<std::uint32_t>(length),
+            chunk_hash(buffer.data() + start, length)});
+        start += length;
+        offset += length;
+    }
+    return chunks;
+}
+
+std::string transport_service::serialize_manifest(
+    const std::vector<Chunk> &chunks
+) {
+    std::string manifest;
+    for (const auto &chunk : chunks) {
+        manifest += chunk.hash + ' ' + std::to_string(chunk.length) + '\n';
+    }
+    return manifest;
+}
+
+std::optional<std::vector<transport_service::Chunk>>
+transport_service::parse_manifest(const std::string_view manifest) {
+    std::vector<Chunk> chunks;
+    std::uint64_t offset = 0;
+    std::size_t pos = 0;
+    while (pos < manifest.size()) {
+        const std::size_t line_end = manifest.find('\n', pos);
+        if (line_end == std::string_view::npos) {
+            return std::nullopt;
+        }
+        const std::string_view line = manifest.substr(pos, line_end - pos);
+        pos = line_end + 1;
+
+        const std::size_t space = line.find(' ');
+        if (space == std::string_view::npos || space == 0) {
+            return std::nullopt;
+        }
+        Chunk chunk{offset, 0, std::string(line.substr(0, space))};
+        const char *first = line.data() + space + 1;
+        const char *last = line.data() + line.size();
+        const auto [ptr, ec] = std::from_chars(first, last, chunk.length);
+        if (ec != std::errc{} || ptr != last || chunk.length == 0) {
+            return std::nullopt;
+        }
+        offset += chunk.length;
+        chunks.push_back(std::move(chunk));
+    }
+    return chunks;
+}
+
+transport_service::Chunk_Store::Chunk_Store(std::string m_store_path)
+    : store_path(std::move(m_store_path)) {
+    load();
+}
+
+transport_service::Chunk_Store &transport_service::Chunk_Store::get_instance() {
+    static Chunk_Store instance(CHUNK_STORE_FILE);
+    return instance;
+}
+
+void transport_service::Chunk_Store::load() {
+    std::ifstream in(store_path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.starts_with("- ")) {
+            locations.erase(line.substr(2));
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string hash;
+        Location location;
+        fields >> hash >> location.offset >> location.length;
+        if (fields.get() == ' ' && std::getline(fields, location.path) &&
+            !location.path.empty()) {
+            locations[hash] = std::move(location);
+        }
+    }
+    in.close();
+
+    // Как и журнал Hash_Index, при загрузке переписывается без мусора.
+    const std::string temp_path = store_path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::trunc);
+        for (const auto &[hash, location] : locations) {
+            out << hash << ' ' << location.offset << ' ' << location.length
+                << ' ' << location.path << '\n';
+        }
+    }
+    std::filesystem::rename(temp_path, store_path);
+    journal.open(store_path, std::ios::app);
+}
+
+void transport_service::Chunk_Store::forget(
+    const std::string &hash,
+    const Location &stale
+) {
+    const std::lock_guard lock(mutex);
+    const auto it = locations.find(hash);
+    // Пока чанк читался, add_file мог указать на новое место.
+    if (it != locations.end() && it->second.path == stale.path &&
+        it->second.offset == stale.offset) {
+        locations.erase(it);
+        journal << "- " << hash << '\n';
+        journal.flush();
+    }
+}
+
+void transport_service::Chunk_Store::add_file(
+    const std::string &path,
+    const std::vector<Chunk> &chunks
+) {
+    const std::string key = store_key(path);
+    const std::lock_guard lock(mutex);
+    for (const auto &chunk : chunks) {
+        locations[chunk.hash] = Location{key, chunk.offset, chunk.length};
+        journal << chunk.hash << ' ' << chunk.offset << ' ' << chunk.length
+                << ' ' << key << '\n';
+    }
+    journal.flush();
+}
+
+std::optional<std::string>
+transport_service::Chunk_Store::read(const Chunk &chunk) {
+    Location location;
+    {
+        const std::lock_guard lock(mutex);
+        const auto it = locations.find(chunk.hash);
+        if (it == locations.end() || it->second.length != chunk.length) {
+            return std::nullopt;
+        }
+        location = it->second;
+    }
+
+    std::ifstream file(location.path, std::ios::binary);
+    std::string data(location.length, '\0');
+    file.seekg(static_cast<std::streamoff>(location.offset));
+    if (!file.read(data.data(), static_cast<std::streamsize>(data.size())) ||
+        chunk_hash(data.data(), data.size()) != chunk.hash) {
+        // Файл изменён или удалён: чанка там больше нет.
+        forget(chunk.hash, location);
+        return std::nullopt;
+    }
+    return data;
+}
+
+bool transport_service::Chunk_Store::contains(const std::string &hash) const {
+    const std::lock_guard lock(mutex);
+    return locations.contains(hash);
+}
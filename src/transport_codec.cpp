@@ -0,0 +1,689 @@
+#include "transport_codec.hpp"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+
+namespace {
+// Один пул на процесс: контексты освобождает тот поток, где закончилось
+// сжатие, а сессии переходят между потоками io, blocking_pool и пулом
+// сжатия, и пул на поток держал бы запас контекстов каждого уровня
+// в каждом из них.
+struct Zlib_Pool {
+    std::mutex mutex;
+    // Индекс - уровень сжатия 0-9.
+    std::vector<std::unique_ptr<transport_service::Deflate_Context>>
+        deflate[Z_BEST_COMPRESSION + 1];
+    std::size_t deflate_count = 0;
+    std::vector<std::unique_ptr<transport_service::Inflate_Context>> inflate;
+};
+
+Zlib_Pool &zlib_pool() {
+    static Zlib_Pool pool;
+    return pool;
+}
+
+// Пул сжатия блоков Parallel_Deflate_Stream, один на процесс.
+boost::asio::thread_pool &compression_pool() {
+    static boost::asio::thread_pool pool(
+        std::max(1U, std::thread::hardware_concurrency())
+    );
+    return pool;
+}
+}  // namespace
+
+transport_service::Deflate_Context::~Deflate_Context() {
+    deflateEnd(&zs);
+}
+
+transport_service::Inflate_Context::~Inflate_Context() {
+    inflateEnd(&zs);
+}
+
+void transport_service::Deflate_Releaser::operator()(
+    Deflate_Context *context
+) const {
+    std::unique_ptr<Deflate_Context> owned(context);
+    if (deflateReset(&context->zs) != Z_OK) {
+        return;
+    }
+    auto &pool = zlib_pool();
+    const std::lock_guard lock(pool.mutex);
+    if (pool.deflate_count < ZLIB_POOL_SIZE) {
+        pool.deflate[context->compression_level].push_back(std::move(owned));
+        ++pool.deflate_count;
+    }
+}
+
+void transport_service::Inflate_Releaser::operator()(
+    Inflate_Context *context
+) const {
+    std::unique_ptr<Inflate_Context> owned(context);
+    if (inflateReset(&context->zs) != Z_OK) {
+        return;
+    }
+    auto &pool = zlib_pool();
+    const std::lock_guard lock(pool.mutex);
+    if (pool.inflate.size() < ZLIB_POOL_SIZE) {
+        pool.inflate.push_back(std::move(owned));
+    }
+}
+
+transport_service::Pooled_Deflate transport_service::acquire_deflate(
+    int compression_level
+) {
+    if (compression_level == Z_DEFAULT_COMPRESSION) {
+        compression_level = 6;
+    }
+    if (compression_level < Z_NO_COMPRESSION ||
+        compression_level > Z_BEST_COMPRESSION) {
+        throw std::invalid_argument("Invalid compression level");
+    }
+    {
+        auto &pool = zlib_pool();
+        const std::lock_guard lock(pool.mutex);
+        auto &level_pool = pool.deflate[compression_level];
+        if (!level_pool.empty()) {
+            Pooled_Deflate context(level_pool.back().release());
+            level_pool.pop_back();
+            --pool.deflate_count;
+            return context;
+        }
+    }
+    auto context = std::make_unique<Deflate_Context>();
+    context->compression_level = compression_level;
+    if (deflateInit(&context->zs, compression_level) != Z_OK) {
+        // deflateEnd на неинициализированном потоке безопасен.
+        throw std::runtime_error("Failed to initialize deflate stream");
+    }
+    return Pooled_Deflate(context.release());
+}
+
+transport_service::Pooled_Inflate transport_service::acquire_inflate() {
+    {
+        auto &pool = zlib_pool();
+        const std::lock_guard lock(pool.mutex);
+        if (!pool.inflate.empty()) {
+            Pooled_Inflate context(pool.inflate.back().release());
+            pool.inflate.pop_back();
+            return context;
+        }
+    }
+    auto context = std::make_unique<Inflate_Context>();
+    if (inflateInit(&context->zs) != Z_OK) {
+        throw std::runtime_error("Failed to initialize inflate stream");
+    }
+    return Pooled_Inflate(context.release());
+}
+
+transport_service::Deflate_Stream::Deflate_Stream(const int compression_level)
+    : context(acquire_deflate(compression_level)),
+      out_buffer(CODEC_BUFFER_SIZE) {
+}
+
+void transport_service::Deflate_Stream::drain(
+    const int flush,
+    const Sink &sink
+) {
+    z_stream &zs = context->zs;
+    int ret;
+    do {
+        zs.next_out = reinterpret_cast<Bytef *>(out_buffer.data());
+        zs.avail_out = static_cast<uInt>(out_buffer.size());
+
+        ret = deflate(&zs, flush);
+        if (ret == Z_STREAM_ERROR) {
+            throw std::runtime_error("Deflate stream error");
+        }
+
+        const std::size_t produced = out_buffer.size() - zs.avail_out;
+        if (produced > 0) {
+            sink(out_buffer.data(), produced);
+        }
+    } while (zs.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+}
+
+void transport_service::Deflate_Stream::write(
+    const char *data,
+    const std::size_t size,
+    const Sink &sink
+) {
+    z_stream &zs = context->zs;
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    zs.avail_in = static_cast<uInt>(size);
+    drain(Z_NO_FLUSH, sink);
+}
+
+void transport_service::Deflate_Stream::finish(const Sink &sink) {
+    z_stream &zs = context->zs;
+    zs.next_in = nullptr;
+    zs.avail_in = 0;
+    drain(Z_FINISH, sink);
+}
+
+// Промежуточный блок заканчивается Z_SYNC_FLUSH на границе байта,
+// последний - Z_FINISH.
+transport_service::Parallel_Deflate_Stream::Block
+transport_service::Parallel_Deflate_Stream::compress_block(
+    const int compression_level,
+    const std::string &input,
+    const std::string &dictionary,
+    const bool last
+) {
+    z_stream zs{};
+    if (deflateInit2(
+            &zs, compression_level, Z_DEFLATED, -MAX_WBITS, 8,
+            Z_DEFAULT_STRATEGY
+        ) != Z_OK) {
+        throw std::runtime_error("Failed to initialize deflate stream");
+    }
+    if (!dictionary.empty()) {
+        deflateSetDictionary(
+            &zs, reinterpret_cast<const Bytef *>(dictionary.data()),
+            static_cast<uInt>(dictionary.size())
+        );
+    }
+
+    Block block;
+    block.size = input.size();
+    block.adler = adler32(
+        adler32(0, nullptr, 0), reinterpret_cast<const Bytef *>(input.data()),
+        static_cast<uInt>(input.size())
+    );
+    // deflateBound не учитывает пустой блок Z_SYNC_FLUSH, отсюда запас.
+    block.data.resize(deflateBound(&zs, static_cast<uLong>(input.size())) + 16);
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+    zs.avail_in = static_cast<uInt>(input.size());
+    zs.next_out = reinterpret_cast<Bytef *>(block.data.data());
+    zs.avail_out = static_cast<uInt>(block.data.size());
+    const int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+    const bool is_complete =
+        last ? ret == Z_STREAM_END : ret == Z_OK && zs.avail_out > 0;
+    block.data.resize(block.data.size() - zs.avail_out);
+    deflateEnd(&zs);
+    if (!is_complete) {
+        throw std::runtime_error("Deflate stream error");
+    }
+    return block;
+}
+
+transport_service::Parallel_Deflate_Stream::Parallel_Deflate_Stream(
+    const int compression_level,
+    const unsigned threads
+)
+    : compression_level(compression_level),
+      threads(std::max(1U, threads)),
+      adler(adler32(0, nullptr, 0)) {
+    input.reserve(PARALLEL_DEFLATE_BLOCK_SIZE);
+}
+
+void transport_service::Parallel_Deflate_Stream::submit(const bool last) {
+    std::string next_dictionary = input.substr(
+        input.size() - std::min<std::size_t>(input.size(), DEFLATE_WINDOW_SIZE)
+    );
+    // Задача владеет своими данными: поток можно уничтожить, не дожидаясь
+    // блоков, которые ещё сжимаются.
+    std::packaged_task<Block()> task(
+        [compression_level = compression_level, input = std::move(input),
+         dictionary = std::move(dictionary), last] {
+            return compress_block(compression_level, input, dictionary, last);
+        }
+    );
+    blocks.push_back(task.get_future());
+    boost::asio::post(compression_pool(), std::move(task));
+    dictionary = std::move(next_dictionary);
+    input.clear();
+    input.reserve(PARALLEL_DEFLATE_BLOCK_SIZE);
+}
+
+void transport_service::Parallel_Deflate_Stream::drain(
+    const std::size_t max_pending,
+    const Sink &sink
+) {
+    if (!started) {
+        // Заголовок zlib с тем же FLEVEL, что поставил бы deflateInit.
+        const int level =
+            compression_level == Z_DEFAULT_COMPRESSION ? 6 : compression_level;
+        const unsigned flevel =
+            level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+        unsigned header = (0x78U << 8) | (flevel << 6);
+        header += 31 - header % 31;
+        const char bytes[2] = {
+            static_cast<char>(header >> 8), static_cast<char>(header & 0xff)
+        };
+        sink(bytes, sizeof(bytes));
+        started = true;
+    }
+    while (!blocks.empty() &&
+           (blocks.size() > max_pending ||
+            blocks.front().wait_for(std::chrono::seconds(0)) ==
+                std::future_status::ready)) {
+        const Block block = blocks.front().get();
+        blocks.pop_front();
+        adler = adler32_combine(
+            adler, block.adler, static_cast<z_off_t>(block.size)
+        );
+        sink(block.data.data(), block.data.size());
+    }
+}
+
+void transport_service::Parallel_Deflate_Stream::write(
+    const char *data,
+    const std::size_t size,
+    const Sink &sink
+) {
+    for (std::size_t pos = 0; pos < size;) {
+        const std::size_t part =
+            std::min(size - pos, PARALLEL_DEFLATE_BLOCK_SIZE - input.size());
+        input.append(data + pos, part);
+        pos += part;
+        if (input.size() == PARALLEL_DEFLATE_BLOCK_SIZE) {
+            // Пока сжимается threads блоков, следующий ждёт своей очереди.
+            drain(threads - 1, sink);
+            submit(false);
+        }
+    }
+    drain(threads, sink);
+}
+
+void transport_service::Parallel_Deflate_Stream::finish(const Sink &sink) {
+    submit(true);
+    drain(0, sink);
+    const char trailer[4] = {
+        static_cast<char>(adler >> 24), static_cast<char>(adler >> 16),
+        static_cast<char>(adler >> 8), static_cast<char>(adler)
+    };
+    sink(trailer, sizeof(trailer));
+}
+
+transport_service::Inflate_Stream::Inflate_Stream()
+    : context(acquire_inflate()), out_buffer(CODEC_BUFFER_SIZE) {
+}
+
+void transport_service::Inflate_Stream::write(
+    const char *data,
+    const std::size_t size,
+    const Sink &sink
+) {
+    z_stream &zs = context->zs;
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    zs.avail_in = static_cast<uInt>(size);
+
+    while (!done && (zs.avail_in > 0 || zs.avail_out == 0)) {
+        zs.next_out = reinterpret_cast<Bytef *>(out_buffer.data());
+        zs.avail_out = static_cast<uInt>(out_buffer.size());
+
+        const int ret = inflate(&zs, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            throw std::runtime_error("Inflate stream error");
+        }
+
+        const std::size_t produced = out_buffer.size() - zs.avail_out;
+        if (produced > 0) {
+            sink(out_buffer.data(), produced);
+        }
+        if (ret == Z_STREAM_END) {
+            done = true;
+        } else if (ret == Z_BUF_ERROR) {
+            break;
+        }
+    }
+}
+
+bool transport_service::Inflate_Stream::is_done() const {
+    return done;
+}
+
+#ifdef DECREP_HAS_ZSTD
+namespace {
+// Шкала zlib 1-9 переводится в 1-12: более высокие уровни zstd слишком
+// медленные для сервера, который и так упирается в процессор.
+int zstd_level(const int compression_level) {
+    return std::clamp(compression_level, 1, 9) * 4 / 3;
+}
+}  // namespace
+
+transport_service::Zstd_Encoder::Zstd_Encoder(
+    const int compression_level,
+    const unsigned workers
+)
+    : cctx(ZSTD_createCCtx()), out_buffer(ZSTD_CStreamOutSize()) {
+    if (cctx == nullptr) {
+        throw std::runtime_error("Failed to initialize zstd stream");
+    }
+    ZSTD_CCtx_setParameter(
+        cctx, ZSTD_c_compressionLevel, zstd_level(compression_level)
+    );
+    // Без поддержки многопоточности в библиотеке вызов вернёт ошибку,
+    // и сжатие останется однопоточным.
+    ZSTD_CCtx_setParameter(
+        cctx, ZSTD_c_nbWorkers, static_cast<int>(workers)
+    );
+}
+
+transport_service::Zstd_Encoder::~Zstd_Encoder() {
+    ZSTD_freeCCtx(cctx);
+}
+
+void transport_service::Zstd_Encoder::write(
+    const char *data,
+    const std::size_t size,
+    const Sink &sink
+) {
+    ZSTD_inBuffer in{data, size, 0};
+    while (in.pos < in.size) {
+        ZSTD_outBuffer out{out_buffer.data(), out_buffer.size(), 0};
+        const std::size_t ret =
+            ZSTD_compressStream2(cctx, &out, &in, ZSTD_e_continue);
+        if (ZSTD_isError(ret)) {
+            throw std::runtime_error(
+                std::string("Zstd stream error: ") + ZSTD_getErrorName(ret)
+            );
+        }
+        if (out.pos > 0) {
+            sink(out_buffer.data(), out.pos);
+        }
+    }
+}
+
+void transport_service::Zstd_Encoder::finish(const Sink &sink) {
+    ZSTD_inBuffer in{nullptr, 0, 0};
+    std::size_t remaining;
+    do {
+        ZSTD_outBuffer out{out_buffer.data(), out_buffer.size(), 0};
+        remaining = ZSTD_compressStream2(cctx, &out, &in, ZSTD_e_end);
+        if (ZSTD_isError(remaining)) {
+            throw std::runtime_error(
+                std::string("Zstd stream error: ") +
+                ZSTD_getErrorName(remaining)
+            );
+        }
+        if (out.pos > 0) {
+            sink(out_buffer.data(), out.pos);
+        }
+    } while (remaining != 0);
+}
+
+transport_service::Zstd_Decoder::Zstd_Decoder()
+    : dctx(ZSTD_createDCtx()), out_buffer(ZSTD_DStreamOutSize()) {
+    if (dctx == nullptr) {
+        throw std::runtime_error("Failed to initialize zstd stream");
+    }
+}
+
+transport_service::Zstd_Decoder::~Zstd_Decoder() {
+    ZSTD_freeDCtx(dctx);
+}
+
+void transport_service::Zstd_Decoder::write(
+    const char *data,
+    const std::size_t size,
+    const Sink &sink
+) {
+    ZSTD_inBuffer in{data, size, 0};
+    bool out_full = false;
+    while (in.pos < in.size || out_full) {
+        ZSTD_outBuffer out{out_buffer.data(), out_buffer.size(), 0};
+        const std::size_t ret = ZSTD_decompressStream(dctx, &out, &in);
+        if (ZSTD_isError(ret)) {
+            throw std::runtime_error(
+                std::string("Zstd stream error: ") + ZSTD_getErrorName(ret)
+            );
+        }
+        if (out.pos > 0) {
+            sink(out_buffer.data(), out.pos);
+        }
+        out_full = out.pos == out.size;
+        if (ret == 0) {
+            done = true;
+        }
+    }
+}
+
+bool transport_service::Zstd_Decoder::is_done() const {
+    return done;
+}
+#endif
+
+#ifdef DECREP_HAS_LZ4
+transport_service::Lz4_Encoder::Lz4_Encoder(const int compression_level) {
+    if (LZ4F_isError(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION))) {
+        throw std::runtime_error("Failed to initialize lz4 stream");
+    }
+    // Уровни ниже 3 - быстрый LZ4, выше - LZ4HC того же уровня.
+    preferences.compressionLevel =
+        std::min(compression_level, LZ4F_compressionLevel_max());
+    out_buffer.resize(LZ4F_compressBound(CODEC_BUFFER_SIZE, &preferences));
+}
+
+transport_service::Lz4_Encoder::~Lz4_Encoder() {
+    LZ4F_freeCompressionContext(cctx);
+}
+
+void transport_service::Lz4_Encoder::begin(const Sink &sink) {
+    if (started) {
+        return;
+    }
+    const std::size_t written = LZ4F_compressBegin(
+        cctx, out_buffer.data(), out_buffer.size(), &preferences
+    );
+    if (LZ4F_isError(written)) {
+        throw std::runtime_error(
+            std::string("Lz4 stream error: ") + LZ4F_getErrorName(written)
+        );
+    }
+    sink(out_buffer.data(), written);
+    started = true;
+}
+
+void transport_service::Lz4_Encoder::write(
+    const char *data,
+    const std::size_t size,
+    const Sink &sink
+) {
+    begin(sink);
+    // out_buffer рассчитан на вход не больше CODEC_BUFFER_SIZE.
+    for (std::size_t pos = 0; pos < size; pos += CODEC_BUFFER_SIZE) {
+        const std::size_t written = LZ4F_compressUpdate(
+            cctx, out_buffer.data(), out_buffer.size(), data + pos,
+            std::min<std::size_t>(CODEC_BUFFER_SIZE, size - pos), nullptr
+        );
+        if (LZ4F_isError(written)) {
+            throw std::runtime_error(
+                std::string("Lz4 stream error: ") + LZ4F_getErrorName(written)
+            );
+        }
+        if (written > 0) {
+            sink(out_buffer.data(), written);
+        }
+    }
+}
+
+void transport_service::Lz4_Encoder::finish(const Sink &sink) {
+    begin(sink);
+    const std::size_t written =
+        LZ4F_compressEnd(cctx, out_buffer.data(), out_buffer.size(), nullptr);
+    if (LZ4F_isError(written)) {
+        throw std::runtime_error(
+            std::string("Lz4 stream error: ") + LZ4F_getErrorName(written)
+        );
+    }
+    sink(out_buffer.data(), written);
+}
+
+transport_service::Lz4_Decoder::Lz4_Decoder() : out_buffer(CODEC_BUFFER_SIZE) {
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) {
+        throw std::runtime_error("Failed to initialize lz4 stream");
+    }
+}
+
+transport_service::Lz4_Decoder::~Lz4_Decoder() {
+    LZ4F_freeDecompressionContext(dctx);
+}
+
+void transport_service::Lz4_Decoder::write(
+    const char *data,
+    const std::size_t size,
+    const Sink &sink
+) {
+    std::size_t pos = 0;
+    bool out_full = false;
+    while (!done && (pos < size || out_full)) {
+        std::size_t produced = out_buffer.size();
+        std::size_t consumed = size - pos;
+        const std::size_t ret = LZ4F_decompress(
+            dctx, out_buffer.data(), &produced, data + pos, &consumed, nullptr
+        );
+        if (LZ4F_isError(ret)) {
+            throw std::runtime_error(
+                std::string("Lz4 stream error: ") + LZ4F_getErrorName(ret)
+            );
+        }
+        pos += consumed;
+        if (produced > 0) {
+            sink(out_buffer.data(), produced);
+        }
+        out_full = produced == out_buffer.size();
+        if (ret == 0) {
+            done = true;
+        } else if (consumed == 0 && produced == 0) {
+            break;
+        }
+    }
+}
+
+bool transport_service::Lz4_Decoder::is_done() const {
+    return done;
+}
+#endif
+
+const std::vector<std::string> &transport_service::supported_encodings() {
+    static const std::vector<std::string> encodings = {
+#ifdef DECREP_HAS_ZSTD
+        "zstd",
+#endif
+#ifdef DECREP_HAS_LZ4
+        "lz4",
+#endif
+        "deflate",
+    };
+    return encodings;
+}
+
+std::string transport_service::accept_encoding_header() {
+    std::string header;
+    for (const auto &encoding : supported_encodings()) {
+        if (!header.empty()) {
+            header += ", ";
+        }
+        header += encoding;
+    }
+    return header;
+}
+
+std::string transport_service::negotiate_encoding(
+    const std::string_view accept_encoding
+) {
+    if (accept_encoding.empty()) {
+        return "deflate";
+    }
+
+    // Разбор "zstd, lz4;q=0.5, deflate;q=0": q=0 означает отказ от кодека,
+    // остальные веса не учитываются - порядок задаёт сервер.
+    std::vector<std::string> accepted;
+    std::size_t pos = 0;
+    while (pos <= accept_encoding.size()) {
+        std::size_t end = accept_encoding.find(',', pos);
+        if (end == std::string_view::npos) {
+            end = accept_encoding.size();
+        }
+        std::string_view item = accept_encoding.substr(pos, end - pos);
+        pos = end + 1;
+
+        const std::size_t params = item.find(';');
+        std::string_view name = item.substr(0, params);
+        std::string_view quality =
+            params == std::string_view::npos ? "" : item.substr(params + 1);
+        const auto trim = [](std::string_view str) {
+            while (!str.empty() && std::isspace(static_cast<unsigned char>(str.front()))) {
+                str.remove_prefix(1);
+            }
+            while (!str.empty() && std::isspace(static_cast<unsigned char>(str.back()))) {
+                str.remove_suffix(1);
+            }
+            return str;
+        };
+        name = trim(name);
+        quality = trim(quality);
+        double weight = 1.0;
+        if (quality.starts_with("q=")) {
+            std::from_chars(
+                quality.data() + 2, quality.data() + quality.size(), weight
+            );
+        }
+        if (!name.empty() && weight > 0.0) {
+            accepted.emplace_back(name);
+        }
+    }
+
+    for (const auto &encoding : supported_encodings()) {
+        if (std::ranges::find(accepted, encoding) != accepted.end() ||
+            std::ranges::find(accepted, "*") != accepted.end()) {
+            return encoding;
+        }
+    }
+    return RAW_ENCODING;
+}
+
+std::unique_ptr<transport_service::Encoder> transport_service::make_encoder(
+    const std::string_view encoding,
+    const int compression_level,
+    const unsigned threads
+) {
+#ifdef DECREP_HAS_ZSTD
+    if (encoding == "zstd") {
+        // nbWorkers = 0 - однопоточное сжатие в вызывающем потоке.
+        return std::make_unique<Zstd_Encoder>(
+            compression_level, threads > 1 ? threads : 0
+        );
+    }
+#endif
+#ifdef DECREP_HAS_LZ4
+    if (encoding == "lz4") {
+        return std::make_unique<Lz4_Encoder>(compression_level);
+    }
+#endif
+    if (encoding == "deflate") {
+        if (threads > 1) {
+            return std::make_unique<Parallel_Deflate_Stream>(
+                compression_level, threads
+            );
+        }
+        return std::make_unique<Deflate_Stream>(compression_level);
+    }
+    return nullptr;
+}
+
+std::unique_ptr<transport_service::Decoder> transport_service::make_decoder(
+    const std::string_view encoding
+) {
+#ifdef DECREP_HAS_ZSTD
+    if (encoding == "zstd") {
+        return std::make_unique<Zstd_Decoder>();
+    }
+#endif
+#ifdef DECREP_HAS_LZ4
+    if (encoding == "lz4") {
+        return std::make_unique<Lz4_Decoder>();
+    }
+#endif
+    if (encoding == "deflate") {
+        return std::make_unique<Inflate_Stream>();
+    }
+    return nullptr;
+}
@@ -0,0 +1,217 @@
+#include "transport_commit.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <set>
+#include <system_error>
+#include <utility>
+
+namespace {
+// Сбрасывает на диск файловые системы, на которых лежат paths: один
+// syncfs на устройство вместо fsync на каждый файл (где syncfs нет -
+// fsync каждого пути). Ошибка открытия или сброса бросает исключение:
+// несброшенные файлы нельзя публиковать.
+void sync_filesystems(const std::vector<std::filesystem::path> &paths) {
+    std::set<dev_t> synced;
+    for (const auto &path : paths) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::system_error(
+                errno, std::generic_category(), "Failed to open " + path.string()
+            );
+        }
+        struct stat st {};
+        int result = ::fstat(fd, &st);
+        if (result == 0 && !synced.contains(st.st_dev)) {
+#ifdef __linux__
+            result = ::syncfs(fd);
+            synced.insert(st.st_dev);
+#else
+            result = ::fsync(fd);
+#endif
+        }
+        const int error = errno;
+        ::close(fd);
+        if (result != 0) {
+            throw std::system_error(
+                error, std::generic_category(), "Failed to sync " + path.string()
+            );
+        }
+    }
+}
+}  // namespace
+
+void transport_service::write_all_at(
+    const int fd,
+    const char *data,
+    std::size_t size,
+    std::uint64_t offset
+) {
+    while (size > 0) {
+        const ssize_t written = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "pwrite");
+        }
+        data += written;
+        size -= static_cast<std::size_t>(written);
+        offset += static_cast<std::uint64_t>(written);
+    }
+}
+
+void transport_service::sync_directory(const std::filesystem::path &directory) {
+    const std::filesystem::path path = directory.empty() ? "." : directory;
+    const int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        throw std::system_error(
+            errno, std::generic_category(), "Failed to open " + path.string()
+        );
+    }
+    const int result = ::fsync(fd);
+    const int error = errno;
+    ::close(fd);
+    if (result != 0) {
+        throw std::system_error(
+            error, std::generic_category(), "Failed to sync " + path.string()
+        );
+    }
+}
+
+transport_service::Part_File::Part_File(std::filesystem::path m_target, const bool is_resumed)
+    : target(std::move(m_target)), part_path(target.string() + PART_FILE_SUFFIX) {
+    fd = ::open(part_path.c_str(), O_WRONLY | O_CREAT | (is_resumed ? 0 : O_TRUNC), 0644);
+    if (fd < 0) {
+        throw std::system_error(
+            errno, std::generic_category(), "Failed to open file: " + part_path.string()
+        );
+    }
+}
+
+transport_service::Part_File::~Part_File() {
+    close_file();
+}
+
+transport_service::Part_File::Part_File(Part_File &&other) noexcept
+    : target(std::move(other.target)),
+      part_path(std::move(other.part_path)),
+      fd(std::exchange(other.fd, -1)) {
+}
+
+void transport_service::Part_File::close_file() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+int transport_service::Part_File::get_fd() const {
+    return fd;
+}
+
+const std::filesystem::path &transport_service::Part_File::get_path() const {
+    return part_path;
+}
+
+const std::filesystem::path &transport_service::Part_File::get_target() const {
+    return target;
+}
+
+void transport_service::Part_File::preallocate(const std::uint64_t size) {
+#ifdef __linux__
+    if (size > 0) {
+        // Ошибка (например, EOPNOTSUPP) не мешает записи.
+        ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size));
+    }
+#endif
+}
+
+void transport_service::Part_File::write_at(
+    const char *data,
+    const std::size_t size,
+    const std::uint64_t offset
+) {
+    write_all_at(fd, data, size, offset);
+}
+
+void transport_service::Part_File::start_writeback() const {
+#ifdef __linux__
+    ::sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+}
+
+void transport_service::Part_File::commit() {
+    if (::fdatasync(fd) != 0) {
+        throw std::system_error(errno, std::generic_category(), "fdatasync");
+    }
+    publish();
+    sync_directory(target.parent_path());
+}
+
+void transport_service::Part_File::publish() {
+    close_file();
+    std::filesystem::rename(part_path, target);
+}
+
+void transport_service::Part_File::discard() {
+    close_file();
+    std::error_code ec;
+    std::filesystem::remove(part_path, ec);
+}
+
+transport_service::Commit_Batch::~Commit_Batch() {
+    for (auto &entry : entries) {
+        entry.file.discard();
+    }
+}
+
+void transport_service::Commit_Batch::add(
+    Part_File &&file,
+    const std::uint64_t size,
+    std::function<void()> on_commit
+) {
+    file.start_writeback();
+    entries.push_back(Entry{std::move(file), std::move(on_commit)});
+    pending_bytes += size;
+    if (entries.size() >= COMMIT_BATCH_FILES || pending_bytes >= COMMIT_BATCH_BYTES) {
+        flush();
+    }
+}
+
+void transport_service::Commit_Batch::flush() {
+    if (entries.empty()) {
+        return;
+    }
+    if (entries.size() == 1) {
+        entries.front().file.commit();
+    } else {
+        std::vector<std::filesystem::path> part_paths;
+        std::set<std::filesystem::path> directories;
+        for (const auto &entry : entries) {
+            part_paths.push_back(entry.file.get_path());
+            const auto directory = entry.file.get_target().parent_path();
+            directories.insert(directory.empty() ? "." : directory);
+        }
+        sync_filesystems(part_paths);
+        for (auto &entry : entries) {
+            entry.file.publish();
+        }
+        sync_filesystems({directories.begin(), directories.end()});
+    }
+    // Файлы уже на своих местах, поэтому пачка очищается до вызова
+    // обработчиков: их исключение не приведёт к удалению файлов.
+    std::vector<Entry> committed = std::move(entries);
+    entries.clear();
+    pending_bytes = 0;
+    for (auto &entry : committed) {
+        if (entry.on_commit) {
+            entry.on_commit();
+        }
+    }
+}
+
+std::size_t transport_service::Commit_Batch::get_pending() const {
+    return entries.size();
+}
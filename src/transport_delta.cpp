@@ -0,0 +1,392 @@
+#include "transport_delta.hpp"
+#include <openssl/evp.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+#include <unistd.h>
+
+namespace {
+constexpr char SIGNATURES_MAGIC[] = "DRS1";
+constexpr std::size_t SIGNATURES_MAGIC_SIZE = sizeof(SIGNATURES_MAGIC) - 1;
+constexpr std::size_t SIGNATURE_SIZE = 4 + DELTA_STRONG_HASH_SIZE;
+constexpr char COPY_OP = 'C';
+constexpr char LITERAL_OP = 'L';
+constexpr std::size_t COPY_OP_SIZE = 1 + 8 + 4;
+constexpr std::size_t LITERAL_OP_SIZE = 1 + 4;
+
+template <typename T>
+void put_le(std::string &out, T value) {
+    for (std::size_t i = 0; i < sizeof(T); ++i) {
+        out.push_back(static_cast<char>(value & 0xFF));
+        value >>= 8;
+    }
+}
+
+template <typename T>
+T get_le(const char *data) {
+    T value = 0;
+    for (std::size_t i = sizeof(T); i > 0; --i) {
+        value = (value << 8) | static_cast<unsigned char>(data[i - 1]);
+    }
+    return value;
+}
+}  // namespace
+
+std::uint32_t transport_service::delta_block_size(const std::uint64_t file_size) {
+    const auto root = static_cast<std::uint64_t>(std::sqrt(static_cast<double>(file_size)));
+    // Кратность 1 KiB, чтобы блоки старой копии читались ровными кусками.
+    const std::uint64_t rounded = (root + 1023) / 1024 * 1024;
+    return static_cast<std::uint32_t>(
+        std::clamp<std::uint64_t>(rounded, DELTA_MIN_BLOCK_SIZE, DELTA_MAX_BLOCK_SIZE)
+    );
+}
+
+void transport_service::Rolling_Checksum::reset(const char *data, const std::size_t size) {
+    a = 0;
+    b = 0;
+    window = static_cast<std::uint32_t>(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        a += static_cast<unsigned char>(data[i]);
+        b += static_cast<std::uint32_t>(size - i) * static_cast<unsigned char>(data[i]);
+    }
+}
+
+void transport_service::Rolling_Checksum::roll(const unsigned char out, const unsigned char in) {
+    a += in - out;
+    b += a - window * out;
+}
+
+std::uint32_t transport_service::Rolling_Checksum::value() const {
+    return (a & 0xFFFF) | (b << 16);
+}
+
+transport_service::Strong_Hash
+transport_service::strong_hash(const char *data, const std::size_t size) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_size = 0;
+    if (EVP_Digest(data, size, digest, &digest_size, EVP_sha1(), nullptr) != 1) {
+        throw std::runtime_error("Failed to hash delta block");
+    }
+    Strong_Hash hash{};
+    std::copy_n(digest, hash.size(), hash.begin());
+    return hash;
+}
+
+transport_service::Delta_Signatures
+transport_service::Delta_Signatures::compute(const std::string &path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+    const auto file_size = static_cast<std::uint64_t>(file.tellg());
+    file.seekg(0);
+
+    Delta_Signatures signatures;
+    signatures.block_size = delta_block_size(file_size);
+    const std::uint64_t block_count = file_size / signatures.block_size;
+    signatures.weak.reserve(block_count);
+    signatures.strong.reserve(block_count);
+
+    std::string block(signatures.block_size, '\0');
+    Rolling_Checksum checksum;
+    for (std::uint64_t i = 0; i < block_count; ++i) {
+        if (!file.read(block.data(), static_cast<std::streamsize>(block.size()))) {
+            throw std::runtime_error("Failed to read file: " + path);
+        }
+        checksum.reset(block.data(), block.size());
+        signatures.weak.push_back(checksum.value());
+        signatures.strong.push_back(strong_hash(block.data(), block.size()));
+    }
+    return signatures;
+}
+
+std::string transport_service::Delta_Signatures::serialize() const {
+    std::string out(SIGNATURES_MAGIC, SIGNATURES_MAGIC_SIZE);
+    out.reserve(SIGNATURES_MAGIC_SIZE + 8 + weak.size() * SIGNATURE_SIZE);
+    put_le(out, block_size);
+    put_le(out, static_cast<std::uint32_t>(weak.size()));
+    for (std::size_t i = 0; i < weak.size(); ++i) {
+        put_le(out, weak[i]);
+        out.append(reinterpret_cast<const char *>(strong[i].data()), strong[i].size());
+    }
+    return out;
+}
+
+std::optional<transport_service::Delta_Signatures>
+transport_service::Delta_Signatures::parse(const std::string_view data) {
+    constexpr std::size_t header_size = SIGNATURES_MAGIC_SIZE + 8;
+    if (data.size() < header_size ||
+        data.substr(0, SIGNATURES_MAGIC_SIZE) != SIGNATURES_MAGIC) {
+        return std::nullopt;
+    }
+    Delta_Signatures signatures;
+    signatures.block_size = get_le<std::uint32_t>(data.data() + SIGNATURES_MAGIC_SIZE);
+    const auto count = get_le<std::uint32_t>(data.data() + SIGNATURES_MAGIC_SIZE + 4);
+    if (signatures.block_size < DELTA_MIN_BLOCK_SIZE ||
+        signatures.block_size > DELTA_MAX_BLOCK_SIZE ||
+        data.size() != header_size + static_cast<std::uint64_t>(count) * SIGNATURE_SIZE) {
+        return std::nullopt;
+    }
+    signatures.weak.reserve(count);
+    signatures.strong.reserve(count);
+    for (const char *p = data.data() + header_size; p != data.data() + data.size();
+         p += SIGNATURE_SIZE) {
+        signatures.weak.push_back(get_le<std::uint32_t>(p));
+        Strong_Hash hash{};
+        std::memcpy(hash.data(), p + 4, hash.size());
+        signatures.strong.push_back(hash);
+    }
+    return signatures;
+}
+
+transport_service::Delta_Encoder::Delta_Encoder(
+    const char *m_data,
+    const std::size_t m_size,
+    const Delta_Signatures &m_signatures
+)
+    : data(m_data), size(m_size), signatures(m_signatures) {
+    index_blocks();
+}
+
+transport_service::Delta_Encoder::Delta_Encoder(
+    const int m_fd,
+    const std::size_t m_size,
+    const Delta_Signatures &m_signatures
+)
+    : fd(m_fd), data(nullptr), size(m_size), signatures(m_signatures) {
+    index_blocks();
+}
+
+void transport_service::Delta_Encoder::index_blocks() {
+    blocks_by_weak.reserve(signatures.weak.size());
+    for (std::uint32_t i = 0; i < signatures.weak.size(); ++i) {
+        blocks_by_weak.emplace(signatures.weak[i], i);
+    }
+}
+
+const char *transport_service::Delta_Encoder::at(const std::size_t offset) const {
+    return data + (offset - base);
+}
+
+void transport_service::Delta_Encoder::fill(const std::size_t end) {
+    if (fd < 0) {
+        return;
+    }
+    if (literal_start > base) {
+        const std::size_t drop = std::min(literal_start - base, window.size());
+        window.erase(window.begin(), window.begin() + static_cast<std::ptrdiff_t>(drop));
+        base += drop;
+    }
+    std::size_t filled = window.size();
+    if (base + filled < end) {
+        window.resize(end - base);
+    }
+    while (filled < window.size()) {
+        const ssize_t read = ::pread(
+            fd, window.data() + filled, window.size() - filled,
+            static_cast<off_t>(base + filled)
+        );
+        if (read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "pread");
+        }
+        if (read == 0) {
+            throw std::runtime_error("File was truncated while building delta");
+        }
+        filled += static_cast<std::size_t>(read);
+    }
+    data = window.data();
+}
+
+std::optional<std::uint32_t> transport_service::Delta_Encoder::find_block() const {
+    const auto [begin, end] = blocks_by_weak.equal_range(checksum.value());
+    if (begin == end) {
+        return std::nullopt;
+    }
+    const Strong_Hash hash = strong_hash(at(pos), signatures.block_size);
+    std::optional<std::uint32_t> found;
+    for (auto it = begin; it != end; ++it) {
+        if (signatures.strong[it->second] != hash) {
+            continue;
+        }
+        // Продолжение текущей серии копирования предпочтительнее:
+        // соседние блоки сливаются в одну команду.
+        if (copy_count > 0 && it->second == copy_first + copy_count) {
+            return it->second;
+        }
+        if (!found) {
+            found = it->second;
+        }
+    }
+    return found;
+}
+
+void transport_service::Delta_Encoder::flush_copy(const Sink &sink) {
+    if (copy_count == 0) {
+        return;
+    }
+    std::string op(1, COPY_OP);
+    put_le(op, copy_first);
+    put_le(op, copy_count);
+    sink(op.data(), op.size());
+    copied_bytes += static_cast<std::uint64_t>(copy_count) * signatures.block_size;
+    copy_count = 0;
+}
+
+void transport_service::Delta_Encoder::flush_literal(const std::size_t end, const Sink &sink) {
+    if (literal_start == end) {
+        return;
+    }
+    flush_copy(sink);
+    std::string op(1, LITERAL_OP);
+    put_le(op, static_cast<std::uint32_t>(end - literal_start));
+    sink(op.data(), op.size());
+    sink(at(literal_start), end - literal_start);
+    literal_start = end;
+}
+
+bool transport_service::Delta_Encoder::step(const Sink &sink) {
+    const std::size_t block_size = signatures.block_size;
+    std::size_t budget = DELTA_STEP_SIZE;
+    // За порцию pos уходит не дальше чем на budget + block_size, и
+    // дальше читается ещё один блок.
+    if (pos < size) {
+        fill(std::min(size, pos + budget + 2 * block_size));
+    }
+    while (budget > 0 && !blocks_by_weak.empty() && pos + block_size <= size) {
+        if (!is_checksum_valid) {
+            checksum.reset(at(pos), block_size);
+            is_checksum_valid = true;
+        }
+        if (const auto block = find_block()) {
+            flush_literal(pos, sink);
+            if (copy_count == 0 || *block != copy_first + copy_count) {
+                flush_copy(sink);
+                copy_first = *block;
+            }
+            ++copy_count;
+            pos += block_size;
+            literal_start = pos;
+            is_checksum_valid = false;
+            budget -= std::min(budget, block_size);
+            continue;
+        }
+        if (pos + block_size < size) {
+            checksum.roll(
+                static_cast<unsigned char>(*at(pos)),
+                static_cast<unsigned char>(*at(pos + block_size))
+            );
+        } else {
+            is_checksum_valid = false;
+        }
+        ++pos;
+        --budget;
+        if (pos - literal_start >= DELTA_MAX_LITERAL) {
+            flush_literal(pos, sink);
+        }
+    }
+    if (budget == 0) {
+        return true;
+    }
+    // Совпадений больше быть не может: хвост уходит литералами.
+    pos = size;
+    fill(std::min(size, literal_start + budget + DELTA_MAX_LITERAL));
+    while (budget > 0 && literal_start < size) {
+        const std::size_t end = std::min<std::size_t>(size, literal_start + DELTA_MAX_LITERAL);
+        budget -= std::min(budget, end - literal_start);
+        flush_literal(end, sink);
+    }
+    if (literal_start < size) {
+        return true;
+    }
+    flush_copy(sink);
+    return false;
+}
+
+std::uint64_t transport_service::Delta_Encoder::get_copied_bytes() const {
+    return copied_bytes;
+}
+
+transport_service::Delta_Decoder::Delta_Decoder(
+    const int m_basis_fd,
+    const std::uint32_t m_block_size
+)
+    : basis_fd(m_basis_fd), block_size(m_block_size) {
+}
+
+void transport_service::Delta_Decoder::copy_blocks(
+    const std::uint64_t first,
+    const std::uint32_t count,
+    const Sink &sink
+) const {
+    std::vector<char> buffer(std::min<std::uint64_t>(
+        static_cast<std::uint64_t>(count) * block_size, CODEC_BUFFER_SIZE
+    ));
+    std::uint64_t offset = first * block_size;
+    std::uint64_t remaining = static_cast<std::uint64_t>(count) * block_size;
+    while (remaining > 0) {
+        const auto want = static_cast<std::size_t>(std::min<std::uint64_t>(remaining, buffer.size()));
+        const ssize_t read =
+            ::pread(basis_fd, buffer.data(), want, static_cast<off_t>(offset));
+        if (read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category());
+        }
+        if (read == 0) {
+            throw std::runtime_error("Delta refers past the end of the local copy");
+        }
+        sink(buffer.data(), static_cast<std::size_t>(read));
+        offset += static_cast<std::uint64_t>(read);
+        remaining -= static_cast<std::uint64_t>(read);
+    }
+}
+
+void transport_service::Delta_Decoder::write(const char *data, std::size_t size, const Sink &sink) {
+    while (size > 0) {
+        if (literal_remaining > 0) {
+            const std::size_t take = std::min<std::size_t>(literal_remaining, size);
+            sink(data, take);
+            data += take;
+            size -= take;
+            literal_remaining -= static_cast<std::uint32_t>(take);
+            continue;
+        }
+        if (header.empty()) {
+            if (*data != COPY_OP && *data != LITERAL_OP) {
+                throw std::runtime_error("Malformed delta stream");
+            }
+        }
+        const std::size_t op_size = (header.empty() ? *data : header[0]) == COPY_OP
+                                        ? COPY_OP_SIZE
+                                        : LITERAL_OP_SIZE;
+        const std::size_t take = std::min(op_size - header.size(), size);
+        header.append(data, take);
+        data += take;
+        size -= take;
+        if (header.size() < op_size) {
+            continue;
+        }
+        if (header[0] == COPY_OP) {
+            copy_blocks(
+                get_le<std::uint64_t>(header.data() + 1),
+                get_le<std::uint32_t>(header.data() + 9),
+                sink
+            );
+        } else {
+            literal_remaining = get_le<std::uint32_t>(header.data() + 1);
+        }
+        header.clear();
+    }
+}
+
+bool transport_service::Delta_Decoder::is_idle() const {
+    return header.empty() && literal_remaining == 0;
+}
@@ -0,0 +1,265 @@
+#include "transport_file_io.hpp"
+#include "transport_commit.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#ifdef DECREP_HAS_IO_URING
+#include <boost/asio/read_at.hpp>
+#endif
+#include <cerrno>
+#include <system_error>
+#include <utility>
+
+namespace net = boost::asio;
+
+namespace {
+#ifndef DECREP_HAS_IO_URING
+// pread ровно size байт с учётом частичного чтения и EINTR.
+void read_all_at(const int fd, char *data, std::size_t size, std::uint64_t offset) {
+    while (size > 0) {
+        const ssize_t read = ::pread(fd, data, size, static_cast<off_t>(offset));
+        if (read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "pread");
+        }
+        if (read == 0) {
+            throw std::runtime_error("Unexpected end of file");
+        }
+        data += read;
+        size -= static_cast<std::size_t>(read);
+        offset += static_cast<std::uint64_t>(read);
+    }
+}
+#endif
+}  // namespace
+
+bool transport_service::has_io_uring() {
+#ifdef DECREP_HAS_IO_URING
+    return true;
+#else
+    return false;
+#endif
+}
+
+transport_service::File_Io_Pool &transport_service::File_Io_Pool::get_instance() {
+    static File_Io_Pool instance;
+    return instance;
+}
+
+net::thread_pool::executor_type transport_service::File_Io_Pool::get_executor() {
+    return pool.get_executor();
+}
+
+#ifdef DECREP_HAS_IO_URING
+transport_service::Async_File::Async_File(
+    const net::any_io_executor &executor,
+    const std::string &path
+)
+    : file(executor, path, net::random_access_file::read_only) {
+}
+
+transport_service::Async_File::~Async_File() = default;
+
+net::awaitable<void> transport_service::Async_File::read_at(
+    const std::uint64_t offset,
+    char *data,
+    const std::size_t size
+) {
+    co_await net::async_read_at(file, offset, net::buffer(data, size), net::use_awaitable);
+}
+#else
+transport_service::Async_File::Async_File(const net::any_io_executor &, const std::string &path)
+    : fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC)) {
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "Could not open file: " + path);
+    }
+}
+
+transport_service::Async_File::~Async_File() {
+    ::close(fd);
+}
+
+net::awaitable<void> transport_service::Async_File::read_at(
+    const std::uint64_t offset,
+    char *data,
+    const std::size_t size
+) {
+    co_await net::co_spawn(
+        File_Io_Pool::get_instance().get_executor(),
+        [this, offset, data, size]() -> net::awaitable<void> {
+            read_all_at(fd, data, size, offset);
+            co_return;
+        },
+        net::use_awaitable
+    );
+}
+#endif
+
+struct transport_service::File_Prefetcher::State {
+    const net::any_io_executor executor;
+    Async_File file;
+    const std::size_t block_size;
+    std::vector<char> blocks[2];
+    std::uint64_t offset;
+    std::uint64_t remaining;
+    // Блок, в который идёт (или уже закончилось) последнее чтение.
+    std::size_t index = 1;
+    std::size_t size = 0;
+    bool is_pending = false;
+    bool is_ready = false;
+    std::exception_ptr error;
+    // Отменой таймера завершённое чтение будит next().
+    net::steady_timer wakeup;
+
+    State(
+        const net::any_io_executor &m_executor,
+        const std::string &path,
+        const std::uint64_t m_offset,
+        const std::uint64_t length,
+        const std::size_t m_block_size
+    )
+        : executor(m_executor),
+          file(m_executor, path),
+          block_size(m_block_size),
+          offset(m_offset),
+          remaining(length),
+          wakeup(m_executor) {
+    }
+};
+
+transport_service::File_Prefetcher::File_Prefetcher(
+    const net::any_io_executor &executor,
+    const std::string &path,
+    const std::uint64_t offset,
+    const std::uint64_t length,
+    const std::size_t block_size
+)
+    : state(std::make_shared<State>(executor, path, offset, length, block_size)) {
+    start_read();
+}
+
+void transport_service::File_Prefetcher::start_read() {
+    if (state->remaining == 0) {
+        return;
+    }
+    state->index ^= 1;
+    state->size = static_cast<std::size_t>(
+        std::min<std::uint64_t>(state->remaining, state->block_size)
+    );
+    state->blocks[state->index].resize(state->size);
+    state->is_pending = true;
+    net::co_spawn(
+        state->executor,
+        [state = state, data = state->blocks[state->index].data(), offset = state->offset,
+         size = state->size]() -> net::awaitable<void> {
+            co_await state->file.read_at(offset, data, size);
+        },
+        [state = state](const std::exception_ptr &e) {
+            state->error = e;
+            state->is_ready = !e;
+            state->is_pending = false;
+            state->wakeup.cancel();
+        }
+    );
+    state->offset += state->size;
+    state->remaining -= state->size;
+}
+
+net::awaitable<std::string_view> transport_service::File_Prefetcher::next() {
+    while (state->is_pending) {
+        boost::system::error_code ec;
+        state->wakeup.expires_at(net::steady_timer::time_point::max());
+        co_await state->wakeup.async_wait(net::redirect_error(net::use_awaitable, ec));
+    }
+    if (state->error) {
+        std::rethrow_exception(std::exchange(state->error, nullptr));
+    }
+    if (!state->is_ready) {
+        co_return std::string_view{};
+    }
+    state->is_ready = false;
+    const std::string_view block(state->blocks[state->index].data(), state->size);
+    start_read();
+    co_return block;
+}
+
+transport_service::Write_Behind::Write_Behind(
+    const int m_fd,
+    const std::uint64_t m_offset,
+    const std::size_t m_block_size
+)
+    : fd(m_fd), offset(m_offset), block_size(m_block_size) {
+    current.reserve(block_size);
+}
+
+transport_service::Write_Behind::~Write_Behind() {
+    for (auto &block : in_flight) {
+        block.done.wait();
+    }
+}
+
+void transport_service::Write_Behind::write(const char *data, std::size_t size) {
+    while (size > 0) {
+        const std::size_t n = std::min(size, block_size - current.size());
+        current.insert(current.end(), data, data + n);
+        data += n;
+        size -= n;
+        if (current.size() == block_size) {
+            submit();
+        }
+    }
+}
+
+void transport_service::Write_Behind::submit() {
+    if (in_flight.size() >= WRITE_BEHIND_DEPTH) {
+        wait_oldest();
+    }
+    std::packaged_task<void()> task(
+        [fd = fd, data = current.data(), size = current.size(), offset = offset] {
+            write_all_at(fd, data, size, offset);
+        }
+    );
+    std::future<void> done = task.get_future();
+    net::post(File_Io_Pool::get_instance().get_executor(), std::move(task));
+    offset += current.size();
+    in_flight.push_back(Block{std::move(current), std::move(done)});
+
+    if (spare.empty()) {
+        current = std::vector<char>();
+        current.reserve(block_size);
+    } else {
+        current = std::move(spare.back());
+        spare.pop_back();
+        current.clear();
+    }
+}
+
+void transport_service::Write_Behind::wait_oldest() {
+    Block block = std::move(in_flight.front());
+    in_flight.pop_front();
+    block.done.get();
+    spare.push_back(std::move(block.data));
+}
+
+void transport_service::Write_Behind::drain() {
+    if (in_flight.empty()) {
+        // Файл меньше блока пишется сразу, без пересылки в пул.
+        write_all_at(fd, current.data(), current.size(), offset);
+        offset += current.size();
+        current.clear();
+        return;
+    }
+    if (!current.empty()) {
+        submit();
+    }
+    while (!in_flight.empty()) {
+        wait_oldest();
+    }
+}
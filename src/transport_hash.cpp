@@ -0,0 +1,405 @@
+#include "transport_hash.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+using Chaining_Value = transport_service::Blake3_Hasher::Chaining_Value;
+using Block_Words = std::array<std::uint32_t, 16>;
+
+constexpr std::size_t BLAKE3_BLOCK_LEN = 64;
+constexpr std::size_t BLAKE3_CHUNK_LEN = 1024;
+constexpr std::uint32_t CHUNK_START = 1 << 0;
+constexpr std::uint32_t CHUNK_END = 1 << 1;
+constexpr std::uint32_t PARENT = 1 << 2;
+constexpr std::uint32_t ROOT = 1 << 3;
+
+constexpr Chaining_Value IV = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+constexpr std::array<std::size_t, 16> MSG_PERMUTATION = {
+    2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8,
+};
+
+// Порядок слов сообщения в каждом из 7 раундов: перестановка применяется
+// заранее, а не копированием блока между раундами.
+constexpr auto MSG_SCHEDULE = [] {
+    std::array<std::array<std::size_t, 16>, 7> schedule{};
+    for (std::size_t i = 0; i < 16; ++i) {
+        schedule[0][i] = i;
+    }
+    for (std::size_t round = 1; round < schedule.size(); ++round) {
+        for (std::size_t i = 0; i < 16; ++i) {
+            schedule[round][i] = schedule[round - 1][MSG_PERMUTATION[i]];
+        }
+    }
+    return schedule;
+}();
+
+inline void g(
+    std::array<std::uint32_t, 16> &state,
+    const std::size_t a,
+    const std::size_t b,
+    const std::size_t c,
+    const std::size_t d,
+    const std::uint32_t mx,
+    const std::uint32_t my
+) {
+    state[a] = state[a] + state[b] + mx;
+    state[d] = std::rotr(state[d] ^ state[a], 16);
+    state[c] = state[c] + state[d];
+    state[b] = std::rotr(state[b] ^ state[c], 12);
+    state[a] = state[a] + state[b] + my;
+    state[d] = std::rotr(state[d] ^ state[a], 8);
+    state[c] = state[c] + state[d];
+    state[b] = std::rotr(state[b] ^ state[c], 7);
+}
+
+void round_function(
+    std::array<std::uint32_t, 16> &state,
+    const Block_Words &m,
+    const std::array<std::size_t, 16> &s
+) {
+    g(state, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+    g(state, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+    g(state, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+    g(state, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+    g(state, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+    g(state, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+    g(state, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+    g(state, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+}
+
+std::array<std::uint32_t, 16> compress(
+    const Chaining_Value &cv,
+    const Block_Words &block,
+    const std::uint64_t counter,
+    const std::uint32_t block_len,
+    const std::uint32_t flags
+) {
+    std::array<std::uint32_t, 16> state = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        IV[0], IV[1], IV[2], IV[3],
+        static_cast<std::uint32_t>(counter),
+        static_cast<std::uint32_t>(counter >> 32),
+        block_len, flags,
+    };
+    for (const auto &schedule : MSG_SCHEDULE) {
+        round_function(state, block, schedule);
+    }
+    for (std::size_t i = 0; i < 8; ++i) {
+        state[i] ^= state[i + 8];
+        state[i + 8] ^= cv[i];
+    }
+    return state;
+}
+
+Block_Words words_from_bytes(const std::uint8_t *bytes) {
+    Block_Words words;
+    for (std::size_t i = 0; i < words.size(); ++i) {
+        words[i] = static_cast<std::uint32_t>(bytes[4 * i]) |
+                   static_cast<std::uint32_t>(bytes[4 * i + 1]) << 8 |
+                   static_cast<std::uint32_t>(bytes[4 * i + 2]) << 16 |
+                   static_cast<std::uint32_t>(bytes[4 * i + 3]) << 24;
+    }
+    return words;
+}
+
+Chaining_Value first_eight(const std::array<std::uint32_t, 16> &words) {
+    Chaining_Value cv;
+    std::copy_n(words.begin(), cv.size(), cv.begin());
+    return cv;
+}
+
+std::string to_hex(const unsigned char *bytes, const std::size_t size) {
+    std::ostringstream oss;
+    oss << std::hex << std::setfill('0');
+    for (std::size_t i = 0; i < size; ++i) {
+        oss << std::setw(2) << static_cast<unsigned int>(bytes[i]);
+    }
+    return oss.str();
+}
+
+struct File_Guard {
+    const int fd;
+
+    ~File_Guard() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+};
+
+// Буфер чтения, выровненный под страницу.
+struct Aligned_Buffer {
+    std::unique_ptr<char, decltype(&std::free)> data;
+
+    Aligned_Buffer()
+        : data(
+              static_cast<char *>(
+                  std::aligned_alloc(HASH_READ_ALIGNMENT, HASH_READ_BLOCK_SIZE)
+              ),
+              &std::free
+          ) {
+        if (!data) {
+            throw std::bad_alloc();
+        }
+    }
+};
+
+// Подаёт в sink байты [offset, offset + length) файла.
+void read_range(
+    const int fd,
+    std::uint64_t offset,
+    std::uint64_t length,
+    const std::function<void(const char *, std::size_t)> &sink
+) {
+    const Aligned_Buffer buffer;
+    while (length > 0) {
+        const auto to_read = static_cast<std::size_t>(
+            std::min<std::uint64_t>(length, HASH_READ_BLOCK_SIZE)
+        );
+        const ssize_t read = ::pread(
+            fd, buffer.data.get(), to_read, static_cast<off_t>(offset)
+        );
+        if (read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read <= 0) {
+            throw std::runtime_error("Failed to read file while hashing");
+        }
+        sink(buffer.data.get(), static_cast<std::size_t>(read));
+        offset += static_cast<std::uint64_t>(read);
+        length -= static_cast<std::uint64_t>(read);
+    }
+}
+
+// Узел дерева BLAKE3 над [offset, offset + length). Левое поддерево -
+// наибольшая степень двойки чанков меньше length, как в самом BLAKE3,
+// поэтому поддеревья независимы и считаются в разных потоках.
+transport_service::Blake3_Hasher::Output blake3_subtree(
+    const int fd,
+    const std::uint64_t offset,
+    const std::uint64_t length,
+    const unsigned threads
+) {
+    if (threads <= 1 || length <= BLAKE3_PARALLEL_MIN_SIZE) {
+        transport_service::Blake3_Hasher hasher(offset / BLAKE3_CHUNK_LEN);
+        read_range(fd, offset, length, [&hasher](const char *data, std::size_t size) {
+            hasher.update(data, size);
+        });
+        return hasher.finalize_output();
+    }
+
+    const std::uint64_t chunks = (length + BLAKE3_CHUNK_LEN - 1) / BLAKE3_CHUNK_LEN;
+    const std::uint64_t left_length = std::bit_floor(chunks - 1) * BLAKE3_CHUNK_LEN;
+    auto left = std::async(
+        std::launch::async, blake3_subtree, fd, offset, left_length, threads / 2
+    );
+    const auto right = blake3_subtree(
+        fd, offset + left_length, length - left_length, threads - threads / 2
+    );
+    return transport_service::Blake3_Hasher::parent_output(
+        left.get().chaining_value(), right.chaining_value()
+    );
+}
+}  // namespace
+
+Chaining_Value transport_service::Blake3_Hasher::Output::chaining_value() const {
+    return first_eight(compress(input_cv, block_words, counter, block_len, flags));
+}
+
+std::array<std::uint8_t, 32> transport_service::Blake3_Hasher::Output::root_hash() const {
+    const auto words = compress(input_cv, block_words, 0, block_len, flags | ROOT);
+    std::array<std::uint8_t, 32> bytes;
+    for (std::size_t i = 0; i < 8; ++i) {
+        for (std::size_t j = 0; j < 4; ++j) {
+            bytes[4 * i + j] = static_cast<std::uint8_t>(words[i] >> (8 * j));
+        }
+    }
+    return bytes;
+}
+
+transport_service::Blake3_Hasher::Output transport_service::Blake3_Hasher::parent_output(
+    const Chaining_Value &left,
+    const Chaining_Value &right
+) {
+    Block_Words block_words;
+    std::copy(left.begin(), left.end(), block_words.begin());
+    std::copy(right.begin(), right.end(), block_words.begin() + 8);
+    return Output{IV, block_words, 0, BLAKE3_BLOCK_LEN, PARENT};
+}
+
+transport_service::Blake3_Hasher::Chunk_State::Chunk_State(
+    const Chaining_Value &key,
+    const std::uint64_t counter
+)
+    : cv(key), chunk_counter(counter) {
+}
+
+std::size_t transport_service::Blake3_Hasher::Chunk_State::len() const {
+    return BLAKE3_BLOCK_LEN * blocks_compressed + block_len;
+}
+
+std::uint32_t transport_service::Blake3_Hasher::Chunk_State::start_flag() const {
+    return blocks_compressed == 0 ? CHUNK_START : 0;
+}
+
+void transport_service::Blake3_Hasher::Chunk_State::update(
+    const std::uint8_t *input,
+    std::size_t size
+) {
+    while (size > 0) {
+        // Последний блок чанка сжимается только в output(): с флагом CHUNK_END.
+        if (block_len == BLAKE3_BLOCK_LEN) {
+            cv = first_eight(compress(
+                cv, words_from_bytes(block.data()), chunk_counter,
+                BLAKE3_BLOCK_LEN, start_flag()
+            ));
+            ++blocks_compressed;
+            block.fill(0);
+            block_len = 0;
+        }
+        const std::size_t take = std::min(BLAKE3_BLOCK_LEN - block_len, size);
+        std::memcpy(block.data() + block_len, input, take);
+        block_len = static_cast<std::uint8_t>(block_len + take);
+        input += take;
+        size -= take;
+    }
+}
+
+transport_service::Blake3_Hasher::Output
+transport_service::Blake3_Hasher::Chunk_State::output() const {
+    return Output{
+        cv, words_from_bytes(block.data()), chunk_counter, block_len,
+        start_flag() | CHUNK_END};
+}
+
+transport_service::Blake3_Hasher::Blake3_Hasher(const std::uint64_t m_first_chunk)
+    : first_chunk(m_first_chunk), chunk_state(IV, m_first_chunk) {
+}
+
+void transport_service::Blake3_Hasher::push_cv(
+    Chaining_Value cv,
+    std::uint64_t total_chunks
+) {
+    // Число завершённых поддеревьев равно числу единиц в total_chunks:
+    // каждый нулевой младший бит - ещё одно слияние с вершиной стека.
+    while ((total_chunks & 1) == 0) {
+        cv = parent_output(cv_stack[--cv_stack_len], cv).chaining_value();
+        total_chunks >>= 1;
+    }
+    cv_stack[cv_stack_len++] = cv;
+}
+
+void transport_service::Blake3_Hasher::update(const char *data, std::size_t size) {
+    const auto *input = reinterpret_cast<const std::uint8_t *>(data);
+    while (size > 0) {
+        if (chunk_state.len() == BLAKE3_CHUNK_LEN) {
+            const std::uint64_t next_chunk = chunk_state.chunk_counter + 1;
+            // Слияния считаются от начала поддерева, а не от начала файла.
+            push_cv(chunk_state.output().chaining_value(), next_chunk - first_chunk);
+            chunk_state = Chunk_State(IV, next_chunk);
+        }
+        const std::size_t take = std::min(BLAKE3_CHUNK_LEN - chunk_state.len(), size);
+        chunk_state.update(input, take);
+        input += take;
+        size -= take;
+    }
+}
+
+transport_service::Blake3_Hasher::Output
+transport_service::Blake3_Hasher::finalize_output() const {
+    Output output = chunk_state.output();
+    for (std::size_t i = cv_stack_len; i > 0; --i) {
+        output = parent_output(cv_stack[i - 1], output.chaining_value());
+    }
+    return output;
+}
+
+transport_service::Hasher::Hasher(const Hash_Algorithm m_algorithm)
+    : algorithm(m_algorithm), evp(nullptr, &EVP_MD_CTX_free) {
+    if (algorithm == Hash_Algorithm::blake3) {
+        blake3 = std::make_unique<Blake3_Hasher>();
+        return;
+    }
+    evp.reset(EVP_MD_CTX_new());
+    const EVP_MD *md = algorithm == Hash_Algorithm::sha1 ? EVP_sha1() : EVP_sha256();
+    if (!evp || EVP_DigestInit_ex(evp.get(), md, nullptr) != 1) {
+        throw std::runtime_error("Failed to initialize digest");
+    }
+}
+
+void transport_service::Hasher::update(const char *data, const std::size_t size) {
+    if (blake3) {
+        blake3->update(data, size);
+    } else if (EVP_DigestUpdate(evp.get(), data, size) != 1) {
+        throw std::runtime_error("Failed to update digest");
+    }
+}
+
+std::string transport_service::Hasher::hex_digest() {
+    if (blake3) {
+        const auto hash = blake3->finalize_output().root_hash();
+        return to_hex(hash.data(), hash.size());
+    }
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int size = 0;
+    if (EVP_DigestFinal_ex(evp.get(), digest, &size) != 1) {
+        throw std::runtime_error("Failed to finalize digest");
+    }
+    return to_hex(digest, size);
+}
+
+std::string transport_service::sha1_to_etag(const std::string &sha1_hex) {
+    std::string etag = sha1_hex;
+    for (std::size_t word = 0; word + 8 <= etag.size(); word += 8) {
+        for (std::size_t i = 0; i < 4; i += 2) {
+            std::swap(etag[word + i], etag[word + 6 - i]);
+            std::swap(etag[word + i + 1], etag[word + 7 - i]);
+        }
+    }
+    return etag;
+}
+
+std::string transport_service::hash_file(
+    const std::string &path,
+    const Hash_Algorithm algorithm,
+    unsigned threads
+) {
+    const File_Guard file{::open(path.c_str(), O_RDONLY)};
+    const int fd = file.fd;
+    if (fd < 0) {
+        return {};
+    }
+    const off_t size = ::lseek(fd, 0, SEEK_END);
+    if (size < 0) {
+        return {};
+    }
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if (algorithm == Hash_Algorithm::blake3) {
+        if (threads == 0) {
+            threads = std::max(1U, std::thread::hardware_concurrency());
+        }
+        const auto hash =
+            blake3_subtree(fd, 0, static_cast<std::uint64_t>(size), threads).root_hash();
+        return to_hex(hash.data(), hash.size());
+    }
+
+    Hasher hasher(algorithm);
+    read_range(fd, 0, static_cast<std::uint64_t>(size), [&hasher](const char *data, std::size_t read) {
+        hasher.update(data, read);
+    });
+    return hasher.hex_digest();
+}
@@ -0,0 +1,176 @@
+#include "transport_logger.hpp"
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+const char *level_name(const transport_service::Log_Level level) {
+    switch (level) {
+        case transport_service::Log_Level::request:
+            return "REQUEST";
+        case transport_service::Log_Level::info:
+            return "INFO";
+        case transport_service::Log_Level::warning:
+            return "WARNING";
+        case transport_service::Log_Level::error:
+            return "ERROR";
+    }
+    return "INFO";
+}
+}  // namespace
+
+transport_service::Log_Queue::Log_Queue(const std::size_t capacity)
+    : mask(capacity - 1), slots(new Slot[capacity]) {
+    if (capacity < 2 || (capacity & mask) != 0) {
+        throw std::invalid_argument("Log queue capacity must be a power of two");
+    }
+    for (std::size_t i = 0; i < capacity; ++i) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool transport_service::Log_Queue::push(Log_Record &&record) {
+    std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    Slot *slot = nullptr;
+    for (;;) {
+        slot = &slots[pos & mask];
+        const std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        const auto diff =
+            static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+        if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    slot->record = std::move(record);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool transport_service::Log_Queue::pop(Log_Record &record) {
+    Slot &slot = slots[dequeue_pos & mask];
+    if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos + 1) {
+        return false;
+    }
+    record = std::move(slot.record);
+    slot.sequence.store(dequeue_pos + mask + 1, std::memory_order_release);
+    ++dequeue_pos;
+    return true;
+}
+
+transport_service::Server_Logger::Server_Logger(
+    std::string m_log_file_name,
+    const std::size_t queue_capacity
+)
+    : log_file_name(std::move(m_log_file_name)), queue(queue_capacity) {
+    log_file.open(log_file_name.c_str());
+    if (!log_file) {
+        std::cerr << "Could not open log file" << std::endl;
+    }
+    flusher = std::thread(&Server_Logger::run, this);
+}
+
+transport_service::Server_Logger::~Server_Logger() {
+    is_stopping = true;
+    flusher.join();
+}
+
+void transport_service::Server_Logger::log(const std::string &message) const {
+    log(Log_Level::info, message);
+}
+
+void transport_service::Server_Logger::log(const Log_Level level, std::string message)
+    const {
+    if (level < min_level.load(std::memory_order_relaxed)) {
+        return;
+    }
+    if (level == Log_Level::request) {
+        const unsigned every_n = sample_rate.load(std::memory_order_relaxed);
+        if (every_n > 1 &&
+            request_count.fetch_add(1, std::memory_order_relaxed) % every_n != 0) {
+            return;
+        }
+    }
+    if (queue.push(Log_Record{std::chrono::system_clock::now(), level, std::move(message)})) {
+        pushed.fetch_add(1, std::memory_order_release);
+    } else {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void transport_service::Server_Logger::set_level(const Log_Level level) {
+    min_level = level;
+}
+
+void transport_service::Server_Logger::set_sample_rate(const unsigned every_n) {
+    sample_rate = every_n > 0 ? every_n : 1;
+}
+
+void transport_service::Server_Logger::flush() const {
+    const std::uint64_t target = pushed.load(std::memory_order_acquire);
+    while (written.load(std::memory_order_acquire) < target) {
+        std::this_thread::sleep_for(LOG_FLUSH_INTERVAL / 10);
+    }
+}
+
+std::uint64_t transport_service::Server_Logger::get_dropped() const {
+    return dropped.load(std::memory_order_relaxed);
+}
+
+void transport_service::Server_Logger::write_record(const Log_Record &record) {
+    const auto since_epoch = record.time.time_since_epoch();
+    const std::time_t seconds =
+        std::chrono::duration_cast<std::chrono::seconds>(since_epoch).count();
+    const auto millis =
+        std::chrono::duration_cast<std::chrono::milliseconds>(since_epoch).count() % 1000;
+    // localtime_r заметно дороже самой записи, дата пересчитывается раз в секунду.
+    if (seconds != stamp_seconds) {
+        std::tm tm{};
+        localtime_r(&seconds, &tm);
+        char buffer[32];
+        stamp.assign(buffer, std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm));
+        stamp_seconds = seconds;
+    }
+    char fraction[8];
+    std::snprintf(fraction, sizeof(fraction), ".%03d ", static_cast<int>(millis));
+
+    // Старые сообщения заканчиваются переводом строки, второй не нужен.
+    std::string_view message = record.message;
+    while (!message.empty() && message.back() == '\n') {
+        message.remove_suffix(1);
+    }
+    log_file << stamp << fraction << level_name(record.level) << ' ' << message << '\n';
+}
+
+void transport_service::Server_Logger::run() {
+    Log_Record record;
+    for (;;) {
+        // Флаг читается до опустошения очереди: всё, что положено до
+        // остановки, будет записано.
+        const bool stopping = is_stopping.load(std::memory_order_acquire);
+        std::uint64_t batch = 0;
+        while (queue.pop(record)) {
+            if (log_file.is_open()) {
+                write_record(record);
+            }
+            ++batch;
+        }
+        if (batch > 0) {
+            log_file.flush();
+            written.fetch_add(batch, std::memory_order_release);
+        }
+        if (stopping) {
+            return;
+        }
+        if (batch == 0) {
+            std::this_thread::sleep_for(LOG_FLUSH_INTERVAL);
+        }
+    }
+}
@@ -0,0 +1,193 @@
+#include "transport_merkle.hpp"
+#include <openssl/evp.h>
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+
+namespace {
+constexpr unsigned char LEAF_PREFIX = 0;
+constexpr unsigned char NODE_PREFIX = 1;
+constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+transport_service::Piece_Hash digest(
+    const unsigned char prefix,
+    const void *first,
+    const std::size_t first_size,
+    const void *second = nullptr,
+    const std::size_t second_size = 0
+) {
+    const std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(
+        EVP_MD_CTX_new(), EVP_MD_CTX_free
+    );
+    transport_service::Piece_Hash hash{};
+    if (!ctx || EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr) != 1 ||
+        EVP_DigestUpdate(ctx.get(), &prefix, 1) != 1 ||
+        EVP_DigestUpdate(ctx.get(), first, first_size) != 1 ||
+        (second_size > 0 &&
+         EVP_DigestUpdate(ctx.get(), second, second_size) != 1) ||
+        EVP_DigestFinal_ex(ctx.get(), hash.data(), nullptr) != 1) {
+        throw std::runtime_error("Failed to compute piece hash");
+    }
+    return hash;
+}
+
+std::string to_hex(const transport_service::Piece_Hash &hash) {
+    std::string hex;
+    hex.reserve(hash.size() * 2);
+    for (const unsigned char byte : hash) {
+        hex.push_back(HEX_DIGITS[byte >> 4]);
+        hex.push_back(HEX_DIGITS[byte & 0xF]);
+    }
+    return hex;
+}
+
+std::optional<transport_service::Piece_Hash> from_hex(const std::string_view hex) {
+    transport_service::Piece_Hash hash{};
+    if (hex.size() != hash.size() * 2) {
+        return std::nullopt;
+    }
+    for (std::size_t i = 0; i < hash.size(); ++i) {
+        const auto [ptr, ec] =
+            std::from_chars(hex.data() + 2 * i, hex.data() + 2 * i + 2, hash[i], 16);
+        if (ec != std::errc{} || ptr != hex.data() + 2 * i + 2) {
+            return std::nullopt;
+        }
+    }
+    return hash;
+}
+
+bool parse_number(const std::string_view text, std::uint64_t &value) {
+    const auto [ptr, ec] =
+        std::from_chars(text.data(), text.data() + text.size(), value);
+    return ec == std::errc{} && ptr == text.data() + text.size();
+}
+}  // namespace
+
+transport_service::Piece_Hash
+transport_service::Merkle_Tree::hash_piece(const char *data, const std::size_t size) {
+    return digest(LEAF_PREFIX, data, size);
+}
+
+transport_service::Merkle_Tree transport_service::Merkle_Tree::build(
+    const std::string &path,
+    const std::uint64_t piece_size
+) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+    Merkle_Tree tree;
+    tree.piece_size = piece_size;
+    tree.file_size = static_cast<std::uint64_t>(file.tellg());
+    file.seekg(0);
+
+    tree.leaves.reserve(tree.piece_count());
+    std::vector<char> piece(static_cast<std::size_t>(
+        std::min(piece_size, std::max<std::uint64_t>(tree.file_size, 1))
+    ));
+    for (std::size_t i = 0; i < tree.piece_count(); ++i) {
+        const auto length = static_cast<std::size_t>(tree.piece_length(i));
+        if (!file.read(piece.data(), static_cast<std::streamsize>(length))) {
+            throw std::runtime_error("Failed to read file: " + path);
+        }
+        tree.leaves.push_back(hash_piece(piece.data(), length));
+    }
+    return tree;
+}
+
+std::string transport_service::Merkle_Tree::serialize() const {
+    std::string out =
+        std::to_string(piece_size) + ' ' + std::to_string(file_size) + '\n';
+    out.reserve(out.size() + leaves.size() * (MERKLE_HASH_SIZE * 2 + 1));
+    for (const auto &leaf : leaves) {
+        out += to_hex(leaf);
+        out += '\n';
+    }
+    return out;
+}
+
+std::optional<transport_service::Merkle_Tree>
+transport_service::Merkle_Tree::parse(const std::string_view data) {
+    std::size_t pos = data.find('\n');
+    if (pos == std::string_view::npos) {
+        return std::nullopt;
+    }
+    const std::string_view header = data.substr(0, pos);
+    const std::size_t space = header.find(' ');
+    Merkle_Tree tree;
+    if (space == std::string_view::npos ||
+        !parse_number(header.substr(0, space), tree.piece_size) ||
+        !parse_number(header.substr(space + 1), tree.file_size) ||
+        tree.piece_size == 0) {
+        return std::nullopt;
+    }
+
+    ++pos;
+    const std::size_t count = tree.piece_count();
+    const std::size_t line_size = MERKLE_HASH_SIZE * 2 + 1;
+    if ((data.size() - pos) % line_size != 0 ||
+        (data.size() - pos) / line_size != count) {
+        return std::nullopt;
+    }
+    tree.leaves.reserve(count);
+    for (; pos < data.size(); pos += line_size) {
+        const auto leaf = from_hex(data.substr(pos, MERKLE_HASH_SIZE * 2));
+        if (!leaf || data[pos + MERKLE_HASH_SIZE * 2] != '\n') {
+            return std::nullopt;
+        }
+        tree.leaves.push_back(*leaf);
+    }
+    return tree;
+}
+
+std::string transport_service::Merkle_Tree::root() const {
+    if (leaves.empty()) {
+        return to_hex(hash_piece(nullptr, 0));
+    }
+    std::vector<Piece_Hash> level = leaves;
+    while (level.size() > 1) {
+        std::vector<Piece_Hash> parents;
+        parents.reserve((level.size() + 1) / 2);
+        for (std::size_t i = 0; i + 1 < level.size(); i += 2) {
+            parents.push_back(digest(
+                NODE_PREFIX, level[i].data(), level[i].size(),
+                level[i + 1].data(), level[i + 1].size()
+            ));
+        }
+        if (level.size() % 2 != 0) {
+            parents.push_back(level.back());
+        }
+        level = std::move(parents);
+    }
+    return to_hex(level.front());
+}
+
+std::uint64_t transport_service::Merkle_Tree::get_piece_size() const {
+    return piece_size;
+}
+
+std::uint64_t transport_service::Merkle_Tree::get_file_size() const {
+    return file_size;
+}
+
+std::size_t transport_service::Merkle_Tree::piece_count() const {
+    return static_cast<std::size_t>(
+        file_size / piece_size + (file_size % piece_size != 0)
+    );
+}
+
+std::uint64_t transport_service::Merkle_Tree::piece_length(const std::size_t index
+) const {
+    return std::min(piece_size, file_size - index * piece_size);
+}
+
+bool transport_service::Merkle_Tree::verify_piece(
+    const std::size_t index,
+    const char *data,
+    const std::size_t size
+) const {
+    return index < leaves.size() && size == piece_length(index) &&
+           hash_piece(data, size) == leaves[index];
+}
@@ -1,7 +1,25 @@
 #include "transport_service.hpp"
 #include <boost/iostreams/filter/zlib.hpp>
-#include <boost/uuid.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <fcntl.h>
+#include <filesystem>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
 
 namespace beast = boost::beast;
 namespace http = beast::http;
@@ -10,247 +28,3124 @@ namespace ssl = net::ssl;
 namespace zlib = boost::iostreams::zlib;
 using tcp = net::ip::tcp;
 
+namespace {
+// Скорость канала по последней несжатой загрузке в Мбит/с, 0 - неизвестна.
+// Сжатые загрузки не учитываются: их скорость упирается в deflate сервера.
+std::atomic<std::uint64_t> observed_link_speed_mbps = 0;
+
+using transport_service::Byte_Range;
+using transport_service::Tls_Stream;
+using transport_service::Traffic_Class;
+
+transport_service::Tls_Stream connect_to_server(
+    net::io_context &ioc,
+    const std::string &server_address
+) {
+    auto &certificates = transport_service::Certificate_Singleton::get_instance();
+    tcp::resolver resolver(ioc);
+    const auto results =
+        resolver.resolve(server_address, std::to_string(SERVER_PORT));
+
+    Tls_Stream stream(ioc, certificates.get_client_context());
+    if (!SSL_set_tlsext_host_name(
+            stream.native_handle(), server_address.c_str()
+        )) {
+        beast::error_code ec{
+            static_cast<int>(::ERR_get_error()),
+            net::error::get_ssl_category()};
+        throw beast::system_error{ec};
+    }
+    if (const auto session = certificates.find_session(server_address)) {
+        SSL_set_session(stream.native_handle(), session.get());
+    }
+
+    beast::get_lowest_layer(stream).connect(results);
+    // Запрос и ответ - короткие записи подряд; с Nagle каждая ждала бы
+    // отложенного ACK собеседника.
+    beast::get_lowest_layer(stream).socket().set_option(tcp::no_delay(true));
+    stream.handshake(ssl::stream_base::client);
+    return stream;
+}
+
+void shutdown_stream(Tls_Stream &stream) {
+    beast::error_code ec;
+    stream.shutdown(ec);
+    if (ec == net::error::eof) {
+        ec = {};
+    }
+    if (ec == ssl::error::stream_truncated) {
+        ec = {};
+    }
+    if (ec) {
+        throw beast::system_error{ec};
+    }
+}
+
+std::string peer_address(Tls_Stream &stream) {
+    beast::error_code ec;
+    const auto endpoint =
+        beast::get_lowest_layer(stream).socket().remote_endpoint(ec);
+    return ec ? std::string() : endpoint.address().to_string();
+}
+
+// Ждёт, пока ограничитель исходящей полосы пропустит bytes байт.
+net::awaitable<void> throttle_upload(
+    Tls_Stream &stream,
+    const Traffic_Class traffic_class,
+    const std::size_t bytes
+) {
+    auto &shaper = transport_service::Bandwidth_Shaper::get_instance(
+        transport_service::Traffic_Direction::upload
+    );
+    if (!shaper.is_limited()) {
+        co_return;
+    }
+    const std::string peer = peer_address(stream);
+    std::optional<net::steady_timer> timer;
+    for (auto delay = shaper.reserve(peer, traffic_class, bytes);
+         delay > std::chrono::steady_clock::duration::zero();
+         delay = shaper.reserve(peer, traffic_class, bytes)) {
+        if (!timer) {
+            timer.emplace(co_await net::this_coro::executor);
+        }
+        timer->expires_after(delay);
+        co_await timer->async_wait(net::use_awaitable);
+    }
+}
+
+// Пишет data в поток. При ограничении полосы - порциями
+// STREAM_BLOCK_SIZE, чтобы большая запись не занимала канал целиком
+// и мелкие файлы могли пройти между порциями.
+net::awaitable<void> write_shaped(
+    Tls_Stream &stream,
+    net::const_buffer data,
+    const Traffic_Class traffic_class
+) {
+    const auto &shaper = transport_service::Bandwidth_Shaper::get_instance(
+        transport_service::Traffic_Direction::upload
+    );
+    if (!shaper.is_limited()) {
+        co_await net::async_write(stream, data, net::use_awaitable);
+        co_return;
+    }
+    while (data.size() > 0) {
+        const std::size_t size =
+            std::min<std::size_t>(data.size(), STREAM_BLOCK_SIZE);
+        co_await throttle_upload(stream, traffic_class, size);
+        co_await net::async_write(
+            stream, net::buffer(data.data(), size), net::use_awaitable
+        );
+        data += size;
+    }
+}
+
+// Учитывает прочитанные из соединения байты во входящей полосе:
+// пока клиент ждёт, TCP сдерживает отправителя.
+void throttle_download(
+    Tls_Stream &stream,
+    const Traffic_Class traffic_class,
+    const std::size_t bytes
+) {
+    auto &shaper = transport_service::Bandwidth_Shaper::get_instance(
+        transport_service::Traffic_Direction::download
+    );
+    if (shaper.is_limited()) {
+        shaper.wait(peer_address(stream), traffic_class, bytes);
+    }
+}
+
+// Размер файла из X-File-Size, если сервер его прислал.
+template <typename Parser>
+std::optional<std::uint64_t> response_file_size(const Parser &parser) {
+    const auto size_header = parser.get()["X-File-Size"];
+    std::uint64_t size = 0;
+    const auto [ptr, ec] = std::from_chars(
+        size_header.data(), size_header.data() + size_header.size(), size
+    );
+    if (size_header.empty() || ec != std::errc{}) {
+        return std::nullopt;
+    }
+    return size;
+}
+
+// Класс ответа с файлом: по X-File-Size, а без него - по длине тела.
+template <typename Parser>
+Traffic_Class response_traffic_class(const Parser &parser) {
+    const std::uint64_t size = response_file_size(parser).value_or(
+        parser.content_length().value_or(
+            std::numeric_limits<std::uint64_t>::max()
+        )
+    );
+    return transport_service::traffic_class_for_size(size);
+}
+
+// Отправляет запрос по соединению из пула и читает заголовок ответа.
+// Простаивавшее соединение сервер мог закрыть: если ответ на нём так
+// и не начался, запрос повторяется по следующему, в конце - по новому.
+template <typename Request, typename Parser>
+transport_service::Connection_Pool::Lease send_pooled(
+    const std::string &server_address,
+    const Request &req,
+    beast::flat_buffer &buffer,
+    Parser &parser
+) {
+    for (;;) {
+        auto connection =
+            transport_service::Connection_Pool::get_instance().acquire(
+                server_address
+            );
+        beast::error_code ec;
+        http::write(connection.get_stream(), req, ec);
+        if (!ec) {
+            http::read_header(connection.get_stream(), buffer, parser, ec);
+        }
+        if (!ec) {
+            return connection;
+        }
+        if (!connection.is_reused() || parser.got_some()) {
+            throw beast::system_error{ec};
+        }
+        buffer.clear();
+    }
+}
+
+// Собирает файл по манифесту. Чанки, которые уже есть в локальных файлах,
+// берутся с диска, а подряд идущие недостающие докачиваются одним
+// Range-запросом по тому же соединению. If-Range гарантирует, что все
+// байты относятся к той версии файла, для которой получен манифест.
+void fetch_chunks(
+    Tls_Stream &stream,
+    beast::flat_buffer &buffer,
+    const std::string &server_address,
+    const std::string &target,
+    const std::string &etag,
+    const std::vector<transport_service::Chunk> &chunks,
+    const transport_service::Sink &sink
+) {
+    auto &store = transport_service::Chunk_Store::get_instance();
+    const auto traffic_class = transport_service::traffic_class_for_size(
+        chunks.empty() ? 0 : chunks.back().offset + chunks.back().length
+    );
+    std::vector<char> block(STREAM_BLOCK_SIZE);
+    // Каждый чанк читается из хранилища один раз: найденный после серии
+    // недостающих отдаётся в sink уже после их докачки.
+    const auto read_local = [&](const std::size_t i) {
+        return i < chunks.size() ? store.read(chunks[i]) : std::nullopt;
+    };
+    std::size_t i = 0;
+    std::optional<std::string> local = read_local(i);
+    while (i < chunks.size()) {
+        if (local) {
+            sink(local->data(), local->size());
+            local = read_local(++i);
+            continue;
+        }
+        const std::uint64_t offset = chunks[i].offset;
+        std::uint64_t length = 0;
+        do {
+            length += chunks[i].length;
+            local = read_local(++i);
+        } while (i < chunks.size() && !local);
+
+        http::request<http::empty_body> req{http::verb::get, target, 11};
+        req.set(http::field::host, server_address);
+        req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+        req.set(
+            http::field::range, "bytes=" + std::to_string(offset) + "-" +
+                                    std::to_string(offset + length - 1)
+        );
+        req.set(http::field::if_range, etag);
+        http::write(stream, req);
+
+        http::response_parser<http::buffer_body> parser;
+        parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+        http::read_header(stream, buffer, parser);
+        if (parser.get().result() != http::status::partial_content) {
+            throw std::runtime_error("File changed while fetching chunks");
+        }
+        while (!parser.is_done()) {
+            parser.get().body().data = block.data();
+            parser.get().body().size = block.size();
+
+            beast::error_code ec;
+            http::read(stream, buffer, parser, ec);
+            if (ec == http::error::need_buffer) {
+                ec = {};
+            }
+            if (ec) {
+                throw beast::system_error{ec};
+            }
+            const std::size_t received =
+                block.size() - parser.get().body().size;
+            throttle_download(stream, traffic_class, received);
+            sink(block.data(), received);
+        }
+    }
+}
+
+// Закрывает дескриптор при выходе из области видимости.
+struct File_Descriptor {
+    int fd;
+
+    explicit File_Descriptor(const int m_fd) : fd(m_fd) {
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category());
+        }
+    }
+
+    ~File_Descriptor() {
+        ::close(fd);
+    }
+
+    File_Descriptor(const File_Descriptor &) = delete;
+    File_Descriptor &operator=(const File_Descriptor &) = delete;
+};
+
+// Дочитывает в hasher первые length байт уже скачанной части файла.
+void hash_file_prefix(
+    const std::string &file_path,
+    std::uint64_t length,
+    transport_service::Sha1_Hasher &hasher
+) {
+    std::ifstream file(file_path, std::ios::binary);
+    std::vector<char> block(STREAM_BLOCK_SIZE);
+    while (length > 0) {
+        const auto to_read = static_cast<std::size_t>(
+            std::min<std::uint64_t>(length, block.size())
+        );
+        file.read(block.data(), static_cast<std::streamsize>(to_read));
+        if (static_cast<std::size_t>(file.gcount()) != to_read) {
+            throw std::runtime_error("Partial file is shorter than journal");
+        }
+        hasher.update(block.data(), to_read);
+        length -= to_read;
+    }
+}
+
+// Сжимает файл целиком в артефакт кэша и фиксирует его.
+void build_artifact(
+    const std::string &file_path,
+    transport_service::Encoder &encoder,
+    transport_service::Artifact_Cache::Builder &builder
+) {
+    const transport_service::Sink append = [&builder](const char *data, std::size_t size) {
+        builder.write(data, size);
+    };
+    std::ifstream file(file_path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Could not open file: " + file_path);
+    }
+    std::vector<char> block(STREAM_BLOCK_SIZE);
+    while (file.read(block.data(), static_cast<std::streamsize>(block.size())) ||
+           file.gcount() > 0) {
+        encoder.write(block.data(), static_cast<std::size_t>(file.gcount()), append);
+    }
+    encoder.finish(append);
+    builder.commit();
+}
+
+// Окно файла, отображённое в память только для чтения.
+class Mapped_Window {
+private:
+    void *mapping = MAP_FAILED;
+    std::size_t mapping_size = 0;
+    std::size_t page_offset = 0;
+
+public:
+    Mapped_Window(const int fd, const std::uint64_t offset, const std::size_t size) {
+        const auto page_size = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+        const std::uint64_t aligned_offset = offset - offset % page_size;
+        page_offset = static_cast<std::size_t>(offset - aligned_offset);
+        mapping_size = size + page_offset;
+        mapping = ::mmap(
+            nullptr, mapping_size, PROT_READ, MAP_SHARED, fd,
+            static_cast<off_t>(aligned_offset)
+        );
+        if (mapping != MAP_FAILED) {
+            ::madvise(mapping, mapping_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+        }
+    }
+
+    ~Mapped_Window() {
+        if (mapping != MAP_FAILED) {
+            ::munmap(mapping, mapping_size);
+        }
+    }
+
+    Mapped_Window(const Mapped_Window &) = delete;
+    Mapped_Window &operator=(const Mapped_Window &) = delete;
+
+    [[nodiscard]] bool is_mapped() const {
+        return mapping != MAP_FAILED;
+    }
+
+    [[nodiscard]] const char *data() const {
+        return static_cast<const char *>(mapping) + page_offset;
+    }
+};
+
+// Отправляет диапазон из окон файла, отображённых в память, и
+// возвращает число отправленных байт. TLS всё равно копирует байты в
+// свои буферы, выигрыш только в отсутствии чтения в буфер приложения.
+// Перед каждым окном размер файла сверяется через fstat: обращение
+// к странице за концом усечённого файла - это SIGBUS. Если файл стал
+// короче окна или отобразить его не удалось, отправка останавливается,
+// и остаток дочитывает pread. Проверка не закрывает усечение посреди
+// окна, поэтому отображение включается только явно.
+net::awaitable<std::uint64_t> send_mapped_range(
+    Tls_Stream &stream,
+    const std::string &file_path,
+    const Byte_Range range,
+    const Traffic_Class traffic_class
+) {
+    const File_Descriptor file(::open(file_path.c_str(), O_RDONLY));
+    std::uint64_t sent = 0;
+    while (sent < range.length) {
+        const auto window_size = static_cast<std::size_t>(
+            std::min<std::uint64_t>(MAPPED_WINDOW_SIZE, range.length - sent)
+        );
+        struct stat file_stat {};
+        if (file.fd < 0 || ::fstat(file.fd, &file_stat) != 0 ||
+            static_cast<std::uint64_t>(file_stat.st_size) <
+                range.offset + sent + window_size) {
+            break;
+        }
+        const Mapped_Window window(file.fd, range.offset + sent, window_size);
+        if (!window.is_mapped()) {
+            break;
+        }
+        co_await write_shaped(
+            stream, net::buffer(window.data(), window_size), traffic_class
+        );
+        sent += window_size;
+    }
+    co_return sent;
+}
+
+// Отправляет байты файла из диапазона как есть. Файл читается блоками
+// STREAM_BLOCK_SIZE с опережением на блок, не занимая сетевой поток
+// ожиданием диска; с memory_mapped - из отображённых окон, пока файл
+// не стал короче диапазона. Если файл укоротился, ответ обрывается
+// исключением "Unexpected end of file".
+net::awaitable<void> send_file_range(
+    Tls_Stream &stream,
+    const std::string &file_path,
+    Byte_Range range,
+    const bool memory_mapped,
+    const Traffic_Class traffic_class
+) {
+    if (memory_mapped && range.length > 0) {
+        const std::uint64_t sent = co_await send_mapped_range(
+            stream, file_path, range, traffic_class
+        );
+        range.offset += sent;
+        range.length -= sent;
+    }
+    if (range.length == 0) {
+        co_return;
+    }
+
+    transport_service::File_Prefetcher reader(
+        co_await net::this_coro::executor, file_path, range.offset,
+        range.length, STREAM_BLOCK_SIZE
+    );
+    for (auto block = co_await reader.next(); !block.empty();
+         block = co_await reader.next()) {
+        co_await throttle_upload(stream, traffic_class, block.size());
+        co_await net::async_write(
+            stream, net::buffer(block.data(), block.size()),
+            net::use_awaitable
+        );
+    }
+}
+
+// Дочитывает ответ на GET файла, заголовок которого уже прочитан:
+// распаковывает, хеширует и пишет во временный файл, а после проверки
+// ETag передаёт его в batch, который переименует его в out_path. Если
+// файл не получен, ответ всё равно дочитывается, чтобы соединением
+// можно было пользоваться дальше.
+bool receive_file(
+    Tls_Stream &stream,
+    beast::flat_buffer &buffer,
+    http::response_parser<http::buffer_body> &parser,
+    const std::string &out_path,
+    transport_service::Commit_Batch &batch
+) {
+    const auto &header = parser.get().base();
+    const std::string_view encoding = header[http::field::content_encoding];
+    std::unique_ptr<transport_service::Decoder> decoder;
+    if (!encoding.empty() && encoding != RAW_ENCODING) {
+        decoder = transport_service::make_decoder(encoding);
+    }
+    const bool is_ok = header.result() == http::status::ok &&
+                       (decoder || encoding.empty() || encoding == RAW_ENCODING);
+    const auto traffic_class = response_traffic_class(parser);
+
+    std::optional<transport_service::Part_File> out_file;
+    std::optional<transport_service::Write_Behind> writer;
+    if (is_ok) {
+        out_file.emplace(out_path);
+        out_file->preallocate(response_file_size(parser).value_or(0));
+        writer.emplace(out_file->get_fd(), 0, STREAM_BLOCK_SIZE);
+    }
+    transport_service::Sha1_Hasher hasher;
+    std::uint64_t offset = 0;
+    const transport_service::Sink write_out = [&](const char *data,
+                                                  const std::size_t size) {
+        writer->write(data, size);
+        hasher.update(data, size);
+        offset += size;
+    };
+
+    // Без журнала оборванную загрузку не докачать, а временный файл
+    // никто не удалит: при ошибке он удаляется сразу.
+    try {
+        std::vector<char> block(STREAM_BLOCK_SIZE);
+        while (!parser.is_done()) {
+            parser.get().body().data = block.data();
+            parser.get().body().size = block.size();
+
+            beast::error_code ec;
+            http::read(stream, buffer, parser, ec);
+            if (ec == http::error::need_buffer) {
+                ec = {};
+            }
+            if (ec) {
+                throw beast::system_error{ec};
+            }
+
+            const std::size_t received = block.size() - parser.get().body().size;
+            throttle_download(stream, traffic_class, received);
+            if (!is_ok || received == 0) {
+                continue;
+            }
+            if (decoder) {
+                decoder->write(block.data(), received, write_out);
+            } else {
+                write_out(block.data(), received);
+            }
+        }
+        if (writer) {
+            writer->drain();
+        }
+    } catch (...) {
+        writer.reset();
+        if (out_file) {
+            out_file->discard();
+        }
+        throw;
+    }
+
+    if (!is_ok) {
+        std::cerr << "Error: " << out_path << ": " << header.result() << " - "
+                  << header.reason() << std::endl;
+        return false;
+    }
+    const std::string hash = hasher.etag();
+    if ((decoder && !decoder->is_done()) || header[http::field::etag] != hash) {
+        out_file->discard();
+        std::cerr << "File doesn't match expected hash: " << out_path
+                  << std::endl;
+        return false;
+    }
+    batch.add(std::move(*out_file), offset, [out_path, hash] {
+        transport_service::Hash_Index::get_instance().record(out_path, hash);
+        std::cout << "File downloaded successfully: " << out_path << std::endl;
+    });
+    return true;
+}
+
+// Скачивает один диапазон файла по уже открытому соединению и по порядку
+// отдаёт его байты в sink. С etag диапазон запрашивается через If-Range.
+// is_cancelled проверяется после каждого блока; false, если загрузка
+// прервана - тогда в соединении остался непрочитанный ответ и его
+// нужно закрыть.
+bool fetch_range(
+    Tls_Stream &stream,
+    beast::flat_buffer &buffer,
+    const std::string &server_address,
+    const std::string &file_name,
+    const Byte_Range &range,
+    const transport_service::Sink &sink,
+    const std::string &etag = {},
+    const std::function<bool()> &is_cancelled = {}
+) {
+    http::request<http::empty_body> req{http::verb::get, "/" + file_name, 11};
+    req.set(http::field::host, server_address);
+    req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+    req.set(
+        http::field::range,
+        "bytes=" + std::to_string(range.offset) + "-" +
+            std::to_string(range.offset + range.length - 1)
+    );
+    if (!etag.empty()) {
+        req.set(http::field::if_range, etag);
+    }
+    req.keep_alive(true);
+    http::write(stream, req);
+
+    http::response_parser<http::buffer_body> parser;
+    parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+    http::read_header(stream, buffer, parser);
+    if (parser.get().result() != http::status::partial_content) {
+        throw std::runtime_error(
+            "Unexpected response to range request: " +
+            std::to_string(parser.get().result_int())
+        );
+    }
+
+    std::vector<char> block(STREAM_BLOCK_SIZE);
+    std::uint64_t received_total = 0;
+    while (!parser.is_done()) {
+        parser.get().body().data = block.data();
+        parser.get().body().size = block.size();
+
+        beast::error_code ec;
+        http::read(stream, buffer, parser, ec);
+        if (ec == http::error::need_buffer) {
+            ec = {};
+        }
+        if (ec) {
+            throw beast::system_error{ec};
+        }
+
+        const std::size_t received = block.size() - parser.get().body().size;
+        if (received_total + received > range.length) {
+            throw std::runtime_error("Range response is too long");
+        }
+        throttle_download(stream, Traffic_Class::bulk, received);
+        sink(block.data(), received);
+        received_total += received;
+        if (is_cancelled && !parser.is_done() && is_cancelled()) {
+            return false;
+        }
+    }
+    if (received_total != range.length) {
+        throw std::runtime_error("Range response is truncated");
+    }
+    return true;
+}
+
+// Версия файла у одного пира по ответу на HEAD.
+struct Peer_File {
+    std::string address;
+    std::string etag;
+    std::uint64_t size = 0;
+    // Пир умеет отдавать дерево Меркла файла.
+    bool has_merkle_tree = false;
+};
+
+std::optional<Peer_File> probe_peer(
+    const std::string &address,
+    const std::string &file_name,
+    const unsigned long local_clock
+) {
+    net::io_context ioc;
+    Tls_Stream stream = connect_to_server(ioc, address);
+
+    http::request<http::empty_body> req{
+        http::verb::head, "/" + file_name, 11};
+    req.set(http::field::host, address);
+    req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+    req.set("X-File-Version", std::to_string(local_clock));
+    http::write(stream, req);
+
+    beast::flat_buffer buffer;
+    http::response_parser<http::empty_body> parser;
+    parser.skip(true);
+    http::read(stream, buffer, parser);
+    shutdown_stream(stream);
+
+    const auto &header = parser.get().base();
+    if (header.result() != http::status::ok || !parser.content_length() ||
+        header[http::field::etag].empty()) {
+        return std::nullopt;
+    }
+    return Peer_File{
+        address, std::string(header[http::field::etag]),
+        *parser.content_length(),
+        header.find("X-Merkle-Piece-Size") != header.end()};
+}
+
+// Дерево Меркла той версии файла, которую пир показал на HEAD;
+// nullopt - пир его не отдал.
+std::optional<transport_service::Merkle_Tree> fetch_merkle_tree(
+    const Peer_File &peer,
+    const std::string &file_name
+) {
+    net::io_context ioc;
+    Tls_Stream stream = connect_to_server(ioc, peer.address);
+
+    http::request<http::empty_body> req{http::verb::get, "/" + file_name, 11};
+    req.set(http::field::host, peer.address);
+    req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+    req.set("X-Transfer-Mode", MERKLE_TRANSFER_MODE);
+    http::write(stream, req);
+
+    beast::flat_buffer buffer;
+    http::response_parser<http::string_body> parser;
+    parser.body_limit(MAX_REQUEST_BODY_SIZE);
+    http::read(stream, buffer, parser);
+    shutdown_stream(stream);
+
+    const auto &res = parser.get();
+    if (res.result() != http::status::ok ||
+        res["X-Transfer-Mode"] != MERKLE_TRANSFER_MODE ||
+        res[http::field::etag] != peer.etag) {
+        return std::nullopt;
+    }
+    auto tree = transport_service::Merkle_Tree::parse(res.body());
+    if (!tree || tree->get_file_size() != peer.size) {
+        return std::nullopt;
+    }
+    return tree;
+}
+
+std::string read_artifact(const transport_service::Cached_Artifact &artifact) {
+    if (artifact.data) {
+        return *artifact.data;
+    }
+    std::ifstream in(artifact.file->path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(in), {}};
+}
+
+// Просит сервер скачать файл у нас (POST), large включает параллельную закачку.
+void request_pull(
+    const std::string &server_address,
+    const std::string &file_name,
+    const std::string &file_path,
+    const bool large
+) {
+    net::io_context ioc;
+    Tls_Stream stream = connect_to_server(ioc, server_address);
+
+    http::request<http::string_body> req{
+        http::verb::post, file_path + "/" + file_name, 11};
+    req.set(http::field::host, server_address);
+    req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+    if (large) {
+        req.set("X-Large-File", "1");
+    }
+
+    http::write(stream, req);
+
+    beast::flat_buffer buffer;
+    http::response<http::dynamic_body> res;
+    http::read(stream, buffer, res);
+    if (res.result() != http::status::ok) {
+        std::cerr << "Error: " << res.result() << " - " << res.reason()
+                  << std::endl;
+    }
+
+    shutdown_stream(stream);
+}
+}  // namespace
+
+int transport_service::Certificate_Singleton::save_session(
+    SSL *ssl,
+    SSL_SESSION *session
+) {
+    // Клиент всегда передаёт адрес сервера в SNI (connect_to_server).
+    const char *address = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (address == nullptr) {
+        return 0;
+    }
+    Certificate_Singleton &instance = get_instance();
+    const std::lock_guard lock(instance.session_mutex);
+    instance.client_sessions.insert_or_assign(
+        address, Session_Ptr(session, SSL_SESSION_free)
+    );
+    return 1;
+}
+
+transport_service::Certificate_Singleton::Session_Ptr
+transport_service::Certificate_Singleton::find_session(const std::string &address
+) {
+    const std::lock_guard lock(session_mutex);
+    const auto it = client_sessions.find(address);
+    if (it == client_sessions.end() ||
+        !SSL_SESSION_is_resumable(it->second.get())) {
+        return {nullptr, SSL_SESSION_free};
+    }
+    SSL_SESSION_up_ref(it->second.get());
+    return {it->second.get(), SSL_SESSION_free};
+}
+
+void transport_service::Certificate_Singleton::forget_sessions() {
+    const std::lock_guard lock(session_mutex);
+    client_sessions.clear();
+}
+
+namespace {
+// Закрывает простаивающее соединение с обменом close_notify, чтобы
+// сервер не считал его оборванным.
+void close_idle_stream(Tls_Stream &stream) {
+    beast::error_code ec;
+    stream.shutdown(ec);
+}
+
+// Простаивающее соединение не должно ничего получать: данные или EOF
+// означают, что сервер его закрыл.
+bool is_alive(Tls_Stream &stream) {
+    char byte = 0;
+    const ssize_t received = ::recv(
+        beast::get_lowest_layer(stream).socket().native_handle(), &byte, 1,
+        MSG_PEEK | MSG_DONTWAIT
+    );
+    return received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+}  // namespace
+
+transport_service::Connection_Pool::Lease::Lease(
+    Connection_Pool &m_pool,
+    std::string m_address,
+    std::unique_ptr<Tls_Stream> m_stream,
+    const bool m_reused
+)
+    : pool(&m_pool),
+      address(std::move(m_address)),
+      stream(std::move(m_stream)),
+      reused(m_reused) {
+}
+
+transport_service::Connection_Pool::Lease::~Lease() {
+    // Не возвращённое соединение могло остаться посреди ответа.
+    if (stream) {
+        beast::get_lowest_layer(*stream).close();
+    }
+}
+
+transport_service::Tls_Stream &
+transport_service::Connection_Pool::Lease::get_stream() const {
+    return *stream;
+}
+
+bool transport_service::Connection_Pool::Lease::is_reused() const {
+    return reused;
+}
+
+void transport_service::Connection_Pool::Lease::release() {
+    if (stream) {
+        pool->put(address, std::move(stream));
+    }
+}
+
+transport_service::Connection_Pool &
+transport_service::Connection_Pool::get_instance() {
+    static Connection_Pool instance;
+    return instance;
+}
+
+void transport_service::Connection_Pool::put(
+    const std::string &address,
+    std::unique_ptr<Tls_Stream> stream
+) {
+    {
+        const std::lock_guard lock(mutex);
+        auto &connections = idle[address];
+        if (connections.size() < CONNECTION_POOL_MAX_IDLE) {
+            connections.push_back(
+                Idle_Connection{std::move(stream), std::chrono::steady_clock::now()}
+            );
+            return;
+        }
+    }
+    close_idle_stream(*stream);
+}
+
+transport_service::Connection_Pool::Lease
+transport_service::Connection_Pool::acquire(const std::string &address) {
+    std::vector<Idle_Connection> stale;
+    std::unique_ptr<Tls_Stream> stream;
+    {
+        const std::lock_guard lock(mutex);
+        const auto it = idle.find(address);
+        // Последнее возвращённое соединение - самое свежее.
+        while (it != idle.end() && !it->second.empty() && !stream) {
+            Idle_Connection connection = std::move(it->second.back());
+            it->second.pop_back();
+            if (std::chrono::steady_clock::now() - connection.since <
+                    CONNECTION_POOL_IDLE_TIMEOUT &&
+                is_alive(*connection.stream)) {
+                stream = std::move(connection.stream);
+            } else {
+                stale.push_back(std::move(connection));
+            }
+        }
+    }
+    for (auto &connection : stale) {
+        close_idle_stream(*connection.stream);
+    }
+    if (stream) {
+        return Lease(*this, address, std::move(stream), true);
+    }
+    return Lease(
+        *this, address,
+        std::make_unique<Tls_Stream>(connect_to_server(ioc, address)), false
+    );
+}
+
+void transport_service::Connection_Pool::clear() {
+    std::unordered_map<std::string, std::vector<Idle_Connection>> closing;
+    {
+        const std::lock_guard lock(mutex);
+        closing.swap(idle);
+    }
+    for (auto &[address, connections] : closing) {
+        for (auto &connection : connections) {
+            close_idle_stream(*connection.stream);
+        }
+    }
+}
+
+std::optional<transport_service::Byte_Range> transport_service::parse_byte_range(
+    const std::string_view value,
+    const std::uint64_t file_size
+) {
+    constexpr std::string_view prefix = "bytes=";
+    if (value.substr(0, prefix.size()) != prefix) {
+        return std::nullopt;
+    }
+    const std::string_view spec = value.substr(prefix.size());
+    const std::size_t dash = spec.find('-');
+    if (dash == std::string_view::npos ||
+        spec.find(',') != std::string_view::npos) {
+        return std::nullopt;
+    }
+
+    const auto parse_number = [](std::string_view str,
+                                 std::uint64_t &number) {
+        if (str.empty()) {
+            return false;
+        }
+        const auto [ptr, ec] =
+            std::from_chars(str.data(), str.data() + str.size(), number);
+        return ec == std::errc() && ptr == str.data() + str.size();
+    };
+
+    const std::string_view first_str = spec.substr(0, dash);
+    const std::string_view last_str = spec.substr(dash + 1);
+    std::uint64_t first = 0;
+    std::uint64_t last = 0;
+
+    if (first_str.empty()) {
+        // bytes=-N: последние N байт
+        if (!parse_number(last_str, last) || last == 0 || file_size == 0) {
+            return std::nullopt;
+        }
+        const std::uint64_t length = std::min(last, file_size);
+        return Byte_Range{file_size - length, length};
+    }
+
+    if (!parse_number(first_str, first) || first >= file_size) {
+        return std::nullopt;
+    }
+    if (last_str.empty()) {
+        last = file_size - 1;
+    } else if (!parse_number(last_str, last) || last < first) {
+        return std::nullopt;
+    }
+    last = std::min(last, file_size - 1);
+    return Byte_Range{first, last - first + 1};
+}
+
+bool transport_service::is_compressed_format(
+    const std::string_view file_name,
+    const std::string_view head
+) {
+    static constexpr std::string_view compressed_extensions[] = {
+        ".7z",   ".aac",  ".apk",  ".avi",  ".avif", ".br",  ".bz2",
+        ".docx", ".epub", ".flac", ".gif",  ".gz",   ".heic", ".jar",
+        ".jpeg", ".jpg",  ".lz4",  ".m4a",  ".mkv",  ".mov", ".mp3",
+        ".mp4",  ".odt",  ".ogg",  ".opus", ".png",  ".pptx", ".rar",
+        ".tgz",  ".webm", ".webp", ".xlsx", ".xz",   ".zip", ".zst",
+    };
+    static constexpr std::string_view signatures[] = {
+        std::string_view("PK\x03\x04", 4),              // zip, docx, jar
+        std::string_view("\x1f\x8b", 2),                // gzip
+        std::string_view("BZh", 3),                     // bzip2
+        std::string_view("\xfd" "7zXZ\x00", 6),         // xz
+        std::string_view("7z\xbc\xaf\x27\x1c", 6),      // 7z
+        std::string_view("Rar!\x1a\x07", 6),            // rar
+        std::string_view("\x28\xb5\x2f\xfd", 4),        // zstd
+        std::string_view("\x04\x22\x4d\x18", 4),        // lz4
+        std::string_view("\x89PNG", 4),                 // png
+        std::string_view("\xff\xd8\xff", 3),            // jpeg
+        std::string_view("GIF8", 4),                    // gif
+        std::string_view("\x1a\x45\xdf\xa3", 4),        // mkv, webm
+        std::string_view("OggS", 4),                    // ogg, opus
+        std::string_view("fLaC", 4),                    // flac
+        std::string_view("ID3", 3),                     // mp3
+    };
+
+    const std::size_t dot = file_name.rfind('.');
+    if (dot != std::string_view::npos) {
+        std::string extension(file_name.substr(dot));
+        std::ranges::transform(extension, extension.begin(), [](unsigned char c) {
+            return static_cast<char>(std::tolower(c));
+        });
+        if (std::ranges::find(compressed_extensions, extension) !=
+            std::end(compressed_extensions)) {
+            return true;
+        }
+    }
+
+    for (const auto signature : signatures) {
+        if (head.starts_with(signature)) {
+            return true;
+        }
+    }
+    // mp4, mov, heic: "ftyp" после 4 байт размера бокса; webp: RIFF....WEBP
+    return head.substr(4, 4) == "ftyp" ||
+           (head.starts_with("RIFF") && head.substr(8, 4) == "WEBP");
+}
+
+int transport_service::choose_compression_level(
+    const std::string &file_path,
+    const int max_level,
+    const std::uint64_t link_speed_mbps
+) {
+    if (max_level <= Z_NO_COMPRESSION) {
+        return Z_NO_COMPRESSION;
+    }
+
+    std::ifstream file(file_path, std::ios::binary);
+    std::string sample(COMPRESSION_SAMPLE_SIZE, '\0');
+    file.read(sample.data(), static_cast<std::streamsize>(sample.size()));
+    sample.resize(static_cast<std::size_t>(file.gcount()));
+    if (sample.empty() ||
+        is_compressed_format(std::filesystem::path(file_path).filename().string(), sample)) {
+        return Z_NO_COMPRESSION;
+    }
+
+    // Проба самым быстрым уровнем: если даже он почти ничего не выигрывает,
+    // более высокие уровни только потратят процессор.
+    // Контекст берётся из пула, проба не платит за deflateInit.
+    const double ratio =
+        static_cast<double>(deflate_compress(sample, Z_BEST_SPEED).size()) /
+        static_cast<double>(sample.size());
+
+    // На быстром канале узким местом становится deflate, а не сеть.
+    const bool is_fast_link = link_speed_mbps >= FAST_LINK_MBPS;
+    if (ratio > INCOMPRESSIBLE_RATIO ||
+        (is_fast_link && ratio > WEAK_COMPRESSION_RATIO)) {
+        return Z_NO_COMPRESSION;
+    }
+    if (is_fast_link || ratio > WEAK_COMPRESSION_RATIO) {
+        return std::min(max_level, Z_BEST_SPEED);
+    }
+    return max_level;
+}
+
+unsigned transport_service::choose_compression_threads(
+    const std::uint64_t file_size,
+    const std::uint64_t link_speed_mbps,
+    const unsigned max_threads
+) {
+    const unsigned threads =
+        max_threads > 0 ? max_threads
+                        : std::max(1U, std::thread::hardware_concurrency());
+    if (file_size < PARALLEL_COMPRESSION_MIN_SIZE) {
+        return 1;
+    }
+    if (link_speed_mbps == 0) {
+        return std::min<unsigned>(threads, UNKNOWN_LINK_COMPRESSION_THREADS);
+    }
+    const std::uint64_t needed =
+        (link_speed_mbps + COMPRESSION_CORE_MBPS - 1) / COMPRESSION_CORE_MBPS;
+    return static_cast<unsigned>(
+        std::clamp<std::uint64_t>(needed, 1, threads)
+    );
+}
+
 http::response<http::string_body> transport_service::Server::handle_response(
     const http::request<http::string_body> &req,
-    const std::string &client_address
+    const std::string &client_address
+) const {
+    http::response<http::string_body> res{http::status::ok, req.version()};
+
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, "text/plain");
+    res.keep_alive(req.keep_alive());
+    logger.log(
+        Log_Level::request,
+        std::string("Received request from ") + client_address + ": " +
+        std::string(req.method_string()) + " " + std::string(req.target()) +
+        '\n'
+    );
+
+    if (req.method() == http::verb::get &&
+        req["X-Transfer-Mode"] == MERKLE_TRANSFER_MODE &&
+        std::filesystem::is_regular_file(
+            dec_rep_path + std::string(req.target())
+        )) {
+        // Дерево требует чтения всего файла и кэшируется по его хешу
+        // рядом со сжатыми артефактами.
+        const std::string file_path = dec_rep_path + std::string(req.target());
+        const std::string hash = Hash_Index::get_instance().hash(file_path);
+        const std::string cache_key =
+            Artifact_Cache::make_key(hash, MERKLE_TRANSFER_MODE, 0);
+        if (const auto cached = artifact_cache.find(cache_key)) {
+            res.body() = read_artifact(*cached);
+        } else {
+            res.body() = Merkle_Tree::build(file_path).serialize();
+            if (const auto builder =
+                    artifact_cache.try_build(cache_key, res.body().size())) {
+                builder->write(res.body().data(), res.body().size());
+                builder->commit();
+            }
+        }
+        if (!hash.empty()) {
+            res.set(http::field::etag, hash);
+        }
+        res.set("X-Transfer-Mode", MERKLE_TRANSFER_MODE);
+        logger.log(
+            Log_Level::request,
+            "Sending piece hashes of " + file_path + '\n'
+        );
+    } else if (req.method() == http::verb::get ||
+               req.method() == http::verb::head) {
+        // Существующие файлы отдаются потоково в write_file_response,
+        // сюда попадают только запросы к отсутствующим файлам.
+        const std::string file_path = dec_rep_path + std::string(req.target());
+        res.result(http::status::not_found);
+        res.body() = "File not found";
+        logger.log(
+            Log_Level::warning,
+            std::string("File not found: ") + file_path + '\n'
+        );
+    } else if (req.method() == http::verb::post) {
+        const std::string file_path = dec_rep_path + std::string(req.target());
+        if (req["X-Large-File"] == "1") {
+            get_large_file(
+                client_address, std::string(req.target()), dec_rep_path,
+                get_local_time(file_path)
+            );
+        } else {
+            get_file(
+                client_address, std::string(req.target()), dec_rep_path,
+                get_local_time(file_path)
+            );
+        }
+        logger.log(Log_Level::request, "Get file: " + file_path + '\n');
+    } else {
+        res.result(http::status::bad_request);
+        res.body() = "Invalid request";
+        logger.log(
+            Log_Level::warning,
+            "Invalid request: " + std::string(req.method_string()) + '\n'
+        );
+    }
+
+    logger.log(Log_Level::request, std::string("Sending response") + '\n');
+    res.prepare_payload();
+    return res;
+}
+
+std::optional<transport_service::File_Fingerprint>
+transport_service::file_fingerprint(const std::string &path) {
+    struct stat info {};
+    if (::stat(path.c_str(), &info) != 0) {
+        return std::nullopt;
+    }
+    return File_Fingerprint{
+        static_cast<std::uint64_t>(info.st_size),
+        static_cast<std::int64_t>(info.st_mtim.tv_sec) * 1'000'000'000 +
+            info.st_mtim.tv_nsec,
+        static_cast<std::uint64_t>(info.st_ino)};
+}
+
+namespace {
+std::string index_key(const std::string &path) {
+    return std::filesystem::absolute(path).lexically_normal().string();
+}
+
+// Файл, изменённый в пределах HASH_INDEX_RACY_WINDOW, может измениться
+// ещё раз с тем же mtime и размером, поэтому его хеш не запоминается.
+bool is_racy(const transport_service::File_Fingerprint &fingerprint) {
+    const auto now = std::chrono::system_clock::now().time_since_epoch();
+    return std::chrono::nanoseconds(fingerprint.mtime_ns) + HASH_INDEX_RACY_WINDOW >
+           now;
+}
+}  // namespace
+
+transport_service::Hash_Index::Hash_Index(std::string m_index_path)
+    : index_path(std::move(m_index_path)) {
+    load();
+}
+
+transport_service::Hash_Index &transport_service::Hash_Index::get_instance() {
+    static Hash_Index instance(HASH_INDEX_FILE);
+    return instance;
+}
+
+void transport_service::Hash_Index::load() {
+    std::ifstream in(index_path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.starts_with("- ")) {
+            entries.erase(line.substr(2));
+            continue;
+        }
+        std::istringstream fields(line);
+        Entry entry;
+        fields >> entry.fingerprint.inode >> entry.fingerprint.size >>
+            entry.fingerprint.mtime_ns >> entry.hash;
+        std::string path;
+        if (fields.get() == ' ' && std::getline(fields, path) && !path.empty()) {
+            entries[path] = entry;
+        }
+    }
+    in.close();
+
+    // Журнал переписывается без удалённых и перезаписанных строк,
+    // дальше записи только дописываются в конец.
+    const std::string temp_path = index_path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::trunc);
+        for (const auto &[path, entry] : entries) {
+            out << entry.fingerprint.inode << ' ' << entry.fingerprint.size
+                << ' ' << entry.fingerprint.mtime_ns << ' ' << entry.hash
+                << ' ' << path << '\n';
+        }
+    }
+    std::filesystem::rename(temp_path, index_path);
+    journal.open(index_path, std::ios::app);
+}
+
+void transport_service::Hash_Index::store(
+    const std::string &key,
+    const Entry &entry
+) {
+    entries[key] = entry;
+    journal << entry.fingerprint.inode << ' ' << entry.fingerprint.size << ' '
+            << entry.fingerprint.mtime_ns << ' ' << entry.hash << ' ' << key
+            << '\n';
+    journal.flush();
+}
+
+std::string transport_service::Hash_Index::hash(const std::string &path) {
+    const std::string key = index_key(path);
+    const auto before = file_fingerprint(path);
+    if (!before) {
+        return {};
+    }
+    {
+        const std::lock_guard lock(mutex);
+        const auto it = entries.find(key);
+        if (it != entries.end() && it->second.fingerprint == *before) {
+            return it->second.hash;
+        }
+    }
+
+    std::string hash = sha1_hash_file(path);
+    // Файл, изменившийся во время хеширования, в индекс не попадает.
+    const auto after = file_fingerprint(path);
+    if (!hash.empty() && after == before && !is_racy(*after)) {
+        const std::lock_guard lock(mutex);
+        store(key, Entry{*after, hash});
+    }
+    return hash;
+}
+
+void transport_service::Hash_Index::record(
+    const std::string &path,
+    const std::string &hash
+) {
+    const auto fingerprint = file_fingerprint(path);
+    if (!fingerprint) {
+        return;
+    }
+    const std::lock_guard lock(mutex);
+    store(index_key(path), Entry{*fingerprint, hash});
+}
+
+void transport_service::Hash_Index::invalidate(const std::string &path) {
+    const std::string key = index_key(path);
+    const std::lock_guard lock(mutex);
+    if (entries.erase(key) > 0) {
+        journal << "- " << key << '\n';
+        journal.flush();
+    }
+}
+
+transport_service::Artifact_File::~Artifact_File() {
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+}
+
+transport_service::Artifact_Cache::Artifact_Cache(
+    std::filesystem::path m_cache_dir,
+    const std::uint64_t m_disk_limit,
+    const std::uint64_t m_memory_limit
+)
+    : cache_dir(std::move(m_cache_dir)),
+      disk_limit(m_disk_limit),
+      memory_limit(m_memory_limit) {
+    // Артефакты прошлых запусков не переиспользуются: их не с чем сверить.
+    std::error_code ec;
+    std::filesystem::remove_all(cache_dir, ec);
+    std::filesystem::create_directories(cache_dir);
+}
+
+transport_service::Artifact_Cache::~Artifact_Cache() {
+    lru.clear();
+    std::error_code ec;
+    std::filesystem::remove_all(cache_dir, ec);
+}
+
+std::string transport_service::Artifact_Cache::make_key(
+    const std::string &hash,
+    const std::string &encoding,
+    const int compression_level
+) {
+    return hash + '.' + encoding + '.' + std::to_string(compression_level);
+}
+
+std::optional<transport_service::Cached_Artifact>
+transport_service::Artifact_Cache::find(const std::string &key) {
+    const std::lock_guard lock(mutex);
+    const auto it = index.find(key);
+    if (it == index.end()) {
+        return std::nullopt;
+    }
+    lru.splice(lru.begin(), lru, it->second);
+    return Cached_Artifact{it->second->file, it->second->data};
+}
+
+std::unique_ptr<transport_service::Artifact_Cache::Builder>
+transport_service::Artifact_Cache::try_build(
+    const std::string &key,
+    const std::uint64_t expected_size
+) {
+    {
+        const std::lock_guard lock(mutex);
+        if (expected_size > disk_limit || index.contains(key) ||
+            !in_progress.insert(key).second) {
+            return nullptr;
+        }
+    }
+    return std::make_unique<Builder>(*this, key);
+}
+
+bool transport_service::Artifact_Cache::is_building(const std::string &key
+) const {
+    const std::lock_guard lock(mutex);
+    return in_progress.contains(key);
+}
+
+std::uint64_t transport_service::Artifact_Cache::get_disk_usage() const {
+    const std::lock_guard lock(mutex);
+    return disk_usage;
+}
+
+std::uint64_t transport_service::Artifact_Cache::get_memory_usage() const {
+    const std::lock_guard lock(mutex);
+    return memory_usage;
+}
+
+void transport_service::Artifact_Cache::finish_build(
+    const std::string &key,
+    std::shared_ptr<const Artifact_File> file,
+    std::shared_ptr<const std::string> data
+) {
+    const std::lock_guard lock(mutex);
+    in_progress.erase(key);
+    if (!file) {
+        return;
+    }
+    disk_usage += file->size;
+    if (data) {
+        memory_usage += data->size();
+    }
+    lru.push_front(Entry{key, std::move(file), std::move(data)});
+    index[key] = lru.begin();
+    evict();
+}
+
+void transport_service::Artifact_Cache::evict() {
+    // Сначала из памяти уходят копии давно не использованных артефактов,
+    // затем с диска - сами артефакты.
+    for (auto it = lru.rbegin(); it != lru.rend() && memory_usage > memory_limit;
+         ++it) {
+        if (it->data) {
+            memory_usage -= it->data->size();
+            it->data.reset();
+        }
+    }
+    while (disk_usage > disk_limit && !lru.empty()) {
+        Entry &last = lru.back();
+        disk_usage -= last.file->size;
+        if (last.data) {
+            memory_usage -= last.data->size();
+        }
+        index.erase(last.key);
+        lru.pop_back();
+    }
+}
+
+transport_service::Artifact_Cache::Builder::Builder(
+    Artifact_Cache &m_cache,
+    std::string m_key
+)
+    : cache(m_cache),
+      key(std::move(m_key)),
+      temp_path((cache.cache_dir / (key + ".tmp")).string()),
+      out(temp_path, std::ios::binary | std::ios::trunc) {
+}
+
+transport_service::Artifact_Cache::Builder::~Builder() {
+    if (!committed) {
+        out.close();
+        std::error_code ec;
+        std::filesystem::remove(temp_path, ec);
+        cache.finish_build(key, nullptr, nullptr);
+    }
+}
+
+void transport_service::Artifact_Cache::Builder::write(
+    const char *data,
+    const std::size_t data_size
+) {
+    out.write(data, static_cast<std::streamsize>(data_size));
+    size += data_size;
+    if (keep_in_memory && size <= ARTIFACT_MEMORY_ENTRY_LIMIT) {
+        memory_copy.append(data, data_size);
+    } else if (keep_in_memory) {
+        keep_in_memory = false;
+        std::string().swap(memory_copy);
+    }
+}
+
+void transport_service::Artifact_Cache::Builder::commit() {
+    out.close();
+    if (!out) {
+        return;
+    }
+    auto file = std::make_shared<Artifact_File>();
+    file->path = (cache.cache_dir / key).string();
+    file->size = size;
+    std::filesystem::rename(temp_path, file->path);
+    std::shared_ptr<const std::string> data;
+    if (keep_in_memory) {
+        data = std::make_shared<const std::string>(std::move(memory_copy));
+    }
+    committed = true;
+    cache.finish_build(key, std::move(file), std::move(data));
+}
+
+transport_service::Session_Limiter::Session_Limiter(
+    net::io_context &ioc,
+    const std::size_t m_limit
+)
+    : strand(net::make_strand(ioc)),
+      released(strand),
+      limit(m_limit) {
+}
+
+net::awaitable<void> transport_service::Session_Limiter::acquire() {
+    while (active >= limit) {
+        released.expires_at(net::steady_timer::time_point::max());
+        beast::error_code ec;
+        co_await released.async_wait(net::redirect_error(net::use_awaitable, ec)
+        );
+    }
+    ++active;
+}
+
+void transport_service::Session_Limiter::release() {
+    net::post(strand, [this] {
+        --active;
+        released.cancel();
+    });
+}
+
+net::awaitable<void> transport_service::Server::do_session(tcp::socket socket
+) const {
+    try {
+        ssl::context &ctx =
+            Certificate_Singleton::get_instance().get_server_context();
+        const std::string client_address =
+            socket.remote_endpoint().address().to_string();
+        // Заголовок и тело ответа уходят отдельными записями.
+        socket.set_option(tcp::no_delay(true));
+        Tls_Stream stream(std::move(socket), ctx);
+
+        co_await stream.async_handshake(
+            ssl::stream_base::server, net::use_awaitable
+        );
+
+        beast::flat_buffer buffer;
+
+        for (;;) {
+            http::request_parser<http::string_body> parser;
+            parser.body_limit(MAX_REQUEST_BODY_SIZE);
+            co_await http::async_read(
+                stream, buffer, parser, net::use_awaitable
+            );
+            http::request<http::string_body> req = parser.release();
+
+            const std::string file_path =
+                dec_rep_path + std::string(req.target());
+            bool keep_alive = false;
+            const bool is_file_request = req.method() == http::verb::get ||
+                                         req.method() == http::verb::head;
+            const bool is_tree_request =
+                req.method() == http::verb::get &&
+                req["X-Transfer-Mode"] == MERKLE_TRANSFER_MODE;
+            if (is_file_request && !is_tree_request &&
+                std::filesystem::is_regular_file(file_path)) {
+                logger.log(
+                    Log_Level::request,
+                    std::string("Received request from ") + client_address +
+                    ": " + std::string(req.method_string()) + " " +
+                    std::string(req.target()) + '\n'
+                );
+                // Старые клиенты не шлют X-Transfer-Mode, а сигнатуры,
+                // которые не разобрались, означают обычную передачу файла.
+                const bool is_get = req.method() == http::verb::get;
+                const auto transfer_mode = req["X-Transfer-Mode"];
+                std::optional<Delta_Signatures> signatures;
+                if (is_get && transfer_mode == DELTA_TRANSFER_MODE) {
+                    signatures = Delta_Signatures::parse(req.body());
+                }
+                if (signatures) {
+                    co_await write_delta_response(
+                        stream, req, file_path, *signatures
+                    );
+                } else if (is_get && transfer_mode == CHUNKED_TRANSFER_MODE &&
+                           req.find(http::field::range) == req.end() &&
+                           std::filesystem::file_size(file_path) >=
+                               CHUNK_MIN_FILE_SIZE) {
+                    co_await write_manifest_response(stream, req, file_path);
+                } else {
+                    co_await write_file_response(stream, req, file_path);
+                }
+                keep_alive = req.keep_alive();
+            } else if (req.method() == http::verb::get &&
+                       req["X-Transfer-Mode"] == ARCHIVE_TRANSFER_MODE &&
+                       std::filesystem::is_directory(file_path)) {
+                logger.log(
+                    Log_Level::request,
+                    std::string("Received request from ") + client_address +
+                    ": GET " + std::string(req.target()) + " (archive)\n"
+                );
+                co_await write_archive_response(stream, req, file_path);
+                keep_alive = req.keep_alive();
+            } else {
+                // POST синхронно скачивает файл у клиента, а дерево
+                // Меркла строится чтением всего файла, поэтому они
+                // выполняются вне пула сетевых потоков.
+                auto res = co_await net::co_spawn(
+                    blocking_pool,
+                    [&]() -> net::awaitable<http::response<http::string_body>> {
+                        co_return handle_response(req, client_address);
+                    },
+                    net::use_awaitable
+                );
+                co_await throttle_upload(
+                    stream, Traffic_Class::metadata, res.body().size()
+                );
+                co_await http::async_write(stream, res, net::use_awaitable);
+                keep_alive = res.keep_alive();
+            }
+            if (!keep_alive) {
+                break;
+            }
+        }
+        beast::error_code ec;
+        co_await stream.async_shutdown(
+            net::redirect_error(net::use_awaitable, ec)
+        );
+        if (ec == net::error::eof) {
+            ec = {};
+        }
+        if (ec == ssl::error::stream_truncated) {
+            ec = {};
+        }
+        if (ec) {
+            throw beast::system_error{ec};
+        }
+    } catch (const beast::system_error &se) {
+        if (se.code() != http::error::end_of_stream) {
+            logger.log(
+                Log_Level::error,
+                "Session error: " + std::string(se.what()) + '\n'
+            );
+        }
+    } catch (const std::exception &e) {
+        logger.log(
+            Log_Level::error,
+            "Session error: " + std::string(e.what()) + '\n'
+        );
+    }
+}
+
+net::awaitable<void> transport_service::Server::write_file_response(
+    Tls_Stream &stream,
+    const http::request<http::string_body> &req,
+    const std::string &file_path
+) const {
+    const std::uint64_t file_size = std::filesystem::file_size(file_path);
+    const Traffic_Class traffic_class = traffic_class_for_size(file_size);
+
+    // Хеш считается, только если нужен: обычному запросу диапазона он
+    // ни к чему. Чтение файла для хеша идёт в blocking_pool.
+    const bool has_range = req.method() == http::verb::get &&
+                           req.find(http::field::range) != req.end();
+    const bool has_if_range = req.find(http::field::if_range) != req.end();
+    std::string hash;
+    if (!has_range || has_if_range) {
+        hash = co_await run_blocking([&] {
+            return Hash_Index::get_instance().hash(file_path);
+        });
+    }
+
+    // Запрос диапазона: байты отдаются без сжатия и без пересчёта хеша,
+    // ETag клиент получает заранее через HEAD. С If-Range диапазон
+    // отдаётся, только если файл не изменился, иначе уходит весь файл.
+    const bool is_range_request =
+        has_range && (!has_if_range || req[http::field::if_range] == hash);
+    if (is_range_request) {
+        const auto range =
+            parse_byte_range(req[http::field::range], file_size);
+
+        http::response<http::empty_body> res{
+            http::status::partial_content, req.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "text/plain");
+        res.set(http::field::accept_ranges, "bytes");
+        res.keep_alive(req.keep_alive());
+        if (!range) {
+            res.result(http::status::range_not_satisfiable);
+            res.set(
+                http::field::content_range,
+                "bytes */" + std::to_string(file_size)
+            );
+            res.content_length(0);
+            logger.log(
+                Log_Level::warning,
+                "Invalid range: " + std::string(req[http::field::range]) + '\n'
+            );
+            co_await http::async_write(stream, res, net::use_awaitable);
+            co_return;
+        }
+
+        res.set(http::field::content_encoding, RAW_ENCODING);
+        res.set(
+            http::field::content_range,
+            "bytes " + std::to_string(range->offset) + "-" +
+                std::to_string(range->offset + range->length - 1) + "/" +
+                std::to_string(file_size)
+        );
+        res.content_length(range->length);
+        http::response_serializer<http::empty_body> serializer{res};
+        co_await http::async_write_header(
+            stream, serializer, net::use_awaitable
+        );
+        co_await send_file_range(
+            stream, file_path, *range, memory_mapped, traffic_class
+        );
+        co_return;
+    }
+
+    logger.log(Log_Level::request, "Hash: " + hash + '\n');
+    const bool is_valid_hash =
+        !hash.empty() &&
+        hash.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos;
+    if (!is_valid_hash) {
+        logger.log(
+            Log_Level::warning,
+            "Invalid ETag value generated: " + hash + '\n'
+        );
+    }
+
+    const auto set_headers = [&](auto &res) {
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "text/plain");
+        res.set(http::field::accept_ranges, "bytes");
+        res.keep_alive(req.keep_alive());
+        res.set("X-File-Size", std::to_string(file_size));
+        if (is_valid_hash) {
+            res.set(http::field::etag, hash);
+        }
+    };
+
+    if (req.method() == http::verb::head) {
+        http::response<http::empty_body> res{http::status::ok, req.version()};
+        set_headers(res);
+        // По этому заголовку клиент узнаёт, что у нас можно попросить
+        // дерево Меркла для проверки кусков.
+        res.set("X-Merkle-Piece-Size", std::to_string(MERKLE_PIECE_SIZE));
+        res.content_length(file_size);
+        http::response_serializer<http::empty_body> serializer{res};
+        co_await http::async_write_header(
+            stream, serializer, net::use_awaitable
+        );
+        co_return;
+    }
+
+    std::uint64_t link_speed_mbps = 0;
+    const auto link_speed = req["X-Link-Speed"];
+    std::from_chars(
+        link_speed.data(), link_speed.data() + link_speed.size(),
+        link_speed_mbps
+    );
+    // Проба сжатия читает начало файла и сжимает его, поэтому тоже
+    // выполняется в blocking_pool.
+    const int current_compression_level = co_await run_blocking([&] {
+        return choose_compression_level(
+            file_path, compression_level, link_speed_mbps
+        );
+    });
+    const std::string encoding =
+        current_compression_level > Z_NO_COMPRESSION
+            ? negotiate_encoding(req[http::field::accept_encoding])
+            : RAW_ENCODING;
+    logger.log(
+        Log_Level::request,
+        std::string("Compression level: ") +
+        std::to_string(current_compression_level) + ", encoding: " +
+        encoding + '\n'
+    );
+
+    const unsigned current_compression_threads = choose_compression_threads(
+        file_size, link_speed_mbps, compression_threads
+    );
+
+    // Сжатое представление ищется в кэше по содержимому файла.
+    // Сессия, начавшая сборку, сжимает файл целиком в blocking_pool и
+    // отдаёт его уже из кэша, как и остальные: сборка не привязана к
+    // скорости её клиента, поэтому при веерной раздаче медленный пир
+    // не задерживает других, и ждать её дешевле, чем сжимать заново.
+    std::optional<Cached_Artifact> cached;
+    if (encoding != RAW_ENCODING && is_valid_hash) {
+        const std::string cache_key = Artifact_Cache::make_key(
+            hash, encoding, current_compression_level
+        );
+        cached = artifact_cache.find(cache_key);
+        if (!cached) {
+            if (auto builder = artifact_cache.try_build(cache_key, file_size)) {
+                co_await run_blocking([&] {
+                    const auto artifact_encoder = make_encoder(
+                        encoding, current_compression_level,
+                        current_compression_threads
+                    );
+                    if (artifact_encoder) {
+                        build_artifact(file_path, *artifact_encoder, *builder);
+                    }
+                });
+                builder.reset();
+                cached = artifact_cache.find(cache_key);
+            }
+        }
+        if (!cached) {
+            net::steady_timer timer(co_await net::this_coro::executor);
+            while (!cached && artifact_cache.is_building(cache_key)) {
+                timer.expires_after(ARTIFACT_WAIT_INTERVAL);
+                co_await timer.async_wait(net::use_awaitable);
+                cached = artifact_cache.find(cache_key);
+            }
+        }
+    }
+
+    if (cached) {
+        logger.log(Log_Level::request, "Artifact cache hit\n");
+        const std::uint64_t artifact_size = cached->file->size;
+        http::response<http::empty_body> res{http::status::ok, req.version()};
+        set_headers(res);
+        res.set(
+            "X-Compression-Level", std::to_string(current_compression_level)
+        );
+        res.set(http::field::content_encoding, encoding);
+        res.content_length(artifact_size);
+
+        http::response_serializer<http::empty_body> serializer{res};
+        co_await http::async_write_header(
+            stream, serializer, net::use_awaitable
+        );
+        if (cached->data) {
+            co_await write_shaped(
+                stream, net::buffer(*cached->data), traffic_class
+            );
+        } else {
+            co_await send_file_range(
+                stream, cached->file->path, Byte_Range{0, artifact_size},
+                memory_mapped, traffic_class
+            );
+        }
+    } else if (const auto encoder = make_encoder(
+                   encoding, current_compression_level,
+                   current_compression_threads
+               )) {
+        File_Prefetcher reader(
+            co_await net::this_coro::executor, file_path, 0, file_size,
+            STREAM_BLOCK_SIZE
+        );
+
+        http::response<http::empty_body> res{http::status::ok, req.version()};
+        set_headers(res);
+        res.set(
+            "X-Compression-Level", std::to_string(current_compression_level)
+        );
+        res.set(http::field::content_encoding, encoding);
+        res.chunked(true);
+
+        http::response_serializer<http::empty_body> serializer{res};
+        co_await http::async_write_header(
+            stream, serializer, net::use_awaitable
+        );
+
+        // Сжатые данные копятся в pending и уходят одним chunk-ом
+        // после каждого входного блока.
+        std::vector<char> pending;
+        const Sink collect = [&](const char *data, std::size_t size) {
+            pending.insert(pending.end(), data, data + size);
+        };
+        const auto flush_pending = [&]() -> net::awaitable<void> {
+            if (!pending.empty()) {
+                co_await throttle_upload(stream, traffic_class, pending.size());
+                co_await net::async_write(
+                    stream, http::make_chunk(net::buffer(pending)),
+                    net::use_awaitable
+                );
+                pending.clear();
+            }
+        };
+
+        // Следующий блок читается с диска, пока сжатый текущий уходит
+        // в сеть. Сжатие идёт в blocking_pool.
+        for (auto block = co_await reader.next(); !block.empty();
+             block = co_await reader.next()) {
+            co_await run_blocking([&] {
+                encoder->write(block.data(), block.size(), collect);
+            });
+            co_await flush_pending();
+        }
+        co_await run_blocking([&] { encoder->finish(collect); });
+        co_await flush_pending();
+        co_await net::async_write(
+            stream, http::make_chunk_last(), net::use_awaitable
+        );
+    } else {
+        // Файл отдаётся через send_file_range, а не через file_body:
+        // так каждый блок проходит через ограничитель полосы.
+        http::response<http::empty_body> res{http::status::ok, req.version()};
+        set_headers(res);
+        res.set("X-Compression-Level", "0");
+        res.set(http::field::content_encoding, RAW_ENCODING);
+        res.content_length(file_size);
+
+        http::response_serializer<http::empty_body> serializer{res};
+        co_await http::async_write_header(
+            stream, serializer, net::use_awaitable
+        );
+        co_await send_file_range(
+            stream, file_path, Byte_Range{0, file_size}, memory_mapped,
+            traffic_class
+        );
+    }
+    logger.log(Log_Level::request, std::string("Sending response") + '\n');
+}
+
+net::awaitable<void> transport_service::Server::write_delta_response(
+    Tls_Stream &stream,
+    const http::request<http::string_body> &req,
+    const std::string &file_path,
+    const Delta_Signatures &signatures
 ) const {
-    http::response<http::string_body> res{http::status::ok, req.version()};
+    const std::uint64_t file_size = std::filesystem::file_size(file_path);
+    // Хеш, проба сжатия и кодирование дельты читают файл и нагружают
+    // процессор, поэтому идут в blocking_pool; в сессии остаётся только
+    // запись в сокет.
+    const std::string hash = co_await run_blocking([&] {
+        return Hash_Index::get_instance().hash(file_path);
+    });
+    logger.log(Log_Level::request, "Hash: " + hash + '\n');
+
+    std::uint64_t link_speed_mbps = 0;
+    const auto link_speed = req["X-Link-Speed"];
+    std::from_chars(
+        link_speed.data(), link_speed.data() + link_speed.size(),
+        link_speed_mbps
+    );
+    const int current_compression_level = co_await run_blocking([&] {
+        return choose_compression_level(
+            file_path, compression_level, link_speed_mbps
+        );
+    });
+    const std::string encoding =
+        current_compression_level > Z_NO_COMPRESSION
+            ? negotiate_encoding(req[http::field::accept_encoding])
+            : RAW_ENCODING;
+    const auto encoder = make_encoder(encoding, current_compression_level);
 
+    http::response<http::empty_body> res{http::status::ok, req.version()};
     res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.set(http::field::content_type, "text/plain");
+    res.set(http::field::content_type, "application/octet-stream");
+    res.set(http::field::accept_ranges, "bytes");
     res.keep_alive(req.keep_alive());
+    res.set("X-File-Size", std::to_string(file_size));
+    res.set("X-Transfer-Mode", DELTA_TRANSFER_MODE);
+    if (!hash.empty()) {
+        res.set(http::field::etag, hash);
+    }
+    res.set(
+        "X-Compression-Level",
+        std::to_string(encoder ? current_compression_level : 0)
+    );
+    res.set(
+        http::field::content_encoding, encoder ? encoding : RAW_ENCODING
+    );
+    res.chunked(true);
+
+    http::response_serializer<http::empty_body> serializer{res};
+    co_await http::async_write_header(
+        stream, serializer, net::use_awaitable
+    );
+
+    // Команды дельты проходят через кодер и уходят chunk-ами
+    // после каждого шага кодировщика.
+    std::vector<char> pending;
+    const Sink collect = [&](const char *data, std::size_t size) {
+        pending.insert(pending.end(), data, data + size);
+    };
+    const Sink emit = encoder ? Sink([&](const char *data, std::size_t size) {
+                                    encoder->write(data, size, collect);
+                                })
+                              : collect;
+    const auto flush_pending = [&]() -> net::awaitable<void> {
+        if (!pending.empty()) {
+            co_await throttle_upload(
+                stream, traffic_class_for_size(file_size), pending.size()
+            );
+            co_await net::async_write(
+                stream, http::make_chunk(net::buffer(pending)),
+                net::use_awaitable
+            );
+            pending.clear();
+        }
+    };
+
+    std::uint64_t copied_bytes = 0;
+    if (file_size > 0) {
+        // Файл не отображается в память: его может усечь синхронизация
+        // или пользователь, и тогда step бросает исключение, а не SIGBUS.
+        std::optional<File_Descriptor> file;
+        std::optional<Delta_Encoder> delta;
+        co_await run_blocking([&] {
+            file.emplace(::open(file_path.c_str(), O_RDONLY));
+            delta.emplace(
+                file->fd, static_cast<std::size_t>(file_size), signatures
+            );
+        });
+        while (co_await run_blocking([&] { return delta->step(emit); })) {
+            co_await flush_pending();
+        }
+        copied_bytes = delta->get_copied_bytes();
+    }
+    if (encoder) {
+        co_await run_blocking([&] { encoder->finish(collect); });
+    }
+    co_await flush_pending();
+    co_await net::async_write(
+        stream, http::make_chunk_last(), net::use_awaitable
+    );
     logger.log(
-        std::string("Received request from ") + client_address + ": " +
-        std::string(req.method_string()) + " " + std::string(req.target()) +
-        '\n'
+        Log_Level::request,
+        "Sending delta: " + std::to_string(file_size - copied_bytes) + " of " +
+        std::to_string(file_size) + " bytes, encoding: " + encoding + '\n'
+    );
+}
+
+net::awaitable<void> transport_service::Server::write_archive_response(
+    Tls_Stream &stream,
+    const http::request<http::string_body> &req,
+    const std::string &dir_path
+) const {
+    // Порядок записей не зависит от порядка обхода файловой системы.
+    // Недокачанные файлы и ссылки не отправляются: ссылка могла бы
+    // вывести за пределы каталога.
+    std::vector<std::filesystem::directory_entry> entries;
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(
+             dir_path, std::filesystem::directory_options::skip_permission_denied
+         )) {
+        const std::string name = entry.path().filename().string();
+        if (entry.is_symlink() || name.ends_with(PART_FILE_SUFFIX) ||
+            name.ends_with(PART_FILE_SUFFIX JOURNAL_FILE_SUFFIX) ||
+            !(entry.is_directory() || entry.is_regular_file())) {
+            continue;
+        }
+        entries.push_back(entry);
+    }
+    std::sort(entries.begin(), entries.end());
+
+    // Уровень выбирается без пробы: в архиве файлы разного типа,
+    // а несжимаемые из них кодер пропустит почти без потерь.
+    std::uint64_t link_speed_mbps = 0;
+    const auto link_speed = req["X-Link-Speed"];
+    std::from_chars(
+        link_speed.data(), link_speed.data() + link_speed.size(),
+        link_speed_mbps
+    );
+    const int max_level =
+        std::min<int>(compression_level, ARCHIVE_MAX_COMPRESSION_LEVEL);
+    const int current_compression_level =
+        link_speed_mbps >= FAST_LINK_MBPS ? std::min(max_level, Z_BEST_SPEED)
+                                          : max_level;
+    const std::string encoding =
+        current_compression_level > Z_NO_COMPRESSION
+            ? negotiate_encoding(req[http::field::accept_encoding])
+            : RAW_ENCODING;
+    std::uint64_t archive_size = 0;
+    for (const auto &entry : entries) {
+        if (entry.is_regular_file()) {
+            archive_size += entry.file_size();
+        }
+    }
+    const auto encoder = make_encoder(
+        encoding, current_compression_level,
+        choose_compression_threads(
+            archive_size, link_speed_mbps, compression_threads
+        )
+    );
+
+    http::response<http::empty_body> res{http::status::ok, req.version()};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, "application/octet-stream");
+    res.keep_alive(req.keep_alive());
+    res.set("X-Transfer-Mode", ARCHIVE_TRANSFER_MODE);
+    res.set(
+        "X-Compression-Level",
+        std::to_string(encoder ? current_compression_level : 0)
+    );
+    res.set(
+        http::field::content_encoding, encoder ? encoding : RAW_ENCODING
+    );
+    res.chunked(true);
+
+    http::response_serializer<http::empty_body> serializer{res};
+    co_await http::async_write_header(
+        stream, serializer, net::use_awaitable
+    );
+
+    std::vector<char> pending;
+    const Sink collect = [&](const char *data, std::size_t size) {
+        pending.insert(pending.end(), data, data + size);
+    };
+    // С кодером записи архива копятся в raw и сжимаются в blocking_pool
+    // одним вызовом на много мелких файлов.
+    std::vector<char> raw;
+    const Sink emit = encoder ? Sink([&](const char *data, std::size_t size) {
+                                    raw.insert(raw.end(), data, data + size);
+                                })
+                              : collect;
+    const auto encode_raw = [&]() -> net::awaitable<void> {
+        if (!raw.empty()) {
+            co_await run_blocking([&] {
+                encoder->write(raw.data(), raw.size(), collect);
+            });
+            raw.clear();
+        }
+    };
+    const auto flush_pending = [&]() -> net::awaitable<void> {
+        co_await encode_raw();
+        if (!pending.empty()) {
+            co_await throttle_upload(
+                stream, Traffic_Class::bulk, pending.size()
+            );
+            co_await net::async_write(
+                stream, http::make_chunk(net::buffer(pending)),
+                net::use_awaitable
+            );
+            pending.clear();
+        }
+    };
+
+    // Мелкие файлы копятся в pending и уходят общим chunk-ом, крупные
+    // отправляются по мере чтения блоками STREAM_BLOCK_SIZE.
+    Archive_Writer archive(emit);
+    const auto executor = co_await net::this_coro::executor;
+    std::size_t file_count = 0;
+    std::uint64_t total_size = 0;
+    for (const auto &entry : entries) {
+        const std::string relative_path =
+            entry.path().lexically_relative(dir_path).generic_string();
+        if (entry.is_directory()) {
+            archive.add_directory(relative_path);
+            continue;
+        }
+        const std::uint64_t file_size = entry.file_size();
+        std::optional<File_Prefetcher> reader;
+        try {
+            reader.emplace(
+                executor, entry.path().string(), 0, file_size,
+                STREAM_BLOCK_SIZE
+            );
+        } catch (const std::exception &) {
+            continue;
+        }
+        archive.begin_file(relative_path, file_size);
+        for (;;) {
+            std::string_view block;
+            try {
+                block = co_await reader->next();
+            } catch (const std::exception &) {
+                // Файл укоротился во время отправки: поток архива уже
+                // не согласован, клиент отбросит незаконченную запись.
+                throw std::runtime_error(
+                    "Failed to read file: " + entry.path().string()
+                );
+            }
+            if (block.empty()) {
+                break;
+            }
+            archive.write(block.data(), block.size());
+            if (pending.size() + raw.size() >= STREAM_BLOCK_SIZE) {
+                co_await flush_pending();
+            }
+        }
+        archive.end_file();
+        ++file_count;
+        total_size += file_size;
+        if (pending.size() + raw.size() >= STREAM_BLOCK_SIZE) {
+            co_await flush_pending();
+        }
+    }
+    archive.finish();
+    co_await encode_raw();
+    if (encoder) {
+        co_await run_blocking([&] { encoder->finish(collect); });
+    }
+    co_await flush_pending();
+    co_await net::async_write(
+        stream, http::make_chunk_last(), net::use_awaitable
+    );
+    logger.log(
+        Log_Level::request,
+        "Sending archive of " + dir_path + ": " + std::to_string(file_count) +
+        " files, " + std::to_string(total_size) + " bytes, encoding: " +
+        encoding + '\n'
     );
+}
+
+net::awaitable<void> transport_service::Server::write_manifest_response(
+    Tls_Stream &stream,
+    const http::request<http::string_body> &req,
+    const std::string &file_path
+) const {
+    const std::uint64_t file_size = std::filesystem::file_size(file_path);
+    const std::string hash = co_await run_blocking([&] {
+        return Hash_Index::get_instance().hash(file_path);
+    });
+    const std::string cache_key =
+        Artifact_Cache::make_key(hash, CHUNKED_TRANSFER_MODE, 0);
+
+    // Манифест требует прохода по всему файлу, поэтому строится вне
+    // сетевых потоков и кэшируется рядом со сжатыми артефактами.
+    std::string manifest;
+    if (const auto cached = artifact_cache.find(cache_key)) {
+        manifest = read_artifact(*cached);
+    } else {
+        const auto chunks = co_await net::co_spawn(
+            blocking_pool,
+            [&]() -> net::awaitable<std::vector<Chunk>> {
+                co_return chunk_file(file_path);
+            },
+            net::use_awaitable
+        );
+        // Раздаваемые файлы тоже становятся источником чанков
+        // для собственных загрузок.
+        Chunk_Store::get_instance().add_file(file_path, chunks);
+        manifest = serialize_manifest(chunks);
+        if (const auto builder =
+                artifact_cache.try_build(cache_key, manifest.size())) {
+            builder->write(manifest.data(), manifest.size());
+            builder->commit();
+        }
+    }
+
+    http::response<http::string_body> res{http::status::ok, req.version()};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, "text/plain");
+    res.set(http::field::accept_ranges, "bytes");
+    res.keep_alive(req.keep_alive());
+    res.set("X-File-Size", std::to_string(file_size));
+    res.set("X-Transfer-Mode", CHUNKED_TRANSFER_MODE);
+    if (!hash.empty()) {
+        res.set(http::field::etag, hash);
+    }
+    res.set(http::field::content_encoding, RAW_ENCODING);
+    res.body() = std::move(manifest);
+    res.prepare_payload();
+    co_await throttle_upload(stream, Traffic_Class::metadata, res.body().size());
+    co_await http::async_write(stream, res, net::use_awaitable);
+    logger.log(Log_Level::request, "Sending manifest of " + file_path + '\n');
+}
+
+net::awaitable<void> transport_service::Server::do_listen(
+    tcp::acceptor &acceptor,
+    Session_Limiter &limiter
+) const {
+    for (;;) {
+        co_await limiter.acquire();
+        logger.log(Log_Level::request, "Waiting for a connection...\n");
+        tcp::socket socket = co_await acceptor.async_accept(net::use_awaitable);
+        logger.log(Log_Level::request, "Handle response\n");
+        // Strand нужен File_Prefetcher: чтение с диска завершается
+        // обработчиком, который не должен идти параллельно с сессией.
+        net::co_spawn(
+            net::make_strand(ioc), do_session(std::move(socket)),
+            [&limiter](const std::exception_ptr &) { limiter.release(); }
+        );
+    }
+}
+
+void transport_service::Server::run() const {
+    try {
+        Session_Limiter limiter(ioc, max_sessions);
+
+        tcp::acceptor acceptor{ioc};
+        boost::asio::ip::tcp::endpoint endpoint(
+            boost::asio::ip::tcp::v4(), port
+        );
+        acceptor.open(endpoint.protocol());
+        acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true)
+        );
+        acceptor.bind(endpoint);
+        acceptor.listen();
+
+        logger.log("Server is running on port " + std::to_string(port) + '\n');
+
+        net::co_spawn(
+            limiter.get_executor(), do_listen(acceptor, limiter),
+            [this](const std::exception_ptr &e) {
+                if (!e) {
+                    return;
+                }
+                try {
+                    std::rethrow_exception(e);
+                } catch (const std::exception &ex) {
+                    logger.log(
+                        Log_Level::error,
+                        "Error: " + std::string(ex.what()) + '\n'
+                    );
+                }
+            }
+        );
+
+        // Все сессии выполняются корутинами на фиксированном пуле потоков.
+        std::vector<std::thread> v;
+        for (auto i = thread_count - 1; i > 0; --i) {
+            v.emplace_back([this] { ioc.run(); });
+        }
+        ioc.run();
+        for (auto &thread : v) {
+            thread.join();
+        }
+    } catch (const std::exception &e) {
+        logger.log(Log_Level::error, "Error: " + std::string(e.what()) + '\n');
+    }
+}
+
+transport_service::Server::~Server() {
+    ioc.stop();
+    if (server_thread.joinable()) {
+        server_thread.join();
+    }
+    blocking_pool.join();
+}
+
+void transport_service::get_file(
+    const std::string &server_address,
+    const std::string &file_name,
+    const std::string &file_path,
+    const unsigned long local_clock,
+    const bool allow_delta
+) {
+    try {
+        const std::string out_path = file_path + file_name;
+        const std::string part_path = out_path + PART_FILE_SUFFIX;
+        Transfer_Journal journal(part_path + JOURNAL_FILE_SUFFIX);
+
+        // Если от прошлой попытки остался журнал, докачиваем с конца
+        // подтверждённого префикса. Последний байт всегда перезапрашивается,
+        // чтобы сервер мог подтвердить ETag через If-Range.
+        std::uint64_t resume_offset = 0;
+        if (journal.load() && std::filesystem::exists(part_path) &&
+            journal.get_size() > 0) {
+            resume_offset =
+                std::min(journal.verified_prefix(), journal.get_size() - 1);
+        }
+
+        // Устаревшая локальная копия описывается сигнатурами блоков,
+        // и сервер присылает только отличия от неё.
+        std::optional<Delta_Signatures> signatures;
+        if (allow_delta && resume_offset == 0 &&
+            std::filesystem::is_regular_file(out_path) &&
+            std::filesystem::file_size(out_path) >= DELTA_MIN_FILE_SIZE) {
+            signatures = Delta_Signatures::compute(out_path);
+        }
+        // Без локальной копии файл собирается из чанков, которые уже
+        // есть в других файлах, если сервер пришлёт манифест.
+        const bool want_chunks =
+            allow_delta && resume_offset == 0 && !signatures;
+
+        http::request<http::string_body> req{
+            http::verb::get, "/" + file_name, 11};
+        req.set(http::field::host, server_address);
+        req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+        req.set("X-File-Version", std::to_string(local_clock));
+        req.set(http::field::accept_encoding, accept_encoding_header());
+        if (const std::uint64_t speed = observed_link_speed_mbps; speed > 0) {
+            req.set("X-Link-Speed", std::to_string(speed));
+        }
+        if (resume_offset > 0) {
+            req.set(
+                http::field::range,
+                "bytes=" + std::to_string(resume_offset) + "-"
+            );
+            req.set(http::field::if_range, journal.get_etag());
+        }
+        if (signatures) {
+            req.set("X-Transfer-Mode", DELTA_TRANSFER_MODE);
+            req.set(http::field::content_type, "application/octet-stream");
+            req.body() = signatures->serialize();
+            req.prepare_payload();
+        } else if (want_chunks) {
+            req.set("X-Transfer-Mode", CHUNKED_TRANSFER_MODE);
+        }
+
+        beast::flat_buffer buffer;
+        http::response_parser<http::buffer_body> parser;
+        parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+        Connection_Pool::Lease connection =
+            send_pooled(server_address, req, buffer, parser);
+        Tls_Stream &stream = connection.get_stream();
+
+        const auto &header = parser.get().base();
+        const bool is_resumed = header.result() == http::status::partial_content;
+        const bool is_ok = is_resumed || header.result() == http::status::ok;
+        const std::string_view encoding = header[http::field::content_encoding];
+        // Сервер без поддержки дельты отвечает обычным файлом.
+        const bool is_delta = signatures && is_ok && !is_resumed &&
+                              header["X-Transfer-Mode"] == DELTA_TRANSFER_MODE;
+        const bool is_chunked =
+            want_chunks && is_ok && !is_resumed &&
+            header["X-Transfer-Mode"] == CHUNKED_TRANSFER_MODE;
+        const auto traffic_class = response_traffic_class(parser);
+
+        // Распаковка, хеширование и запись на диск идут за один проход
+        // по каждому полученному блоку.
+        Sha1_Hasher hasher;
+        std::optional<Part_File> out_file;
+        std::uint64_t offset = 0;
+        std::string etag;
+        if (is_resumed) {
+            etag = journal.get_etag();
+            offset = resume_offset;
+            hash_file_prefix(part_path, offset, hasher);
+            out_file.emplace(out_path, true);
+        } else if (is_ok) {
+            etag = std::string(header[http::field::etag]);
+            const std::uint64_t file_size =
+                response_file_size(parser).value_or(0);
+            journal.reset(etag, file_size);
+            out_file.emplace(out_path);
+            out_file->preallocate(file_size);
+        }
+        // Запись на диск идёт в фоне, пока читается следующий блок.
+        std::optional<Write_Behind> writer;
+        if (out_file) {
+            writer.emplace(out_file->get_fd(), offset, STREAM_BLOCK_SIZE);
+        }
+
+        std::unique_ptr<Decoder> decoder;
+        if (is_ok && !encoding.empty() && encoding != RAW_ENCODING) {
+            decoder = make_decoder(encoding);
+            if (!decoder) {
+                throw std::runtime_error(
+                    "Unsupported Content-Encoding: " + std::string(encoding)
+                );
+            }
+        }
+        // Каждые RESUME_CHECKPOINT_SIZE байт данные сбрасываются на диск
+        // и только после этого отмечаются в журнале.
+        std::uint64_t checkpoint = offset;
+        const Sink write_out = [&](const char *data, const std::size_t size) {
+            writer->write(data, size);
+            hasher.update(data, size);
+            offset += size;
+            if (offset - checkpoint >= RESUME_CHECKPOINT_SIZE) {
+                writer->drain();
+                ::fdatasync(out_file->get_fd());
+                journal.add(Byte_Range{checkpoint, offset - checkpoint});
+                checkpoint = offset;
+            }
+        };
+        // Дельта собирается поверх старой копии, которая заменяется
+        // только после проверки хеша.
+        std::optional<File_Descriptor> basis_file;
+        std::optional<Delta_Decoder> delta_decoder;
+        if (is_delta) {
+            basis_file.emplace(::open(out_path.c_str(), O_RDONLY));
+            delta_decoder.emplace(basis_file->fd, signatures->block_size);
+        }
+        std::string manifest;
+        Sink body_out = write_out;
+        if (is_delta) {
+            body_out = [&](const char *data, const std::size_t size) {
+                delta_decoder->write(data, size, write_out);
+            };
+        } else if (is_chunked) {
+            body_out = [&](const char *data, const std::size_t size) {
+                manifest.append(data, size);
+            };
+        }
+
+        std::vector<char> block(STREAM_BLOCK_SIZE);
+        std::uint64_t received_total = 0;
+        const auto body_start = std::chrono::steady_clock::now();
+        while (!parser.is_done()) {
+            parser.get().body().data = block.data();
+            parser.get().body().size = block.size();
+
+            beast::error_code read_ec;
+            http::read(stream, buffer, parser, read_ec);
+            if (read_ec == http::error::need_buffer) {
+                read_ec = {};
+            }
+            if (read_ec) {
+                throw beast::system_error{read_ec};
+            }
+
+            const std::size_t received = block.size() - parser.get().body().size;
+            throttle_download(stream, traffic_class, received);
+            if (!is_ok || received == 0) {
+                continue;
+            }
+            received_total += received;
+            if (decoder) {
+                decoder->write(block.data(), received, body_out);
+            } else {
+                body_out(block.data(), received);
+            }
+        }
+
+        if (is_ok) {
+            if (decoder && !decoder->is_done()) {
+                throw std::runtime_error("Compressed stream is truncated");
+            }
+            if (delta_decoder && !delta_decoder->is_idle()) {
+                throw std::runtime_error("Delta stream is truncated");
+            }
+            std::optional<std::vector<Chunk>> chunks;
+            if (is_chunked) {
+                chunks = parse_manifest(manifest);
+                if (!chunks) {
+                    throw std::runtime_error("Malformed chunk manifest");
+                }
+                fetch_chunks(
+                    stream, buffer, server_address, "/" + file_name, etag,
+                    *chunks, write_out
+                );
+            }
+
+            writer->drain();
+            const std::string hash = hasher.etag();
+            if (etag != hash) {
+                // Испорченную частичную копию докачивать бессмысленно.
+                out_file->discard();
+                journal.remove();
+                if (is_delta || is_chunked) {
+                    // Локальные данные могли измениться, пока файл
+                    // собирался: он запрашивается целиком.
+                    std::cerr << "Rebuilt file doesn't match expected hash, "
+                                 "downloading the whole file"
+                              << std::endl;
+                    connection.release();
+                    get_file(
+                        server_address, file_name, file_path, local_clock,
+                        false
+                    );
+                    return;
+                }
+                std::cerr << "File doesn't match expected hash" << std::endl;
+                std::cerr << out_path + " hash: " << hash << std::endl;
+                std::cerr << "Expected ETag: " << etag << std::endl;
+                throw std::runtime_error("File doesn't match expected hash");
+            }
+
+            if (::ftruncate(out_file->get_fd(), static_cast<off_t>(offset)) !=
+                0) {
+                throw std::system_error(
+                    errno, std::generic_category(), "ftruncate"
+                );
+            }
+            out_file->commit();
+            journal.remove();
+            Hash_Index::get_instance().record(out_path, hash);
+            if (chunks) {
+                Chunk_Store::get_instance().add_file(out_path, *chunks);
+            }
+
+            const std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - body_start;
+            if (!decoder && !is_delta && !is_chunked &&
+                received_total >= LINK_SPEED_SAMPLE_SIZE &&
+                elapsed.count() > 0) {
+                observed_link_speed_mbps = static_cast<std::uint64_t>(
+                    static_cast<double>(received_total) * 8 / 1e6 /
+                    elapsed.count()
+                );
+            }
+
+            std::cout << "File downloaded successfully: " << out_path
+                      << std::endl;
+        } else {
+            std::cerr << "Error: " << header.result() << " - "
+                      << header.reason() << std::endl;
+        }
+
+        // Ответ прочитан целиком: соединение остаётся для следующих файлов.
+        if (parser.keep_alive()) {
+            connection.release();
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+}
+
+void transport_service::get_files(
+    const std::string &server_address,
+    const std::vector<std::string> &file_names,
+    const std::string &file_path,
+    const unsigned long local_clock
+) {
+    std::size_t received = 0;
+    // Файлы, ответ на которые не прошёл проверку.
+    std::vector<std::size_t> failed;
+    // Мелкие файлы сбрасываются на диск и встают на места пачками.
+    Commit_Batch batch;
+    try {
+        const auto make_request = [&](const std::string &file_name) {
+            http::request<http::empty_body> req{
+                http::verb::get, "/" + file_name, 11};
+            req.set(http::field::host, server_address);
+            req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+            req.set("X-File-Version", std::to_string(local_clock));
+            req.set(http::field::accept_encoding, accept_encoding_header());
+            if (const std::uint64_t speed = observed_link_speed_mbps;
+                speed > 0) {
+                req.set("X-Link-Speed", std::to_string(speed));
+            }
+            return req;
+        };
+
+        beast::flat_buffer buffer;
+        std::optional<http::response_parser<http::buffer_body>> parser;
+        const auto next_parser = [&] {
+            parser.emplace();
+            parser->body_limit(std::numeric_limits<std::uint64_t>::max());
+        };
+
+        // Первый запрос идёт отдельно: только получив ответ, можно быть
+        // уверенным, что соединение из пула живо и конвейер не пропадёт.
+        std::size_t sent = 0;
+        std::optional<Connection_Pool::Lease> connection;
+        while (received < file_names.size()) {
+            if (!connection) {
+                next_parser();
+                connection.emplace(send_pooled(
+                    server_address, make_request(file_names[received]),
+                    buffer, *parser
+                ));
+                sent = received + 1;
+            }
+            Tls_Stream &stream = connection->get_stream();
+            while (sent < file_names.size() &&
+                   sent - received < PIPELINE_DEPTH) {
+                http::write(stream, make_request(file_names[sent++]));
+            }
+
+            if (!receive_file(
+                    stream, buffer, *parser,
+                    file_path + file_names[received], batch
+                )) {
+                failed.push_back(received);
+            }
+            ++received;
+            if (!parser->keep_alive()) {
+                // Отправленные следом запросы сервер уже не прочитает.
+                connection.reset();
+                buffer.clear();
+                continue;
+            }
+            if (received == file_names.size()) {
+                connection->release();
+                break;
+            }
+            next_parser();
+            http::read_header(stream, buffer, *parser);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+    // Уже проверенные файлы публикуются и после обрыва соединения.
+    try {
+        batch.flush();
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+    // Непрошедшие проверку файлы и оставшиеся после обрыва соединения
+    // запрашиваются по одному.
+    for (; received < file_names.size(); ++received) {
+        failed.push_back(received);
+    }
+    for (const std::size_t index : failed) {
+        get_file(server_address, file_names[index], file_path, local_clock);
+    }
+}
+
+bool transport_service::get_folder(
+    const std::string &server_address,
+    const std::string &folder_name,
+    const std::string &folder_path,
+    const unsigned long local_clock
+) {
+    try {
+        http::request<http::empty_body> req{
+            http::verb::get, "/" + folder_name, 11};
+        req.set(http::field::host, server_address);
+        req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+        req.set("X-File-Version", std::to_string(local_clock));
+        req.set("X-Transfer-Mode", ARCHIVE_TRANSFER_MODE);
+        req.set(http::field::accept_encoding, accept_encoding_header());
+        if (const std::uint64_t speed = observed_link_speed_mbps; speed > 0) {
+            req.set("X-Link-Speed", std::to_string(speed));
+        }
 
-    if (req.method() == http::verb::get) {
-        const std::string file_path = dec_rep_path + std::string(req.target());
-        std::ifstream file(file_path);
-        if (!file) {
-            res.result(http::status::not_found);
-            res.body() = "File not found";
-            logger.log(std::string("File not found: ") + file_path + '\n');
-        } else {
-            std::string content(
-                (std::istreambuf_iterator<char>(file)),
-                std::istreambuf_iterator<char>()
-            );
-            file.close();
-            const int current_compression_level = compression_level;
-            if (current_compression_level > Z_BEST_SPEED - 1) {
-                std::string compressed =
-                    deflate_compress(content, current_compression_level);
-                res.body() = compressed;
-                res.set(
-                    "X-Compression-Level",
-                    std::to_string(current_compression_level)
+        beast::flat_buffer buffer;
+        http::response_parser<http::buffer_body> parser;
+        parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+        Connection_Pool::Lease connection =
+            send_pooled(server_address, req, buffer, parser);
+        Tls_Stream &stream = connection.get_stream();
+
+        // Сервер без поддержки архивов отвечает на запрос каталога ошибкой.
+        const auto &header = parser.get().base();
+        const std::string_view encoding = header[http::field::content_encoding];
+        std::unique_ptr<Decoder> decoder;
+        if (!encoding.empty() && encoding != RAW_ENCODING) {
+            decoder = make_decoder(encoding);
+        }
+        const bool is_ok =
+            header.result() == http::status::ok &&
+            header["X-Transfer-Mode"] == ARCHIVE_TRANSFER_MODE &&
+            (decoder || encoding.empty() || encoding == RAW_ENCODING);
+
+        // Хеши распакованных файлов записываются сразу, чтобы при обрыве
+        // потока уже полученные файлы не пришлось хешировать заново.
+        Archive_Reader archive(folder_path + folder_name);
+        std::size_t recorded = 0;
+        const Sink unpack = [&](const char *data, const std::size_t size) {
+            archive.write(data, size);
+            const auto &extracted = archive.get_extracted();
+            for (; recorded < extracted.size(); ++recorded) {
+                Hash_Index::get_instance().record(
+                    extracted[recorded].path.string(), extracted[recorded].hash
                 );
-                res.set(http::field::content_encoding, "deflate");
-            } else {
-                res.body() = content;
-                res.set(http::field::content_encoding, "raw");
             }
+        };
+        std::vector<char> block(STREAM_BLOCK_SIZE);
+        while (!parser.is_done()) {
+            parser.get().body().data = block.data();
+            parser.get().body().size = block.size();
 
-            logger.log(
-                std::string("Compression level: ") +
-                std::to_string(current_compression_level) + '\n'
-            );
-            std::string hash = sha1_hash_file(file_path);
-            logger.log("Hash: " + hash + '\n');
+            beast::error_code ec;
+            http::read(stream, buffer, parser, ec);
+            if (ec == http::error::need_buffer) {
+                ec = {};
+            }
+            if (ec) {
+                throw beast::system_error{ec};
+            }
 
-            if (!hash.empty() && hash.find_first_not_of("0123456789abcdefABCDEF"
-                                 ) == std::string::npos) {
-                res.set(http::field::etag, hash);
+            const std::size_t received = block.size() - parser.get().body().size;
+            throttle_download(stream, Traffic_Class::bulk, received);
+            if (!is_ok || received == 0) {
+                continue;
+            }
+            if (decoder) {
+                decoder->write(block.data(), received, unpack);
             } else {
-                logger.log("Invalid ETag value generated: " + hash + '\n');
+                unpack(block.data(), received);
             }
         }
-    } else if (req.method() == http::verb::post) {
-        const std::string file_path = dec_rep_path + std::string(req.target());
-        get_file(
-            client_address, std::string(req.target()), dec_rep_path,
-            get_local_time(file_path)
-        );
-        logger.log("Get file: " + file_path + '\n');
-    } else {
-        res.result(http::status::bad_request);
-        res.body() = "Invalid request";
-        logger.log(
-            "Invalid request: " + std::string(req.method_string()) + '\n'
-        );
-    }
+        if (parser.keep_alive()) {
+            connection.release();
+        }
 
-    logger.log(std::string("Sending response") + '\n');
-    res.prepare_payload();
-    return res;
+        if (!is_ok) {
+            std::cerr << "Error: " << folder_path + folder_name << ": "
+                      << header.result() << " - " << header.reason()
+                      << std::endl;
+            return false;
+        }
+        if (!archive.is_done() || (decoder && !decoder->is_done())) {
+            std::cerr << "Archive is incomplete: " << folder_path + folder_name
+                      << std::endl;
+            return false;
+        }
+        std::cout << "Folder downloaded successfully: "
+                  << folder_path + folder_name << " ("
+                  << archive.get_extracted().size() << " files)" << std::endl;
+        return true;
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+    return false;
 }
 
-void transport_service::Server::do_session(tcp::socket &socket) const {
-    try {
-        ssl::context &ctx =
-            Certificate_Singleton::get_instance().get_server_context();
-        const std::string client_address =
-            socket.remote_endpoint().address().to_string();
-        beast::ssl_stream<beast::tcp_stream> stream(std::move(socket), ctx);
+namespace {
+using transport_service::Merkle_Tree;
 
-        stream.handshake(ssl::stream_base::server);
+// Дерево Меркла берётся у первых двух источников, которые его отдают.
+// Если корни не совпали, одному из них верить нельзя, и куски
+// проверяются только хешем всего файла.
+std::optional<Merkle_Tree> fetch_agreed_tree(
+    const std::vector<Peer_File> &sources,
+    const std::string &file_name
+) {
+    std::optional<Merkle_Tree> tree;
+    std::size_t tree_count = 0;
+    for (const auto &source : sources) {
+        if (!source.has_merkle_tree || tree_count == 2) {
+            continue;
+        }
+        try {
+            auto candidate = fetch_merkle_tree(source, file_name);
+            if (!candidate) {
+                continue;
+            }
+            if (tree && tree->root() != candidate->root()) {
+                std::cerr << "Peers disagree on piece hashes of " << file_name
+                          << std::endl;
+                return std::nullopt;
+            }
+            if (!tree) {
+                tree = std::move(candidate);
+            }
+            ++tree_count;
+        } catch (const std::exception &e) {
+            std::cerr << "Peer " << source.address
+                      << " did not send piece hashes: " << e.what()
+                      << std::endl;
+        }
+    }
+    return tree;
+}
 
-        beast::flat_buffer buffer;
+// Качает файл кусками у источников одной версии файла, по
+// connections_per_peer соединений к каждому; куски распределяет
+// Swarm_Scheduler. С деревом Меркла куски идут по его сетке и пишутся
+// только после проверки, без дерева - по piece_size, и тогда их
+// проверяет лишь хеш всего файла.
+void download_pieces(
+    const std::vector<Peer_File> &sources,
+    const std::string &file_name,
+    const std::string &file_path,
+    const std::size_t connections_per_peer,
+    std::uint64_t piece_size
+) {
+    const std::string &etag = sources.front().etag;
+    const std::uint64_t file_size = sources.front().size;
+    const std::optional<Merkle_Tree> tree = fetch_agreed_tree(sources, file_name);
+    if (tree) {
+        piece_size = tree->get_piece_size();
+    }
 
-        for (;;) {
-            http::request<http::string_body> req;
-            http::read(stream, buffer, req);
+    const std::string out_path = file_path + file_name;
+    const std::string part_path = out_path + PART_FILE_SUFFIX;
+    transport_service::Transfer_Journal journal(part_path + JOURNAL_FILE_SUFFIX);
+    if (!journal.load() || journal.get_etag() != etag ||
+        journal.get_size() != file_size ||
+        !std::filesystem::exists(part_path)) {
+        journal.reset(etag, file_size);
+    }
 
-            auto res = handle_response(req, client_address);
+    transport_service::Part_File out_file(out_path, true);
+    if (::ftruncate(out_file.get_fd(), static_cast<off_t>(file_size)) != 0) {
+        throw std::system_error(errno, std::generic_category(), "ftruncate");
+    }
+    // Не везде поддерживается, тогда файл остаётся разреженным.
+    out_file.preallocate(file_size);
 
-            http::write(stream, res);
-            if (!res.keep_alive()) {
-                break;
-            }
+    // Качаются только куски, которых ещё нет в журнале. С деревом кусок,
+    // который журнал покрывает лишь частично (например, после get_file),
+    // качается целиком, иначе его нельзя проверить.
+    std::vector<Byte_Range> ranges;
+    for (const auto &gap : journal.missing(piece_size)) {
+        if (!tree) {
+            ranges.push_back(gap);
+            continue;
         }
-        beast::error_code ec;
-        stream.shutdown(ec);
-        if (ec == net::error::eof) {
-            ec = {};
+        for (std::uint64_t i = gap.offset / piece_size;
+             i * piece_size < gap.offset + gap.length; ++i) {
+            if (ranges.empty() || ranges.back().offset < i * piece_size) {
+                ranges.push_back(Byte_Range{
+                    i * piece_size,
+                    tree->piece_length(static_cast<std::size_t>(i))});
+            }
         }
-        if (ec == ssl::error::stream_truncated) {
-            ec = {};
+    }
+    transport_service::Swarm_Scheduler scheduler(ranges, sources.size());
+
+    // Отказавшее соединение переподключается, пока пир не исчерпает
+    // SWARM_PEER_RETRIES, а его кусок возвращается в очередь.
+    const auto worker = [&](const std::size_t peer) {
+        const std::string &address = sources[peer].address;
+        std::string data;
+        std::optional<std::size_t> piece = scheduler.wait_acquire(peer);
+        while (piece) {
+            try {
+                net::io_context worker_ioc;
+                Tls_Stream stream = connect_to_server(worker_ioc, address);
+                beast::flat_buffer buffer;
+                bool is_reusable = true;
+                while (piece && is_reusable) {
+                    const Byte_Range range = scheduler.get_range(*piece);
+                    const std::size_t current = *piece;
+                    data.clear();
+                    data.reserve(static_cast<std::size_t>(range.length));
+                    if (!fetch_range(
+                            stream, buffer, address, file_name, range,
+                            [&data](const char *bytes, const std::size_t size) {
+                                data.append(bytes, size);
+                            },
+                            etag, [&] { return scheduler.is_done(current); }
+                        )) {
+                        // Кусок докачал другой пир; в соединении
+                        // остался недочитанный ответ.
+                        scheduler.release(current, peer, false);
+                        is_reusable = false;
+                    } else if (tree && !tree->verify_piece(
+                                           static_cast<std::size_t>(
+                                               range.offset / piece_size
+                                           ),
+                                           data.data(), data.size()
+                                       )) {
+                        std::cerr << "Peer " << address
+                                  << " sent a corrupt piece at offset "
+                                  << range.offset << std::endl;
+                        scheduler.reject(current, peer);
+                    } else {
+                        // Кусок пишется целиком и только после проверки,
+                        // поэтому дубликат от другого пира не испортит
+                        // уже готовые байты.
+                        out_file.write_at(
+                            data.data(), data.size(), range.offset
+                        );
+                        if (scheduler.complete(current, peer)) {
+                            ::fdatasync(out_file.get_fd());
+                            journal.add(range);
+                        }
+                    }
+                    piece = scheduler.wait_acquire(peer);
+                }
+                if (is_reusable) {
+                    shutdown_stream(stream);
+                }
+            } catch (const std::exception &e) {
+                std::cerr << "Peer " << address << " failed: " << e.what()
+                          << std::endl;
+                if (piece) {
+                    scheduler.release(*piece, peer, true);
+                    piece = scheduler.wait_acquire(peer);
+                }
+            }
         }
-        if (ec) {
-            throw beast::system_error{ec};
+    };
+
+    std::vector<std::thread> workers;
+    for (std::size_t peer = 0; peer < sources.size(); ++peer) {
+        for (std::size_t i = 0; i < connections_per_peer; ++i) {
+            workers.emplace_back(worker, peer);
         }
-    } catch (const beast::system_error &se) {
-        if (se.code() != http::error::end_of_stream) {
-            logger.log("Session error: " + std::string(se.what()) + '\n');
+    }
+    for (auto &thread : workers) {
+        thread.join();
+    }
+    if (!scheduler.is_finished()) {
+        throw std::runtime_error("All peers failed, download is incomplete");
+    }
+
+    // Куски приходят не по порядку, поэтому хеш считается
+    // один раз по готовому файлу.
+    const std::string hash = transport_service::sha1_hash_file(part_path);
+    if (etag != hash) {
+        out_file.discard();
+        journal.remove();
+        std::cerr << "File doesn't match expected hash" << std::endl;
+        std::cerr << out_path + " hash: " << hash << std::endl;
+        std::cerr << "Expected ETag: " << etag << std::endl;
+        throw std::runtime_error("File doesn't match expected hash");
+    }
+    out_file.commit();
+    transport_service::Hash_Index::get_instance().record(out_path, hash);
+    journal.remove();
+
+    std::cout << "File downloaded successfully from " << sources.size()
+              << (sources.size() == 1 ? " peer: " : " peers: ") << out_path
+              << std::endl;
+}
+}  // namespace
+
+void transport_service::get_large_file(
+    const std::string &server_address,
+    const std::string &file_name,
+    const std::string &file_path,
+    const unsigned long local_clock
+) {
+    try {
+        const auto source = probe_peer(server_address, file_name, local_clock);
+        if (!source) {
+            std::cerr << "Error: " << server_address << " has no "
+                      << file_name << std::endl;
+            return;
         }
+        download_pieces(
+            {*source}, file_name, file_path, LARGE_FILE_CONNECTIONS,
+            LARGE_FILE_RANGE_SIZE
+        );
     } catch (const std::exception &e) {
-        logger.log("Session error: " + std::string(e.what()) + '\n');
+        std::cerr << "Error: " << e.what() << std::endl;
     }
 }
 
-void transport_service::Server::run() const {
-    try {
-        net::io_context ioc{thread_count};
-        std::vector<std::thread> v;
-        for (auto i = thread_count - 1; i > 0; --i) {
-            v.emplace_back([&ioc] { ioc.run(); });
+transport_service::Swarm_Scheduler::Swarm_Scheduler(
+    const std::vector<Byte_Range> &ranges,
+    const std::size_t peer_count
+)
+    : peers(peer_count) {
+    for (const auto &range : ranges) {
+        pending.push_back(pieces.size());
+        Piece piece;
+        piece.range = range;
+        pieces.push_back(piece);
+    }
+}
+
+bool transport_service::Swarm_Scheduler::is_slow(const std::size_t peer
+) const {
+    double best = 0;
+    for (const auto &other : peers) {
+        if (!other.dropped) {
+            best = std::max(best, other.rate);
         }
+    }
+    return peers[peer].rate > 0 &&
+           peers[peer].rate < best * SWARM_SLOW_PEER_RATIO;
+}
 
-        tcp::acceptor acceptor{ioc};
-        boost::asio::ip::tcp::endpoint endpoint(
-            boost::asio::ip::tcp::v4(), port
-        );
-        acceptor.open(endpoint.protocol());
-        acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true)
-        );
-        acceptor.bind(endpoint);
-        acceptor.listen();
+std::optional<std::size_t>
+transport_service::Swarm_Scheduler::take(const std::size_t peer) {
+    if (peers[peer].dropped || done_count == pieces.size()) {
+        return std::nullopt;
+    }
+    const bool slow = is_slow(peer);
+    std::size_t fast_peers = 0;
+    for (std::size_t i = 0; i < peers.size(); ++i) {
+        fast_peers += !peers[i].dropped && !is_slow(i);
+    }
+    // Хвост придерживается для быстрых пиров, только пока кто-то качает:
+    // если в работе нет ни одного куска, ждать некого.
+    std::optional<std::size_t> piece;
+    if (!pending.empty() &&
+        (!slow || in_flight_count == 0 ||
+         pending.size() > fast_peers * SWARM_CONNECTIONS_PER_PEER)) {
+        piece = pending.front();
+        pending.pop_front();
+    } else if (pending.empty() && !slow) {
+        // Endgame: дублируется самый давний кусок, который качает
+        // только один более медленный пир.
+        for (std::size_t i = 0; i < pieces.size(); ++i) {
+            const Piece &candidate = pieces[i];
+            if (candidate.done || candidate.in_flight != 1 ||
+                candidate.peer == peer ||
+                peers[candidate.peer].rate >= peers[peer].rate) {
+                continue;
+            }
+            if (!piece || candidate.started < pieces[*piece].started) {
+                piece = i;
+            }
+        }
+    }
+    if (piece) {
+        ++pieces[*piece].in_flight;
+        ++in_flight_count;
+        pieces[*piece].peer = peer;
+        pieces[*piece].started = std::chrono::steady_clock::now();
+    }
+    return piece;
+}
 
-        logger.log("Server is running on port " + port + '\n');
+std::optional<std::size_t>
+transport_service::Swarm_Scheduler::acquire(const std::size_t peer) {
+    const std::lock_guard lock(mutex);
+    return take(peer);
+}
 
-        for (;;) {
-            logger.log("Waiting for a connection..." + '\n');
-            tcp::socket socket{ioc};
-            acceptor.accept(socket);
-            logger.log("Handle response" + '\n');
-            std::thread(
-                [this](tcp::socket m_socket) { do_session(m_socket); },
-                std::move(socket)
-            )
-                .detach();
+std::optional<std::size_t>
+transport_service::Swarm_Scheduler::wait_acquire(const std::size_t peer) {
+    std::unique_lock lock(mutex);
+    for (;;) {
+        if (const auto piece = take(peer)) {
+            return piece;
         }
-    } catch (const std::exception &e) {
-        logger.log("Error: " + std::string(e.what()) + '\n');
+        // Без кусков в работе состояние уже не изменится.
+        if (peers[peer].dropped || done_count == pieces.size() ||
+            in_flight_count == 0) {
+            return std::nullopt;
+        }
+        changed.wait(lock);
     }
 }
 
-void transport_service::get_file(
-    const std::string &server_address,
+bool transport_service::Swarm_Scheduler::complete(
+    const std::size_t piece,
+    const std::size_t peer
+) {
+    const std::lock_guard lock(mutex);
+    Piece &p = pieces[piece];
+    --p.in_flight;
+    --in_flight_count;
+    changed.notify_all();
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - p.started;
+    if (elapsed.count() > 0) {
+        const double rate =
+            static_cast<double>(p.range.length) / elapsed.count();
+        double &peer_rate = peers[peer].rate;
+        peer_rate = peer_rate == 0 ? rate
+                                   : SWARM_RATE_SMOOTHING * rate +
+                                         (1 - SWARM_RATE_SMOOTHING) * peer_rate;
+    }
+    if (p.done) {
+        return false;
+    }
+    p.done = true;
+    ++done_count;
+    return true;
+}
+
+void transport_service::Swarm_Scheduler::release(
+    const std::size_t piece,
+    const std::size_t peer,
+    const bool failed
+) {
+    const std::lock_guard lock(mutex);
+    Piece &p = pieces[piece];
+    --p.in_flight;
+    --in_flight_count;
+    changed.notify_all();
+    if (!p.done && p.in_flight == 0) {
+        pending.push_front(piece);
+    }
+    if (failed && ++peers[peer].failures > SWARM_PEER_RETRIES) {
+        peers[peer].dropped = true;
+    }
+}
+
+void transport_service::Swarm_Scheduler::reject(
+    const std::size_t piece,
+    const std::size_t peer
+) {
+    const std::lock_guard lock(mutex);
+    Piece &p = pieces[piece];
+    --p.in_flight;
+    --in_flight_count;
+    changed.notify_all();
+    if (!p.done && p.in_flight == 0) {
+        pending.push_front(piece);
+    }
+    // TLS исключает порчу в пути: у пира сама копия файла не та.
+    peers[peer].dropped = true;
+}
+
+transport_service::Byte_Range
+transport_service::Swarm_Scheduler::get_range(const std::size_t piece) const {
+    const std::lock_guard lock(mutex);
+    return pieces[piece].range;
+}
+
+bool transport_service::Swarm_Scheduler::is_done(const std::size_t piece
+) const {
+    const std::lock_guard lock(mutex);
+    return pieces[piece].done;
+}
+
+bool transport_service::Swarm_Scheduler::is_finished() const {
+    const std::lock_guard lock(mutex);
+    return done_count == pieces.size();
+}
+
+void transport_service::get_file_from_peers(
+    const std::vector<std::string> &peer_addresses,
     const std::string &file_name,
     const std::string &file_path,
     const unsigned long local_clock
 ) {
     try {
-        ssl::context &ctx =
-            Certificate_Singleton::get_instance().get_client_context();
-        net::io_context ioc;
-        tcp::resolver resolver(ioc);
-        const auto results =
-            resolver.resolve(server_address, std::to_string(SERVER_PORT));
-
-        beast::ssl_stream<beast::tcp_stream> stream(ioc, ctx);
-        if (!SSL_set_tlsext_host_name(
-                stream.native_handle(), server_address.c_str()
-            )) {
-            beast::error_code ec{
-                static_cast<int>(::ERR_get_error()),
-                net::error::get_ssl_category()};
-            throw beast::system_error{ec};
-        }
-
-        beast::get_lowest_layer(stream).connect(results);
-        stream.handshake(ssl::stream_base::client);
-
-        http::request<http::string_body> req{
-            http::verb::get, "/" + file_name, 11};
-        req.set(http::field::host, server_address);
-        req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
-        req.set("X-File-Version", std::to_string(local_clock));
-        http::write(stream, req);
-
-        beast::flat_buffer buffer;
-        http::response<http::dynamic_body> res;
-        http::read(stream, buffer, res);
-
-        if (res.result() == http::status::ok) {
-            std::ofstream out_file(file_path + file_name, std::ios::binary);
-            if (!out_file) {
-                std::cerr << "Failed to open file for writing: "
-                          << file_path + file_name << std::endl;
-                return;
-            }
-
-            std::string file_data = beast::buffers_to_string(res.body().data());
-
-            if (res.base().find(http::field::content_encoding) !=
-                    res.base().end() &&
-                res.base().at(http::field::content_encoding) == "deflate") {
-                file_data = deflate_decompress(file_data);
-            }
-            out_file << file_data;
-            out_file.close();
-            // out_file << beast::buffers_to_string(res.body().data());
-            out_file.close();
-            std::string etag = res.base().at(http::field::etag);
-            std::string hash = sha1_hash_file(file_path + file_name);
-            if (etag != hash) {
-                std::cerr << "File doesn't match expected hash" << std::endl;
-                std::cerr << file_path + file_name + " hash: " << hash
-                          << std::endl;
-                std::cerr << "Expected ETag: " << etag << std::endl;
-                throw std::runtime_error("File doesn't match expected hash");
+        // Пиры опрашиваются параллельно; недоступные просто выпадают.
+        std::vector<std::optional<Peer_File>> probes(peer_addresses.size());
+        {
+            std::vector<std::thread> probe_threads;
+            for (std::size_t i = 0; i < peer_addresses.size(); ++i) {
+                probe_threads.emplace_back([&, i] {
+                    try {
+                        probes[i] = probe_peer(
+                            peer_addresses[i], file_name, local_clock
+                        );
+                    } catch (const std::exception &e) {
+                        std::cerr << "Peer " << peer_addresses[i]
+                                  << " is unavailable: " << e.what()
+                                  << std::endl;
+                    }
+                });
+            }
+            for (auto &thread : probe_threads) {
+                thread.join();
             }
-
-            std::cout << "File downloaded successfully: "
-                      << file_path + file_name << std::endl;
-        } else {
-            std::cerr << "Error: " << res.result() << " - " << res.reason()
-                      << std::endl;
         }
 
-        beast::error_code ec;
-        stream.shutdown(ec);
-        if (ec == net::error::eof) {
-            ec = {};
+        // Качается версия, которая есть у большинства пиров.
+        std::map<std::string, std::size_t> etag_votes;
+        for (const auto &probe : probes) {
+            if (probe) {
+                ++etag_votes[probe->etag];
+            }
         }
-        if (ec == ssl::error::stream_truncated) {
-            ec = {};
+        if (etag_votes.empty()) {
+            std::cerr << "Error: no peer has " << file_name << std::endl;
+            return;
         }
-        if (ec) {
-            throw beast::system_error{ec};
+        const std::string etag =
+            std::max_element(
+                etag_votes.begin(), etag_votes.end(),
+                [](const auto &a, const auto &b) { return a.second < b.second; }
+            )->first;
+        std::vector<Peer_File> sources;
+        for (auto &probe : probes) {
+            if (probe && probe->etag == etag &&
+                sources.size() < SWARM_MAX_PEERS) {
+                sources.push_back(std::move(*probe));
+            }
         }
+        download_pieces(
+            sources, file_name, file_path, SWARM_CONNECTIONS_PER_PEER,
+            SWARM_PIECE_SIZE
+        );
     } catch (const std::exception &e) {
         std::cerr << "Error: " << e.what() << std::endl;
     }
@@ -260,142 +3155,235 @@ void transport_service::send_file(
     const std::string &server_address,
     const std::string &file_name,
     const std::string &file_path,
-    const unsigned long local_clock
+    const unsigned long /*local_clock*/
 ) {
     try {
-        ssl::context &ctx =
-            Certificate_Singleton::get_instance().get_client_context();
-        net::io_context ioc;
-        tcp::resolver resolver(ioc);
-        const auto results =
-            resolver.resolve(server_address, std::to_string(SERVER_PORT));
-
-        beast::ssl_stream<beast::tcp_stream> stream(ioc, ctx);
-        if (!SSL_set_tlsext_host_name(
-                stream.native_handle(), server_address.c_str()
-            )) {
-            beast::error_code ec{
-                static_cast<int>(::ERR_get_error()),
-                net::error::get_ssl_category()};
-            throw beast::system_error{ec};
-        }
-
-        beast::get_lowest_layer(stream).connect(results);
-        stream.handshake(ssl::stream_base::client);
+        request_pull(server_address, file_name, file_path, false);
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+}
 
-        http::request<http::string_body> req{
-            http::verb::post, file_path + "/" + file_name, 11};
-        req.set(http::field::host, server_address);
-        req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+void transport_service::send_large_file(
+    const std::string &server_address,
+    const std::string &file_name,
+    const std::string &file_path,
+    const unsigned long /*local_clock*/
+) {
+    try {
+        request_pull(server_address, file_name, file_path, true);
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+}
 
-        http::write(stream, req);
+transport_service::Transfer_Journal::Transfer_Journal(
+    std::string m_journal_path
+)
+    : journal_path(std::move(m_journal_path)) {
+}
 
-        beast::flat_buffer buffer;
-        http::response<http::dynamic_body> res;
-        http::read(stream, buffer, res);
-        if (res.result() != http::status::ok) {
-            std::cerr << "Error: " << res.result() << " - " << res.reason()
-                      << std::endl;
+bool transport_service::Transfer_Journal::load() {
+    const std::lock_guard lock(mutex);
+    verified.clear();
+    std::ifstream file(journal_path);
+    if (!(file >> etag >> size)) {
+        etag.clear();
+        size = 0;
+        return false;
+    }
+    Byte_Range range{};
+    while (file >> range.offset >> range.length) {
+        if (range.length > 0 && range.offset + range.length <= size) {
+            verified.push_back(range);
         }
+    }
+    merge();
+    return true;
+}
 
-        beast::error_code ec;
-        stream.shutdown(ec);
-        if (ec == net::error::eof) {
-            ec = {};
+void transport_service::Transfer_Journal::reset(
+    const std::string &m_etag,
+    const std::uint64_t m_size
+) {
+    const std::lock_guard lock(mutex);
+    etag = m_etag;
+    size = m_size;
+    verified.clear();
+    std::ofstream file(journal_path, std::ios::trunc);
+    file << etag << ' ' << size << '\n';
+}
+
+void transport_service::Transfer_Journal::add(const Byte_Range &range) {
+    const std::lock_guard lock(mutex);
+    verified.push_back(range);
+    merge();
+    std::ofstream file(journal_path, std::ios::app);
+    file << range.offset << ' ' << range.length << '\n';
+}
+
+void transport_service::Transfer_Journal::merge() {
+    std::sort(
+        verified.begin(), verified.end(),
+        [](const Byte_Range &lhs, const Byte_Range &rhs) {
+            return lhs.offset < rhs.offset;
         }
-        if (ec == ssl::error::stream_truncated) {
-            ec = {};
+    );
+    std::vector<Byte_Range> merged;
+    for (const auto &range : verified) {
+        if (!merged.empty() &&
+            merged.back().offset + merged.back().length >= range.offset) {
+            const std::uint64_t end = std::max(
+                merged.back().offset + merged.back().length,
+                range.offset + range.length
+            );
+            merged.back().length = end - merged.back().offset;
+        } else {
+            merged.push_back(range);
         }
-        if (ec) {
-            throw beast::system_error{ec};
+    }
+    verified = std::move(merged);
+}
+
+std::vector<transport_service::Byte_Range>
+transport_service::Transfer_Journal::missing(const std::uint64_t piece_size
+) const {
+    const std::lock_guard lock(mutex);
+    std::vector<Byte_Range> result;
+    const auto add_gap = [&](std::uint64_t from, const std::uint64_t to) {
+        while (from < to) {
+            const std::uint64_t length = std::min(piece_size, to - from);
+            result.push_back(Byte_Range{from, length});
+            from += length;
         }
+    };
 
-    } catch (const std::exception &e) {
-        std::cerr << "Error: " << e.what() << std::endl;
+    std::uint64_t position = 0;
+    for (const auto &range : verified) {
+        add_gap(position, range.offset);
+        position = range.offset + range.length;
     }
+    add_gap(position, size);
+    return result;
 }
 
-[[nodiscard]] std::string transport_service::sha1_hash_file(
-    const std::string &filename
-) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file) {
-        return {};
+std::uint64_t transport_service::Transfer_Journal::verified_prefix() const {
+    const std::lock_guard lock(mutex);
+    if (verified.empty() || verified.front().offset != 0) {
+        return 0;
     }
+    return verified.front().length;
+}
 
-    std::vector<char> buffer(std::istreambuf_iterator<char>(file), {});
-    boost::uuids::detail::sha1 sha1;
-    sha1.process_bytes(buffer.data(), buffer.size());
+bool transport_service::Transfer_Journal::is_complete() const {
+    return verified_prefix() == size;
+}
 
-    boost::uuids::detail::sha1::digest_type digest;
-    sha1.get_digest(digest);
+const std::string &transport_service::Transfer_Journal::get_etag() const {
+    return etag;
+}
 
-    std::ostringstream oss;
-    oss << std::hex << std::setfill('0');
+std::uint64_t transport_service::Transfer_Journal::get_size() const {
+    return size;
+}
 
-    for (unsigned int i : digest) {
-        unsigned int value = ((i & 0xFF000000) >> 24) |
-                             ((i & 0x00FF0000) >> 8) | ((i & 0x0000FF00) << 8) |
-                             ((i & 0x000000FF) << 24);
+void transport_service::Transfer_Journal::remove() const {
+    std::error_code ec;
+    std::filesystem::remove(journal_path, ec);
+}
 
-        oss << std::setw(8) << value;
-    }
-    return oss.str();
+[[nodiscard]] std::string transport_service::sha1_hash_file(
+    const std::string &filename
+) {
+    return sha1_to_etag(hash_file(filename, Hash_Algorithm::sha1));
 }
 
 [[nodiscard]] std::string transport_service::deflate_compress(
     const std::string &data,
-    const int compression_level
+    const int compression_level,
+    const unsigned threads
 ) {
-    z_stream zs{};
-    deflateInit(&zs, compression_level);
+    if (threads > 1 && data.size() > PARALLEL_DEFLATE_BLOCK_SIZE) {
+        std::string out_string;
+        const Sink append = [&](const char *chunk, std::size_t size) {
+            out_string.append(chunk, size);
+        };
+        Parallel_Deflate_Stream encoder(compression_level, threads);
+        encoder.write(data.data(), data.size(), append);
+        encoder.finish(append);
+        return out_string;
+    }
 
+    // deflateBound - верхняя граница для всего входа, поэтому deflate
+    // пишет прямо в строку результата за один проход, а затем строка
+    // обрезается до сжатого размера без лишнего копирования.
+    const auto context = acquire_deflate(compression_level);
+    z_stream &zs = context->zs;
+    const std::size_t bound =
+        deflateBound(&zs, static_cast<uLong>(data.size()));
+    std::string out_string(bound, '\0');
     zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
-    zs.avail_in = data.size();
+    zs.next_out = reinterpret_cast<Bytef *>(out_string.data());
 
+    // avail_in и avail_out 32-битные, гигабайтные данные подаются частями.
+    constexpr std::size_t max_step = std::numeric_limits<uInt>::max();
+    std::size_t in_left = data.size();
+    std::size_t out_left = bound;
     int ret;
-    char out_buffer[BUFFER_SIZE];
-    std::string out_string;
-
     do {
-        zs.next_out = reinterpret_cast<Bytef *>(out_buffer);
-        zs.avail_out = sizeof(out_buffer);
-
-        ret = deflate(&zs, Z_FINISH);
-
-        if (out_string.size() < zs.total_out) {
-            out_string.append(out_buffer, zs.total_out - out_string.size());
-        }
-    } while (ret == Z_OK);
-
-    deflateEnd(&zs);
+        const auto in_step = static_cast<uInt>(std::min(in_left, max_step));
+        const auto out_step = static_cast<uInt>(std::min(out_left, max_step));
+        zs.avail_in = in_step;
+        zs.avail_out = out_step;
+        ret = deflate(&zs, in_left == in_step ? Z_FINISH : Z_NO_FLUSH);
+        in_left -= in_step - zs.avail_in;
+        out_left -= out_step - zs.avail_out;
+    } while (ret == Z_OK && out_left > 0);
+    if (ret != Z_STREAM_END) {
+        throw std::runtime_error("Deflate stream error");
+    }
+    out_string.resize(zs.total_out);
     return out_string;
 }
 
 [[nodiscard]] std::string transport_service::deflate_decompress(
     const std::string &data
 ) {
-    z_stream zs{};
-    inflateInit(&zs);
-
+    const auto context = acquire_inflate();
+    z_stream &zs = context->zs;
     zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
-    zs.avail_in = data.size();
 
+    // Размер результата заранее неизвестен: строка растёт вдвое, когда
+    // заканчивается место, и inflate пишет прямо в неё.
+    std::string out_string(
+        std::max<std::size_t>(data.size() * 4, BUFFER_SIZE), '\0'
+    );
+    constexpr std::size_t max_step = std::numeric_limits<uInt>::max();
+    std::size_t in_left = data.size();
+    std::size_t produced = 0;
     int ret;
-    char out_buffer[32768];
-    std::string out_string;
-
     do {
-        zs.next_out = reinterpret_cast<Bytef *>(out_buffer);
-        zs.avail_out = sizeof(out_buffer);
-
-        ret = inflate(&zs, 0);
-
-        if (out_string.size() < zs.total_out) {
-            out_string.append(out_buffer, zs.total_out - out_string.size());
+        if (produced == out_string.size()) {
+            out_string.resize(out_string.size() * 2);
         }
-    } while (ret == Z_OK);
-
-    inflateEnd(&zs);
+        const auto in_step = static_cast<uInt>(std::min(in_left, max_step));
+        const auto out_step = static_cast<uInt>(
+            std::min(out_string.size() - produced, max_step)
+        );
+        zs.avail_in = in_step;
+        zs.next_out = reinterpret_cast<Bytef *>(out_string.data() + produced);
+        zs.avail_out = out_step;
+        ret = inflate(&zs, Z_NO_FLUSH);
+        in_left -= in_step - zs.avail_in;
+        produced += out_step - zs.avail_out;
+        // Z_BUF_ERROR при свободном месте - вход кончился раньше потока.
+    } while (ret == Z_OK || (ret == Z_BUF_ERROR && zs.avail_out == 0));
+    if (ret != Z_STREAM_END) {
+        throw std::runtime_error(
+            ret == Z_BUF_ERROR ? "Truncated deflate stream"
+                               : "Inflate stream error"
+        );
+    }
+    out_string.resize(produced);
     return out_string;
 }
\ No newline at end of file
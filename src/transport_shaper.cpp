@@ -0,0 +1,139 @@
+#include "transport_shaper.hpp"
+#include <algorithm>
+#include <limits>
+#include <thread>
+
+namespace {
+double burst_size(const std::uint64_t rate) {
+    const double interval =
+        std::chrono::duration<double>(SHAPER_BURST_INTERVAL).count();
+    return std::max(static_cast<double>(rate) * interval, static_cast<double>(SHAPER_MIN_BURST));
+}
+
+// Уровень ведра, ниже которого класс не начинает новую порцию.
+double class_floor(const transport_service::Traffic_Class traffic_class, const double burst) {
+    switch (traffic_class) {
+        case transport_service::Traffic_Class::metadata:
+            return -std::numeric_limits<double>::infinity();
+        case transport_service::Traffic_Class::small_file:
+            return 0;
+        case transport_service::Traffic_Class::bulk:
+            return burst * SHAPER_BULK_RESERVE;
+    }
+    return 0;
+}
+}  // namespace
+
+transport_service::Traffic_Class
+transport_service::traffic_class_for_size(const std::uint64_t size) {
+    return size < SHAPER_SMALL_FILE_SIZE ? Traffic_Class::small_file : Traffic_Class::bulk;
+}
+
+void transport_service::Bandwidth_Shaper::Bucket::refill(
+    const double rate,
+    const double burst,
+    const Clock::time_point now
+) {
+    if (!is_started) {
+        tokens = burst;
+        updated = now;
+        is_started = true;
+        return;
+    }
+    if (now > updated) {
+        tokens = std::min(
+            burst, tokens + rate * std::chrono::duration<double>(now - updated).count()
+        );
+        updated = now;
+    }
+}
+
+transport_service::Bandwidth_Shaper &
+transport_service::Bandwidth_Shaper::get_instance(const Traffic_Direction direction) {
+    static Bandwidth_Shaper upload;
+    static Bandwidth_Shaper download;
+    return direction == Traffic_Direction::upload ? upload : download;
+}
+
+void transport_service::Bandwidth_Shaper::set_limits(
+    const std::uint64_t node_bytes_per_second,
+    const std::uint64_t peer_bytes_per_second
+) {
+    const std::lock_guard lock(mutex);
+    node_rate = node_bytes_per_second;
+    peer_rate = peer_bytes_per_second;
+    node = Bucket{};
+    peers.clear();
+}
+
+bool transport_service::Bandwidth_Shaper::is_limited() const {
+    return node_rate.load(std::memory_order_relaxed) != 0 ||
+           peer_rate.load(std::memory_order_relaxed) != 0;
+}
+
+transport_service::Bandwidth_Shaper::Clock::duration
+transport_service::Bandwidth_Shaper::reserve(
+    const std::string &peer,
+    const Traffic_Class traffic_class,
+    const std::size_t bytes,
+    const Clock::time_point now
+) {
+    if (!is_limited()) {
+        return Clock::duration::zero();
+    }
+    const std::lock_guard lock(mutex);
+    // Лимиты могли смениться после проверки без блокировки.
+    const double rates[2] = {
+        static_cast<double>(node_rate.load(std::memory_order_relaxed)),
+        static_cast<double>(peer_rate.load(std::memory_order_relaxed))
+    };
+    if (rates[0] == 0 && rates[1] == 0) {
+        return Clock::duration::zero();
+    }
+    Bucket *buckets[2] = {nullptr, nullptr};
+    if (rates[0] > 0) {
+        buckets[0] = &node;
+    }
+    if (rates[1] > 0) {
+        buckets[1] = &peers[peer];
+    }
+
+    double wait_seconds = 0;
+    for (std::size_t i = 0; i < 2; ++i) {
+        if (!buckets[i]) {
+            continue;
+        }
+        const double burst = burst_size(static_cast<std::uint64_t>(rates[i]));
+        buckets[i]->refill(rates[i], burst, now);
+        const double floor = class_floor(traffic_class, burst);
+        if (buckets[i]->tokens < floor) {
+            wait_seconds = std::max(wait_seconds, (floor - buckets[i]->tokens) / rates[i]);
+        }
+    }
+    if (wait_seconds > 0) {
+        // Не меньше миллисекунды, чтобы не крутиться на округлении.
+        return std::max<Clock::duration>(
+            std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(wait_seconds)
+            ),
+            std::chrono::milliseconds(1)
+        );
+    }
+    for (Bucket *bucket : buckets) {
+        if (bucket) {
+            bucket->tokens -= static_cast<double>(bytes);
+        }
+    }
+    return Clock::duration::zero();
+}
+
+void transport_service::Bandwidth_Shaper::wait(
+    const std::string &peer,
+    const Traffic_Class traffic_class,
+    const std::size_t bytes
+) {
+    for (auto delay = reserve(peer, traffic_class, bytes); delay > Clock::duration::zero();
+         delay = reserve(peer, traffic_class, bytes)) {
+        std::this_thread::sleep_for(delay);
+    }
+}
@@ -393,6 +393,29 @@ TEST_F(DBManagerTest, IsUsersEmpty)
     ASSERT_FALSE(manager->is_users_empty());
 }
 
+// Подготовленные запросы регистрируются на каждом соединении отдельно,
+// поэтому несколько Manager на одной базе не мешают друг другу
+TEST_F(DBManagerTest, PreparedStatementsPerConnection)
+{
+    DBManager::Manager second(TEST_DB_CONNECTION);
+
+    manager->add_user("first");
+    second.add_user("second");
+    create_temp_file("temp_test_file.txt", "data");
+
+    manager->add_file("./temp_test_file.txt", "a.txt", "/repo", "first");
+    second.add_file("./temp_test_file.txt", "b.txt", "/repo", "second");
+    // Повторный вызов того же запроса на том же соединении
+    manager->add_file("./temp_test_file.txt", "c.txt", "/repo", "first");
+
+    ASSERT_EQ(count_rows("Users"), 2);
+    ASSERT_EQ(count_rows("Files"), 3);
+    ASSERT_EQ(count_rows("FileOwners"), 3);
+
+    ASSERT_EQ(second.delete_local_file("./temp_test_file.txt", "second"), "/repo/b.txt");
+    ASSERT_EQ(count_rows("Files"), 2);
+}
+
 int main(int argc, char **argv)
 {
     ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,1561 @@
+#include "../include/transport_service.hpp"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+using namespace transport_service;
+
+namespace {
+// Несжимаемые данные, одинаковые при одном seed.
+std::string random_bytes(std::size_t size, unsigned seed)
+{
+    std::string data(size, '\0');
+    std::mt19937 generator(seed);
+    for (auto &c : data) {
+        c = static_cast<char>(generator());
+    }
+    return data;
+}
+
+void write_file(const std::filesystem::path &path, const std::string &content)
+{
+    std::ofstream out(path, std::ios::binary);
+    out << content;
+}
+} // namespace
+
+// parse_byte_range()
+TEST(ByteRangeTest, ClosedRange)
+{
+    auto range = parse_byte_range("bytes=0-9", 100);
+    ASSERT_TRUE(range.has_value());
+    EXPECT_EQ(range->offset, 0);
+    EXPECT_EQ(range->length, 10);
+}
+
+TEST(ByteRangeTest, OpenEndedRange)
+{
+    auto range = parse_byte_range("bytes=90-", 100);
+    ASSERT_TRUE(range.has_value());
+    EXPECT_EQ(range->offset, 90);
+    EXPECT_EQ(range->length, 10);
+}
+
+TEST(ByteRangeTest, SuffixRange)
+{
+    auto range = parse_byte_range("bytes=-5", 100);
+    ASSERT_TRUE(range.has_value());
+    EXPECT_EQ(range->offset, 95);
+    EXPECT_EQ(range->length, 5);
+}
+
+TEST(ByteRangeTest, LastIsClampedToFileSize)
+{
+    auto range = parse_byte_range("bytes=50-1000", 100);
+    ASSERT_TRUE(range.has_value());
+    EXPECT_EQ(range->offset, 50);
+    EXPECT_EQ(range->length, 50);
+}
+
+TEST(ByteRangeTest, UnsatisfiableRanges)
+{
+    EXPECT_FALSE(parse_byte_range("bytes=100-", 100).has_value());
+    EXPECT_FALSE(parse_byte_range("bytes=5-2", 100).has_value());
+    EXPECT_FALSE(parse_byte_range("bytes=0-1,5-6", 100).has_value());
+    EXPECT_FALSE(parse_byte_range("items=0-1", 100).has_value());
+    EXPECT_FALSE(parse_byte_range("bytes=-0", 100).has_value());
+}
+
+class TransferJournalTest : public ::testing::Test {
+protected:
+    const std::string journal_path = "temp_test_file.part.journal";
+
+    void TearDown() override
+    {
+        std::filesystem::remove(journal_path);
+    }
+};
+
+// Transfer_Journal
+TEST_F(TransferJournalTest, MissingRangesAfterReset)
+{
+    Transfer_Journal journal(journal_path);
+    journal.reset("abc", 25);
+
+    auto missing = journal.missing(10);
+    ASSERT_EQ(missing.size(), 3);
+    EXPECT_EQ(missing[2].offset, 20);
+    EXPECT_EQ(missing[2].length, 5);
+    EXPECT_EQ(journal.verified_prefix(), 0);
+    EXPECT_FALSE(journal.is_complete());
+}
+
+TEST_F(TransferJournalTest, AddedRangesAreMerged)
+{
+    Transfer_Journal journal(journal_path);
+    journal.reset("abc", 30);
+    journal.add({10, 10});
+    journal.add({0, 10});
+
+    EXPECT_EQ(journal.verified_prefix(), 20);
+    auto missing = journal.missing(100);
+    ASSERT_EQ(missing.size(), 1);
+    EXPECT_EQ(missing[0].offset, 20);
+    EXPECT_EQ(missing[0].length, 10);
+
+    journal.add({20, 10});
+    EXPECT_TRUE(journal.is_complete());
+    EXPECT_TRUE(journal.missing(100).empty());
+}
+
+TEST_F(TransferJournalTest, LoadRestoresState)
+{
+    {
+        Transfer_Journal journal(journal_path);
+        journal.reset("etag", 100);
+        journal.add({0, 40});
+        journal.add({60, 20});
+    }
+
+    Transfer_Journal journal(journal_path);
+    ASSERT_TRUE(journal.load());
+    EXPECT_EQ(journal.get_etag(), "etag");
+    EXPECT_EQ(journal.get_size(), 100);
+    EXPECT_EQ(journal.verified_prefix(), 40);
+    auto missing = journal.missing(100);
+    ASSERT_EQ(missing.size(), 2);
+    EXPECT_EQ(missing[0].offset, 40);
+    EXPECT_EQ(missing[1].offset, 80);
+}
+
+TEST_F(TransferJournalTest, LoadWithoutFileFails)
+{
+    Transfer_Journal journal(journal_path);
+    EXPECT_FALSE(journal.load());
+}
+
+class CompressionPolicyTest : public ::testing::Test {
+protected:
+    const std::string file_path = "temp_test_file.dat";
+
+    void TearDown() override
+    {
+        std::filesystem::remove(file_path);
+    }
+};
+
+// is_compressed_format(), choose_compression_level()
+TEST_F(CompressionPolicyTest, DetectsCompressedFormats)
+{
+    EXPECT_TRUE(is_compressed_format("photo.JPG", ""));
+    EXPECT_TRUE(is_compressed_format("data.bin", std::string("PK\x03\x04", 4)));
+    EXPECT_TRUE(is_compressed_format("movie", std::string("\0\0\0\x20" "ftypisom", 12)));
+    EXPECT_FALSE(is_compressed_format("notes.txt", "plain text"));
+}
+
+TEST_F(CompressionPolicyTest, TextGetsMaxLevel)
+{
+    std::string text;
+    for (int i = 0; i < 5000; ++i) {
+        text += "line " + std::to_string(i) + " of a text file\n";
+    }
+    write_file(file_path, text);
+    EXPECT_EQ(choose_compression_level(file_path, Z_BEST_COMPRESSION, 0), Z_BEST_COMPRESSION);
+    EXPECT_EQ(choose_compression_level(file_path, 6, 0), 6);
+    EXPECT_EQ(choose_compression_level(file_path, Z_BEST_COMPRESSION, FAST_LINK_MBPS), Z_BEST_SPEED);
+    EXPECT_EQ(choose_compression_level(file_path, Z_NO_COMPRESSION, 0), Z_NO_COMPRESSION);
+}
+
+TEST_F(CompressionPolicyTest, RandomDataIsSentRaw)
+{
+    write_file(file_path, random_bytes(64 * 1024, 1));
+    EXPECT_EQ(choose_compression_level(file_path, Z_BEST_COMPRESSION, 0), Z_NO_COMPRESSION);
+}
+
+TEST_F(CompressionPolicyTest, EmptyFileIsSentRaw)
+{
+    write_file(file_path, "");
+    EXPECT_EQ(choose_compression_level(file_path, Z_BEST_COMPRESSION, 0), Z_NO_COMPRESSION);
+}
+
+// make_encoder(), make_decoder()
+TEST(CodecTest, RoundTripForEverySupportedEncoding)
+{
+    std::string input;
+    for (int i = 0; i < 50000; ++i) {
+        input += "block " + std::to_string(i * 7919 % 1000) + '\n';
+    }
+
+    for (const auto &encoding : supported_encodings()) {
+        for (const int level : { Z_BEST_SPEED, Z_BEST_COMPRESSION }) {
+            std::string compressed;
+            const Sink append_compressed = [&](const char *data, std::size_t size) {
+                compressed.append(data, size);
+            };
+            auto encoder = make_encoder(encoding, level);
+            ASSERT_NE(encoder, nullptr) << encoding;
+            for (std::size_t pos = 0; pos < input.size(); pos += 10000) {
+                encoder->write(input.data() + pos, std::min<std::size_t>(10000, input.size() - pos), append_compressed);
+            }
+            encoder->finish(append_compressed);
+            EXPECT_LT(compressed.size(), input.size()) << encoding;
+
+            std::string output;
+            auto decoder = make_decoder(encoding);
+            ASSERT_NE(decoder, nullptr) << encoding;
+            for (std::size_t pos = 0; pos < compressed.size(); pos += 777) {
+                decoder->write(compressed.data() + pos, std::min<std::size_t>(777, compressed.size() - pos),
+                    [&](const char *data, std::size_t size) { output.append(data, size); });
+            }
+            EXPECT_TRUE(decoder->is_done()) << encoding;
+            EXPECT_EQ(output, input) << encoding;
+        }
+    }
+}
+
+TEST(CodecTest, ParallelDeflateIsOneZlibStream)
+{
+    std::string input;
+    std::uint32_t state = 1;
+    while (input.size() < 3 * PARALLEL_DEFLATE_BLOCK_SIZE + 12345) {
+        state = state * 1664525 + 1013904223;
+        input += "record " + std::to_string(state % 5000) + " of a parallel test\n";
+    }
+    input.resize(3 * PARALLEL_DEFLATE_BLOCK_SIZE + 12345);
+
+    for (const std::size_t size : { std::size_t { 0 }, std::size_t { 1000 }, std::size_t { PARALLEL_DEFLATE_BLOCK_SIZE }, input.size() }) {
+        const std::string data = input.substr(0, size);
+        std::string compressed;
+        Parallel_Deflate_Stream encoder(Z_BEST_COMPRESSION, 4);
+        const Sink append = [&](const char *chunk, std::size_t length) { compressed.append(chunk, length); };
+        for (std::size_t pos = 0; pos < data.size(); pos += 50000) {
+            encoder.write(data.data() + pos, std::min<std::size_t>(50000, data.size() - pos), append);
+        }
+        encoder.finish(append);
+
+        // Обычный inflate проверяет и заголовок, и общую adler32.
+        EXPECT_EQ(deflate_decompress(compressed), data) << size;
+        std::string output;
+        Inflate_Stream decoder;
+        decoder.write(compressed.data(), compressed.size(), [&](const char *chunk, std::size_t length) { output.append(chunk, length); });
+        EXPECT_TRUE(decoder.is_done()) << size;
+        EXPECT_EQ(output, data) << size;
+    }
+
+    // Словарь из предыдущего блока сохраняет степень сжатия.
+    const std::string serial = deflate_compress(input, Z_BEST_COMPRESSION);
+    const std::string parallel = deflate_compress(input, Z_BEST_COMPRESSION, 4);
+    EXPECT_EQ(deflate_decompress(parallel), input);
+    EXPECT_LT(parallel.size(), serial.size() + serial.size() / 50);
+}
+
+TEST(CodecTest, CompressionThreadsFollowLinkSpeed)
+{
+    EXPECT_EQ(choose_compression_threads(PARALLEL_COMPRESSION_MIN_SIZE - 1, 0, 8), 1);
+    EXPECT_EQ(choose_compression_threads(PARALLEL_COMPRESSION_MIN_SIZE, 0, 8), UNKNOWN_LINK_COMPRESSION_THREADS);
+    EXPECT_EQ(choose_compression_threads(PARALLEL_COMPRESSION_MIN_SIZE, 0, 1), 1);
+    EXPECT_EQ(choose_compression_threads(PARALLEL_COMPRESSION_MIN_SIZE, COMPRESSION_CORE_MBPS / 2, 8), 1);
+    EXPECT_EQ(choose_compression_threads(PARALLEL_COMPRESSION_MIN_SIZE, 3 * COMPRESSION_CORE_MBPS, 8), 3);
+    EXPECT_EQ(choose_compression_threads(PARALLEL_COMPRESSION_MIN_SIZE, 100 * COMPRESSION_CORE_MBPS, 8), 8);
+    EXPECT_GE(choose_compression_threads(PARALLEL_COMPRESSION_MIN_SIZE, 0, 0), 1);
+}
+
+TEST(CodecTest, DeflateCompressRoundTrip)
+{
+    std::string text;
+    for (int i = 0; text.size() < 300000; ++i) {
+        text += "entry " + std::to_string(i % 977) + '\n';
+    }
+    for (const std::size_t size : { std::size_t { 0 }, std::size_t { 1 }, std::size_t { 100 }, text.size() }) {
+        const std::string data = text.substr(0, size);
+        for (const int level : { Z_NO_COMPRESSION, Z_BEST_SPEED, Z_DEFAULT_COMPRESSION, Z_BEST_COMPRESSION }) {
+            EXPECT_EQ(deflate_decompress(deflate_compress(data, level)), data) << size << ' ' << level;
+        }
+    }
+
+    // Повреждённый и обрезанный поток - ошибка, а не тихо укороченный результат.
+    const std::string compressed = deflate_compress(text, Z_BEST_SPEED);
+    EXPECT_THROW(deflate_decompress(compressed.substr(0, compressed.size() / 2)), std::runtime_error);
+    std::string corrupted = compressed;
+    corrupted[corrupted.size() / 2] ^= 0x55;
+    corrupted[corrupted.size() / 2 + 1] ^= 0x55;
+    EXPECT_THROW(deflate_decompress(corrupted), std::runtime_error);
+    EXPECT_THROW(deflate_compress(text, 10), std::invalid_argument);
+}
+
+TEST(CodecTest, ZlibContextsAreReused)
+{
+    const Deflate_Context* deflate_context = acquire_deflate(Z_BEST_SPEED).get();
+    EXPECT_EQ(acquire_deflate(Z_BEST_SPEED).get(), deflate_context);
+    {
+        // Занятый контекст не выдаётся второй раз.
+        const auto first = acquire_deflate(Z_BEST_SPEED);
+        const auto second = acquire_deflate(Z_BEST_SPEED);
+        EXPECT_NE(first.get(), second.get());
+    }
+    const Inflate_Context* inflate_context = acquire_inflate().get();
+    EXPECT_EQ(acquire_inflate().get(), inflate_context);
+
+    // Сброшенный контекст сжимает так же, как новый.
+    const std::string data(10000, 'a');
+    EXPECT_EQ(deflate_compress(data, Z_BEST_SPEED), deflate_compress(data, Z_BEST_SPEED));
+}
+
+TEST(CodecTest, UnknownEncodingHasNoCodec)
+{
+    EXPECT_EQ(make_encoder(RAW_ENCODING, Z_BEST_SPEED), nullptr);
+    EXPECT_EQ(make_decoder("br"), nullptr);
+}
+
+// negotiate_encoding()
+TEST(CodecTest, NegotiatesEncoding)
+{
+    EXPECT_EQ(negotiate_encoding(""), "deflate");
+    EXPECT_EQ(negotiate_encoding("gzip, deflate"), "deflate");
+    EXPECT_EQ(negotiate_encoding("gzip, br"), RAW_ENCODING);
+    EXPECT_EQ(negotiate_encoding("deflate;q=0"), RAW_ENCODING);
+    EXPECT_EQ(negotiate_encoding("*"), supported_encodings().front());
+    EXPECT_EQ(negotiate_encoding(accept_encoding_header()), supported_encodings().front());
+}
+
+class ArtifactCacheTest : public ::testing::Test {
+protected:
+    const std::filesystem::path cache_dir = "temp_artifact_cache";
+
+    static void build(Artifact_Cache &cache, const std::string &key, const std::string &content)
+    {
+        auto builder = cache.try_build(key, content.size());
+        ASSERT_NE(builder, nullptr);
+        builder->write(content.data(), content.size());
+        builder->commit();
+    }
+};
+
+// Artifact_Cache
+TEST_F(ArtifactCacheTest, ServesBuiltArtifact)
+{
+    Artifact_Cache cache(cache_dir, 1000, 1000);
+    const std::string key = Artifact_Cache::make_key("abc", "deflate", 9);
+    EXPECT_FALSE(cache.find(key).has_value());
+
+    build(cache, key, "compressed");
+    auto artifact = cache.find(key);
+    ASSERT_TRUE(artifact.has_value());
+    ASSERT_NE(artifact->data, nullptr);
+    EXPECT_EQ(*artifact->data, "compressed");
+    EXPECT_EQ(artifact->file->size, 10);
+    EXPECT_TRUE(std::filesystem::exists(artifact->file->path));
+    EXPECT_EQ(cache.try_build(key, 10), nullptr);
+}
+
+TEST_F(ArtifactCacheTest, SingleBuilderPerKey)
+{
+    Artifact_Cache cache(cache_dir, 1000, 1000);
+    auto builder = cache.try_build("key", 10);
+    ASSERT_NE(builder, nullptr);
+    EXPECT_TRUE(cache.is_building("key"));
+    EXPECT_EQ(cache.try_build("key", 10), nullptr);
+
+    builder.reset();
+    EXPECT_FALSE(cache.is_building("key"));
+    EXPECT_FALSE(cache.find("key").has_value());
+    EXPECT_EQ(cache.try_build("too_big", 1001), nullptr);
+}
+
+TEST_F(ArtifactCacheTest, EvictsLeastRecentlyUsed)
+{
+    Artifact_Cache cache(cache_dir, 25, 15);
+    build(cache, "a", std::string(10, 'a'));
+    build(cache, "b", std::string(10, 'b'));
+    // Память переполнена: копия "a" остаётся только на диске.
+    auto a = cache.find("a");
+    ASSERT_TRUE(a.has_value());
+    EXPECT_EQ(a->data, nullptr);
+    EXPECT_EQ(cache.get_memory_usage(), 10);
+
+    // Диск переполнен: вытесняется "b", к которому обращались раньше "a".
+    build(cache, "c", std::string(10, 'c'));
+    EXPECT_FALSE(cache.find("b").has_value());
+    EXPECT_TRUE(cache.find("a").has_value());
+    EXPECT_TRUE(cache.find("c").has_value());
+    EXPECT_EQ(cache.get_disk_usage(), 20);
+
+    // Вытесненный файл живёт, пока на него есть ссылка.
+    const std::string path = a->file->path;
+    build(cache, "d", std::string(10, 'd'));
+    build(cache, "e", std::string(10, 'e'));
+    EXPECT_FALSE(cache.find("a").has_value());
+    EXPECT_TRUE(std::filesystem::exists(path));
+    a.reset();
+    EXPECT_FALSE(std::filesystem::exists(path));
+}
+
+class HashIndexTest : public ::testing::Test {
+protected:
+    const std::string index_path = "temp_hash_index.journal";
+    const std::string file_path = "temp_indexed_file.txt";
+
+    void TearDown() override
+    {
+        std::filesystem::remove(index_path);
+        std::filesystem::remove(file_path);
+    }
+};
+
+// Hash_Index
+TEST_F(HashIndexTest, HashesMissingAndChangedFiles)
+{
+    Hash_Index index(index_path);
+    EXPECT_EQ(index.hash(file_path), "");
+
+    write_file(file_path, "hello");
+    EXPECT_EQ(index.hash(file_path), sha1_hash_file(file_path));
+    write_file(file_path, "hello, world");
+    EXPECT_EQ(index.hash(file_path), sha1_hash_file(file_path));
+}
+
+TEST_F(HashIndexTest, RecordedHashIsServedUntilFileChanges)
+{
+    write_file(file_path, "content");
+    {
+        Hash_Index index(index_path);
+        index.record(file_path, "recorded");
+        EXPECT_EQ(index.hash(file_path), "recorded");
+    }
+
+    // Запись переживает перезапуск.
+    Hash_Index index(index_path);
+    EXPECT_EQ(index.hash(file_path), "recorded");
+
+    write_file(file_path, "changed content");
+    EXPECT_EQ(index.hash(file_path), sha1_hash_file(file_path));
+}
+
+TEST_F(HashIndexTest, InvalidateDropsEntry)
+{
+    write_file(file_path, "content");
+    Hash_Index index(index_path);
+    index.record(file_path, "recorded");
+    index.invalidate(file_path);
+    EXPECT_EQ(index.hash(file_path), sha1_hash_file(file_path));
+
+    Hash_Index reloaded(index_path);
+    EXPECT_EQ(reloaded.hash(file_path), sha1_hash_file(file_path));
+}
+
+// Hasher, hash_file()
+namespace {
+// Вход официальных тестовых векторов BLAKE3: байты i % 251.
+std::string blake3_test_input(std::size_t size)
+{
+    std::string input(size, '\0');
+    for (std::size_t i = 0; i < size; ++i) {
+        input[i] = static_cast<char>(i % 251);
+    }
+    return input;
+}
+} // namespace
+
+TEST(HasherTest, KnownDigests)
+{
+    Hasher sha1(Hash_Algorithm::sha1);
+    sha1.update("abc", 3);
+    EXPECT_EQ(sha1.hex_digest(), "a9993e364706816aba3e25717850c26c9cd0d89d");
+
+    Hasher sha256(Hash_Algorithm::sha256);
+    sha256.update("abc", 3);
+    EXPECT_EQ(sha256.hex_digest(), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+}
+
+TEST(HasherTest, EtagKeepsLegacyWordOrder)
+{
+    const std::string path = "etag_test.txt";
+    write_file(path, "abc");
+    // Значение прежней реализации на boost::uuids::detail::sha1.
+    EXPECT_EQ(sha1_hash_file(path), "363e99a96a81064771253eba6cc250789dd8d09c");
+    Sha1_Hasher hasher;
+    hasher.update("abc", 3);
+    EXPECT_EQ(hasher.etag(), sha1_hash_file(path));
+    EXPECT_EQ(sha1_hash_file("no_such_file.txt"), "");
+    std::filesystem::remove(path);
+}
+
+TEST(HasherTest, Blake3TestVectors)
+{
+    const std::pair<std::size_t, std::string> vectors[] = {
+        { 0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262" },
+        { 1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213" },
+        { 1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7" },
+        { 1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444" },
+        { 102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085" },
+    };
+    for (const auto &[size, expected] : vectors) {
+        const std::string input = blake3_test_input(size);
+        Hasher hasher(Hash_Algorithm::blake3);
+        for (std::size_t pos = 0; pos < input.size(); pos += 100) {
+            hasher.update(input.data() + pos, std::min<std::size_t>(100, input.size() - pos));
+        }
+        EXPECT_EQ(hasher.hex_digest(), expected) << size;
+    }
+}
+
+TEST(HasherTest, ParallelBlake3MatchesSequential)
+{
+    const std::string path = "temp_hashed_file.bin";
+    const std::string input = blake3_test_input(3 * BLAKE3_PARALLEL_MIN_SIZE + 12345);
+    write_file(path, input);
+    Hasher hasher(Hash_Algorithm::blake3);
+    hasher.update(input.data(), input.size());
+    const std::string expected = hasher.hex_digest();
+
+    EXPECT_EQ(hash_file(path, Hash_Algorithm::blake3, 1), expected);
+    EXPECT_EQ(hash_file(path, Hash_Algorithm::blake3, 3), expected);
+    EXPECT_EQ(hash_file(path, Hash_Algorithm::blake3, 8), expected);
+    EXPECT_EQ(hash_file("no_such_file.bin", Hash_Algorithm::blake3), "");
+    std::filesystem::remove(path);
+}
+
+class DeltaTest : public ::testing::Test {
+protected:
+    const std::string basis_path = "temp_delta_basis.bin";
+    const std::string target_path = "temp_delta_target.bin";
+
+    // Прогоняет дельту через декодер мелкими порциями, чтобы команды
+    // разрезались на границах блоков сети. Возвращает собранный файл.
+    std::string round_trip(const std::string &target, std::size_t *delta_size = nullptr)
+    {
+        const auto signatures = Delta_Signatures::compute(basis_path);
+        std::string delta;
+        Delta_Encoder encoder(target.data(), target.size(), signatures);
+        const Sink collect = [&](const char *data, std::size_t size) {
+            delta.append(data, size);
+        };
+        while (encoder.step(collect)) { }
+        if (delta_size) {
+            *delta_size = delta.size();
+        }
+
+        const int fd = ::open(basis_path.c_str(), O_RDONLY);
+        std::string result;
+        Delta_Decoder decoder(fd, signatures.block_size);
+        for (std::size_t pos = 0; pos < delta.size(); pos += 7) {
+            decoder.write(delta.data() + pos, std::min<std::size_t>(7, delta.size() - pos),
+                [&](const char *data, std::size_t size) { result.append(data, size); });
+        }
+        EXPECT_TRUE(decoder.is_idle());
+        ::close(fd);
+        return result;
+    }
+
+    void TearDown() override
+    {
+        std::filesystem::remove(basis_path);
+        std::filesystem::remove(target_path);
+    }
+};
+
+// Rolling_Checksum, Delta_Signatures, Delta_Encoder, Delta_Decoder
+TEST(RollingChecksumTest, RollMatchesRecompute)
+{
+    const std::string data = "the quick brown fox jumps over the lazy dog";
+    const std::size_t window = 8;
+    Rolling_Checksum rolling;
+    rolling.reset(data.data(), window);
+    for (std::size_t pos = 1; pos + window <= data.size(); ++pos) {
+        rolling.roll(data[pos - 1], data[pos + window - 1]);
+        Rolling_Checksum fresh;
+        fresh.reset(data.data() + pos, window);
+        EXPECT_EQ(rolling.value(), fresh.value()) << pos;
+    }
+}
+
+TEST_F(DeltaTest, SignaturesSurviveSerialization)
+{
+    write_file(basis_path, random_bytes(100000, 1));
+    const auto signatures = Delta_Signatures::compute(basis_path);
+    EXPECT_EQ(signatures.weak.size(), 100000 / signatures.block_size);
+
+    const auto parsed = Delta_Signatures::parse(signatures.serialize());
+    ASSERT_TRUE(parsed.has_value());
+    EXPECT_EQ(parsed->block_size, signatures.block_size);
+    EXPECT_EQ(parsed->weak, signatures.weak);
+    EXPECT_EQ(parsed->strong, signatures.strong);
+
+    EXPECT_FALSE(Delta_Signatures::parse("").has_value());
+    EXPECT_FALSE(Delta_Signatures::parse(signatures.serialize().substr(1)).has_value());
+}
+
+TEST_F(DeltaTest, EditedFileIsRebuiltFromSmallDelta)
+{
+    const std::string basis = random_bytes(1024 * 1024, 2);
+    write_file(basis_path, basis);
+
+    std::string target = basis;
+    target.insert(1000, "inserted bytes");
+    target[500000] ^= 0x5A;
+    target.erase(800000, 3000);
+    target += "appended tail";
+
+    std::size_t delta_size = 0;
+    EXPECT_EQ(round_trip(target, &delta_size), target);
+    EXPECT_LT(delta_size, target.size() / 20);
+}
+
+TEST_F(DeltaTest, UnrelatedAndEmptyTargets)
+{
+    write_file(basis_path, random_bytes(200000, 3));
+    EXPECT_EQ(round_trip(""), "");
+    const std::string unrelated = random_bytes(300000, 4);
+    EXPECT_EQ(round_trip(unrelated), unrelated);
+}
+
+TEST_F(DeltaTest, FileEncoderMatchesMemoryEncoder)
+{
+    const std::string basis = random_bytes(1024 * 1024, 8);
+    write_file(basis_path, basis);
+    std::string target = random_bytes(300000, 9) + basis + random_bytes(2 * DELTA_STEP_SIZE, 10) + basis;
+    target[1500000] ^= 0x5A;
+    write_file(target_path, target);
+
+    const auto signatures = Delta_Signatures::compute(basis_path);
+    const auto encode = [](Delta_Encoder &encoder) {
+        std::string delta;
+        while (encoder.step([&](const char *data, std::size_t size) { delta.append(data, size); })) { }
+        return delta;
+    };
+    Delta_Encoder from_memory(target.data(), target.size(), signatures);
+    const int fd = ::open(target_path.c_str(), O_RDONLY);
+    Delta_Encoder from_file(fd, target.size(), signatures);
+    EXPECT_EQ(encode(from_file), encode(from_memory));
+    EXPECT_EQ(from_file.get_copied_bytes(), from_memory.get_copied_bytes());
+    ::close(fd);
+}
+
+TEST_F(DeltaTest, TruncatedFileThrowsInsteadOfCrashing)
+{
+    write_file(basis_path, random_bytes(100000, 11));
+    const std::string target = random_bytes(4 * DELTA_STEP_SIZE, 12);
+    write_file(target_path, target);
+
+    const auto signatures = Delta_Signatures::compute(basis_path);
+    const int fd = ::open(target_path.c_str(), O_RDONLY);
+    Delta_Encoder encoder(fd, target.size(), signatures);
+    std::filesystem::resize_file(target_path, DELTA_STEP_SIZE / 2);
+    EXPECT_THROW(while (encoder.step([](const char *, std::size_t) { })) { }, std::runtime_error);
+    ::close(fd);
+}
+
+class ChunkStoreTest : public ::testing::Test {
+protected:
+    const std::string store_path = "temp_chunk_store.journal";
+    const std::string file_path = "temp_chunked_file.bin";
+
+    void TearDown() override
+    {
+        std::filesystem::remove(store_path);
+        std::filesystem::remove(file_path);
+    }
+};
+
+// fastcdc_cut(), chunk_file(), manifest, Chunk_Store
+TEST_F(ChunkStoreTest, ChunkBoundariesFollowContent)
+{
+    const std::string data = random_bytes(4 * 1024 * 1024, 5);
+    write_file(file_path, data);
+    const auto chunks = chunk_file(file_path);
+    ASSERT_FALSE(chunks.empty());
+    std::uint64_t total = 0;
+    for (std::size_t i = 0; i < chunks.size(); ++i) {
+        EXPECT_EQ(chunks[i].offset, total);
+        EXPECT_LE(chunks[i].length, CDC_MAX_CHUNK_SIZE);
+        if (i + 1 < chunks.size()) {
+            EXPECT_GE(chunks[i].length, CDC_MIN_CHUNK_SIZE);
+        }
+        total += chunks[i].length;
+    }
+    EXPECT_EQ(total, data.size());
+
+    // Вставка в начало меняет только ближайшие чанки.
+    write_file(file_path, "prefix" + data);
+    const auto shifted = chunk_file(file_path);
+    std::size_t shared = 0;
+    for (const auto &chunk : shifted) {
+        shared += std::count_if(chunks.begin(), chunks.end(), [&](const Chunk &old) {
+            return old.hash == chunk.hash;
+        });
+    }
+    EXPECT_GE(shared + 2, chunks.size());
+}
+
+TEST_F(ChunkStoreTest, ManifestRoundTrip)
+{
+    write_file(file_path, random_bytes(1024 * 1024, 6));
+    const auto chunks = chunk_file(file_path);
+    const auto parsed = parse_manifest(serialize_manifest(chunks));
+    ASSERT_TRUE(parsed.has_value());
+    ASSERT_EQ(parsed->size(), chunks.size());
+    for (std::size_t i = 0; i < chunks.size(); ++i) {
+        EXPECT_EQ((*parsed)[i].offset, chunks[i].offset);
+        EXPECT_EQ((*parsed)[i].length, chunks[i].length);
+        EXPECT_EQ((*parsed)[i].hash, chunks[i].hash);
+    }
+    EXPECT_TRUE(parse_manifest("")->empty());
+    EXPECT_FALSE(parse_manifest("abc 12").has_value());
+    EXPECT_FALSE(parse_manifest("abc x\n").has_value());
+}
+
+TEST_F(ChunkStoreTest, ReadsChunksFromLocalFiles)
+{
+    const std::string data = random_bytes(1024 * 1024, 7);
+    write_file(file_path, data);
+    const auto chunks = chunk_file(file_path);
+    {
+        Chunk_Store store(store_path);
+        store.add_file(file_path, chunks);
+    }
+
+    // Расположение чанков переживает перезапуск.
+    Chunk_Store store(store_path);
+    const auto &chunk = chunks[1];
+    const auto read = store.read(chunk);
+    ASSERT_TRUE(read.has_value());
+    EXPECT_EQ(*read, data.substr(chunk.offset, chunk.length));
+
+    // Изменённый файл больше не источник своих старых чанков.
+    write_file(file_path, random_bytes(1024 * 1024, 8));
+    EXPECT_FALSE(store.read(chunk).has_value());
+    EXPECT_FALSE(store.contains(chunk.hash));
+}
+
+// Swarm_Scheduler
+TEST(SwarmSchedulerTest, EveryPieceIsCompletedOnce)
+{
+    Swarm_Scheduler scheduler({ { 0, 10 }, { 10, 10 }, { 20, 5 } }, 2);
+    std::vector<std::size_t> taken;
+    while (const auto piece = scheduler.acquire(taken.size() % 2)) {
+        taken.push_back(*piece);
+        EXPECT_TRUE(scheduler.complete(*piece, (taken.size() - 1) % 2));
+    }
+    EXPECT_EQ(taken, (std::vector<std::size_t> { 0, 1, 2 }));
+    EXPECT_TRUE(scheduler.is_finished());
+    EXPECT_EQ(scheduler.get_range(2).offset, 20);
+}
+
+TEST(SwarmSchedulerTest, FailedPieceReturnsAndPeerIsDropped)
+{
+    Swarm_Scheduler scheduler({ { 0, 10 }, { 10, 10 } }, 2);
+    for (int i = 0; i <= SWARM_PEER_RETRIES; ++i) {
+        const auto piece = scheduler.acquire(0);
+        ASSERT_TRUE(piece.has_value());
+        EXPECT_EQ(*piece, 0);
+        scheduler.release(*piece, 0, true);
+    }
+    EXPECT_FALSE(scheduler.acquire(0).has_value());
+    EXPECT_EQ(scheduler.acquire(1), 0);
+}
+
+TEST(SwarmSchedulerTest, FastPeerTakesOverTailOfSlowPeer)
+{
+    std::vector<Byte_Range> ranges;
+    for (std::uint64_t i = 0; i < 4 + 2 * SWARM_CONNECTIONS_PER_PEER; ++i) {
+        ranges.push_back({ i * 1024, 1024 });
+    }
+    Swarm_Scheduler scheduler(ranges, 2);
+
+    // Пир 0 отдаёт кусок мгновенно, пир 1 - заметно дольше.
+    scheduler.complete(*scheduler.acquire(0), 0);
+    const auto slow_piece = scheduler.acquire(1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    scheduler.complete(*slow_piece, 1);
+
+    // Медленный пир не берёт последние куски: они остаются быстрому.
+    std::vector<std::size_t> slow_pieces;
+    while (const auto piece = scheduler.acquire(1)) {
+        slow_pieces.push_back(*piece);
+    }
+    EXPECT_EQ(slow_pieces.size(), ranges.size() - 2 - SWARM_CONNECTIONS_PER_PEER);
+
+    // Быстрый пир забирает хвост, а затем дублирует куски медленного.
+    std::size_t fast_count = 0;
+    while (const auto piece = scheduler.acquire(0)) {
+        EXPECT_TRUE(scheduler.complete(*piece, 0));
+        ++fast_count;
+    }
+    EXPECT_EQ(fast_count, SWARM_CONNECTIONS_PER_PEER + slow_pieces.size());
+    EXPECT_TRUE(scheduler.is_finished());
+    for (const auto piece : slow_pieces) {
+        EXPECT_TRUE(scheduler.is_done(piece));
+        EXPECT_FALSE(scheduler.complete(piece, 1));
+    }
+}
+
+TEST(SwarmSchedulerTest, CorruptPieceIsRefetchedFromAnotherPeer)
+{
+    Swarm_Scheduler scheduler({ { 0, 10 }, { 10, 10 } }, 2);
+    const auto piece = scheduler.acquire(0);
+    ASSERT_TRUE(piece.has_value());
+    scheduler.reject(*piece, 0);
+    EXPECT_FALSE(scheduler.acquire(0).has_value());
+    EXPECT_EQ(scheduler.acquire(1), piece);
+}
+
+TEST(SwarmSchedulerTest, IdleWorkerWaitsForReleasedPiece)
+{
+    Swarm_Scheduler scheduler({ { 0, 10 } }, 2);
+    const auto piece = scheduler.acquire(0);
+    ASSERT_TRUE(piece.has_value());
+    auto waiting = std::async(std::launch::async, [&] { return scheduler.wait_acquire(1); });
+    EXPECT_EQ(waiting.wait_for(std::chrono::milliseconds(50)), std::future_status::timeout);
+    scheduler.release(*piece, 0, true);
+    EXPECT_EQ(waiting.get(), piece);
+    EXPECT_TRUE(scheduler.complete(*piece, 1));
+    EXPECT_FALSE(scheduler.wait_acquire(0).has_value());
+}
+
+// Merkle_Tree
+TEST(MerkleTreeTest, PiecesAreVerifiedAgainstLeaves)
+{
+    const std::string path = "merkle_test.bin";
+    const std::string data = random_bytes(10 * 1024 + 123, 9);
+    write_file(path, data);
+    const Merkle_Tree tree = Merkle_Tree::build(path, 1024);
+    std::filesystem::remove(path);
+
+    ASSERT_EQ(tree.piece_count(), 11);
+    EXPECT_EQ(tree.piece_length(10), 123);
+    for (std::size_t i = 0; i < tree.piece_count(); ++i) {
+        EXPECT_TRUE(tree.verify_piece(i, data.data() + i * 1024, tree.piece_length(i)));
+    }
+    std::string corrupt = data.substr(3 * 1024, 1024);
+    corrupt[100] ^= 1;
+    EXPECT_FALSE(tree.verify_piece(3, corrupt.data(), corrupt.size()));
+    EXPECT_FALSE(tree.verify_piece(2, data.data() + 3 * 1024, 1024));
+    EXPECT_FALSE(tree.verify_piece(10, data.data() + 10 * 1024, 100));
+    EXPECT_FALSE(tree.verify_piece(11, data.data(), 0));
+}
+
+TEST(MerkleTreeTest, SerializationAndRoot)
+{
+    const std::string path = "merkle_test.bin";
+    write_file(path, std::string(5000, 'a'));
+    const Merkle_Tree tree = Merkle_Tree::build(path, 1000);
+    write_file(path, std::string(4999, 'a') + 'b');
+    const Merkle_Tree changed = Merkle_Tree::build(path, 1000);
+    write_file(path, "");
+    const Merkle_Tree empty = Merkle_Tree::build(path, 1000);
+    std::filesystem::remove(path);
+
+    const auto parsed = Merkle_Tree::parse(tree.serialize());
+    ASSERT_TRUE(parsed.has_value());
+    EXPECT_EQ(parsed->root(), tree.root());
+    EXPECT_EQ(parsed->get_piece_size(), 1000);
+    EXPECT_EQ(parsed->get_file_size(), 5000);
+    EXPECT_NE(changed.root(), tree.root());
+    EXPECT_EQ(empty.piece_count(), 0);
+    EXPECT_EQ(Merkle_Tree::parse(empty.serialize())->root(), empty.root());
+
+    // Число листьев должно соответствовать размеру файла.
+    EXPECT_FALSE(Merkle_Tree::parse("1000 5001\n").has_value());
+    EXPECT_FALSE(Merkle_Tree::parse("0 0\n").has_value());
+    EXPECT_FALSE(Merkle_Tree::parse("1000 10\nxyz\n").has_value());
+}
+
+// Archive_Writer, Archive_Reader
+TEST(ArchiveTest, RoundTripByteByByte)
+{
+    const std::filesystem::path root = "archive_test_root";
+    std::filesystem::remove_all(root);
+
+    const std::string text(100000, 'x');
+    std::string stream;
+    Archive_Writer writer([&](const char* data, std::size_t size) { stream.append(data, size); });
+    writer.add_directory("docs");
+    writer.add_directory("empty");
+    writer.begin_file("docs/a.txt", text.size());
+    writer.write(text.data(), 1000);
+    writer.write(text.data() + 1000, text.size() - 1000);
+    writer.end_file();
+    writer.begin_file("zero.bin", 0);
+    writer.end_file();
+    writer.finish();
+
+    // Поток разбирается с любой нарезкой, в том числе по одному байту.
+    {
+        Archive_Reader reader(root);
+        for (const char byte : stream) {
+            reader.write(&byte, 1);
+        }
+        EXPECT_TRUE(reader.is_done());
+        ASSERT_EQ(reader.get_extracted().size(), 2);
+        EXPECT_EQ(reader.get_extracted()[0].path, root / "docs/a.txt");
+        EXPECT_EQ(reader.get_extracted()[0].hash, sha1_hash_file((root / "docs/a.txt").string()));
+    }
+    EXPECT_TRUE(std::filesystem::is_directory(root / "empty"));
+    EXPECT_EQ(std::filesystem::file_size(root / "docs/a.txt"), text.size());
+    EXPECT_EQ(std::filesystem::file_size(root / "zero.bin"), 0);
+    EXPECT_FALSE(std::filesystem::exists(root / "docs/a.txt.part"));
+
+    // Испорченный байт данных отбрасывает файл, а не кладёт его на место.
+    std::filesystem::remove_all(root);
+    std::string corrupt = stream;
+    corrupt[corrupt.find(text.substr(0, 16)) + 500] = 'y';
+    {
+        Archive_Reader reader(root);
+        EXPECT_THROW(reader.write(corrupt.data(), corrupt.size()), std::runtime_error);
+    }
+    EXPECT_FALSE(std::filesystem::exists(root / "docs/a.txt"));
+    EXPECT_FALSE(std::filesystem::exists(root / "docs/a.txt.part"));
+    std::filesystem::remove_all(root);
+}
+
+TEST(ArchiveTest, RejectsUnsafePaths)
+{
+    EXPECT_TRUE(is_safe_archive_path("a/b.txt"));
+    EXPECT_TRUE(is_safe_archive_path("..hidden"));
+    EXPECT_FALSE(is_safe_archive_path(""));
+    EXPECT_FALSE(is_safe_archive_path("/etc/passwd"));
+    EXPECT_FALSE(is_safe_archive_path("../secret"));
+    EXPECT_FALSE(is_safe_archive_path("a/../../b"));
+    EXPECT_FALSE(is_safe_archive_path("a//b"));
+    EXPECT_FALSE(is_safe_archive_path("a/./b"));
+    EXPECT_FALSE(is_safe_archive_path("a/"));
+
+    std::string stream;
+    Archive_Writer writer([&](const char* data, std::size_t size) { stream.append(data, size); });
+    EXPECT_THROW(writer.add_directory("../up"), std::invalid_argument);
+
+    // Запись с путём из "..", собранная вручную, не должна выйти за root.
+    stream += 'D';
+    stream += std::string("\x05\x00\x00\x00", 4);
+    stream += "../up";
+    Archive_Reader reader("archive_test_root");
+    EXPECT_THROW(reader.write(stream.data(), stream.size()), std::runtime_error);
+    EXPECT_FALSE(std::filesystem::exists("up"));
+    std::filesystem::remove_all("archive_test_root");
+}
+
+// Bandwidth_Shaper
+TEST(BandwidthShaperTest, UnlimitedNeverWaits)
+{
+    Bandwidth_Shaper shaper;
+    EXPECT_FALSE(shaper.is_limited());
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_EQ(shaper.reserve("peer", Traffic_Class::bulk, 1 << 20), Bandwidth_Shaper::Clock::duration::zero());
+    }
+}
+
+TEST(BandwidthShaperTest, SmallFilesOvertakeBulk)
+{
+    using namespace std::chrono_literals;
+    const auto zero = Bandwidth_Shaper::Clock::duration::zero();
+    Bandwidth_Shaper shaper;
+    // Ведро - 256 KiB, bulk не опускает его ниже половины.
+    shaper.set_limits(1000000, 0);
+    const auto now = Bandwidth_Shaper::Clock::now();
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(shaper.reserve("a", Traffic_Class::bulk, 65536, now), zero);
+    }
+    EXPECT_GT(shaper.reserve("a", Traffic_Class::bulk, 65536, now), 60ms);
+
+    // Мелкий файл проходит сразу, пока ведро не в долгу, метаданные - всегда.
+    EXPECT_EQ(shaper.reserve("b", Traffic_Class::small_file, 65536, now), zero);
+    EXPECT_EQ(shaper.reserve("b", Traffic_Class::metadata, 65536, now), zero);
+    const auto small_wait = shaper.reserve("b", Traffic_Class::small_file, 65536, now);
+    EXPECT_GT(small_wait, 60ms);
+    EXPECT_LT(small_wait, 70ms);
+    EXPECT_EQ(shaper.reserve("b", Traffic_Class::small_file, 65536, now + small_wait), zero);
+
+    // Ведро наполняется со скоростью лимита и не больше своей ёмкости.
+    EXPECT_EQ(shaper.reserve("a", Traffic_Class::bulk, 65536, now + 10s), zero);
+    EXPECT_EQ(shaper.reserve("a", Traffic_Class::bulk, 65536, now + 10s), zero);
+    EXPECT_EQ(shaper.reserve("a", Traffic_Class::bulk, 65536, now + 10s), zero);
+    EXPECT_GT(shaper.reserve("a", Traffic_Class::bulk, 65536, now + 10s), zero);
+}
+
+TEST(BandwidthShaperTest, PeerLimitsAreIndependent)
+{
+    const auto zero = Bandwidth_Shaper::Clock::duration::zero();
+    Bandwidth_Shaper shaper;
+    shaper.set_limits(0, 1000000);
+    const auto now = Bandwidth_Shaper::Clock::now();
+    EXPECT_EQ(shaper.reserve("a", Traffic_Class::small_file, 1 << 20, now), zero);
+    EXPECT_GT(shaper.reserve("a", Traffic_Class::small_file, 1, now), zero);
+    EXPECT_EQ(shaper.reserve("b", Traffic_Class::small_file, 1, now), zero);
+
+    EXPECT_EQ(traffic_class_for_size(4096), Traffic_Class::small_file);
+    EXPECT_EQ(traffic_class_for_size(SHAPER_SMALL_FILE_SIZE), Traffic_Class::bulk);
+}
+
+// Server_Logger, Log_Queue
+namespace {
+std::vector<std::string> read_lines(const std::string& path)
+{
+    std::ifstream file(path);
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(file, line);) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+}
+
+TEST(ServerLoggerTest, ConcurrentWritersProduceWholeLines)
+{
+    const std::string path = "logger_test.log";
+    constexpr int threads = 8;
+    constexpr int per_thread = 500;
+    {
+        Server_Logger logger(path);
+        std::vector<std::thread> writers;
+        for (int t = 0; t < threads; ++t) {
+            writers.emplace_back([&logger, t] {
+                for (int i = 0; i < per_thread; ++i) {
+                    logger.log(Log_Level::request, "writer " + std::to_string(t) + " message " + std::to_string(i) + '\n');
+                }
+            });
+        }
+        for (auto& writer : writers) {
+            writer.join();
+        }
+        logger.flush();
+        EXPECT_EQ(logger.get_dropped(), 0);
+        EXPECT_EQ(read_lines(path).size() + logger.get_dropped(), threads * per_thread);
+    }
+
+    // Каждая строка - отметка времени, уровень и сообщение без лишнего \n.
+    const auto lines = read_lines(path);
+    ASSERT_EQ(lines.size(), threads * per_thread);
+    for (const auto& line : lines) {
+        ASSERT_GT(line.size(), 24);
+        EXPECT_EQ(line[4], '-');
+        EXPECT_EQ(line[19], '.');
+        EXPECT_EQ(line.substr(24, 8), "REQUEST ");
+        EXPECT_NE(line.find("writer "), std::string::npos);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST(ServerLoggerTest, SamplingAndLevelFilter)
+{
+    const std::string path = "logger_test.log";
+    {
+        Server_Logger logger(path);
+        logger.set_sample_rate(10);
+        for (int i = 0; i < 100; ++i) {
+            logger.log(Log_Level::request, "request " + std::to_string(i));
+        }
+        // Прореживаются только подробности запросов.
+        logger.log(Log_Level::warning, "warning");
+        logger.log("info");
+
+        logger.set_level(Log_Level::warning);
+        logger.log(Log_Level::request, "hidden request");
+        logger.log("hidden info");
+        logger.log(Log_Level::error, "error");
+    }
+
+    const auto lines = read_lines(path);
+    ASSERT_EQ(lines.size(), 13);
+    EXPECT_NE(lines[0].find("REQUEST request 0"), std::string::npos);
+    EXPECT_NE(lines[9].find("REQUEST request 90"), std::string::npos);
+    EXPECT_NE(lines[10].find("WARNING warning"), std::string::npos);
+    EXPECT_NE(lines[11].find("INFO info"), std::string::npos);
+    EXPECT_NE(lines[12].find("ERROR error"), std::string::npos);
+    std::filesystem::remove(path);
+}
+
+TEST(LogQueueTest, FullQueueRejectsPush)
+{
+    EXPECT_THROW(Log_Queue(6), std::invalid_argument);
+
+    Log_Queue queue(4);
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(queue.push(Log_Record { {}, Log_Level::info, std::to_string(i) }));
+    }
+    EXPECT_FALSE(queue.push(Log_Record { {}, Log_Level::info, "overflow" }));
+
+    Log_Record record;
+    ASSERT_TRUE(queue.pop(record));
+    EXPECT_EQ(record.message, "0");
+    EXPECT_TRUE(queue.push(Log_Record { {}, Log_Level::info, "4" }));
+    for (int i = 1; i <= 4; ++i) {
+        ASSERT_TRUE(queue.pop(record));
+        EXPECT_EQ(record.message, std::to_string(i));
+    }
+    EXPECT_FALSE(queue.pop(record));
+}
+
+// Part_File, Commit_Batch
+TEST(PartFileTest, CommitReplacesTargetAndDiscardRemovesPart)
+{
+    const std::filesystem::path root = "part_file_test_root";
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+    const std::filesystem::path target = root / "a.txt";
+    write_file(target, "old");
+
+    const std::string text = "new contents";
+    {
+        Part_File file(target);
+        // Место резервируется, но размер файла не меняется.
+        file.preallocate(1 << 20);
+        EXPECT_EQ(std::filesystem::file_size(file.get_path()), 0);
+        file.write_at(text.data(), text.size(), 0);
+        std::ifstream current(target);
+        EXPECT_EQ(std::string(std::istreambuf_iterator<char>(current), {}), "old");
+        file.commit();
+    }
+    EXPECT_FALSE(std::filesystem::exists(target.string() + PART_FILE_SUFFIX));
+    std::ifstream published(target);
+    EXPECT_EQ(std::string(std::istreambuf_iterator<char>(published), {}), text);
+
+    {
+        Part_File file(root / "b.txt");
+        file.write_at(text.data(), text.size(), 0);
+        file.discard();
+    }
+    EXPECT_FALSE(std::filesystem::exists(root / "b.txt"));
+    EXPECT_FALSE(std::filesystem::exists(root / ("b.txt" PART_FILE_SUFFIX)));
+
+    // Деструктор оставляет временный файл для докачки.
+    {
+        Part_File file(root / "c.txt");
+        file.write_at(text.data(), 4, 0);
+    }
+    {
+        Part_File file(root / "c.txt", true);
+        file.write_at(text.data() + 4, text.size() - 4, 4);
+        file.commit();
+    }
+    EXPECT_EQ(std::filesystem::file_size(root / "c.txt"), text.size());
+    std::filesystem::remove_all(root);
+}
+
+TEST(CommitBatchTest, FilesAppearOnlyAfterFlush)
+{
+    const std::filesystem::path root = "commit_batch_test_root";
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+
+    std::vector<std::string> committed;
+    {
+        Commit_Batch batch;
+        for (int i = 0; i < 3; ++i) {
+            const std::string name = std::to_string(i) + ".txt";
+            Part_File file(root / name);
+            file.write_at(name.data(), name.size(), 0);
+            batch.add(std::move(file), name.size(), [&committed, name] { committed.push_back(name); });
+        }
+        EXPECT_EQ(batch.get_pending(), 3);
+        EXPECT_FALSE(std::filesystem::exists(root / "0.txt"));
+        EXPECT_TRUE(committed.empty());
+
+        batch.flush();
+        EXPECT_EQ(batch.get_pending(), 0);
+        EXPECT_EQ(committed, (std::vector<std::string> { "0.txt", "1.txt", "2.txt" }));
+        for (const auto& name : committed) {
+            EXPECT_EQ(std::filesystem::file_size(root / name), name.size());
+            EXPECT_FALSE(std::filesystem::exists(root / (name + PART_FILE_SUFFIX)));
+        }
+
+        // Пачка сбрасывается сама, набрав COMMIT_BATCH_FILES файлов.
+        for (int i = 0; i < COMMIT_BATCH_FILES; ++i) {
+            batch.add(Part_File(root / ("full" + std::to_string(i))), 0);
+        }
+        EXPECT_EQ(batch.get_pending(), 0);
+        EXPECT_TRUE(std::filesystem::exists(root / "full0"));
+
+        batch.add(Part_File(root / "dropped.txt"), 0);
+    }
+    // Непубликованные файлы удаляются вместе с пачкой.
+    EXPECT_FALSE(std::filesystem::exists(root / "dropped.txt"));
+    EXPECT_FALSE(std::filesystem::exists(root / ("dropped.txt" PART_FILE_SUFFIX)));
+    std::filesystem::remove_all(root);
+}
+
+TEST(CommitBatchTest, FailedSyncPublishesNothing)
+{
+    const std::filesystem::path root = "commit_batch_sync_test_root";
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+    {
+        Commit_Batch batch;
+        batch.add(Part_File(root / "a.txt"), 0);
+        batch.add(Part_File(root / "b.txt"), 0);
+        // Временный файл пропал до сброса: syncfs его не откроет.
+        std::filesystem::remove(root / ("b.txt" PART_FILE_SUFFIX));
+        EXPECT_THROW(batch.flush(), std::system_error);
+        EXPECT_FALSE(std::filesystem::exists(root / "a.txt"));
+        EXPECT_FALSE(std::filesystem::exists(root / "b.txt"));
+    }
+    EXPECT_FALSE(std::filesystem::exists(root / ("a.txt" PART_FILE_SUFFIX)));
+    EXPECT_THROW(sync_directory(root / "missing"), std::system_error);
+    std::filesystem::remove_all(root);
+}
+
+// Write_Behind, File_Prefetcher
+TEST(FileIoTest, WriteBehindWritesBlocksInOrder)
+{
+    const std::string path = "write_behind_test.bin";
+    std::string text(10 * 1000 + 7, '\0');
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        text[i] = static_cast<char>('a' + i % 26);
+    }
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+    {
+        // Блоки меньше порций записи, и в пул уходит больше
+        // WRITE_BEHIND_DEPTH блоков.
+        Write_Behind writer(fd, 5, 1000);
+        for (std::size_t i = 0; i < text.size(); i += 333) {
+            writer.write(text.data() + i, std::min<std::size_t>(333, text.size() - i));
+        }
+        writer.drain();
+    }
+    ::close(fd);
+
+    std::ifstream file(path, std::ios::binary);
+    const std::string written(std::istreambuf_iterator<char>(file), {});
+    ASSERT_EQ(written.size(), text.size() + 5);
+    EXPECT_EQ(written.substr(5), text);
+    std::filesystem::remove(path);
+}
+
+TEST(FileIoTest, PrefetcherReadsRangeBlockByBlock)
+{
+    const std::string path = "prefetcher_test.bin";
+    std::string text(100000, '\0');
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        text[i] = static_cast<char>(i % 251);
+    }
+    write_file(path, text);
+
+    net::io_context ioc;
+    std::string received;
+    std::size_t blocks = 0;
+    bool is_short_file_rejected = false;
+    net::co_spawn(
+        net::make_strand(ioc),
+        [&]() -> net::awaitable<void> {
+            const auto executor = co_await net::this_coro::executor;
+            File_Prefetcher reader(executor, path, 1000, 50000, 4096);
+            for (auto block = co_await reader.next(); !block.empty(); block = co_await reader.next()) {
+                received.append(block);
+                ++blocks;
+            }
+            // Файл короче диапазона - ошибка, а не обрезанные данные.
+            File_Prefetcher short_reader(executor, path, 90000, 20000, 4096);
+            try {
+                while (!(co_await short_reader.next()).empty()) { }
+            } catch (const std::exception&) {
+                is_short_file_rejected = true;
+            }
+        },
+        net::detached);
+    ioc.run();
+
+    EXPECT_EQ(received, text.substr(1000, 50000));
+    EXPECT_EQ(blocks, (50000 + 4095) / 4096);
+    EXPECT_TRUE(is_short_file_rejected);
+    std::filesystem::remove(path);
+}
+
+// Server и клиент по loopback
+namespace {
+const std::string LOOPBACK_ADDRESS = "127.0.0.1";
+
+std::string text_data(std::size_t lines)
+{
+    std::string text;
+    for (std::size_t i = 0; i < lines; ++i) {
+        text += "line " + std::to_string(i) + " of the loopback test\n";
+    }
+    return text;
+}
+
+std::string read_file(const std::filesystem::path &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return { std::istreambuf_iterator<char>(file), {} };
+}
+
+// GET без сжатия: тело ответа сравнивается с файлом как есть.
+http::request<http::string_body> make_get(const std::string &name)
+{
+    http::request<http::string_body> req { http::verb::get, "/" + name, 11 };
+    req.set(http::field::host, LOOPBACK_ADDRESS);
+    req.set(http::field::accept_encoding, "identity");
+    return req;
+}
+
+http::response<http::string_body> read_response(Tls_Stream &stream, beast::flat_buffer &buffer)
+{
+    http::response_parser<http::string_body> parser;
+    parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+    http::read(stream, buffer, parser);
+    return parser.release();
+}
+
+http::response<http::string_body> send_request(http::request<http::string_body> req)
+{
+    auto connection = Connection_Pool::get_instance().acquire(LOOPBACK_ADDRESS);
+    req.prepare_payload();
+    http::write(connection.get_stream(), req);
+    beast::flat_buffer buffer;
+    auto res = read_response(connection.get_stream(), buffer);
+    connection.release();
+    return res;
+}
+
+std::string decode(std::string_view encoding, const std::string &body)
+{
+    const auto decoder = make_decoder(encoding);
+    if (!decoder) {
+        return body;
+    }
+    std::string out;
+    decoder->write(body.data(), body.size(), [&out](const char *data, std::size_t size) {
+        out.append(data, size);
+    });
+    EXPECT_TRUE(decoder->is_done());
+    return out;
+}
+} // namespace
+
+// Сервер на SERVER_PORT раздаёт served, клиент качает в received.
+// Сертификаты берутся из test/certs: тест, как и dec-rep-db_manager_test,
+// запускается из каталога сборки внутри репозитория.
+class LoopbackServerTest : public ::testing::Test {
+protected:
+    static inline const std::filesystem::path root = std::filesystem::absolute("loopback_test_root");
+    static inline const std::filesystem::path served = root / "served";
+    static inline const std::filesystem::path received = root / "received";
+    static inline std::unique_ptr<Server> server;
+
+    static void SetUpTestSuite()
+    {
+        for (const char *name : { "server.crt", "server.key", "dhparams.pem" }) {
+            if (!std::filesystem::exists(name)) {
+                std::filesystem::copy_file(std::filesystem::path("../test/certs") / name, name);
+            }
+        }
+        std::filesystem::remove_all(root);
+        std::filesystem::create_directories(served);
+        std::filesystem::create_directories(received);
+        server = std::make_unique<Server>(SERVER_PORT, 2, served.string(), (root / "server.log").string());
+
+        // Сервер слушает порт из своего потока: ждём первого соединения.
+        for (int attempt = 0; attempt < 100; ++attempt) {
+            try {
+                Connection_Pool::get_instance().acquire(LOOPBACK_ADDRESS);
+                return;
+            } catch (const std::exception &) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+        }
+        ADD_FAILURE() << "Server did not start";
+    }
+
+    static void TearDownTestSuite()
+    {
+        Connection_Pool::get_instance().clear();
+        server.reset();
+        std::filesystem::remove_all(root);
+    }
+
+    static void serve(const std::string &name, const std::string &data)
+    {
+        write_file(served / name, data);
+    }
+
+    static std::string received_dir()
+    {
+        return received.string() + "/";
+    }
+};
+
+TEST_F(LoopbackServerTest, RangeRequestsHonourIfRange)
+{
+    const std::string data = text_data(1000);
+    serve("range.txt", data);
+    const std::string size = std::to_string(data.size());
+    const std::string etag = sha1_hash_file((served / "range.txt").string());
+
+    auto req = make_get("range.txt");
+    req.set(http::field::range, "bytes=10-19");
+    auto res = send_request(req);
+    EXPECT_EQ(res.result(), http::status::partial_content);
+    EXPECT_EQ(res[http::field::content_range], "bytes 10-19/" + size);
+    EXPECT_EQ(res.body(), data.substr(10, 10));
+
+    req.set(http::field::range, "bytes=" + size + "-");
+    res = send_request(req);
+    EXPECT_EQ(res.result(), http::status::range_not_satisfiable);
+    EXPECT_EQ(res[http::field::content_range], "bytes */" + size);
+    EXPECT_TRUE(res.body().empty());
+
+    // If-Range с текущим ETag - диапазон, с устаревшим - весь файл.
+    req.set(http::field::range, "bytes=-5");
+    req.set(http::field::if_range, etag);
+    res = send_request(req);
+    EXPECT_EQ(res.result(), http::status::partial_content);
+    EXPECT_EQ(res.body(), data.substr(data.size() - 5));
+
+    req.set(http::field::if_range, "0000000000000000000000000000000000000000");
+    res = send_request(req);
+    EXPECT_EQ(res.result(), http::status::ok);
+    EXPECT_EQ(res[http::field::etag], etag);
+    EXPECT_EQ(res.body(), data);
+}
+
+TEST_F(LoopbackServerTest, AcceptEncodingSelectsCodec)
+{
+    const std::string data = text_data(20000);
+    serve("encoding.txt", data);
+
+    auto req = make_get("encoding.txt");
+    req.set(http::field::accept_encoding, "deflate");
+    auto res = send_request(req);
+    ASSERT_EQ(res.result(), http::status::ok);
+    EXPECT_EQ(res[http::field::content_encoding], "deflate");
+    EXPECT_LT(res.body().size(), data.size());
+    EXPECT_EQ(decode("deflate", res.body()), data);
+    // Артефакт сжимается целиком до ответа, и даже первый клиент
+    // получает его из кэша с известной длиной.
+    EXPECT_FALSE(res.chunked());
+    EXPECT_EQ(res[http::field::content_length], std::to_string(res.body().size()));
+
+    // Общего кодека нет - файл уходит без сжатия.
+    req.set(http::field::accept_encoding, "br, deflate;q=0");
+    res = send_request(req);
+    EXPECT_EQ(res[http::field::content_encoding], RAW_ENCODING);
+    EXPECT_EQ(res.body(), data);
+
+    // Клиент сам выбирает кодек из поддерживаемых обеими сторонами.
+    std::filesystem::remove(received / "encoding.txt");
+    get_file(LOOPBACK_ADDRESS, "encoding.txt", received_dir(), 0);
+    EXPECT_EQ(read_file(received / "encoding.txt"), data);
+}
+
+TEST_F(LoopbackServerTest, PipelinedRequestsAreAnsweredInOrder)
+{
+    std::vector<std::string> names;
+    for (int i = 0; i < 5; ++i) {
+        names.push_back("pipelined" + std::to_string(i) + ".txt");
+        serve(names.back(), text_data(10 * i + 1));
+    }
+
+    auto connection = Connection_Pool::get_instance().acquire(LOOPBACK_ADDRESS);
+    for (const auto &name : names) {
+        auto req = make_get(name);
+        req.prepare_payload();
+        http::write(connection.get_stream(), req);
+    }
+    beast::flat_buffer buffer;
+    for (const auto &name : names) {
+        const auto res = read_response(connection.get_stream(), buffer);
+        EXPECT_EQ(res.body(), read_file(served / name)) << name;
+    }
+    connection.release();
+
+    // Отсутствующий файл посреди конвейера не мешает остальным.
+    names.insert(names.begin() + 2, "missing.txt");
+    get_files(LOOPBACK_ADDRESS, names, received_dir(), 0);
+    for (const auto &name : names) {
+        if (name == "missing.txt") {
+            EXPECT_FALSE(std::filesystem::exists(received / name));
+        } else {
+            EXPECT_EQ(read_file(received / name), read_file(served / name)) << name;
+        }
+    }
+}
+
+TEST_F(LoopbackServerTest, InterruptedDownloadIsResumed)
+{
+    const std::string data = random_bytes(3 * RESUME_CHECKPOINT_SIZE / 2, 1);
+    serve("resume.bin", data);
+    const std::string etag = sha1_hash_file((served / "resume.bin").string());
+    const std::filesystem::path part = received / ("resume.bin" PART_FILE_SUFFIX);
+    const std::string journal_path = part.string() + JOURNAL_FILE_SUFFIX;
+
+    // Подтверждена первая половина, хвост временного файла - мусор.
+    std::string prefix = data.substr(0, data.size() / 2) + std::string(100, 'x');
+    write_file(part, prefix);
+    Transfer_Journal journal(journal_path);
+    journal.reset(etag, data.size());
+    journal.add(Byte_Range { 0, data.size() / 2 });
+
+    get_file(LOOPBACK_ADDRESS, "resume.bin", received_dir(), 0);
+    EXPECT_EQ(read_file(received / "resume.bin"), data);
+    EXPECT_FALSE(std::filesystem::exists(part));
+    EXPECT_FALSE(std::filesystem::exists(journal_path));
+
+    // Журнал от другой версии файла: If-Range не совпадает, и файл
+    // качается целиком.
+    std::filesystem::remove(received / "resume.bin");
+    write_file(part, "stale");
+    journal.reset("0000000000000000000000000000000000000000", data.size());
+    journal.add(Byte_Range { 0, 5 });
+    get_file(LOOPBACK_ADDRESS, "resume.bin", received_dir(), 0);
+    EXPECT_EQ(read_file(received / "resume.bin"), data);
+    EXPECT_FALSE(std::filesystem::exists(journal_path));
+}
+
+TEST_F(LoopbackServerTest, DeltaFallsBackToFullFile)
+{
+    std::string data = random_bytes(4 * DELTA_MIN_FILE_SIZE, 2);
+    serve("delta.bin", data);
+
+    // Сигнатуры не разобрались - сервер отвечает обычным файлом.
+    auto req = make_get("delta.bin");
+    req.set("X-Transfer-Mode", DELTA_TRANSFER_MODE);
+    req.body() = "not signatures";
+    const auto res = send_request(req);
+    EXPECT_EQ(res.result(), http::status::ok);
+    EXPECT_NE(res["X-Transfer-Mode"], DELTA_TRANSFER_MODE);
+    EXPECT_EQ(res.body(), data);
+
+    // Устаревшая копия у клиента обновляется дельтой.
+    write_file(received / "delta.bin", data);
+    data.insert(1000, "inserted");
+    data[data.size() / 2] ^= 1;
+    serve("delta.bin", data);
+    get_file(LOOPBACK_ADDRESS, "delta.bin", received_dir(), 0);
+    EXPECT_EQ(read_file(received / "delta.bin"), data);
+}
+
+TEST_F(LoopbackServerTest, ChunksFallBackToFullFile)
+{
+    // Файл меньше CHUNK_MIN_FILE_SIZE не режется на чанки.
+    const std::string small = random_bytes(CHUNK_MIN_FILE_SIZE / 2, 3);
+    serve("small.bin", small);
+    auto req = make_get("small.bin");
+    req.set("X-Transfer-Mode", CHUNKED_TRANSFER_MODE);
+    auto res = send_request(req);
+    EXPECT_EQ(res.result(), http::status::ok);
+    EXPECT_NE(res["X-Transfer-Mode"], CHUNKED_TRANSFER_MODE);
+    EXPECT_EQ(res.body(), small);
+
+    // Запрос диапазона тоже получает байты, а не манифест.
+    const std::string large = random_bytes(2 * CHUNK_MIN_FILE_SIZE, 4);
+    serve("chunks.bin", large);
+    req = make_get("chunks.bin");
+    req.set("X-Transfer-Mode", CHUNKED_TRANSFER_MODE);
+    req.set(http::field::range, "bytes=0-99");
+    res = send_request(req);
+    EXPECT_EQ(res.result(), http::status::partial_content);
+    EXPECT_EQ(res.body(), large.substr(0, 100));
+
+    std::filesystem::remove(received / "chunks.bin");
+    get_file(LOOPBACK_ADDRESS, "chunks.bin", received_dir(), 0);
+    EXPECT_EQ(read_file(received / "chunks.bin"), large);
+}